@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "addrmap.h"
+#include "arena.h"
+
+/** An entry of a debug table, by address and then by position in the
+ *  table, so that sorting keeps the table's order among equal addresses. */
+struct addr_key {
+  u32 addr;
+  int i;
+};
+
+int addr_key_comparator(const void *key1_, const void *key2_) {
+  const struct addr_key *key1 = key1_,
+                        *key2 = key2_;
+
+  if (key1->addr != key2->addr) return key1->addr < key2->addr? -1 : +1;
+  return key1->i - key2->i;
+}
+
+int addr_range_comparator(const void *r1_, const void *r2_) {
+  const struct addr_range *r1 = r1_,
+                          *r2 = r2_;
+
+  if (r1->file  != r2->file)  return r1->file  < r2->file?  -1 : +1;
+  if (r1->line  != r2->line)  return r1->line  < r2->line?  -1 : +1;
+  if (r1->start != r2->start) return r1->start < r2->start? -1 : +1;
+  return 0;
+}
+
+struct debug_addrs *build_debug_addrs(struct debug_block *debug) {
+  int nfiles = debug->nfiles, nlinenos = debug->nlinenos, nfunctions = 0;
+  struct addr_key *files   = malloc(sizeof(struct addr_key) * nfiles + 1),
+                  *linenos = malloc(sizeof(struct addr_key) * nlinenos + 1),
+                  *functions = malloc(sizeof(struct addr_key) * debug->nsymbols + 1);
+
+  for (int i = 0; i < nfiles; i++) files[i] = (struct addr_key) { debug->files[i].start, i };
+  for (int i = 0; i < nlinenos; i++) linenos[i] = (struct addr_key) { debug->linenos[i].start, i };
+  for (int i = 0; i < debug->nsymbols; i++) {
+    if (debug->symbols[i].type == 0x0009) functions[nfunctions++] = (struct addr_key) { debug->symbols[i].id, i };
+  }
+  qsort(files, nfiles, sizeof(struct addr_key), addr_key_comparator);
+  qsort(linenos, nlinenos, sizeof(struct addr_key), addr_key_comparator);
+  qsort(functions, nfunctions, sizeof(struct addr_key), addr_key_comparator);
+
+  // A function's address is its ID; of several, the first in the table
+  // wins, as in `lookup_sym`
+  struct debug_addrs *a = palloc(sizeof(struct debug_addrs));
+  a->functions = palloc(sizeof(struct debug_symbol *) * nfunctions + 1);
+  a->nfunctions = 0;
+  for (int i = 0; i < nfunctions; i++) {
+    if (i > 0 && functions[i].addr == functions[i - 1].addr) continue;
+    a->functions[a->nfunctions++] = &debug->symbols[functions[i].i];
+  }
+
+  //-- Runs: merge the three tables by address.  Where several entries of a
+  //   table share an address, the last one wins, as with the disassembler's
+  //   cursors
+  a->runs = palloc(sizeof(struct addr_run) * (nfiles + nlinenos + a->nfunctions) + 1);
+  a->nruns = 0;
+  int file_i = 0, line_i = 0, function_i = 0;
+  struct addr_run cur = { 0, -1, -1, -1 };
+  for (;;) {
+    u32 next = UINT32_MAX;
+    int more = 0;
+    if (file_i < nfiles) next = files[file_i].addr, more = 1;
+    if (line_i < nlinenos && (!more || linenos[line_i].addr < next)) next = linenos[line_i].addr, more = 1;
+    if (function_i < a->nfunctions && (!more || a->functions[function_i]->id < next)) {
+      next = a->functions[function_i]->id;
+      more = 1;
+    }
+    if (!more) break;
+
+    while (file_i < nfiles && files[file_i].addr <= next) cur.file = files[file_i++].i;
+    while (line_i < nlinenos && linenos[line_i].addr <= next) {
+      cur.line = debug->linenos[linenos[line_i++].i].lineno;
+    }
+    while (function_i < a->nfunctions && a->functions[function_i]->id <= next) cur.function = function_i++;
+    cur.start = next;
+
+    struct addr_run *last = a->nruns > 0? &a->runs[a->nruns - 1] : NULL;
+    if (last != NULL && last->file == cur.file && last->line == cur.line
+        && last->function == cur.function) continue;
+    a->runs[a->nruns++] = cur;
+  }
+
+  //-- Ranges: the runs of each line (joined where only the function
+  //   changes), sorted by line
+  a->ranges = palloc(sizeof(struct addr_range) * a->nruns + 1);
+  a->nranges = 0;
+  for (int i = 0; i < a->nruns; i++) {
+    struct addr_run *run = &a->runs[i];
+    u32 end = i + 1 < a->nruns? a->runs[i + 1].start : UINT32_MAX;
+    struct addr_range *last = a->nranges > 0? &a->ranges[a->nranges - 1] : NULL;
+    if (last != NULL && last->file == run->file && last->line == run->line && last->end == run->start) {
+      last->end = end;
+    } else if (run->line >= 0) {
+      a->ranges[a->nranges++] = (struct addr_range) { run->file, run->line, run->start, end };
+    }
+  }
+  qsort(a->ranges, a->nranges, sizeof(struct addr_range), addr_range_comparator);
+
+  free(files);
+  free(linenos);
+  free(functions);
+  return a;
+}
+
+struct debug_addrs *get_debug_addrs(struct debug_block *debug) {
+  if (debug->addrs == NULL) debug->addrs = build_debug_addrs(debug);
+  return debug->addrs;
+}
+
+
+//-- Lookups --------------------------------------------------------
+const struct addr_run *addr_find_run(const struct addr_run *runs, int n, u32 addr) {
+  // The last run starting at or before `addr`
+  int lo = 0, hi = n;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (runs[mid].start <= addr) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo > 0? &runs[lo - 1] : NULL;
+}
+
+const struct addr_range *addr_find_ranges(const struct addr_range *ranges, int n,
+                                          i32 file, i32 line, int *count) {
+  // The first range of the line or after it
+  int lo = 0, hi = n;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    const struct addr_range *r = &ranges[mid];
+    if (r->file < file || (r->file == file && r->line < line)) lo = mid + 1;
+    else hi = mid;
+  }
+
+  int k = lo;
+  while (k < n && ranges[k].file == file && ranges[k].line == line) k++;
+  *count = k - lo;
+  return k > lo? &ranges[lo] : NULL;
+}
@@ -0,0 +1,63 @@
+#ifndef ADDRMAP_H
+#define ADDRMAP_H
+
+#include "poketools.h"
+#include "formats/script.h"
+
+/** Lookup tables between code addresses and where they come from, built
+ *  from a debug section.  The disassembler finds each instruction's file
+ *  and line with cursors that only move forwards, which suits a listing
+ *  but can't answer "what is at $1a40?"; these tables answer that, and the
+ *  reverse, with a binary search.
+ *
+ *  An address maps to a run: the span of code up to the next address at
+ *  which the file, the line or the function changes.  A line maps to the
+ *  address ranges its code was compiled to.  Both are arrays of plain
+ *  `u32`s, so they can be written out and mapped back in as they are (see
+ *  symmap.h). */
+
+/** The code from `start` up to the next run's start (or the end of the
+ *  code): its file (index into `debug->files`), line and function (index
+ *  into `debug_addrs.functions`), each -1 if there is none. */
+struct addr_run {
+  u32 start;
+  i32 file;
+  i32 line;
+  i32 function;
+};
+
+/** The code of a line: [start, end), where an `end` of UINT32_MAX means up
+ *  to the end of the code. */
+struct addr_range {
+  i32 file;
+  i32 line;
+  u32 start;
+  u32 end;
+};
+
+struct debug_addrs {
+  int nruns;
+  struct addr_run *runs;         // By start
+  int nranges;
+  struct addr_range *ranges;     // By file, line and start
+  int nfunctions;
+  struct debug_symbol **functions; // By address (the symbol's id)
+};
+
+/** Builds the address tables of `debug`. */
+struct debug_addrs *build_debug_addrs(struct debug_block *debug);
+
+/** Returns the address tables of `debug`, building them on first use;
+ *  cached in `debug` like the symbol index. */
+struct debug_addrs *get_debug_addrs(struct debug_block *debug);
+
+/** Returns the run of the `n` in `runs` that covers byte address `addr`,
+ *  or NULL if it comes before them all. */
+const struct addr_run *addr_find_run(const struct addr_run *runs, int n, u32 addr);
+
+/** Returns the first of the `n` ranges in `ranges` of line `line` of file
+ *  `file`, storing how many there are in `*count`; NULL if there are none. */
+const struct addr_range *addr_find_ranges(const struct addr_range *ranges, int n,
+                                          i32 file, i32 line, int *count);
+
+#endif
@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "timings.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_CHUNK (1 << 16)
+
+struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size, used;
+  _Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+__thread struct arena *parse_arena = NULL;
+
+//-- Arenas ---------------------------------------------------------
+void *arena_alloc(struct arena *a, size_t n) {
+  n = (n + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+  struct arena_chunk *c = a->chunks;
+
+  if (c == NULL || c->size - c->used < n) {
+    size_t size = n > ARENA_CHUNK? n : ARENA_CHUNK;
+    c = malloc(sizeof(struct arena_chunk) + size);
+    c->size = size;
+    c->used = 0;
+
+    // A big one-off goes behind the current chunk, which may still have room
+    if (a->chunks != NULL && size > ARENA_CHUNK
+        && a->chunks->size - a->chunks->used >= ARENA_CHUNK / 4) {
+      c->next = a->chunks->next;
+      a->chunks->next = c;
+    } else {
+      c->next = a->chunks;
+      a->chunks = c;
+    }
+  }
+
+  void *p = c->data + c->used;
+  c->used += n;
+  a->used += n;
+  return p;
+}
+
+void *arena_realloc(struct arena *a, void *p, size_t old, size_t n) {
+  if (p == NULL) return arena_alloc(a, n);
+
+  // The last allocation can grow (or shrink) where it is
+  struct arena_chunk *c = a->chunks;
+  size_t old_aligned = (old + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1),
+         n_aligned   = (n + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+  if ((unsigned char *) p + old_aligned == c->data + c->used
+      && c->used - old_aligned + n_aligned <= c->size) {
+    c->used = c->used - old_aligned + n_aligned;
+    a->used = a->used - old_aligned + n_aligned;
+    return p;
+  }
+
+  void *res = arena_alloc(a, n);
+  memcpy(res, p, old < n? old : n);
+  return res;
+}
+
+void arena_release(struct arena *a) {
+  struct arena_chunk *c = a->chunks;
+  if (c == NULL) return;
+
+  // One chunk that fits it all next time
+  if (c->next != NULL) {
+    size_t size = a->used > ARENA_CHUNK? a->used : ARENA_CHUNK;
+    arena_free(a);
+    c = malloc(sizeof(struct arena_chunk) + size);
+    c->size = size;
+    c->next = NULL;
+    a->chunks = c;
+  }
+  c->used = 0;
+  a->used = 0;
+}
+
+void arena_free(struct arena *a) {
+  struct arena_chunk *c = a->chunks;
+  while (c != NULL) {
+    struct arena_chunk *next = c->next;
+    free(c);
+    c = next;
+  }
+  a->chunks = NULL;
+  a->used = 0;
+}
+
+
+//-- Parser allocation ----------------------------------------------
+void *palloc(size_t n) {
+  TIMING_ALLOC(n);
+  return parse_arena != NULL? arena_alloc(parse_arena, n) : malloc(n);
+}
+
+void *prealloc(void *p, size_t old, size_t n) {
+  TIMING_ALLOC(n);
+  return parse_arena != NULL? arena_realloc(parse_arena, p, old, n) : realloc(p, n);
+}
+
+void pfree(void *p) {
+  if (parse_arena == NULL) free(p);
+}
+
+char *pstrdup(const char *s) {
+  size_t n = strlen(s) + 1;
+  return memcpy(palloc(n), s, n);
+}
@@ -0,0 +1,42 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/** A bump allocator: memory is handed out from large chunks, and only ever
+ *  given back all at once.  Everything parsed from one file (sections, debug
+ *  tables, symbol indices, the IR) lives in one arena, so a batch run can
+ *  drop it all with a single `arena_release` before the next file. */
+struct arena {
+  struct arena_chunk *chunks; // Most recent first
+  size_t used;                // Bytes allocated since the last release
+};
+
+/** The arena the parsers allocate from on this thread, or NULL to use
+ *  `malloc` (and have callers free what they get). */
+extern __thread struct arena *parse_arena;
+
+/** Allocates `n` bytes (aligned for any type) from `a`. */
+void *arena_alloc(struct arena *a, size_t n);
+
+/** Resizes the allocation `p` of `old` bytes to `n` bytes, in place if it
+ *  was the last one made. */
+void *arena_realloc(struct arena *a, void *p, size_t old, size_t n);
+
+/** Releases everything allocated from `a`.  The memory is kept (as a single
+ *  chunk big enough for all of it) for reuse, so the next file of a similar
+ *  size costs no `malloc` calls at all. */
+void arena_release(struct arena *a);
+
+/** Releases everything allocated from `a`, and gives its memory back. */
+void arena_free(struct arena *a);
+
+//-- Parser allocation ----------------------------------------------
+// Like `malloc`, `realloc`, `free` and `strdup`, but from `parse_arena` if
+// there is one.  `pfree` does nothing in an arena.
+void *palloc(size_t n);
+void *prealloc(void *p, size_t old, size_t n);
+void pfree(void *p);
+char *pstrdup(const char *s);
+
+#endif
@@ -0,0 +1,269 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "poketools.h"
+#include "arena.h"
+#include "assemble.h"
+#include "batch.h"
+#include "decode.h"
+#include "mapfile.h"
+#include "render.h"
+#include "script_pp.h"
+#include "formats/script.h"
+
+const char *debug_path = NULL; // `-d`: script (or directory) to take debug sections from
+const char *out_path   = NULL; // `-o`: output file (or directory)
+int verify = 0;                // `--verify`: check round-trips instead
+
+/** Finds the first section with the given `magic` in `file`, and stores its
+ *  size in `*size`.  Returns its offset, or -1 if there is none. */
+long find_section(struct mapped_file *file, u32 magic, size_t *size) {
+  size_t start = 0;
+  while (file->size - start >= 2 * sizeof(u32)) {
+    u32 section_size, section_magic;
+    memcpy(&section_size,  file->data + start,               sizeof(u32));
+    memcpy(&section_magic, file->data + start + sizeof(u32), sizeof(u32));
+
+    if (section_magic == magic) {
+      *size = section_size < file->size - start? section_size : file->size - start;
+      return start;
+    }
+    if (section_size == 0 || section_size > file->size - start) break;
+    start += section_size;
+  }
+  return -1;
+}
+
+/** Returns nonzero if `path` is a directory. */
+int is_dir(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/** Returns the (newly-allocated) name of the script assembled from the
+ *  listing at `path`: its extension is replaced with `.bin`, so that
+ *  `foo.bin.txt` becomes `foo.bin` again.  It goes in `dir`, if not NULL. */
+char *script_name(const char *path, const char *dir) {
+  const char *base = strrchr(path, '/');
+  base = base != NULL? base + 1 : path;
+
+  char *res = malloc((dir != NULL? strlen(dir) : 0) + strlen(path) + 8);
+  if (dir != NULL) sprintf(res, "%s/%s", dir, base);
+  else strcpy(res, path);
+
+  char *name = strrchr(res, '/');
+  name = name != NULL? name + 1 : res;
+  char *ext = strrchr(name, '.');
+  if (ext != NULL && ext != name) *ext = 0;
+  if (strlen(name) < 4 || strcmp(name + strlen(name) - 4, ".bin") != 0) {
+    strcat(res, ".bin");
+  }
+  return res;
+}
+
+/** Writes the `n` bytes at `p` to the file at `path`, via a temporary file
+ *  so that it is replaced in one go.  Returns 0 on success. */
+int write_file(const char *path, const u8 *p, size_t n) {
+  char *tmp = malloc(strlen(path) + 16);
+  sprintf(tmp, "%s.tmp-XXXXXX", path);
+  int fd = mkstemp(tmp);
+  if (fd < 0) {
+    free(tmp);
+    return -1;
+  }
+
+  int ok = 1;
+  for (size_t pos = 0; ok && pos < n; ) {
+    ssize_t k = write(fd, p + pos, n - pos);
+    if (k < 0 && errno != EINTR) ok = 0;
+    if (k > 0) pos += k;
+  }
+  fchmod(fd, 0644);
+  close(fd);
+
+  if (!ok || rename(tmp, path) < 0) {
+    unlink(tmp);
+    ok = 0;
+  }
+  free(tmp);
+  return ok? 0 : -1;
+}
+
+/** Assembles the listing at `path` into a script. */
+int asmscript(FILE *out, const char *path) {
+  struct mapped_file listing;
+  if (map_file(&listing, path) < 0) {
+    fprintf(stderr, "Couldn't open '%s' for reading.\n", path);
+    return 2;
+  }
+
+  int to_stdout = out_path != NULL && strcmp(out_path, "-") == 0;
+  char *target = to_stdout? NULL
+               : out_path != NULL && !is_dir(out_path)? strdup(out_path)
+               : script_name(path, out_path);
+
+  // The debug section is taken as it is from the original script
+  struct mapped_file orig = { NULL, 0 };
+  struct debug_block *debug = NULL;
+  u8 *debug_data = NULL;
+  size_t debug_size = 0;
+
+  if (debug_path != NULL) {
+    char *orig_path = is_dir(debug_path)? script_name(target != NULL? target : path, debug_path)
+                                        : strdup(debug_path);
+    if (map_file(&orig, orig_path) < 0) {
+      fprintf(stderr, "Couldn't open '%s' for reading.\n", orig_path);
+      free(orig_path);
+      free(target);
+      unmap_file(&listing);
+      return 2;
+    }
+    free(orig_path);
+
+    // Scripts without one get none
+    long start = find_section(&orig, 0x0A0AF1EF, &debug_size);
+    if (start >= 0) {
+      debug_data = orig.data + start;
+      debug = parse_debug_block(debug_data, debug_size, NULL);
+      if (debug == NULL) fprintf(stderr, "%s: Malformed debug section in '%s'.\n", path, debug_path);
+    }
+  }
+
+  struct code_block *code = assemble((char *) listing.data, listing.size, debug, path);
+  int status = 0;
+
+  if (code == NULL) {
+    status = 2;
+  } else {
+    size_t size = code->size;
+    u8 *buf = malloc(size + debug_size);
+    encode_code_block(buf, code);
+    if (debug != NULL) memcpy(buf + size, debug_data, debug_size);
+    else debug_size = 0;
+
+    if (to_stdout) {
+      fwrite(buf, 1, size + debug_size, out);
+    } else if (write_file(target, buf, size + debug_size) < 0) {
+      fprintf(stderr, "Couldn't write '%s'.\n", target);
+      status = 2;
+    }
+    free(buf);
+  }
+
+  free_assembly(code);
+  free(target);
+  if (orig.data != NULL) unmap_file(&orig);
+  unmap_file(&listing);
+  return status;
+}
+
+/** Returns the offset of the first byte where the `n1` bytes at `p1` and the
+ *  `n2` bytes at `p2` differ, or -1 if they're the same. */
+long first_difference(const u8 *p1, size_t n1, const u8 *p2, size_t n2) {
+  size_t n = n1 < n2? n1 : n2;
+  for (size_t i = 0; i < n; i++) {
+    if (p1[i] != p2[i]) return i;
+  }
+  return n1 == n2? -1 : (long) n;
+}
+
+/** Checks that the script at `path` survives both decode→encode and
+ *  disassemble→assemble byte for byte. */
+int verifyscript(FILE *out, const char *path) {
+  struct mapped_file file;
+  if (map_file(&file, path) < 0) {
+    fprintf(stderr, "Couldn't open '%s' for reading.\n", path);
+    return 2;
+  }
+
+  size_t code_size = 0, debug_size = 0;
+  long code_start  = find_section(&file, 0x0A0AF1E0, &code_size),
+       debug_start = find_section(&file, 0x0A0AF1EF, &debug_size);
+
+  struct code_block *code = NULL;
+  struct debug_block *debug = NULL;
+  if (code_start >= 0) code = parse_code_block(file.data + code_start, code_size, NULL);
+  if (debug_start >= 0) debug = parse_debug_block(file.data + debug_start, debug_size, NULL);
+  if (code == NULL) {
+    fprintf(stderr, "%s: No code section.\n", path);
+    unmap_file(&file);
+    return 2;
+  }
+  const u8 *orig = file.data + code_start;
+
+  // Decode→encode
+  u8 *buf = malloc(code_block_encoded_size(code));
+  size_t size = encode_code_block(buf, code);
+  long diff = first_difference(buf, size, orig, code_size);
+  free(buf);
+
+  // Disassemble→assemble
+  char *text = NULL;
+  size_t len = 0;
+  FILE *f = open_memstream(&text, &len);
+  disassemble(f, code, debug);
+  fclose(f);
+
+  long rediff = -1;
+  struct code_block *re = assemble(text, len, debug, path);
+  if (re != NULL) {
+    buf = malloc(re->size);
+    size = encode_code_block(buf, re);
+    rediff = first_difference(buf, size, orig, code_size);
+    free(buf);
+  }
+
+  int status = 0;
+  if (diff >= 0 || re == NULL || rediff >= 0) {
+    // Failures go to stderr, as the output of failed files is dropped
+    fprintf(stderr, "%s: FAILED", path);
+    if (diff >= 0) fprintf(stderr, "  (encoding differs at byte $%04lx)", diff);
+    if (re == NULL) fprintf(stderr, "  (listing doesn't assemble)");
+    else if (rediff >= 0) fprintf(stderr, "  (assembly differs at byte $%04lx)", rediff);
+    fputc('\n', stderr);
+    status = 1;
+  } else {
+    fprintf(out, "%s: ok\n", path);
+  }
+
+  // Cleanup
+  free_assembly(re);
+  free(text);
+  free_code_ir(code->ir);
+  if ((u8 *) code->extra != file.data + code_start + 0x20) pfree(code->extra);
+  pfree(code->instrs);
+  pfree(code);
+  unmap_file(&file);
+  return status;
+}
+
+int main(int argc, char *argv[]) {
+  // Our own options: `-d <script|dir>`, `-o <file|dir|->` and `--verify`
+  int k = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--verify") == 0) {
+      verify = 1;
+    } else if ((strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "-o") == 0) && i + 1 < argc) {
+      *(argv[i][1] == 'd'? &debug_path : &out_path) = argv[i + 1];
+      i++;
+    } else {
+      argv[k++] = argv[i];
+    }
+  }
+  argv[k] = NULL;
+  argc = k;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s [-j <threads>] [-d <script|dir>] [-o <file|dir|->] <listing|dir|->...\n"
+                    "       %s [-j <threads>] --verify <script|dir|->...\n", argv[0], argv[0]);
+    return 1;
+  }
+
+  render_color = 0; // Listings are only for us to read back
+  batch_headers = 0;
+  return batch_main(verify? verifyscript : asmscript, argc, argv);
+}
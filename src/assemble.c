@@ -0,0 +1,975 @@
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assemble.h"
+#include "decode.h"
+#include "formats/varint.h"
+
+#define ASM_MAX_WORDS 8 // Words a line may list in its comment
+
+
+//-- Mnemonics ------------------------------------------------------
+/** How an instruction's operands are written. */
+enum operand_kind {
+  OPD_NONE,     // `Return`
+  OPD_TARGET,   // `Call Func_00a4`: a label, as an offset word
+  OPD_GLOBAL,   // `DGetGlobal g_var3`: an identifier, in the high half
+  OPD_LOCAL,    // `DGetLocal loc0_1`
+  OPD_SIGNED,   // `CAdjustStack -2`: a number, in the high half
+  OPD_UNSIGNED, // `DPushConst 37`
+  OPD_HEX,      // `CmpConst $0019`
+  OPD_WORD,     // `CPushConst $ffff`: a number, as a whole word
+  OPD_COMMAND,  // `DoCommand? 244 (2 args)`
+  OPD_RAW,      // `$009b`, `$8E 1.5, 2.0`: an opcode, then operand words
+};
+
+/** The mnemonics `render_disassembly` prints, and how to read them back. */
+struct mnemonic {
+  const char *name;
+  i32 op;       // -1 if several opcodes print the same
+  enum operand_kind kind;
+  int nargs;
+};
+
+struct mnemonic mnemonics[] = {
+  { "CPushConst",   0x0027, OPD_WORD,     1 },
+  { "CPushConst",   0x00BC, OPD_SIGNED,   0 },
+  { "Begin",        0x002E, OPD_NONE,     0 },
+  { "Return",       0x0030, OPD_NONE,     0 },
+  { "Call",         0x0031, OPD_TARGET,   1 },
+  { "Jump",         0x0033, OPD_TARGET,   1 },
+  { "Jump??",           -1, OPD_TARGET,   1 },
+  { "JumpNE",       0x0035, OPD_TARGET,   1 },
+  { "JumpEq",       0x0036, OPD_TARGET,   1 },
+  { "Add?",         0x004E, OPD_NONE,     0 },
+  { "Cmp?",         0x0051, OPD_NONE,     0 },
+  { "DPushFalse",   0x0059, OPD_NONE,     0 },
+  { "Trampoline",   0x0081, OPD_TARGET,   1 },
+  { "DoCommand?",   0x0087, OPD_COMMAND,  2 },
+  { "LineNo",       0x0089, OPD_NONE,     0 },
+  { "TGetGlobal2",  0x00A2, OPD_GLOBAL,   0 },
+  { "DGetGlobal",   0x00A3, OPD_GLOBAL,   0 },
+  { "DGetLocal",    0x00A4, OPD_LOCAL,    0 },
+  { "DPushConst",   0x00AB, OPD_UNSIGNED, 0 },
+  { "CmpConst2",    0x00AC, OPD_HEX,      0 },
+  { "DSetGlobal",   0x00AF, OPD_GLOBAL,   0 },
+  { "DSetLocal",    0x00B1, OPD_LOCAL,    0 },
+  { "CGetGlobal",   0x00BD, OPD_GLOBAL,   0 },
+  { "CGetLocal",    0x00BE, OPD_LOCAL,    0 },
+  { "CAdjustStack", 0x00BF, OPD_SIGNED,   0 },
+  { "CmpLocal",     0x00C8, OPD_LOCAL,    0 },
+  { "CmpConst",     0x00C9, OPD_HEX,      0 },
+  { "Script Begin", 0x00D2, OPD_NONE,     0 },
+};
+
+struct mnemonic raw_mnemonic = { "$", -1, OPD_RAW, 0 };
+
+/** Finds the mnemonic `name`, whose operands are `text`.  Returns NULL if
+ *  there is none. */
+const struct mnemonic *find_mnemonic(const char *name, const char *text) {
+  if (name[0] == '$') return &raw_mnemonic;
+
+  int n = sizeof(mnemonics) / sizeof(mnemonics[0]);
+  for (int i = 0; i < n; i++) {
+    const struct mnemonic *mn = &mnemonics[i];
+    if (strcmp(mn->name, name) != 0) continue;
+    // `CPushConst` is either a whole hex word or a signed high half
+    if (mn->kind == OPD_WORD && text[0] != '$') continue;
+    return mn;
+  }
+  return NULL;
+}
+
+/** Returns nonzero if `op` is one of the opcodes printed as `Jump??`. */
+int is_unnamed_jump(i32 op) {
+  const char *name = ir_op_name(op);
+  return name != NULL && strcmp(name, "Jump??") == 0;
+}
+
+/** Returns nonzero if the operands of `op` are printed as floats. */
+int has_float_args(i32 op) {
+  return op == 0x008A || op == 0x008E || op == 0x0096;
+}
+
+
+//-- Assembler state ------------------------------------------------
+enum line_kind {
+  LINE_INSTR,       // An instruction
+  LINE_FUNC,        // A function header, `Func_00f0:`
+  LINE_MAP,         // `JumpMap {`
+  LINE_FALLBACK,    // `* => .l2`, within a JumpMap
+  LINE_CASE,        // `3 => .l4`
+  LINE_MAP_END,     // `}`
+  LINE_SKIP,        // Within a broken JumpMap; only there for show
+};
+
+/** One line of the listing. */
+struct asm_line {
+  int lineno;                  // In the listing
+  enum line_kind kind;
+  const struct mnemonic *mn;   // LINE_INSTR
+  char *label;                 // Defined by this line, if any
+  char *text;                  // Operands
+  u32 word;                    // OPD_RAW: the opcode word
+  i32 value;                   // LINE_CASE: the choice; LINE_MAP: the
+                               // number of choices
+  int scope;                   // Function the line is in, for local labels
+  u32 pos;                     // Word index
+  int nwords;                  // Words the line assembles to
+  int nlisted;                 // Words listed in its comment
+  u32 listed[ASM_MAX_WORDS];
+};
+
+struct asm_label {
+  const char *name;
+  int scope;                   // -1 for function labels
+  u32 pos;
+  int lineno;
+};
+
+/** Where in the listing we are. */
+enum asm_state {
+  ST_HEADER,
+  ST_EXTRA,
+  ST_CODE,
+  ST_MOVEMENT,
+};
+
+/** The "extra" blocks, in the order `render_disassembly` prints them. */
+const char *extra_names[] = {
+  "(unk0)", "(unk1)", "(unk2)", "globals", "(unk4)", "(unk5)", "(unk6)",
+};
+
+#define NEXTRA_BLOCKS 7
+
+/** A growable array of words. */
+struct words {
+  int n, cap;
+  u32 *v;
+};
+
+struct assembler {
+  const char *path;
+  struct debug_block *debug;
+  int nerrors;
+
+  enum asm_state state;
+  struct code_header header;
+  int have_header;
+  struct words extra[NEXTRA_BLOCKS];
+  int block;                   // The block being listed
+  struct words movement;
+
+  int nlines, cap;
+  struct asm_line *lines;
+  int map;                     // The open JumpMap's line, or -1
+  int scope;
+
+  int nlabels, lcap;
+  struct asm_label *labels;    // Sorted by name, then scope, after pass 1
+  u32 nwords;                  // Laid out by pass 1
+
+  const struct debug_symbol **by_name; // Built on first use
+};
+
+/** Reports an error at line `lineno`. */
+void asm_error(struct assembler *as, int lineno, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(stderr, "%s:%d: ", as->path, lineno);
+  vfprintf(stderr, fmt, ap);
+  fputc('\n', stderr);
+  va_end(ap);
+  as->nerrors++;
+}
+
+/** Makes room for one more of the `n` elements of `size` bytes at `p`. */
+void *asm_grow(void *p, int n, int *cap, size_t size) {
+  if (n < *cap) return p;
+  *cap = *cap? 2 * *cap : 64;
+  return realloc(p, *cap * size);
+}
+
+void words_push(struct words *w, u32 v) {
+  w->v = asm_grow(w->v, w->n, &w->cap, sizeof(u32));
+  w->v[w->n++] = v;
+}
+
+
+//-- Lexing ---------------------------------------------------------
+char *skip_space(char *s) {
+  while (*s == ' ' || *s == '\t') s++;
+  return s;
+}
+
+/** Removes trailing whitespace from `s`. */
+void trim_end(char *s) {
+  char *end = s + strlen(s);
+  while (end > s && isspace((u8) end[-1])) end--;
+  *end = 0;
+}
+
+/** Removes SGR escape sequences from `s`, in place. */
+void strip_sgr(char *s) {
+  char *out = s;
+  for (char *p = s; *p; ) {
+    if (p[0] == '\x1B' && p[1] == '[') {
+      p += 2;
+      while (*p && !isalpha((u8) *p)) p++;
+      if (*p) p++;
+    } else {
+      *out++ = *p++;
+    }
+  }
+  *out = 0;
+}
+
+/** Parses a number making up all of `s`: decimal, or hex after a `$`.
+ *  Returns 0 if it isn't one. */
+int parse_number(const char *s, i64 *v) {
+  const char *digits = *s == '$'? s + 1 : s;
+  char *end;
+  *v = strtoll(digits, &end, *s == '$'? 16 : 10);
+  return end != digits && *end == 0;
+}
+
+/** Splits off the next operand at `*p` (separated by commas or spaces).
+ *  Returns NULL if there are no more. */
+char *next_operand(char **p) {
+  char *s = *p + strspn(*p, ", \t");
+  if (*s == 0) return NULL;
+  char *end = s + strcspn(s, ", \t");
+  *p = *end? end + 1 : end;
+  *end = 0;
+  return s;
+}
+
+/** Returns nonzero if `s` consists of nothing but 8-digit hex words. */
+int is_word_list(const char *s) {
+  int n = 0;
+  for (s = skip_space((char *) s); *s; s = skip_space((char *) s)) {
+    for (int k = 0; k < 8; k++, s++) {
+      if (!isxdigit((u8) *s)) return 0;
+    }
+    if (*s && *s != ' ' && *s != '\t') return 0;
+    n++;
+  }
+  return n > 0;
+}
+
+/** Appends the 8-digit hex words in `s` to `w`. */
+void push_word_list(struct words *w, char *s) {
+  char *tok;
+  while ((tok = next_operand(&s)) != NULL) words_push(w, strtoul(tok, NULL, 16));
+}
+
+/** Parses the words listed in the comment `s` (`  0004: 00000031 000000a0`)
+ *  into `line`. */
+void parse_listed(struct assembler *as, struct asm_line *line, char *s) {
+  char *colon = s != NULL? strchr(s, ':') : NULL;
+  if (colon == NULL || !is_word_list(colon + 1)) return; // Nothing, or prose
+
+  char *p = colon + 1, *tok;
+  while ((tok = next_operand(&p)) != NULL) {
+    if (line->nlisted == ASM_MAX_WORDS) {
+      asm_error(as, line->lineno, "too many words listed");
+      return;
+    }
+    line->listed[line->nlisted++] = strtoul(tok, NULL, 16);
+  }
+}
+
+
+//-- Parsing --------------------------------------------------------
+/** Reads a field `key=<hex>` of the code block header, if it's in `s`. */
+void header_field(const char *s, const char *key, void *field, int size) {
+  const char *p = strstr(s, key);
+  if (p == NULL) return;
+  u32 v = strtoul(p + strlen(key), NULL, 16);
+  if (size == sizeof(u16)) *(u16 *) field = v;
+  else *(u32 *) field = v;
+}
+
+/** Parses a line of the header, or of the "extra" blocks.  Returns 0 if it
+ *  is neither. */
+int parse_header_line(struct assembler *as, char *s, int lineno) {
+  s = skip_space(s);
+
+  if (strncmp(s, "[Code block]", 12) == 0 || (as->state == ST_HEADER && strchr(s, '='))) {
+    struct code_header *hd = &as->header;
+    as->have_header = 1;
+    header_field(s, "unk1=", &hd->unk1, sizeof(u16));
+    header_field(s, "unk2=", &hd->unk2, sizeof(u16));
+    header_field(s, "unk4=", &hd->unk4, sizeof(u32));
+    header_field(s, "unk6=", &hd->unk6, sizeof(u32));
+    header_field(s, "header_size=", &hd->header_size, sizeof(u32));
+    header_field(s, "extracted_code_size=", &hd->extracted_code_size, sizeof(u32));
+    return 1;
+  }
+
+  // A new block: `(unk1):   0000bc60 00000094`
+  char *colon = strchr(s, ':');
+  if (colon != NULL && as->state != ST_MOVEMENT) {
+    for (int k = 0; k < NEXTRA_BLOCKS; k++) {
+      if (strlen(extra_names[k]) != (size_t) (colon - s) || strncmp(s, extra_names[k], colon - s) != 0) continue;
+      as->block = k;
+      as->state = k == NEXTRA_BLOCKS - 1? ST_CODE : ST_EXTRA;
+      if (*skip_space(colon + 1) && !is_word_list(colon + 1)) {
+        asm_error(as, lineno, "bad words in %s", extra_names[k]);
+      }
+      push_word_list(&as->extra[k], colon + 1);
+      return 1;
+    }
+  }
+
+  // More words for the current block
+  if (as->state == ST_EXTRA && is_word_list(s)) {
+    push_word_list(&as->extra[as->block], s);
+    return 1;
+  }
+
+  return 0;
+}
+
+/** Works out how many words the OPD_RAW instruction `line` takes up. */
+void size_raw(struct assembler *as, struct asm_line *line, const char *name) {
+  char *end;
+  u32 w = strtoul(name + 1, &end, 16);
+  if (end == name + 1 || *end) {
+    asm_error(as, line->lineno, "bad opcode '%s'", name);
+    return;
+  }
+
+  // A listed opcode word fills in the high half
+  if (w <= 0xFFFF && line->nlisted > 0 && (line->listed[0] & 0xFFFF) == w) {
+    w = line->listed[0];
+  }
+  line->word = w;
+
+  // Operands are either given, or listed
+  int nargs = 0;
+  char *p = line->text, *tok;
+  while ((tok = p + strspn(p, ", \t")), *tok) {
+    nargs++;
+    p = tok + strcspn(tok, ", \t");
+  }
+  if (nargs == 0 && line->nlisted > 0 && (line->listed[0] & 0xFFFF) == (w & 0xFFFF)) {
+    nargs = line->nlisted - 1;
+  } else if (nargs == 0) {
+    struct instr instr;
+    u32 code[2] = { w, 0 };
+    if ((w & 0xFFFF) != 0x0082 && decode(&instr, code)) nargs = instr.nargs;
+    if (nargs > 0) {
+      asm_error(as, line->lineno, "$%04x takes %d operand(s)", w & 0xFFFF, nargs);
+    }
+  }
+  line->nwords = nargs + 1;
+}
+
+/** Closes the JumpMap opened at line `as->map`, which ends at `end`. */
+void close_map(struct assembler *as, struct asm_line *end) {
+  struct asm_line *map = &as->lines[as->map];
+  int ncases = 0, fallback = 0;
+  for (struct asm_line *l = map + 1; l < end; l++) {
+    if (l->kind == LINE_CASE) ncases++;
+    if (l->kind == LINE_FALLBACK) fallback++;
+  }
+
+  // A broken JumpMap (one whose choices run off the code) is really a single
+  // word; the disassembler lists the words after it anyway, so they follow.
+  // Its choices are listed only as far as they go.
+  if (map->nlisted >= 2 && ((i32) map->listed[1] < 0 || ncases < (i32) map->listed[1])) {
+    map->nwords = 1;
+    for (struct asm_line *l = map + 1; l < end; l++) {
+      l->kind = LINE_SKIP;
+      l->label = NULL;
+      l->nwords = 0;
+    }
+  } else if (fallback != 1) {
+    asm_error(as, map->lineno, "JumpMap needs exactly one `* =>` fallback");
+  }
+  map->value = ncases;
+
+  as->map = -1;
+}
+
+/** Parses a line of code: an instruction, a function header, or part of a
+ *  JumpMap.  The comment (if any) is `comment`. */
+void parse_code_line(struct assembler *as, char *s, char *comment, int lineno) {
+  struct asm_line line = { .lineno = lineno, .scope = as->scope };
+  parse_listed(as, &line, comment);
+
+  // A function header is a lone label at the start of the line
+  if (!isspace((u8) s[0]) && !isdigit((u8) s[0]) && strpbrk(s, " \t") == NULL
+      && s[strlen(s) - 1] == ':') {
+    s[strlen(s) - 1] = 0;
+    line.kind = LINE_FUNC;
+    line.label = s;
+    line.scope = ++as->scope;
+    goto add;
+  }
+
+  // Line number and label columns
+  char *p = skip_space(s);
+  int is_case = strstr(p, "=>") != NULL;
+  if (!is_case) {
+    while (isdigit((u8) *p)) p++;
+    p = skip_space(p);
+  }
+  char *end = p + strcspn(p, " \t");
+  if (end > p && end[-1] == ':') {
+    end[-1] = 0;
+    line.label = p;
+    p = skip_space(end);
+  }
+
+  if (is_case) {
+    char *arrow = strstr(p, "=>");
+    *arrow = 0;
+    trim_end(p);
+    line.text = skip_space(arrow + 2);
+
+    i64 v;
+    if (strcmp(p, "*") == 0) {
+      line.kind = LINE_FALLBACK;
+      line.nwords = 1;
+    } else if (parse_number(p, &v)) {
+      line.kind = LINE_CASE;
+      line.value = v;
+      line.nwords = 2;
+    } else {
+      asm_error(as, lineno, "bad JumpMap choice '%s'", p);
+    }
+
+    if (as->map < 0) {
+      asm_error(as, lineno, "JumpMap choice outside of a JumpMap");
+    } else if (line.kind == LINE_FALLBACK && as->lines[as->nlines - 1].kind != LINE_MAP) {
+      asm_error(as, lineno, "the `* =>` fallback must come first");
+    }
+
+  } else if (strcmp(p, "JumpMap {") == 0) {
+    if (as->map >= 0) asm_error(as, lineno, "nested JumpMap");
+    line.kind = LINE_MAP;
+    line.nwords = 2;
+    as->map = as->nlines;
+
+  } else if (strcmp(p, "}") == 0) {
+    line.kind = LINE_MAP_END;
+    if (as->map < 0) asm_error(as, lineno, "'}' outside of a JumpMap");
+    else close_map(as, as->lines + as->nlines);
+
+  } else {
+    // `Script Begin` is the one mnemonic with a space in it
+    char *name = p;
+    if (strncmp(p, "Script Begin", 12) == 0 && (p[12] == 0 || isspace((u8) p[12]))) {
+      p += 12;
+    } else {
+      p += strcspn(p, " \t");
+    }
+    if (*p) *p++ = 0;
+    line.text = skip_space(p);
+
+    line.kind = LINE_INSTR;
+    line.mn = find_mnemonic(name, line.text);
+    if (line.mn == NULL) {
+      asm_error(as, lineno, "unknown mnemonic '%s'", name);
+      return;
+    }
+    if (line.mn->kind == OPD_RAW) size_raw(as, &line, name);
+    else line.nwords = line.mn->nargs + 1;
+  }
+
+add:
+  as->lines = asm_grow(as->lines, as->nlines, &as->cap, sizeof(struct asm_line));
+  as->lines[as->nlines++] = line;
+}
+
+/** Parses the listing line `s`. */
+void parse_line(struct assembler *as, char *s, int lineno) {
+  strip_sgr(s);
+
+  char *comment = strchr(s, ';');
+  if (comment != NULL) *comment++ = 0;
+  trim_end(s);
+  if (*skip_space(s) == 0) return; // Blank, or nothing but a comment
+
+  if (as->state != ST_CODE && as->state != ST_MOVEMENT
+      && parse_header_line(as, s, lineno)) return;
+
+  // Movement data comes after the code
+  if (as->state != ST_HEADER && as->state != ST_EXTRA && is_word_list(s)) {
+    push_word_list(&as->movement, s);
+    as->state = ST_MOVEMENT;
+    return;
+  }
+
+  if (as->state == ST_MOVEMENT) {
+    asm_error(as, lineno, "code after the movement data");
+    return;
+  }
+  as->state = ST_CODE;
+  parse_code_line(as, s, comment, lineno);
+}
+
+
+//-- Labels and identifiers -----------------------------------------
+int labels_comparator(const void *a, const void *b) {
+  const struct asm_label *l1 = a, *l2 = b;
+  int c = strcmp(l1->name, l2->name);
+  if (c != 0) return c;
+  return (l1->scope > l2->scope) - (l1->scope < l2->scope);
+}
+
+void add_label(struct assembler *as, const char *name, int scope, u32 pos,
+               int lineno) {
+  as->labels = asm_grow(as->labels, as->nlabels, &as->lcap, sizeof(struct asm_label));
+  as->labels[as->nlabels++] = (struct asm_label) { name, scope, pos, lineno };
+}
+
+/** Returns the first label named `name` in `scope`, or NULL if there is
+ *  none. */
+struct asm_label *lookup_label(struct assembler *as, const char *name, int scope) {
+  struct asm_label key = { name, scope };
+  int lo = 0, hi = as->nlabels;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (labels_comparator(&as->labels[mid], &key) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo < as->nlabels && labels_comparator(&as->labels[lo], &key) == 0) return &as->labels[lo];
+  return NULL;
+}
+
+/** Returns the scope (function) word `pos` lies in. */
+int scope_at(struct assembler *as, u32 pos) {
+  int lo = 0, hi = as->nlines;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (as->lines[mid].pos <= pos) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo > 0? as->lines[lo - 1].scope : 0;
+}
+
+/** Returns the word index of the label `name` as seen from `scope`, or -1 if
+ *  there is no such label.  If a label of that name is at `hint`, though
+ *  (the target the listed words give), that one wins: local labels of other
+ *  functions may be referred to by their own number. */
+i64 find_label(struct assembler *as, const char *name, int scope, i64 hint) {
+  struct asm_label *l;
+
+  // Function labels; several functions may share a name
+  if (strncmp(name, ".l", 2) != 0) {
+    struct asm_label *end = as->labels + as->nlabels;
+    l = lookup_label(as, name, -1);
+    for (struct asm_label *k = l; k != NULL && k < end && strcmp(k->name, name) == 0; k++) {
+      if (k->pos == hint) return hint;
+    }
+    return l != NULL? l->pos : -1;
+  }
+
+  if (hint >= 0 && hint < as->nwords) {
+    l = lookup_label(as, name, scope_at(as, hint));
+    if (l != NULL && l->pos == hint) return hint;
+  }
+  l = lookup_label(as, name, scope);
+  return l != NULL? l->pos : -1;
+}
+
+/** Returns nonzero if the local label `name` at word `pos` must be one the
+ *  listing doesn't show (e.g. one inside an instruction's operands): labels
+ *  are numbered within their own function, whether shown or not, and that
+ *  function doesn't define it. */
+int is_hidden_label(struct assembler *as, const char *name, i64 pos) {
+  if (pos < 0 || pos >= as->nwords || strncmp(name, ".l", 2) != 0) return 0;
+  return lookup_label(as, name, scope_at(as, pos)) == NULL;
+}
+
+int by_name_comparator(const void *a, const void *b) {
+  const struct debug_symbol *s1 = *(const struct debug_symbol **) a,
+                            *s2 = *(const struct debug_symbol **) b;
+  return strcmp(s1->name, s2->name);
+}
+
+/** Finds the symbol of `type` named `name` that the disassembler would print
+ *  for its ID at word `pos`.  Returns NULL if there is none. */
+const struct debug_symbol *find_symbol(struct assembler *as, const char *name,
+                                       u32 type, u32 pos) {
+  struct debug_block *debug = as->debug;
+  if (as->by_name == NULL) {
+    as->by_name = malloc(sizeof(struct debug_symbol *) * (debug->nsymbols + 1));
+    for (int i = 0; i < debug->nsymbols; i++) as->by_name[i] = &debug->symbols[i];
+    qsort(as->by_name, debug->nsymbols, sizeof(struct debug_symbol *), by_name_comparator);
+  }
+
+  int lo = 0, hi = debug->nsymbols;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (strcmp(as->by_name[mid]->name, name) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+
+  for (int i = lo; i < debug->nsymbols && strcmp(as->by_name[i]->name, name) == 0; i++) {
+    const struct debug_symbol *sym = as->by_name[i], *seen;
+    if (sym->type != type) continue;
+    seen = lookup_sym(debug, (i16) sym->id, type, pos * 4);
+    if (seen != NULL && strcmp(seen->name, name) == 0) return sym;
+  }
+  return NULL;
+}
+
+
+//-- Encoding -------------------------------------------------------
+/** Encodes the offset word `k` of `line` (at word `idx`), which branches to
+ *  the label `name`: the target is `idx + word/4 - 1`.  The listed word is
+ *  kept if it already gets there, and used as is if there's no label (e.g.
+ *  for targets outside the code).  Returns 0 on error. */
+int encode_target(struct assembler *as, struct asm_line *line, const char *name,
+                  int k, u32 idx, u32 *out) {
+  int listed = k < line->nlisted;
+  i64 hint = listed? (i64) idx + (i32) line->listed[k] / 4 - 1 : -1;
+
+  if (*name) {
+    i64 target = find_label(as, name, line->scope, hint);
+    if (target >= 0 && !(listed && target != hint && is_hidden_label(as, name, hint))) {
+      *out = target == hint? line->listed[k] : (u32) (4 * (target - idx + 1));
+      return 1;
+    }
+  }
+
+  if (listed) {
+    *out = line->listed[k];
+    return 1;
+  }
+
+  if (*name) asm_error(as, line->lineno, "undefined label '%s'", name);
+  else asm_error(as, line->lineno, "missing branch target");
+  return 0;
+}
+
+/** Encodes the identifier `name` of symbol `type` used by `line`, into the
+ *  high half `*id`.  Returns 0 on error. */
+int encode_identifier(struct assembler *as, struct asm_line *line,
+                      const char *name, u32 type, u16 *id) {
+  i64 v;
+  if (name[0] == '$') {
+    if (!parse_number(name, &v) || v < 0 || v > 0xFFFF) {
+      asm_error(as, line->lineno, "bad identifier '%s'", name);
+      return 0;
+    }
+    *id = v;
+    return 1;
+  }
+
+  int listed = line->nlisted > 0;
+  u16 listed_id = listed? line->listed[0] >> 16 : 0;
+
+  if (as->debug != NULL) {
+    const struct debug_symbol *sym = NULL;
+    if (listed) sym = lookup_sym(as->debug, (i16) listed_id, type, line->pos * 4);
+    if (sym != NULL && strcmp(sym->name, name) == 0) {
+      *id = listed_id;
+      return 1;
+    }
+
+    sym = find_symbol(as, name, type, line->pos);
+    if (sym != NULL) {
+      *id = sym->id;
+      return 1;
+    }
+    asm_error(as, line->lineno, "unknown %s '%s'", type == 0x0101? "local" : "global", name);
+    return 0;
+  }
+
+  // Without the debug section, names can only be taken as listed
+  if (listed) {
+    *id = listed_id;
+    return 1;
+  }
+  asm_error(as, line->lineno, "'%s' needs the debug section", name);
+  return 0;
+}
+
+/** Encodes the float operand `s` (word `k` of `line`).  The listed word is
+ *  kept if it prints the same, since `%f` rounds. */
+int encode_float(struct assembler *as, struct asm_line *line, const char *s,
+                 int k, u32 *out) {
+  char *end;
+  float f = strtof(s, &end);
+  if (end == s || *end) {
+    asm_error(as, line->lineno, "bad float '%s'", s);
+    return 0;
+  }
+
+  if (k < line->nlisted) {
+    char buf[64];
+    float g;
+    memcpy(&g, &line->listed[k], sizeof(float));
+    snprintf(buf, sizeof(buf), "%f", g);
+    if (strcmp(buf, s) == 0) {
+      *out = line->listed[k];
+      return 1;
+    }
+  }
+
+  memcpy(out, &f, sizeof(float));
+  return 1;
+}
+
+/** Encodes the operands of an OPD_RAW instruction into `w`. */
+void encode_raw(struct assembler *as, struct asm_line *line, u32 *w) {
+  w[0] = line->word;
+
+  // Not given, so taken as listed
+  if (*line->text == 0) {
+    for (int k = 1; k < line->nwords; k++) w[k] = line->listed[k];
+    return;
+  }
+
+  i32 op = line->word & 0xFFFF;
+  char *p = line->text, *tok;
+  for (int k = 1; (tok = next_operand(&p)) != NULL; k++) {
+    i64 v;
+    if (has_float_args(op)) {
+      encode_float(as, line, tok, k, &w[k]);
+    } else if (parse_number(tok, &v)) {
+      w[k] = v;
+    } else {
+      encode_target(as, line, tok, k, line->pos + k, &w[k]);
+    }
+  }
+}
+
+/** Encodes the instruction `line` into `w`. */
+void encode_instr(struct assembler *as, struct asm_line *line, u32 *w) {
+  const struct mnemonic *mn = line->mn;
+  if (mn->kind == OPD_RAW) {
+    encode_raw(as, line, w);
+    return;
+  }
+
+  // The opcode; a listed one may have something in its high half
+  i32 op = mn->op;
+  if (op < 0) {
+    if (line->nlisted == 0 || !is_unnamed_jump(line->listed[0] & 0xFFFF)) {
+      asm_error(as, line->lineno, "ambiguous '%s'; write it as `$00xx <label>`", mn->name);
+      return;
+    }
+    op = line->listed[0] & 0xFFFF;
+  }
+  w[0] = line->nlisted > 0 && (line->listed[0] & 0xFFFF) == (u32) op? line->listed[0] : (u32) op;
+
+  const char *text = line->text;
+  i64 v;
+  u16 id;
+
+  switch (mn->kind) {
+    case OPD_NONE:
+      if (*text) asm_error(as, line->lineno, "'%s' takes no operands", mn->name);
+      break;
+
+    case OPD_TARGET:
+      encode_target(as, line, text, 1, line->pos + 1, &w[1]);
+      break;
+
+    case OPD_GLOBAL:
+    case OPD_LOCAL:
+      if (encode_identifier(as, line, text, mn->kind == OPD_LOCAL? 0x0101 : 0x0001, &id)) {
+        w[0] = (u32) id << 16 | op;
+      }
+      break;
+
+    case OPD_SIGNED:
+    case OPD_UNSIGNED:
+    case OPD_HEX:
+      if (!parse_number(text, &v) || v < -0x8000 || v > 0xFFFF
+          || (mn->kind == OPD_HEX) != (text[0] == '$')) {
+        asm_error(as, line->lineno, "bad operand '%s'", text);
+        break;
+      }
+      w[0] = (u32) (u16) v << 16 | op;
+      break;
+
+    case OPD_WORD:
+      if (!parse_number(text, &v) || v < -0x80000000LL || v > 0xFFFFFFFFLL) {
+        asm_error(as, line->lineno, "bad operand '%s'", text);
+        break;
+      }
+      w[1] = v;
+      break;
+
+    case OPD_COMMAND: {
+      int command, nargs, len = 0;
+      if (sscanf(text, "%d (%d args)%n", &command, &nargs, &len) != 2 || text[len]) {
+        asm_error(as, line->lineno, "bad operands '%s'", text);
+        break;
+      }
+      w[1] = command;
+      // The listed word is kept if it rounds to the same count
+      w[2] = line->nlisted > 2 && (i32) (line->listed[2] / 4) == nargs? line->listed[2] : (u32) nargs * 4;
+    } break;
+
+    case OPD_RAW:
+      break;
+  }
+}
+
+/** Encodes the JumpMap line `line` into `w`. */
+void encode_map_line(struct assembler *as, struct asm_line *line, u32 *w) {
+  switch (line->kind) {
+    case LINE_MAP: {
+      w[0] = line->nlisted > 0 && (line->listed[0] & 0xFFFF) == 0x0082? line->listed[0] : 0x0082;
+      if (line->nwords == 2) w[1] = line->value; // Unless broken
+    } break;
+
+    case LINE_FALLBACK:
+      encode_target(as, line, line->text, 0, line->pos, &w[0]);
+      break;
+
+    case LINE_CASE:
+      w[0] = line->value;
+      encode_target(as, line, line->text, 1, line->pos + 1, &w[1]);
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+//-- Assembler proper -----------------------------------------------
+/** Builds the section from the assembled `words`. */
+struct code_block *build_section(struct assembler *as, u32 *words, int nwords) {
+  struct code_header *hd = malloc(sizeof(struct code_header));
+  *hd = as->header;
+  hd->magic = 0x0A0AF1E0;
+
+  // The "extra" words: 7 block offsets and a pad word, the blocks, then unk6
+  int nextra = 8;
+  for (int k = 0; k < NEXTRA_BLOCKS - 1; k++) nextra += as->extra[k].n;
+  nextra += 1;
+
+  u32 *extra = calloc(nextra, sizeof(u32));
+  int j = 8;
+  for (int k = 0; k < NEXTRA_BLOCKS - 1; k++) {
+    extra[k] = 0x20 + 4 * j;
+    if (as->extra[k].n > 0) memcpy(&extra[j], as->extra[k].v, as->extra[k].n * sizeof(u32));
+    j += as->extra[k].n;
+  }
+  extra[NEXTRA_BLOCKS - 1] = 0x20 + 4 * j;
+  extra[j] = as->extra[NEXTRA_BLOCKS - 1].n > 0? as->extra[NEXTRA_BLOCKS - 1].v[0] : 0;
+
+  // Operands may spill over into the movement data, which lists them again
+  int ninstrs = nwords;
+  if (as->have_header && as->header.extracted_code_size >= as->header.header_size) {
+    int listed = (as->header.extracted_code_size - as->header.header_size) / sizeof(u32),
+        spill = nwords - listed;
+    if (spill > 0 && spill <= as->movement.n
+        && memcmp(words + listed, as->movement.v, spill * sizeof(u32)) == 0) {
+      ninstrs = listed;
+    }
+  }
+
+  int total = ninstrs + as->movement.n;
+  u32 *instrs = malloc((total + 1) * sizeof(u32));
+  memcpy(instrs, words, ninstrs * sizeof(u32));
+  if (as->movement.n > 0) memcpy(instrs + ninstrs, as->movement.v, as->movement.n * sizeof(u32));
+
+  struct code_block *code = malloc(sizeof(struct code_block));
+  *code = (struct code_block) {
+    .header    = hd,
+    .nextra    = nextra,
+    .extra     = extra,
+    .ninstrs   = ninstrs,
+    .instrs    = instrs,
+    .nmovement = as->movement.n,
+    .movement  = instrs + ninstrs,
+  };
+
+  hd->header_size = 0x20 + nextra * sizeof(u32);
+  hd->extracted_code_size = hd->header_size + ninstrs * sizeof(u32);
+  hd->extracted_size = hd->extracted_code_size + as->movement.n * sizeof(u32);
+  code->size = code_block_encoded_size(code);
+  hd->section_size = code->size;
+
+  return code;
+}
+
+/** Assembles a code section from a disassembly listing. */
+struct code_block *assemble(const char *text, size_t n,
+                            struct debug_block *debug, const char *path) {
+  struct assembler as = { .path = path, .debug = debug, .map = -1 };
+
+  // Lines point into our own copy of the listing
+  char *buf = malloc(n + 1);
+  memcpy(buf, text, n);
+  buf[n] = 0;
+
+  int lineno = 1;
+  for (char *s = buf; s < buf + n; lineno++) {
+    char *nl = memchr(s, '\n', buf + n - s);
+    if (nl == NULL) nl = buf + n;
+    *nl = 0;
+    parse_line(&as, s, lineno);
+    s = nl + 1;
+  }
+  if (as.map >= 0) asm_error(&as, as.lines[as.map].lineno, "unterminated JumpMap");
+  if (!as.have_header && as.nlines == 0) asm_error(&as, lineno - 1, "no code section");
+
+  //-- Pass 1: lay out the words, and define labels
+  u32 pos = 0;
+  for (int k = 0; k < as.nlines; k++) {
+    struct asm_line *line = &as.lines[k];
+    line->pos = pos;
+    if (line->label != NULL) {
+      int local = line->kind != LINE_FUNC && strncmp(line->label, ".l", 2) == 0;
+      add_label(&as, line->label, local? line->scope : -1, pos, line->lineno);
+    }
+    pos += line->nwords;
+  }
+  as.nwords = pos;
+
+  qsort(as.labels, as.nlabels, sizeof(struct asm_label), labels_comparator);
+  for (int k = 1; k < as.nlabels; k++) {
+    struct asm_label *a = &as.labels[k - 1], *b = &as.labels[k];
+    // Function headers may be repeated (e.g. before a JumpMap's `}`)
+    if (labels_comparator(a, b) == 0 && a->pos != b->pos && b->scope >= 0) {
+      asm_error(&as, b->lineno, "label '%s' defined twice", b->name);
+    }
+  }
+
+  //-- Pass 2: encode
+  u32 *words = calloc(pos + 1, sizeof(u32));
+  for (int k = 0; k < as.nlines; k++) {
+    struct asm_line *line = &as.lines[k];
+    u32 *w = &words[line->pos];
+    if (line->kind == LINE_INSTR) encode_instr(&as, line, w);
+    else encode_map_line(&as, line, w);
+  }
+
+  struct code_block *code = as.nerrors == 0? build_section(&as, words, pos) : NULL;
+
+  // Cleanup
+  free(words);
+  for (int k = 0; k < NEXTRA_BLOCKS; k++) free(as.extra[k].v);
+  free(as.movement.v);
+  free(as.lines);
+  free(as.labels);
+  free(as.by_name);
+  free(buf);
+
+  return code;
+}
+
+/** Frees a code section returned by `assemble`. */
+void free_assembly(struct code_block *code) {
+  if (code == NULL) return;
+  free_code_ir(code->ir);
+  free(code->header);
+  free(code->extra);
+  free(code->instrs);
+  free(code);
+}
@@ -0,0 +1,27 @@
+#ifndef ASSEMBLE_H
+#define ASSEMBLE_H
+
+#include <stddef.h>
+
+#include "poketools.h"
+#include "formats/script.h"
+
+/** Assembles a code section from the `n` bytes of listing at `text`, in the
+ *  format `disassemble` prints (with or without color): the header and
+ *  "extra" blocks, then one instruction per line, with labels, and finally
+ *  the movement data.  Line numbers and `;` comments are ignored, except for
+ *  the words each line lists, which fill in whatever the mnemonic doesn't
+ *  say (e.g. which `Jump??` it is, or an unknown opcode's operands), so the
+ *  output of `disassemble` assembles back to the very same section.
+ *
+ *  Labels (`.lN` within each function, and function names) are resolved by
+ *  the assembler; identifiers are either `$xxxx` or names from `debug`.
+ *  Errors are reported on stderr, prefixed by `path` and the line number.
+ *  Returns the newly-allocated section, or NULL if there were any. */
+struct code_block *assemble(const char *text, size_t n,
+                            struct debug_block *debug, const char *path);
+
+/** Frees a code section returned by `assemble`. */
+void free_assembly(struct code_block *code);
+
+#endif
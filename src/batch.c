@@ -0,0 +1,304 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "arena.h"
+#include "timings.h"
+
+int batch_headers = 1;
+const char *batch_options = "";
+
+//-- Path lists -----------------------------------------------------
+void batch_push(struct batch_list *list, const char *path) {
+  if (list->n == list->cap) {
+    list->cap = list->cap? 2 * list->cap : 64;
+    list->paths = realloc(list->paths, list->cap * sizeof(char *));
+  }
+  list->paths[list->n++] = strdup(path);
+}
+
+int path_comparator(const void *a, const void *b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/** Adds every file below the directory `dir` to `list`, in sorted order. */
+int batch_add_dir(struct batch_list *list, const char *dir) {
+  DIR *d = opendir(dir);
+  if (d == NULL) return -1;
+
+  // Collect and sort the entries first, so the order is deterministic
+  struct batch_list entries = { 0 };
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL) {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+    char *path = malloc(strlen(dir) + strlen(ent->d_name) + 2);
+    sprintf(path, "%s/%s", dir, ent->d_name);
+    batch_push(&entries, path);
+    free(path);
+  }
+  closedir(d);
+
+  qsort(entries.paths, entries.n, sizeof(char *), path_comparator);
+
+  for (int i = 0; i < entries.n; i++) {
+    struct stat st;
+    if (stat(entries.paths[i], &st) == 0) {
+      if (S_ISDIR(st.st_mode))      batch_add_dir(list, entries.paths[i]);
+      else if (S_ISREG(st.st_mode)) batch_push(list, entries.paths[i]);
+    }
+    free(entries.paths[i]);
+  }
+  free(entries.paths);
+
+  return 0;
+}
+
+/** Adds the files named by `arg` to `list`. */
+int batch_add(struct batch_list *list, const char *arg) {
+  // List of paths on stdin
+  if (strcmp(arg, "-") == 0) {
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, stdin)) >= 0) {
+      if (len > 0 && line[len - 1] == '\n') line[--len] = 0;
+      if (len > 0) batch_push(list, line);
+    }
+    free(line);
+    return 0;
+  }
+
+  struct stat st;
+  if (stat(arg, &st) == 0 && S_ISDIR(st.st_mode)) {
+    return batch_add_dir(list, arg);
+  }
+
+  // Anything else is processed (and fails) as a single file
+  batch_push(list, arg);
+  return 0;
+}
+
+
+//-- Work-stealing pool ---------------------------------------------
+// Each worker owns a range [lo, hi) of job indices.  Owners take jobs from
+// the front, so output tends to complete in order; idle workers steal the
+// back half of someone else's range.
+struct deque {
+  pthread_mutex_t lock;
+  int lo, hi;
+};
+
+struct result {
+  char *buf;
+  size_t len;
+  int status;
+  int done;
+};
+
+struct pool {
+  struct batch_list *list;
+  batch_fn *fn;
+  int nworkers;
+  struct deque *deques;
+  struct result *results;
+  pthread_mutex_t lock; // Guards `results[*].done`
+  pthread_cond_t cond;
+};
+
+struct worker {
+  struct pool *pool;
+  int id;
+  pthread_t thread;
+};
+
+/** Takes the next job from the front of `d`, or returns -1 if empty. */
+int deque_take(struct deque *d) {
+  pthread_mutex_lock(&d->lock);
+  int i = d->lo < d->hi? d->lo++ : -1;
+  pthread_mutex_unlock(&d->lock);
+  return i;
+}
+
+/** Steals the back half of another worker's range into worker `id`'s own
+ *  deque.  Returns 0 on success, or -1 if there was nothing left to steal. */
+int pool_steal(struct pool *pool, int id) {
+  for (int k = 1; k < pool->nworkers; k++) {
+    struct deque *victim = &pool->deques[(id + k) % pool->nworkers];
+
+    pthread_mutex_lock(&victim->lock);
+    int n = (victim->hi - victim->lo + 1) / 2,
+        hi = victim->hi;
+    victim->hi -= n;
+    pthread_mutex_unlock(&victim->lock);
+
+    if (n > 0) {
+      struct deque *own = &pool->deques[id];
+      pthread_mutex_lock(&own->lock);
+      own->lo = hi - n;
+      own->hi = hi;
+      pthread_mutex_unlock(&own->lock);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+void pool_run_job(struct pool *pool, int i) {
+  struct result res = { NULL, 0, 0, 1 };
+
+  FILE *out = open_memstream(&res.buf, &res.len);
+  timings_file_begin();
+  res.status = pool->fn(out, pool->list->paths[i]);
+  timings_file_end(pool->list->paths[i]);
+  fclose(out);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->results[i] = res;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void *worker_main(void *worker_) {
+  struct worker *worker = worker_;
+  struct pool *pool = worker->pool;
+  struct deque *own = &pool->deques[worker->id];
+
+  // Whatever a job parses lives in the worker's arena, and is released in
+  // one go when it is done
+  struct arena arena = { 0 };
+  parse_arena = &arena;
+
+  while (1) {
+    int i = deque_take(own);
+    if (i < 0) {
+      if (pool_steal(pool, worker->id) < 0) break;
+      continue;
+    }
+    pool_run_job(pool, i);
+    arena_release(&arena);
+  }
+
+  parse_arena = NULL;
+  arena_free(&arena);
+  return NULL;
+}
+
+/** Runs `fn` over every path in `list` on `nthreads` threads, writing the
+ *  outputs to `out` in list order.  Returns the number of failed files. */
+int batch_run(struct batch_list *list, batch_fn *fn, int nthreads,
+              int headers, FILE *out) {
+  if (nthreads < 1) nthreads = 1;
+  if (nthreads > list->n) nthreads = list->n > 0? list->n : 1;
+
+  struct pool pool = {
+    .list     = list,
+    .fn       = fn,
+    .nworkers = nthreads,
+    .deques   = calloc(nthreads, sizeof(struct deque)),
+    .results  = calloc(list->n, sizeof(struct result)),
+  };
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.cond, NULL);
+
+  // Hand out contiguous ranges up front
+  for (int w = 0; w < nthreads; w++) {
+    pthread_mutex_init(&pool.deques[w].lock, NULL);
+    pool.deques[w].lo = (long) list->n *  w      / nthreads;
+    pool.deques[w].hi = (long) list->n * (w + 1) / nthreads;
+  }
+
+  struct worker *workers = calloc(nthreads, sizeof(struct worker));
+  for (int w = 0; w < nthreads; w++) {
+    workers[w] = (struct worker) { &pool, w };
+    pthread_create(&workers[w].thread, NULL, worker_main, &workers[w]);
+  }
+
+  // Write out results in order as they complete
+  int failures = 0, printed = 0;
+  for (int i = 0; i < list->n; i++) {
+    pthread_mutex_lock(&pool.lock);
+    while (!pool.results[i].done) pthread_cond_wait(&pool.cond, &pool.lock);
+    struct result res = pool.results[i];
+    pthread_mutex_unlock(&pool.lock);
+
+    if (res.status != 0) {
+      failures++;
+    } else {
+      if (headers) fprintf(out, "%s==> %s <==\n", printed++? "\n" : "", list->paths[i]);
+      fwrite(res.buf, 1, res.len, out);
+    }
+    free(res.buf);
+  }
+
+  for (int w = 0; w < nthreads; w++) pthread_join(workers[w].thread, NULL);
+  for (int w = 0; w < nthreads; w++) pthread_mutex_destroy(&pool.deques[w].lock);
+  pthread_mutex_destroy(&pool.lock);
+  pthread_cond_destroy(&pool.cond);
+  free(workers);
+  free(pool.deques);
+  free(pool.results);
+
+  return failures;
+}
+
+
+//-- Command line ---------------------------------------------------
+/** Parses `[-j <threads>] <file|dir|->...`. */
+int batch_parse_args(struct batch_list *list, int *nthreads,
+                     int argc, char *argv[]) {
+  *nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  int nargs = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "-j", 2) == 0) {
+      const char *n = argv[i][2]? &argv[i][2] : ++i < argc? argv[i] : NULL;
+      if (n == NULL || (*nthreads = atoi(n)) < 1) return -1;
+      continue;
+    }
+
+    nargs++;
+    if (batch_add(list, argv[i]) < 0) {
+      fprintf(stderr, "Couldn't read directory '%s'.\n", argv[i]);
+    }
+  }
+
+  return nargs > 0? 0 : -1;
+}
+
+/** Runs `fn` over the files named on the command line. */
+int batch_main(batch_fn *fn, int argc, char *argv[]) {
+  struct batch_list list = { 0 };
+  int nthreads;
+
+  argc = timings_parse_args(argc, argv);
+  if (batch_parse_args(&list, &nthreads, argc, argv) < 0) {
+    fprintf(stderr, "usage: %s %s[-j <threads>] [--no-color] [--format <text|json|binary>] [--cache <dir>] [--cfg <dot|json>] [--timings[=json]] <file|dir|->...\n",
+            argv[0], batch_options);
+    return 1;
+  }
+
+  // A single plain file works just like it always has
+  struct stat st;
+  if (argc == 2 && strcmp(argv[1], "-") != 0
+      && !(stat(argv[1], &st) == 0 && S_ISDIR(st.st_mode))) {
+    timings_file_begin();
+    int status = fn(stdout, argv[1]);
+    timings_file_end(argv[1]);
+    return status;
+  }
+
+  int failures = batch_run(&list, fn, nthreads, batch_headers, stdout);
+  if (failures > 0) {
+    fprintf(stderr, "%d of %d files failed.\n", failures, list.n);
+  }
+
+  for (int i = 0; i < list.n; i++) free(list.paths[i]);
+  free(list.paths);
+
+  return failures > 0? 2 : 0;
+}
@@ -0,0 +1,52 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+/** A list of paths to process in a batch. */
+struct batch_list {
+  int n;
+  int cap;
+  char **paths;
+};
+
+/** Processes the file at `path`, writing its output to `out`.  Returns 0 on
+ *  success, or nonzero (after reporting why on stderr) on failure. */
+typedef int batch_fn(FILE *out, const char *path);
+
+/** Whether `batch_main` precedes each file's output with a header naming it
+ *  (set by default).  Tools whose output is self-describing clear it. */
+extern int batch_headers;
+
+/** The tool's own options, for `batch_main`'s usage message: each followed
+ *  by a space, like "[--scan] " ("" by default). */
+extern const char *batch_options;
+
+/** Adds (a copy of) `path` to `list`. */
+void batch_push(struct batch_list *list, const char *path);
+
+/** Adds the files named by `arg` to `list`: a regular file is added as-is, a
+ *  directory adds every file below it (in sorted order), and "-" adds one path
+ *  per line read from stdin.  Returns 0 on success, or -1 if `arg` couldn't
+ *  be read. */
+int batch_add(struct batch_list *list, const char *arg);
+
+/** Runs `fn` over every path in `list` on a pool of `nthreads` work-stealing
+ *  threads, and writes the outputs to `out` in list order, so the result is
+ *  the same as a serial run.  If `headers` is set, each file's output is
+ *  preceded by a header naming it.  Returns the number of failed files. */
+int batch_run(struct batch_list *list, batch_fn *fn, int nthreads,
+              int headers, FILE *out);
+
+/** Parses the command line shared by the batch-capable tools:
+ *  `[-j <threads>] <file|dir|->...`.  Fills in `list` and `*nthreads`, and
+ *  returns 0 on success or -1 on a usage error. */
+int batch_parse_args(struct batch_list *list, int *nthreads,
+                     int argc, char *argv[]);
+
+/** Runs `fn` over the files named on the command line, the way the
+ *  batch-capable tools do: a single plain file is processed exactly as
+ *  before, anything else in batch mode.  Returns the tool's exit status. */
+int batch_main(batch_fn *fn, int argc, char *argv[]);
+
+#endif
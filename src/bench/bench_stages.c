@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "synth.h"
+#include "../poketools.h"
+#include "../arena.h"
+#include "../columns.h"
+#include "../decode.h"
+#include "../mapfile.h"
+#include "../script_pp.h"
+#include "../formats/script.h"
+#include "../formats/varint.h"
+#include "../formats/zonedata.h"
+
+#define MIN_TIME 0.2 // Seconds each stage is repeated for, at least
+#define MAX_CODE 4096
+
+//-- Inputs ---------------------------------------------------------
+/** A set of files, parsed up front so each stage can be timed alone. */
+struct corpus {
+  const char *name;
+  int nfiles;
+  u8 **data;
+  size_t *size;
+  int *zone;
+  int nzones, ndebug;
+
+  int ncode;
+  struct code_block *code[MAX_CODE];
+  struct debug_block *debug[MAX_CODE]; // Per code section, or NULL
+
+  u64 ninstrs;         // Words of instructions, in all code sections
+  u64 nbytes;          // Bytes of all files
+};
+
+/** Parses the file at `data` into `c`. */
+void corpus_add(struct corpus *c, u8 *data, size_t size) {
+  c->data = realloc(c->data, sizeof(u8 *) * (c->nfiles + 1));
+  c->size = realloc(c->size, sizeof(size_t) * (c->nfiles + 1));
+  c->zone = realloc(c->zone, sizeof(int) * (c->nfiles + 1));
+  c->data[c->nfiles] = data;
+  c->size[c->nfiles] = size;
+  c->zone[c->nfiles] = 0;
+  c->nbytes += size;
+
+  struct code_block *code[2] = { NULL, NULL };
+  struct debug_block *debug = NULL;
+  struct zonedata *zone = parse_zonedata(data, size);
+  if (zone != NULL) {
+    c->zone[c->nfiles] = 1;
+    c->nzones++;
+    code[0] = zone->code1;
+    code[1] = zone->code2;
+  } else {
+    size_t nread = 0;
+    code[0] = parse_code_block(data, size, &nread);
+    if (code[0] != NULL && nread < size) debug = parse_debug_block(data + nread, size - nread, NULL);
+  }
+  c->ndebug += debug != NULL;
+  c->nfiles++;
+
+  for (int k = 0; k < 2; k++) {
+    if (code[k] == NULL || c->ncode == MAX_CODE) continue;
+    get_code_ir(code[k]);
+    get_code_columns(code[k]);
+    c->code[c->ncode] = code[k];
+    c->debug[c->ncode] = debug;
+    c->ncode++;
+    c->ninstrs += code[k]->ninstrs;
+  }
+}
+
+
+//-- Stages ---------------------------------------------------------
+struct arena bench_arena;
+FILE *devnull;
+
+void stage_varint(struct corpus *c) {
+  static u32 *out = NULL;
+  static size_t cap = 0;
+  for (int k = 0; k < c->ncode; k++) {
+    struct code_block *code = c->code[k];
+    size_t nwords = code->ninstrs + code->nmovement, n;
+    if (nwords + 1 > cap) out = realloc(out, sizeof(u32) * (cap = nwords + 1));
+    u8 *stream = (u8 *) code->header + code->header->header_size;
+    varint_decode(out, nwords, stream, code->header->section_size - code->header->header_size, &n);
+  }
+}
+
+void stage_parse(struct corpus *c) {
+  for (int i = 0; i < c->nfiles; i++) {
+    if (c->zone[i]) {
+      parse_zonedata(c->data[i], c->size[i]);
+    } else {
+      size_t nread = 0;
+      if (parse_code_block(c->data[i], c->size[i], &nread) != NULL && nread < c->size[i]) {
+        parse_debug_block(c->data[i] + nread, c->size[i] - nread, NULL);
+      }
+    }
+    arena_release(&bench_arena);
+  }
+}
+
+void stage_read_zonedata(struct corpus *c) {
+  for (int i = 0; i < c->nfiles; i++) {
+    if (!c->zone[i]) continue;
+    FILE *f = fmemopen(c->data[i], c->size[i], "rb");
+    read_zonedata(f);
+    fclose(f);
+    arena_release(&bench_arena);
+  }
+}
+
+void stage_scan(struct corpus *c) {
+  struct zone_layout l;
+  for (int i = 0; i < c->nfiles; i++) {
+    if (c->zone[i]) scan_zonedata(&l, c->data[i], c->size[i]);
+  }
+}
+
+void stage_decode(struct corpus *c) {
+  struct instr instr;
+  for (int k = 0; k < c->ncode; k++) {
+    struct code_block *code = c->code[k];
+    for (int i = 0; i < code->ninstrs; ) {
+      if ((code->instrs[i] & 0xFFFF) == 0x0082 && i + 1 >= code->ninstrs) break;
+      decode(&instr, &code->instrs[i]);
+      i += instr.nargs + 1;
+    }
+  }
+}
+
+void stage_ir(struct corpus *c) {
+  for (int k = 0; k < c->ncode; k++) {
+    build_code_ir(c->code[k]);
+    arena_release(&bench_arena);
+  }
+}
+
+void stage_columns(struct corpus *c) {
+  for (int k = 0; k < c->ncode; k++) {
+    build_code_columns(c->code[k]);
+    arena_release(&bench_arena);
+  }
+}
+
+/** Counts the `DSetGlobal $0010`s, by walking the IR and by the columns. */
+u64 filter_found;
+
+void stage_filter_ir(struct corpus *c) {
+  for (int k = 0; k < c->ncode; k++) {
+    struct code_ir *ir = c->code[k]->ir;
+    for (int j = 0; j < ir->ninstrs; j++) {
+      filter_found += ir->instrs[j].op == 0x00AF && ir->instrs[j].high_half == 0x0010;
+    }
+  }
+}
+
+void stage_filter_columns(struct corpus *c) {
+  struct column_filter f = { 0x00AF, 0x0010, -1 };
+  for (int k = 0; k < c->ncode; k++) filter_found += columns_count(c->code[k]->columns, &f);
+}
+
+void stage_labels(struct corpus *c) {
+  for (int k = 0; k < c->ncode; k++) {
+    struct code_block *code = c->code[k];
+    u32 *labels = arena_alloc(&bench_arena, sizeof(u32) * (code->ninstrs + code->nmovement + 1));
+    memset(labels, 0, sizeof(u32) * (code->ninstrs + code->nmovement + 1));
+    assign_labels(labels, code, code->ir);
+    arena_release(&bench_arena);
+  }
+}
+
+/** Looks up every function start and every global or local an instruction
+ *  refers to, the way the disassembler does. */
+void stage_lookup_sym(struct corpus *c) {
+  for (int k = 0; k < c->ncode; k++) {
+    struct debug_block *debug = c->debug[k];
+    struct code_ir *ir = c->code[k]->ir;
+    if (debug == NULL) continue;
+    for (int j = 0; j < ir->ninstrs; j++) {
+      struct ir_instr *instr = &ir->instrs[j];
+      u32 type = ref_type(instr->op);
+      if (instr->op == 0x002E) lookup_sym(debug, instr->pos * 4, 0x0009, 0);
+      else if (type != 0) lookup_sym(debug, instr->high_half, type, instr->pos * 4);
+    }
+  }
+}
+
+void stage_render(struct corpus *c) {
+  for (int k = 0; k < c->ncode; k++) {
+    disassemble(devnull, c->code[k], c->debug[k]);
+    arena_release(&bench_arena);
+  }
+  fflush(devnull);
+}
+
+
+//-- Running --------------------------------------------------------
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#define NEEDS_ZONES 1
+#define NEEDS_DEBUG 2
+
+struct stage {
+  const char *name;
+  void (*fn)(struct corpus *c);
+  int needs;
+};
+
+/** Times each stage over `c`: the best of as many runs as fit in
+ *  `MIN_TIME`, reported per instruction word and per input byte. */
+void run(struct corpus *c, struct stage *stages, int nstages) {
+  printf("%-10s %5d files, %8.2f MB, %9llu instruction words\n", c->name, c->nfiles,
+         c->nbytes / 1e6, (unsigned long long) c->ninstrs);
+  if (c->ninstrs == 0) return;
+
+  for (int k = 0; k < nstages; k++) {
+    if ((stages[k].needs & NEEDS_ZONES && c->nzones == 0)
+        || (stages[k].needs & NEEDS_DEBUG && c->ndebug == 0)) continue;
+
+    double best = 1e9, total = 0;
+    int reps = 0;
+    while (total < MIN_TIME || reps < 3) {
+      double t0 = now();
+      stages[k].fn(c);
+      double t = now() - t0;
+      if (t < best) best = t;
+      total += t;
+      reps++;
+    }
+    printf("  %-14s %9.2f ns/instr %10.1f MB/s\n", stages[k].name,
+           best / c->ninstrs * 1e9, c->nbytes / best / 1e6);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  struct synth_params params;
+  synth_defaults(&params);
+  params.nfunctions = 200;
+
+  // `-f <functions>` and `-b <body>` size the synthetic inputs; the rest
+  // are files to time as well
+  int k = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) params.nfunctions = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) params.body = atoi(argv[++i]);
+    else argv[k++] = argv[i];
+  }
+  argc = k;
+
+  struct stage stages[] = {
+    { "varint",        stage_varint,        0           },
+    { "parse",         stage_parse,         0           },
+    { "read_zonedata", stage_read_zonedata, NEEDS_ZONES },
+    { "scan",          stage_scan,          NEEDS_ZONES },
+    { "decode",        stage_decode,        0           },
+    { "ir",            stage_ir,            0           },
+    { "columns",       stage_columns,       0           },
+    { "filter_ir",     stage_filter_ir,     0           },
+    { "filter_cols",   stage_filter_columns, 0          },
+    { "labels",        stage_labels,        0           },
+    { "lookup_sym",    stage_lookup_sym,    NEEDS_DEBUG },
+    { "render",        stage_render,        0           },
+  };
+  int nstages = sizeof(stages) / sizeof(stages[0]);
+
+  devnull = fopen("/dev/null", "w");
+  size_t size;
+
+  // Inputs are parsed with malloc, so they outlive the stages' arena
+  struct corpus scripts = { "scripts" }, zones = { "zones" }, files = { "files" };
+  for (u32 seed = 1; seed <= 8; seed++) {
+    params.seed = seed;
+    u8 *data = synth_script(&params, &size);
+    corpus_add(&scripts, data, size);
+    data = synth_zone(&params, &size);
+    corpus_add(&zones, data, size);
+  }
+  for (int i = 1; i < argc; i++) {
+    struct mapped_file f;
+    if (map_file(&f, argv[i]) < 0) {
+      fprintf(stderr, "Couldn't open '%s' for reading.\n", argv[i]);
+      continue;
+    }
+    corpus_add(&files, f.data, f.size);
+  }
+
+  parse_arena = &bench_arena;
+  run(&scripts, stages, nstages);
+  run(&zones, stages, nstages);
+  if (files.nfiles > 0) run(&files, stages, nstages);
+
+  fclose(devnull);
+  return 0;
+}
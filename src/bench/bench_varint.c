@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../poketools.h"
+#include "../mapfile.h"
+#include "../formats/script.h"
+#include "../formats/varint.h"
+#include "../formats/zonedata.h"
+
+#define NVALUES (1 << 22)
+#define REPS    20
+
+//-- Streams --------------------------------------------------------
+struct stream {
+  const char *name;
+  u8 *bytes;
+  size_t nbytes;
+  size_t nvalues;
+};
+
+/** Appends the minimal encoding of `x` to `p`, returning the new end. */
+u8 *encode(u8 *p, u32 x) {
+  int n = 1;
+  while (n < 5 && !((i32) x >= -(1 << (7*n - 1)) && (i32) x < (1 << (7*n - 1)))) n++;
+  for (int k = n - 1; k >= 0; k--) {
+    *p++ = (x >> 7*k & 0x7F) | (k? 0x80 : 0);
+  }
+  return p;
+}
+
+u32 rng_state = 0x2545F491;
+u32 rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+/** Values with uniformly distributed encoded lengths (1..5 bytes). */
+u32 gen_uniform(void) {
+  int bits = 7 * (rng() % 5 + 1) - 1;
+  u32 x = rng() & ((bits >= 32? 0 : 1u << bits) - 1);
+  return rng() & 1? -x : x;
+}
+
+/** Values shaped like real instruction streams: mostly bare opcodes,
+ *  high-half opcodes with small immediates, and small jump offsets. */
+u32 gen_instr(void) {
+  u32 r = rng() % 100;
+  if (r < 40) return 0x20 + rng() % 0x20;               // Bare opcode
+  if (r < 70) return (rng() % 0x40) << 16 | 0xA3;       // High-half opcode
+  if (r < 90) return 4 * (rng() % 64);                  // Jump offset
+  return rng();                                         // Constant
+}
+
+/** All single-byte values. */
+u32 gen_single(void) {
+  return (u32) ((i32) (rng() << 25) >> 25);
+}
+
+struct stream make_stream(const char *name, u32 (*gen)(void)) {
+  struct stream s = { name, malloc(5 * NVALUES), 0, NVALUES };
+  u8 *p = s.bytes;
+  for (int i = 0; i < NVALUES; i++) p = encode(p, gen());
+  s.nbytes = p - s.bytes;
+  return s;
+}
+
+/** Concatenates the code streams of the given script/zone files. */
+struct stream load_stream(int nfiles, char **files) {
+  struct stream s = { "files", NULL, 0, 0 };
+  size_t cap = 0;
+
+  for (int i = 0; i < nfiles; i++) {
+    struct mapped_file f;
+    if (map_file(&f, files[i]) < 0) {
+      fprintf(stderr, "Couldn't open '%s' for reading.\n", files[i]);
+      continue;
+    }
+
+    // Zones have two code blocks, scripts start with one
+    struct code_block *blocks[2] = { NULL, NULL };
+    struct zonedata *zone = parse_zonedata(f.data, f.size);
+    if (zone != NULL) {
+      blocks[0] = zone->code1;
+      blocks[1] = zone->code2;
+    } else {
+      blocks[0] = parse_code_block(f.data, f.size, NULL);
+    }
+
+    for (int k = 0; k < 2; k++) {
+      struct code_block *code = blocks[k];
+      if (code == NULL) continue;
+      u32 nstream = code->header->section_size - code->header->header_size;
+      u8 *stream = (u8 *) code->header + code->header->header_size;
+      if (s.nbytes + nstream > cap) {
+        cap = 2 * (s.nbytes + nstream);
+        s.bytes = realloc(s.bytes, cap);
+      }
+      memcpy(s.bytes + s.nbytes, stream, nstream);
+      s.nbytes += nstream;
+    }
+  }
+
+  // Count the complete values in the stream
+  u32 *tmp = malloc(s.nbytes * sizeof(u32) + 1);
+  s.nbytes = varint_decode_scalar(tmp, s.nbytes, s.bytes, s.nbytes, &s.nvalues);
+  free(tmp);
+
+  return s;
+}
+
+
+//-- Kernels --------------------------------------------------------
+/** The byte-at-a-time loop `read_code_block` uses, as a reference. */
+size_t decode_reference(u32 *out, size_t nout, const u8 *in, size_t nin,
+                        size_t *ndecoded) {
+  u32 i = 0, j = 0, x = 0;
+  size_t k = 0, done = 0;
+  while (i < nout && k < nin) {
+    int byte = in[k++],
+        v = byte & 0x7F,
+        final = (byte & 0x80) == 0;
+    if (++j == 1) x = SEXT(v, 6);
+    else x = x << 7 | v;
+    if (final) {
+      out[i++] = x;
+      j = 0;
+      done = k;
+    }
+  }
+  *ndecoded = i;
+  return done;
+}
+
+struct kernel {
+  const char *name;
+  varint_decoder *fn;
+  int (*supported)(void);
+};
+
+int always(void) { return 1; }
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void run(struct stream *s, struct kernel *kernels, int nkernels) {
+  u32 *expect = malloc(s->nvalues * sizeof(u32) + 1),
+      *got    = malloc(s->nvalues * sizeof(u32) + 1);
+  size_t n;
+  decode_reference(expect, s->nvalues, s->bytes, s->nbytes, &n);
+
+  printf("%-8s %8.2f MB, %9zu values\n", s->name, s->nbytes / 1e6, s->nvalues);
+
+  for (int k = 0; k < nkernels; k++) {
+    struct kernel *kern = &kernels[k];
+    if (!kern->supported()) continue;
+
+    // Verify output first
+    memset(got, 0, s->nvalues * sizeof(u32));
+    kern->fn(got, s->nvalues, s->bytes, s->nbytes, &n);
+    int ok = n == s->nvalues && memcmp(got, expect, n * sizeof(u32)) == 0;
+
+    double best = 1e9;
+    for (int r = 0; r < REPS; r++) {
+      double t0 = now();
+      kern->fn(got, s->nvalues, s->bytes, s->nbytes, &n);
+      double t = now() - t0;
+      if (t < best) best = t;
+    }
+
+    printf("  %-10s %9.1f MB/s %9.1f Mvalues/s  %s\n", kern->name,
+           s->nbytes / best / 1e6, s->nvalues / best / 1e6,
+           ok? "ok" : "\x1B[31mMISMATCH\x1B[m");
+  }
+
+  free(expect);
+  free(got);
+}
+
+int main(int argc, char *argv[]) {
+  struct kernel kernels[] = {
+    { "reference", decode_reference,     always           },
+    { "scalar",    varint_decode_scalar, always           },
+    { "sse2",      varint_decode_sse2,   varint_have_sse2 },
+    { "avx2",      varint_decode_avx2,   varint_have_avx2 },
+    { "dispatch",  varint_decode,        always           },
+  };
+  int nkernels = sizeof(kernels) / sizeof(kernels[0]);
+
+  struct stream streams[] = {
+    make_stream("uniform", gen_uniform),
+    make_stream("instr",   gen_instr),
+    make_stream("single",  gen_single),
+  };
+
+  for (int i = 0; i < sizeof(streams) / sizeof(streams[0]); i++) {
+    run(&streams[i], kernels, nkernels);
+  }
+
+  if (argc > 1) {
+    struct stream s = load_stream(argc - 1, argv + 1);
+    run(&s, kernels, nkernels);
+  }
+
+  return 0;
+}
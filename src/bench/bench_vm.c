@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../poketools.h"
+#include "../decode.h"
+#include "../mapfile.h"
+#include "../vm.h"
+#include "../formats/script.h"
+#include "../formats/zonedata.h"
+
+#define ITERATIONS 2000000
+#define REPS       5
+
+//-- Programs -------------------------------------------------------
+struct program {
+  const char *name;
+  u32 words[64];
+  int n;
+};
+
+void emit(struct program *p, u32 w) {
+  p->words[p->n++] = w;
+}
+
+/** The operand of a jump at `pos` to `target`. */
+u32 jump_to(int pos, int target) {
+  return (u32) (target - pos) * 4;
+}
+
+/** `local0 += 1` and loop back to `top` until it reaches `n`. */
+void emit_loop_tail(struct program *p, int top, u32 n) {
+  emit(p, 0x00A4);                   // DGetLocal 0
+  emit(p, 1 << 16 | 0x00BC);         // CPushConst2 1
+  emit(p, 0x004E);                   // Add?
+  emit(p, 0x00B1);                   // DSetLocal 0
+  emit(p, 0x00A4);                   // DGetLocal 0
+  emit(p, 0x0027); emit(p, n);       // CPushConst n
+  emit(p, 0x0051);                   // Cmp?
+  emit(p, 0x0035); emit(p, jump_to(p->n - 1, top)); // JumpNE top
+  emit(p, 0x0030);                   // Return
+}
+
+/** A counting loop: arithmetic, locals and a backward branch. */
+struct program make_loop(u32 n) {
+  struct program p = { "loop" };
+  emit(&p, 0x002E);                  // Begin
+  emit(&p, 0x00BC);                  // CPushConst2 0
+  emit(&p, 0x00B1);                  // DSetLocal 0
+  emit_loop_tail(&p, p.n, n);
+  return p;
+}
+
+/** A loop calling a small function on every iteration. */
+struct program make_call(u32 n) {
+  struct program p = { "call" };
+  emit(&p, 0x002E);
+  emit(&p, 0x00BC);
+  emit(&p, 0x00B1);
+  int top = p.n, call = p.n;
+  emit(&p, 0x0031); emit(&p, 0);     // Call leaf (patched below)
+  emit_loop_tail(&p, top, n);
+
+  int leaf = p.n;
+  p.words[call + 1] = jump_to(call, leaf);
+  emit(&p, 0x002E);                  // Begin
+  emit(&p, 7 << 16 | 0x00BC);        // CPushConst2 7
+  emit(&p, 1 << 16 | 0x00AF);        // DSetGlobal 1
+  emit(&p, 0x0030);                  // Return
+  return p;
+}
+
+/** A loop through a JumpMap, cycling through its four choices. */
+struct program make_jumpmap(u32 n) {
+  struct program p = { "jumpmap" };
+  emit(&p, 0x002E);
+  emit(&p, 0x00BC);
+  emit(&p, 0x00B1);
+  int top = p.n;
+  emit(&p, 1 << 16 | 0x00A3);        // DGetGlobal 1
+  int map = p.n;
+  emit(&p, 0x0082); emit(&p, 4);     // JumpMap, 4 choices
+  emit(&p, 0);                       // Fallback (patched below)
+  for (int c = 0; c < 4; c++) {
+    emit(&p, c);
+    emit(&p, 0);
+  }
+
+  // Each choice sets the global to the next one, then joins the tail
+  int tail = p.n + 4 * 4, idx;
+  for (int c = 0; c < 4; c++) {
+    idx = map + 4 + 2*c;
+    p.words[idx] = (u32) (p.n - idx + 1) * 4;
+    emit(&p, (u32) (c + 1) % 4 << 16 | 0x00BC); // CPushConst2 c + 1
+    emit(&p, 1 << 16 | 0x00AF);                 // DSetGlobal 1
+    emit(&p, 0x0033); emit(&p, jump_to(p.n - 1, tail)); // Jump tail
+  }
+  idx = map + 2;
+  p.words[idx] = (u32) (tail - idx + 1) * 4;
+  emit_loop_tail(&p, top, n);
+  return p;
+}
+
+
+//-- Running --------------------------------------------------------
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void report(const char *name, u64 steps, double t, const char *result) {
+  printf("  %-10s %12llu ops %9.1f Mops/s  %s\n", name, (unsigned long long) steps,
+         steps / t / 1e6, result);
+}
+
+void run_program(struct program *p) {
+  struct code_block code = { 0 };
+  code.instrs = p->words;
+  code.ninstrs = p->n;
+
+  struct vm *vm = malloc(sizeof(struct vm));
+  vm_init(vm, &code);
+
+  double best = 1e9;
+  enum vm_status status = VM_DONE;
+  for (int r = 0; r < REPS; r++) {
+    vm->steps = 0;
+    vm_call(vm, 0);
+    double t0 = now();
+    status = vm_run(vm, 0);
+    double t = now() - t0;
+    if (t < best) best = t;
+  }
+
+  report(p->name, vm->steps, best, status == VM_DONE? "ok" : vm->error);
+  vm_free(vm);
+  free(vm);
+  free_code_ir(code.ir);
+}
+
+/** Runs every function of the given script/zone files, each for up to
+ *  `max_steps` operations. */
+void run_files(int nfiles, char **files, u64 max_steps) {
+  u64 steps = 0;
+  double t = 0;
+  int runs = 0, errors = 0;
+
+  for (int i = 0; i < nfiles; i++) {
+    struct mapped_file f;
+    if (map_file(&f, files[i]) < 0) {
+      fprintf(stderr, "Couldn't open '%s' for reading.\n", files[i]);
+      continue;
+    }
+
+    // Zones have two code blocks, scripts start with one
+    struct code_block *blocks[2] = { NULL, NULL };
+    struct zonedata *zone = parse_zonedata(f.data, f.size);
+    if (zone != NULL) {
+      blocks[0] = zone->code1;
+      blocks[1] = zone->code2;
+    } else {
+      blocks[0] = parse_code_block(f.data, f.size, NULL);
+    }
+
+    for (int k = 0; k < 2; k++) {
+      struct code_block *code = blocks[k];
+      if (code == NULL) continue;
+      struct vm *vm = malloc(sizeof(struct vm));
+      vm_init(vm, code);
+
+      struct code_ir *ir = get_code_ir(code);
+      for (int j = 0; j < ir->ninstrs; j++) {
+        if (ir->instrs[j].op != 0x002E) continue;
+        vm->steps = 0;
+        vm_call(vm, ir->instrs[j].pos * 4);
+        double t0 = now();
+        errors += vm_run(vm, max_steps) == VM_ERROR;
+        t += now() - t0;
+        steps += vm->steps;
+        runs++;
+      }
+
+      vm_free(vm);
+      free(vm);
+    }
+  }
+
+  char result[64];
+  sprintf(result, "%d functions, %d errors", runs, errors);
+  report("files", steps, t, result);
+}
+
+int main(int argc, char *argv[]) {
+  struct program programs[] = {
+    make_loop(ITERATIONS),
+    make_call(ITERATIONS),
+    make_jumpmap(ITERATIONS),
+  };
+
+  printf("synthetic\n");
+  for (int i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+    run_program(&programs[i]);
+  }
+
+  if (argc > 1) {
+    printf("files\n");
+    run_files(argc - 1, argv + 1, 100000);
+  }
+
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "synth.h"
+
+/** Writes the `n` bytes at `p` to `path`.  Returns 0 on success. */
+int write_synth(const char *path, const u8 *p, size_t n) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    fprintf(stderr, "Couldn't open '%s' for writing.\n", path);
+    return -1;
+  }
+  size_t written = fwrite(p, 1, n, f);
+  if (fclose(f) != 0 || written != n) {
+    fprintf(stderr, "Couldn't write '%s'.\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  struct synth_params params;
+  synth_defaults(&params);
+  int count = 10;
+  const char *dir = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) count = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) params.seed = strtoul(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) params.nfunctions = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) params.body = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) params.nglobals = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--no-debug") == 0) params.debug = 0;
+    else if (dir == NULL && argv[i][0] != '-') dir = argv[i];
+    else dir = NULL, i = argc;
+  }
+
+  if (dir == NULL) {
+    fprintf(stderr, "usage: %s [-n <count>] [-s <seed>] [-f <functions>] [-b <body>] [-g <globals>] [--no-debug] <dir>\n"
+                    "Writes <count> scripts to <dir>/scripts and as many zones to <dir>/zones.\n", argv[0]);
+    return 1;
+  }
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s", dir);
+  mkdir(path, 0777);
+  snprintf(path, sizeof(path), "%s/scripts", dir);
+  mkdir(path, 0777);
+  snprintf(path, sizeof(path), "%s/zones", dir);
+  mkdir(path, 0777);
+
+  // File k is made from seed `seed + k`, so any one can be regenerated alone
+  u32 seed = params.seed;
+  for (int k = 0; k < count; k++) {
+    size_t size;
+    params.seed = seed + k;
+
+    u8 *data = synth_script(&params, &size);
+    snprintf(path, sizeof(path), "%s/scripts/s%04d.bin", dir, k);
+    int failed = write_synth(path, data, size);
+    free(data);
+
+    data = synth_zone(&params, &size);
+    snprintf(path, sizeof(path), "%s/zones/z%04d.bin", dir, k);
+    failed |= write_synth(path, data, size);
+    free(data);
+
+    if (failed) return 2;
+  }
+  return 0;
+}
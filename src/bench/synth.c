@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "synth.h"
+#include "../formats/script.h"
+#include "../formats/zonedata.h"
+
+//-- Buffers --------------------------------------------------------
+struct synth_words {
+  u32 *v;
+  int n, cap;
+};
+
+struct synth_bytes {
+  u8 *p;
+  size_t n, cap;
+};
+
+void synth_word(struct synth_words *w, u32 x) {
+  if (w->n == w->cap) {
+    w->cap = w->cap? 2 * w->cap : 256;
+    w->v = realloc(w->v, sizeof(u32) * w->cap);
+  }
+  w->v[w->n++] = x;
+}
+
+void synth_put(struct synth_bytes *b, const void *p, size_t n) {
+  if (b->n + n > b->cap) {
+    b->cap = 2 * (b->n + n) + 256;
+    b->p = realloc(b->p, b->cap);
+  }
+  memcpy(b->p + b->n, p, n);
+  b->n += n;
+}
+
+void synth_str(struct synth_bytes *b, const char *s) {
+  synth_put(b, s, strlen(s) + 1);
+}
+
+/** xorshift32; never returns 0 for a nonzero state. */
+u32 synth_rng(u32 *s) {
+  *s ^= *s << 13;
+  *s ^= *s >> 17;
+  *s ^= *s << 5;
+  return *s;
+}
+
+/** A random number in [lo, hi]. */
+int synth_range(u32 *s, int lo, int hi) {
+  return lo + (int) (synth_rng(s) % (u32) (hi - lo + 1));
+}
+
+void synth_defaults(struct synth_params *p) {
+  *p = (struct synth_params) {
+    .seed       = 1,
+    .nfunctions = 40,
+    .body       = 40,
+    .nmovement  = 6,
+    .nglobals   = 30,
+    .debug      = 1,
+  };
+}
+
+
+//-- Code -----------------------------------------------------------
+/** Generated instructions, and where each function lies. */
+struct synth_code {
+  struct synth_words ins;
+  int nfunctions;
+  int *starts, *ends;  // Word ranges
+};
+
+/** An operand to point at an instruction once they're all placed. */
+struct synth_fixup {
+  int idx;             // Operand word
+  int base;            // Word the offset is relative to
+};
+
+const u16 synth_simple[] = { 0x09, 0x0C, 0x17, 0x20, 0x22, 0x24, 0x2B, 0x4E, 0x51, 0x59, 0xD2 };
+const u16 synth_global[] = { 0xA2, 0xA3, 0xAF, 0xBD };
+const u16 synth_local[]  = { 0xA4, 0xB1, 0xBE };
+const u16 synth_const[]  = { 0xAB, 0xAC, 0xB8, 0xB9, 0xBC, 0xC5, 0xC6, 0xC9 };
+const u16 synth_one[]    = { 0x0B, 0x0E, 0x27, 0x69, 0x75, 0x77, 0x78 };
+const u16 synth_jumps[]  = { 0x33, 0x35, 0x36, 0x37, 0x38, 0x3D, 0x3E, 0x40, 0x81 };
+
+#define PICK(s, a) ((a)[synth_rng(s) % (sizeof(a) / sizeof((a)[0]))])
+
+void synth_gen_code(struct synth_code *c, const struct synth_params *p, u32 *s) {
+  struct synth_words *w = &c->ins;
+  int nglobals = p->nglobals > 0? p->nglobals : 1;
+
+  c->nfunctions = p->nfunctions > 0? p->nfunctions : 1;
+  c->starts = malloc(sizeof(int) * c->nfunctions);
+  c->ends   = malloc(sizeof(int) * c->nfunctions);
+
+  int nfix = 0, capfix = 64, nlabels = 0, caplabels = 64;
+  struct synth_fixup *fix = malloc(sizeof(struct synth_fixup) * capfix),
+                     *calls = NULL;
+  int ncalls = 0, capcalls = 0;
+  int *labels = malloc(sizeof(int) * caplabels);
+
+  for (int f = 0; f < c->nfunctions; f++) {
+    c->starts[f] = w->n;
+    synth_word(w, 0x002E);                       // Begin
+    nfix = nlabels = 0;
+
+    int body = synth_range(s, p->body / 2, p->body * 3 / 2);
+    for (int k = 0; k <= body; k++) {
+      int i = w->n, r = synth_range(s, 0, 99);
+      if (nlabels == caplabels) labels = realloc(labels, sizeof(int) * (caplabels *= 2));
+      labels[nlabels++] = i;
+      if (nfix + 8 > capfix) fix = realloc(fix, sizeof(struct synth_fixup) * (capfix *= 2));
+
+      if (k == body) {
+        synth_word(w, 0x0030);                   // Return
+      } else if (r < 12) {
+        synth_word(w, synth_range(s, 0, nglobals - 1) << 16 | PICK(s, synth_global));
+      } else if (r < 22) {
+        synth_word(w, 4 * synth_range(s, 0, 3) << 16 | PICK(s, synth_local));
+      } else if (r < 34) {
+        synth_word(w, synth_range(s, 0, 40) << 16 | PICK(s, synth_const));
+      } else if (r < 37) {
+        synth_word(w, (u32) (4 * synth_range(s, -4, 4)) << 16 | 0x00BF);  // CAdjustStack
+      } else if (r < 50) {
+        synth_word(w, PICK(s, synth_simple));
+      } else if (r < 55) {
+        synth_word(w, 0x0089);                   // LineNo
+      } else if (r < 63) {
+        synth_word(w, PICK(s, synth_one));
+        synth_word(w, synth_rng(s) % 4 == 0? synth_rng(s) : 4 * synth_range(s, -8, 64));
+      } else if (r < 76) {
+        synth_word(w, PICK(s, synth_jumps));
+        fix[nfix++] = (struct synth_fixup) { w->n, i };
+        synth_word(w, 0);
+      } else if (r < 81) {
+        synth_word(w, 0x0031);                   // Call
+        if (ncalls == capcalls) {
+          capcalls = capcalls? 2 * capcalls : 64;
+          calls = realloc(calls, sizeof(struct synth_fixup) * capcalls);
+        }
+        calls[ncalls++] = (struct synth_fixup) { w->n, i };
+        synth_word(w, 0);
+      } else if (r < 85) {
+        int choices = synth_range(s, 0, 4);      // JumpMap
+        synth_word(w, 0x0082);
+        synth_word(w, choices);
+        fix[nfix++] = (struct synth_fixup) { w->n, w->n - 1 };
+        synth_word(w, 0);
+        for (int j = 0; j < choices; j++) {
+          synth_word(w, j + synth_range(s, 0, 2));
+          fix[nfix++] = (struct synth_fixup) { w->n, w->n - 1 };
+          synth_word(w, 0);
+        }
+      } else if (r < 91) {
+        synth_word(w, 0x0087);                   // DoCommand?
+        synth_word(w, synth_range(s, 0, 300));
+        synth_word(w, 4 * synth_range(s, 0, 4));
+      } else if (r < 95) {
+        static const int nargs[] = { 2, 3, 5 };
+        static const u16 ops[]   = { 0x8A, 0x8E, 0x96 };
+        int j = synth_range(s, 0, 2);
+        synth_word(w, ops[j]);
+        for (int a = 0; a < nargs[j]; a++) {
+          float x = synth_range(s, -10000, 10000) / 100.0f;
+          u32 bits;
+          memcpy(&bits, &x, sizeof(u32));
+          synth_word(w, bits);
+        }
+      } else {
+        synth_word(w, 0x009B);                   // Copy?
+        synth_word(w, (u32) (4 * synth_range(s, -4, 4)));
+        synth_word(w, (u32) (4 * synth_range(s, -4, 4)));
+      }
+    }
+    c->ends[f] = w->n;
+
+    // Branches land on instructions of the same function
+    for (int j = 0; j < nfix; j++) {
+      int target = labels[synth_rng(s) % nlabels];
+      w->v[fix[j].idx] = (u32) (target - fix[j].base) * 4;
+    }
+  }
+
+  for (int j = 0; j < ncalls; j++) {
+    int target = c->starts[synth_rng(s) % c->nfunctions];
+    w->v[calls[j].idx] = (u32) (target - calls[j].base) * 4;
+  }
+
+  free(fix);
+  free(calls);
+  free(labels);
+}
+
+/** Encodes the code section for `c`, appending it to `out`. */
+void synth_code_section(struct synth_bytes *out, struct synth_code *c,
+                        const struct synth_params *p, u32 *s) {
+  // The "extra" words: 7 offsets of empty blocks, a pad word and unk6
+  u32 extra[9] = { 0 };
+  for (int k = 0; k < 7; k++) extra[k] = 0x20 + 8 * sizeof(u32);
+  extra[8] = synth_range(s, 0, 0xFF);
+
+  struct synth_words movement = { 0 };
+  for (int k = 0; k < p->nmovement; k++) synth_word(&movement, synth_rng(s));
+
+  struct code_header hd = {
+    .magic = 0x0A0AF1E0,
+    .unk1  = synth_range(s, 0, 0xFFFF),
+    .unk2  = synth_range(s, 0, 0xFFFF),
+    .unk4  = synth_range(s, 0, 99),
+    .unk6  = synth_range(s, 0, 99),
+  };
+  struct code_block code = {
+    .header    = &hd,
+    .nextra    = 9,
+    .extra     = extra,
+    .ninstrs   = c->ins.n,
+    .instrs    = c->ins.v,
+    .nmovement = movement.n,
+    .movement  = movement.v,
+  };
+
+  size_t size = code_block_encoded_size(&code);
+  if (out->n + size > out->cap) {
+    out->cap = out->n + size;
+    out->p = realloc(out->p, out->cap);
+  }
+  out->n += encode_code_block(out->p + out->n, &code);
+  free(movement.v);
+}
+
+void synth_free_code(struct synth_code *c) {
+  free(c->ins.v);
+  free(c->starts);
+  free(c->ends);
+}
+
+
+//-- Debug ----------------------------------------------------------
+/** Appends a debug section for `c` to `out`: two files, a line number for
+ *  about every third word, and symbols for the globals, functions and
+ *  locals the code refers to. */
+void synth_debug_section(struct synth_bytes *out, struct synth_code *c,
+                         const struct synth_params *p, u32 *s) {
+  size_t start = out->n;
+  u32 n = c->ins.n;
+  char name[32];
+
+  struct debug_header hd = { .magic = 0x0A0AF1EF, .count_files = 2, .count_types = 3 };
+  synth_put(out, &hd, sizeof(hd));
+
+  // Files
+  u32 split = 4 * c->starts[c->nfunctions / 2];
+  synth_put(out, &(u32) { 0 }, sizeof(u32));
+  synth_str(out, "main.c");
+  synth_put(out, &split, sizeof(u32));
+  synth_str(out, "lib/other.c");
+
+  // Line numbers, in order
+  u32 line = 1;
+  for (u32 i = 0; i < n && hd.count_linenos < 0xFFFF; i += synth_range(s, 1, 5)) {
+    struct debug_lineno l = { 4 * i, line += synth_range(s, 0, 3) };
+    synth_put(out, &l, sizeof(l));
+    hd.count_linenos++;
+  }
+
+  // Symbols: globals, then each function and its locals
+  struct {
+    u32 id;
+    u16 unk1;
+    u32 start, end, type;
+  } __attribute__((packed)) sym;
+
+  for (int g = 0; g < p->nglobals && hd.count_symbols < 0xFFFF; g++) {
+    sym = (typeof(sym)) { g, 0, 0, 4 * n, 0x0001 };
+    synth_put(out, &sym, sizeof(sym));
+    sprintf(name, "g_var%d", g);
+    synth_str(out, name);
+    hd.count_symbols++;
+  }
+  for (int f = 0; f < c->nfunctions && hd.count_symbols < 0xFFFF - 4; f++) {
+    u32 fstart = 4 * c->starts[f], fend = 4 * c->ends[f];
+    sym = (typeof(sym)) { fstart, 0, fstart, fend, 0x0009 };
+    synth_put(out, &sym, sizeof(sym));
+    sprintf(name, "func_%d", f);
+    synth_str(out, name);
+    hd.count_symbols++;
+
+    for (int l = 0; l < 4; l++) {
+      sym = (typeof(sym)) { 4 * l, 0, fstart, fend, 0x0101 };
+      synth_put(out, &sym, sizeof(sym));
+      sprintf(name, "loc%d_%d", f, l);
+      synth_str(out, name);
+      hd.count_symbols++;
+    }
+  }
+
+  // Types
+  static const char *types[] = { "int", "float", "bool" };
+  for (u16 t = 0; t < 3; t++) {
+    u16 id = t + 1;
+    synth_put(out, &id, sizeof(u16));
+    synth_str(out, types[t]);
+  }
+
+  synth_put(out, (u8[7]) { 0 }, 7);
+
+  hd.section_size = out->n - start;
+  memcpy(out->p + start, &hd, sizeof(hd));
+}
+
+
+//-- Files ----------------------------------------------------------
+u8 *synth_script(const struct synth_params *p, size_t *size) {
+  u32 s = p->seed? p->seed : 1;
+  struct synth_bytes out = { 0 };
+  struct synth_code c = { 0 };
+
+  synth_gen_code(&c, p, &s);
+  synth_code_section(&out, &c, p, &s);
+  if (p->debug) synth_debug_section(&out, &c, p, &s);
+  synth_free_code(&c);
+
+  *size = out.n;
+  return out.p;
+}
+
+u8 *synth_zone(const struct synth_params *p, size_t *size) {
+  u32 s = p->seed? p->seed : 1;
+  struct synth_bytes out = { 0 };
+
+  struct zone_header hd = {
+    .magic = 0x00044F5A,
+    .unk1  = synth_range(&s, 0, 9),
+    .unk2  = synth_range(&s, 0, 9),
+  };
+  for (int k = 0; k < 0x1C; k++) hd.unk3[k] = synth_rng(&s);
+  synth_put(&out, &hd, sizeof(hd));
+
+  // unk1 tables of random words
+  static const int widths[5] = { 10, 24, 12, 12, 12 };
+  u8 counts[5];
+  size_t nwords = 0;
+  for (int k = 0; k < 5; k++) {
+    counts[k] = synth_range(&s, 0, 6);
+    nwords += counts[k] * widths[k];
+  }
+  struct zone_unk1_header unk1 = {
+    .size = sizeof(struct zone_unk1_header) - sizeof(u32) + nwords * sizeof(u16),
+    .num_unk1 = counts[0], .num_unk2 = counts[1], .num_unk3 = counts[2],
+    .num_unk4 = counts[3], .num_unk5 = counts[4],
+  };
+  synth_put(&out, &unk1, sizeof(unk1));
+  for (size_t k = 0; k < nwords; k++) synth_put(&out, &(u16) { synth_rng(&s) }, sizeof(u16));
+
+  // Two code sections, the second word-aligned
+  for (int k = 0; k < 2; k++) {
+    struct synth_code c = { 0 };
+    if (k == 1) {
+      while (out.n % 4 != 0) synth_put(&out, (u8[1]) { 0 }, 1);
+      hd.code2_offset = out.n;
+    }
+    synth_gen_code(&c, p, &s);
+    synth_code_section(&out, &c, p, &s);
+    synth_free_code(&c);
+  }
+
+  hd.file_size = hd.file_size2 = out.n;
+  memcpy(out.p, &hd, sizeof(hd));
+
+  *size = out.n;
+  return out.p;
+}
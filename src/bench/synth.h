@@ -0,0 +1,35 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stddef.h>
+
+#include "../poketools.h"
+
+/** Synthetic scripts and zones for benchmarking: valid code sections (made
+ *  of known opcodes, with every branch landing on an instruction), debug
+ *  sections naming their functions, globals and locals, and zone files
+ *  wrapping two code sections.  The same parameters always give the same
+ *  bytes. */
+
+struct synth_params {
+  u32 seed;
+  int nfunctions;      // Per code section
+  int body;            // Average instructions per function
+  int nmovement;       // Movement words after the instructions
+  int nglobals;        // Global symbols in the debug section
+  int debug;           // Whether scripts get a debug section
+};
+
+/** Fills in `p` with defaults: a few dozen functions of a few dozen
+ *  instructions each, with debug sections. */
+void synth_defaults(struct synth_params *p);
+
+/** Generates a script: a code section followed by a debug section (if
+ *  `p->debug`).  Returns a newly-allocated buffer of `*size` bytes. */
+u8 *synth_script(const struct synth_params *p, size_t *size);
+
+/** Generates a zone file with two code sections.  Returns a newly-allocated
+ *  buffer of `*size` bytes. */
+u8 *synth_zone(const struct synth_params *p, size_t *size);
+
+#endif
@@ -0,0 +1,582 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "arena.h"
+
+#define CACHE_MAGIC   0x31434B50 // "PKC1"
+#define CACHE_VERSION 1
+
+const char *cache_dir = NULL;
+u64 cache_limit = 256 << 20;
+
+//-- Entry format ---------------------------------------------------
+// An entry is a header followed by chunks, each a `cache_chunk` and its
+// data, padded to 8 bytes.  Everything is in native byte order; entries
+// aren't meant to be shared between machines.
+struct cache_file_header {
+  u32 magic;
+  u32 version;
+  u64 hash[2];
+  u64 source_size;
+  u32 nchunks;
+  u32 pad;
+};
+
+enum { CHUNK_CODE = 1, CHUNK_DEBUG = 2 };
+
+struct cache_chunk {
+  u32 type;
+  u32 pad;
+  u64 offset;                  // Of the section in the input
+  u64 nread;                   // Bytes the section takes up
+  u64 size;                    // Of the data that follows
+};
+
+// A code chunk's data is just the decoded words.  A debug chunk's is a
+// `cache_debug`, followed by its tables: files, symbols, sorted symbols,
+// types, then the index's `by_key`, `max_end` and (8-aligned) slots.  Names
+// are byte offsets into the input.
+struct cache_debug {
+  u32 nfiles, nlinenos, nsymbols, ntypes, nslots, pad;
+  u64 linenos;                 // Offset of the (in-place) line numbers
+};
+
+struct cache_named {
+  u32 value;                   // File start, or type ID
+  u32 name;
+};
+
+struct cache_symbol {
+  u32 id;
+  u16 unk1, pad;
+  u32 start, end, type;
+  u32 name;
+};
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t) 7)
+
+/** Size of a debug chunk's data. */
+size_t debug_chunk_size(const struct cache_debug *cd) {
+  return ALIGN8(sizeof(struct cache_debug)
+                + sizeof(struct cache_named)  * (cd->nfiles + cd->ntypes)
+                + sizeof(struct cache_symbol) * cd->nsymbols * 2
+                + sizeof(u32)                 * cd->nsymbols * 2)
+       + sizeof(struct debug_index_slot) * cd->nslots;
+}
+
+
+//-- Hashing --------------------------------------------------------
+static inline u64 rotl64(u64 x, int r) {
+  return x << r | x >> (64 - r);
+}
+
+static inline u64 fmix64(u64 k) {
+  k ^= k >> 33;
+  k *= 0xFF51AFD7ED558CCDULL;
+  k ^= k >> 33;
+  k *= 0xC4CEB9FE1A85EC53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+/** Hashes the `n` bytes at `p` into 128 bits (two lanes, MurmurHash3-style,
+ *  16 bytes at a time). */
+void content_hash(const u8 *p, size_t n, u64 h[2]) {
+  const u64 c1 = 0x87C37B91114253D5ULL,
+            c2 = 0x4CF5AD432745937FULL;
+  u64 a = 0x9E3779B97F4A7C15ULL,
+      b = 0xC2B2AE3D27D4EB4FULL;
+
+  for (size_t i = 0; i < n; i += 16) {
+    u64 x[2] = { 0, 0 };
+    memcpy(x, p + i, n - i >= 16? 16 : n - i);
+
+    a ^= rotl64(x[0] * c1, 31) * c2;
+    a = (rotl64(a, 27) + b) * 5 + 0x52DCE729;
+    b ^= rotl64(x[1] * c2, 33) * c1;
+    b = (rotl64(b, 31) + a) * 5 + 0x38495AB5;
+  }
+
+  a ^= n;
+  b ^= n;
+  a += b;
+  b += a;
+  a = fmix64(a);
+  b = fmix64(b);
+  h[0] = a + b;
+  h[1] = b + h[0];
+}
+
+
+//-- Command line ---------------------------------------------------
+int cache_parse_args(int argc, char *argv[]) {
+  if (getenv("POKETOOLS_CACHE") != NULL && *getenv("POKETOOLS_CACHE")) {
+    cache_dir = getenv("POKETOOLS_CACHE");
+  }
+
+  int k = 1;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i], *val;
+
+    #define OPTION(name) \
+      (strncmp(arg, name, strlen(name)) == 0 \
+       && (arg[strlen(name)] == '=' || arg[strlen(name)] == 0) \
+       && (val = arg[strlen(name)] == '='? &arg[strlen(name) + 1] \
+               : i + 1 < argc? argv[++i] : NULL) != NULL)
+
+    if (strcmp(arg, "--no-cache") == 0) {
+      cache_dir = NULL;
+    } else if (OPTION("--cache-size")) {
+      char *end;
+      double mib = strtod(val, &end);
+      if (*end || mib < 0) {
+        fprintf(stderr, "Bad cache size '%s' (in MiB).\n", val);
+        return -1;
+      }
+      cache_limit = mib * (1 << 20);
+    } else if (OPTION("--cache")) {
+      cache_dir = val;
+    } else {
+      argv[k++] = argv[i];
+    }
+
+    #undef OPTION
+  }
+  argv[k] = NULL;
+  return k;
+}
+
+
+//-- Entries --------------------------------------------------------
+/** Checks that the mapped entry is complete, and is for our input. */
+int entry_valid(struct cache_entry *e) {
+  if (e->map.size < sizeof(struct cache_file_header)) return 0;
+  struct cache_file_header *hd = (struct cache_file_header *) e->map.data;
+  if (hd->magic != CACHE_MAGIC || hd->version != CACHE_VERSION) return 0;
+  if (hd->hash[0] != e->hash[0] || hd->hash[1] != e->hash[1]) return 0;
+  if (hd->source_size != e->source_size) return 0;
+
+  // Walk the chunks, to make sure they're all there
+  size_t pos = sizeof(struct cache_file_header);
+  for (u32 i = 0; i < hd->nchunks; i++) {
+    if (e->map.size - pos < sizeof(struct cache_chunk)) return 0;
+    struct cache_chunk *chunk = (struct cache_chunk *) (e->map.data + pos);
+    pos += sizeof(struct cache_chunk);
+    if (e->map.size - pos < chunk->size) return 0;
+    if (chunk->offset > e->source_size || chunk->nread > e->source_size - chunk->offset) return 0;
+    pos += ALIGN8(chunk->size);
+  }
+
+  return 1;
+}
+
+int cache_open(struct cache_entry *e, u8 *source, size_t size) {
+  *e = (struct cache_entry) { .source = source, .source_size = size };
+  if (cache_dir == NULL) return 0;
+
+  content_hash(source, size, e->hash);
+  e->path = malloc(strlen(cache_dir) + 34);
+  sprintf(e->path, "%s/%016llx%016llx", cache_dir,
+          (unsigned long long) e->hash[0], (unsigned long long) e->hash[1]);
+
+  if (map_file(&e->map, e->path) == 0) {
+    if (entry_valid(e)) {
+      utimensat(AT_FDCWD, e->path, NULL, 0); // Mark as recently used
+      e->hit = 1;
+      return 1;
+    }
+    unmap_file(&e->map);
+  }
+
+  // Start building a new entry
+  e->cap = 1 << 16;
+  e->buf = malloc(e->cap);
+  e->len = sizeof(struct cache_file_header);
+  return 0;
+}
+
+/** Finds the chunk of `type` for the section at `offset`, or NULL. */
+struct cache_chunk *find_chunk(struct cache_entry *e, u32 type, size_t offset) {
+  if (!e->hit) return NULL;
+
+  struct cache_file_header *hd = (struct cache_file_header *) e->map.data;
+  size_t pos = sizeof(struct cache_file_header);
+  for (u32 i = 0; i < hd->nchunks; i++) {
+    struct cache_chunk *chunk = (struct cache_chunk *) (e->map.data + pos);
+    if (chunk->type == type && (offset == (size_t) -1 || chunk->offset == offset)) {
+      return chunk;
+    }
+    pos += sizeof(struct cache_chunk) + ALIGN8(chunk->size);
+  }
+  return NULL;
+}
+
+
+//-- Hits -----------------------------------------------------------
+/** Fills in `dec` from the code chunk `chunk`. */
+struct code_decoded *chunk_decoded(struct cache_chunk *chunk,
+                                   struct code_decoded *dec) {
+  *dec = (struct code_decoded) {
+    .offset = chunk->offset,
+    .nread  = chunk->nread,
+    .nwords = chunk->size / sizeof(u32),
+    .words  = (u32 *) (chunk + 1),
+  };
+  return dec;
+}
+
+struct code_decoded *cache_code(struct cache_entry *e, size_t offset,
+                                struct code_decoded *dec) {
+  struct cache_chunk *chunk = find_chunk(e, CHUNK_CODE, offset);
+  return chunk != NULL? chunk_decoded(chunk, dec) : NULL;
+}
+
+int cache_codes(struct cache_entry *e, struct code_decoded *dec, int max) {
+  if (!e->hit) return 0;
+
+  struct cache_file_header *hd = (struct cache_file_header *) e->map.data;
+  size_t pos = sizeof(struct cache_file_header);
+  int n = 0;
+  for (u32 i = 0; i < hd->nchunks && n < max; i++) {
+    struct cache_chunk *chunk = (struct cache_chunk *) (e->map.data + pos);
+    if (chunk->type == CHUNK_CODE) chunk_decoded(chunk, &dec[n++]);
+    pos += sizeof(struct cache_chunk) + ALIGN8(chunk->size);
+  }
+  return n;
+}
+
+struct debug_block *cache_debug_block(struct cache_entry *e, size_t offset) {
+  struct cache_chunk *chunk = find_chunk(e, CHUNK_DEBUG, offset);
+  if (chunk == NULL) return NULL;
+
+  u8 *src = e->source;
+  size_t n = e->source_size;
+
+  // Everything taken from the input must lie in the section, which ends in
+  // padding, so names can't run off its end
+  size_t start = offset, end = offset + chunk->nread;
+  if (chunk->nread < sizeof(struct debug_header) || src[end - 1] != 0) return NULL;
+
+  struct cache_debug *cd = (struct cache_debug *) (chunk + 1);
+  if (chunk->size < sizeof(struct cache_debug) || chunk->size < debug_chunk_size(cd)) return NULL;
+  if (cd->nslots == 0 || (cd->nslots & (cd->nslots - 1)) != 0) return NULL;
+  if (cd->nlinenos > 0 && (cd->linenos < start || cd->linenos > end
+                           || (end - cd->linenos) / sizeof(struct debug_lineno) < cd->nlinenos)) {
+    return NULL;
+  }
+
+  struct cache_named  *files   = (struct cache_named *) (cd + 1);
+  struct cache_symbol *symbols = (struct cache_symbol *) (files + cd->nfiles),
+                      *sorted  = symbols + cd->nsymbols;
+  struct cache_named  *types   = (struct cache_named *) (sorted + cd->nsymbols);
+  int *by_key  = (int *) (types + cd->ntypes);
+  u32 *max_end = (u32 *) (by_key + cd->nsymbols);
+  struct debug_index_slot *slots =
+    (struct debug_index_slot *) ((u8 *) cd + debug_chunk_size(cd)
+                                 - sizeof(struct debug_index_slot) * cd->nslots);
+
+  // The index is used as it is, so every symbol it refers to must exist,
+  // and lookups must find an empty slot to stop at
+  int empty = 0;
+  for (u32 i = 0; i < cd->nsymbols; i++) {
+    if ((u32) by_key[i] >= cd->nsymbols) return NULL;
+  }
+  for (u32 i = 0; i < cd->nslots; i++) {
+    if (slots[i].start < 0) empty = 1;
+    else if (slots[i].start >= slots[i].end || (u32) slots[i].end > cd->nsymbols) return NULL;
+  }
+  if (!empty) return NULL;
+
+  struct debug_block *res = palloc(sizeof(struct debug_block));
+  res->header = (struct debug_header *) (src + offset);
+  res->nfiles = cd->nfiles;
+  res->files = palloc(sizeof(struct debug_file) * cd->nfiles + 1);
+  res->nlinenos = cd->nlinenos;
+  res->linenos = (struct debug_lineno *) (src + cd->linenos);
+  res->nsymbols = cd->nsymbols;
+  res->symbols = palloc(sizeof(struct debug_symbol) * cd->nsymbols + 1);
+  res->ntypes = cd->ntypes;
+  res->types = palloc(sizeof(struct debug_type) * cd->ntypes + 1);
+  res->size = chunk->nread;
+  res->interned = 0;
+  res->addrs = NULL;
+
+  struct debug_index *index = palloc(sizeof(struct debug_index));
+  index->sorted = palloc(sizeof(struct debug_symbol) * cd->nsymbols + 1);
+  index->by_key = by_key;
+  index->max_end = max_end;
+  index->nslots = cd->nslots;
+  index->slots = slots;
+  res->index = index;
+
+  // Point the names back into the input
+  int ok = res->header->magic == 0x0A0AF1EF;
+  #define NAME(off) (ok &= (off) >= start && (off) < end, (char *) src + ((off) < n? (off) : 0))
+
+  for (int i = 0; i < cd->nfiles; i++) {
+    res->files[i] = (struct debug_file) { files[i].value, NAME(files[i].name) };
+  }
+  for (int i = 0; i < cd->nsymbols; i++) {
+    struct cache_symbol *s = &symbols[i], *t = &sorted[i];
+    res->symbols[i] = (struct debug_symbol) {
+                        s->id, s->unk1, s->start, s->end, s->type, NAME(s->name) };
+    index->sorted[i] = (struct debug_symbol) {
+                         t->id, t->unk1, t->start, t->end, t->type, NAME(t->name) };
+  }
+  for (int i = 0; i < cd->ntypes; i++) {
+    res->types[i] = (struct debug_type) { types[i].value, NAME(types[i].name) };
+  }
+
+  #undef NAME
+
+  if (!ok) {
+    pfree(res->files);
+    pfree(res->symbols);
+    pfree(res->types);
+    pfree(index->sorted);
+    pfree(index);
+    pfree(res);
+    return NULL;
+  }
+
+  return res;
+}
+
+
+//-- Misses ---------------------------------------------------------
+/** Appends a chunk with `size` bytes of (zeroed) data to the entry being
+ *  built, and returns its data. */
+void *add_chunk(struct cache_entry *e, u32 type, size_t offset, size_t nread,
+                size_t size) {
+  size_t need = sizeof(struct cache_chunk) + ALIGN8(size);
+  if (e->len + need > e->cap) {
+    while (e->len + need > e->cap) e->cap *= 2;
+    e->buf = realloc(e->buf, e->cap);
+  }
+
+  struct cache_chunk *chunk = (struct cache_chunk *) (e->buf + e->len);
+  *chunk = (struct cache_chunk) { type, 0, offset, nread, size };
+  memset(chunk + 1, 0, ALIGN8(size));
+  e->len += need;
+  e->nchunks++;
+  return chunk + 1;
+}
+
+/** Whether a new entry is being built. */
+int building(struct cache_entry *e) {
+  return e->path != NULL && !e->hit;
+}
+
+void cache_add_code(struct cache_entry *e, struct code_block *code) {
+  if (!building(e)) return;
+
+  size_t nwords = code->ninstrs + code->nmovement;
+  u32 *words = add_chunk(e, CHUNK_CODE, (u8 *) code->header - e->source,
+                         code->size, nwords * sizeof(u32));
+  memcpy(words, code->instrs, nwords * sizeof(u32));
+}
+
+void cache_add_debug(struct cache_entry *e, struct debug_block *debug) {
+  // Names are stored as offsets, so must all lie in the section (which is
+  // checked again on a hit): interned ones are in the pool instead
+  if (!building(e) || debug->index == NULL || debug->interned) return;
+
+  u8 *src = e->source;
+  #define OFFSET(ptr) ((u8 *) (ptr) - src)
+  if (e->source_size > 0xFFFFFFFF) return;
+  if ((u8 *) debug->header < src || OFFSET(debug->header) >= e->source_size
+      || debug->size > e->source_size - OFFSET(debug->header)) {
+    return;
+  }
+
+  u8 *start = (u8 *) debug->header, *end = start + debug->size;
+  #define IN_SECTION(ptr) ((u8 *) (ptr) >= start && (u8 *) (ptr) < end)
+  int ok = debug->nlinenos == 0 || IN_SECTION(debug->linenos);
+  for (int i = 0; i < debug->nfiles; i++) ok &= IN_SECTION(debug->files[i].name);
+  for (int i = 0; i < debug->nsymbols; i++) {
+    ok &= IN_SECTION(debug->symbols[i].name) && IN_SECTION(debug->index->sorted[i].name);
+  }
+  for (int i = 0; i < debug->ntypes; i++) ok &= IN_SECTION(debug->types[i].name);
+  #undef IN_SECTION
+  if (!ok) return;
+
+  struct cache_debug cd = {
+    .nfiles   = debug->nfiles,
+    .nlinenos = debug->nlinenos,
+    .nsymbols = debug->nsymbols,
+    .ntypes   = debug->ntypes,
+    .nslots   = debug->index->nslots,
+    .linenos  = debug->nlinenos > 0? OFFSET(debug->linenos) : 0,
+  };
+
+  size_t size = debug_chunk_size(&cd);
+  struct cache_debug *out = add_chunk(e, CHUNK_DEBUG, OFFSET(debug->header),
+                                      debug->size, size);
+  *out = cd;
+
+  struct cache_named  *files   = (struct cache_named *) (out + 1);
+  struct cache_symbol *symbols = (struct cache_symbol *) (files + cd.nfiles),
+                      *sorted  = symbols + cd.nsymbols;
+  struct cache_named  *types   = (struct cache_named *) (sorted + cd.nsymbols);
+  int *by_key  = (int *) (types + cd.ntypes);
+  u32 *max_end = (u32 *) (by_key + cd.nsymbols);
+  struct debug_index_slot *slots =
+    (struct debug_index_slot *) ((u8 *) out + size
+                                 - sizeof(struct debug_index_slot) * cd.nslots);
+
+  for (int i = 0; i < cd.nfiles; i++) {
+    files[i] = (struct cache_named) { debug->files[i].start, OFFSET(debug->files[i].name) };
+  }
+  for (int i = 0; i < cd.nsymbols; i++) {
+    struct debug_symbol *s = &debug->symbols[i], *t = &debug->index->sorted[i];
+    symbols[i] = (struct cache_symbol) { s->id, s->unk1, 0, s->start, s->end, s->type, OFFSET(s->name) };
+    sorted[i]  = (struct cache_symbol) { t->id, t->unk1, 0, t->start, t->end, t->type, OFFSET(t->name) };
+  }
+  for (int i = 0; i < cd.ntypes; i++) {
+    types[i] = (struct cache_named) { debug->types[i].id, OFFSET(debug->types[i].name) };
+  }
+  memcpy(by_key,  debug->index->by_key,  sizeof(int) * cd.nsymbols);
+  memcpy(max_end, debug->index->max_end, sizeof(u32) * cd.nsymbols);
+  memcpy(slots,   debug->index->slots,   sizeof(struct debug_index_slot) * cd.nslots);
+
+  #undef OFFSET
+}
+
+
+//-- Writing and eviction -------------------------------------------
+struct cache_file {
+  char *name;
+  u64 size;
+  struct timespec mtime;
+};
+
+int lru_comparator(const void *a_, const void *b_) {
+  const struct cache_file *a = a_, *b = b_;
+  if (a->mtime.tv_sec  != b->mtime.tv_sec)  return a->mtime.tv_sec  < b->mtime.tv_sec?  -1 : +1;
+  if (a->mtime.tv_nsec != b->mtime.tv_nsec) return a->mtime.tv_nsec < b->mtime.tv_nsec? -1 : +1;
+  return strcmp(a->name, b->name);
+}
+
+/** Whether `name` is that of a cache entry: 32 hex digits. */
+int is_entry_name(const char *name) {
+  int i = 0;
+  while (name[i] && strchr("0123456789abcdef", name[i])) i++;
+  return i == 32 && name[i] == 0;
+}
+
+/** Bytes taken up by the cache's entries, as of the last look at the
+ *  directory plus what was written since; UINT64_MAX before the first look.
+ *  The directory is only looked at again once this goes over the limit. */
+u64 cache_used = UINT64_MAX;
+pthread_mutex_t cache_used_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** If the cache is over its limit, evicts the least recently used entries
+ *  until it is down to 7/8 of it, so that the entries written next don't
+ *  each need another pass.  Returns the bytes its entries take up. */
+u64 cache_evict(void) {
+  DIR *d = opendir(cache_dir);
+  if (d == NULL) return 0;
+
+  struct cache_file *files = NULL;
+  int n = 0, cap = 0;
+  u64 total = 0;
+
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL) {
+    if (!is_entry_name(ent->d_name)) continue;
+
+    char *path = malloc(strlen(cache_dir) + strlen(ent->d_name) + 2);
+    sprintf(path, "%s/%s", cache_dir, ent->d_name);
+    struct stat st;
+    if (stat(path, &st) < 0) {
+      free(path);
+      continue;
+    }
+
+    if (n == cap) {
+      cap = cap? 2 * cap : 64;
+      files = realloc(files, sizeof(struct cache_file) * cap);
+    }
+    files[n++] = (struct cache_file) { path, st.st_size, st.st_mtim };
+    total += st.st_size;
+  }
+  closedir(d);
+
+  if (total > cache_limit) {
+    qsort(files, n, sizeof(struct cache_file), lru_comparator);
+    for (int i = 0; i < n && total > cache_limit - cache_limit / 8; i++) {
+      if (unlink(files[i].name) == 0 || errno == ENOENT) total -= files[i].size;
+    }
+  }
+
+  for (int i = 0; i < n; i++) free(files[i].name);
+  free(files);
+  return total;
+}
+
+/** Counts `size` more bytes written to the cache, evicting if that takes it
+ *  over its limit. */
+void cache_account(u64 size) {
+  pthread_mutex_lock(&cache_used_lock);
+  if (cache_used != UINT64_MAX) cache_used += size;
+  if (cache_used == UINT64_MAX || cache_used > cache_limit) cache_used = cache_evict();
+  pthread_mutex_unlock(&cache_used_lock);
+}
+
+/** Writes the entry being built out to its file.  Returns whether it was. */
+int write_entry(struct cache_entry *e) {
+  struct cache_file_header *hd = (struct cache_file_header *) e->buf;
+  *hd = (struct cache_file_header) {
+    .magic       = CACHE_MAGIC,
+    .version     = CACHE_VERSION,
+    .hash        = { e->hash[0], e->hash[1] },
+    .source_size = e->source_size,
+    .nchunks     = e->nchunks,
+  };
+
+  mkdir(cache_dir, 0777);
+
+  // Write to a temporary file first, so readers never see half an entry
+  char *tmp = malloc(strlen(cache_dir) + 16);
+  sprintf(tmp, "%s/.tmp-XXXXXX", cache_dir);
+  int fd = mkstemp(tmp);
+  if (fd < 0) {
+    free(tmp);
+    return 0;
+  }
+
+  int ok = 1;
+  for (size_t pos = 0; ok && pos < e->len; ) {
+    ssize_t k = write(fd, e->buf + pos, e->len - pos);
+    if (k < 0 && errno != EINTR) ok = 0;
+    if (k > 0) pos += k;
+  }
+  fchmod(fd, 0644);
+  close(fd);
+
+  if (ok && rename(tmp, e->path) < 0) ok = 0;
+  if (!ok) unlink(tmp);
+  free(tmp);
+  return ok;
+}
+
+void cache_close(struct cache_entry *e, int commit) {
+  if (e->hit) {
+    unmap_file(&e->map);
+  } else if (e->path != NULL && commit && e->nchunks > 0) {
+    if (write_entry(e)) cache_account(e->len);
+  }
+
+  free(e->buf);
+  free(e->path);
+  e->buf = NULL;
+  e->path = NULL;
+}
@@ -0,0 +1,78 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+#include "poketools.h"
+#include "mapfile.h"
+#include "formats/script.h"
+
+/** A persistent on-disk cache of decoded instructions and parsed debug
+ *  tables, keyed by a hash of the input file's contents.  Each input gets one
+ *  entry file, which is mapped on a hit: cached instructions are used in
+ *  place, and debug tables only need their names pointed back into the
+ *  input, so neither varint decoding nor string parsing happens again.
+ *
+ *  The cache is off unless a directory is given with `--cache <dir>` (or the
+ *  POKETOOLS_CACHE environment variable).  Once its entries add up to more
+ *  than the size limit, the least recently used ones are evicted, down to
+ *  7/8 of the limit. */
+
+/** The cache directory (NULL if caching is off), and its size limit. */
+extern const char *cache_dir;
+extern u64 cache_limit;
+
+/** Removes the cache options (`--cache <dir>`, `--cache-size <MiB>` and
+ *  `--no-cache`) from the command line, applying them.  Returns the new
+ *  `argc`, or -1 on a bad option. */
+int cache_parse_args(int argc, char *argv[]);
+
+/** The cache entry for one input file. */
+struct cache_entry {
+  u8 *source;                  // The input
+  size_t source_size;
+  u64 hash[2];
+  char *path;                  // Of the entry file; NULL if caching is off
+
+  struct mapped_file map;      // The entry, on a hit
+  int hit;
+
+  u8 *buf;                     // The entry being built, on a miss
+  size_t len, cap;
+  int nchunks;
+};
+
+/** Hashes the `n` bytes at `p` into the 128-bit key `h` entries go by. */
+void content_hash(const u8 *p, size_t n, u64 h[2]);
+
+/** Looks up the entry for the `size` bytes at `source`.  Returns 1 on a hit,
+ *  or 0 on a miss (or if caching is off). */
+int cache_open(struct cache_entry *e, u8 *source, size_t size);
+
+/** On a miss, writes the entry out (if `commit` is set), evicting old
+ *  entries if needed.  Anything taken from the entry must not be used
+ *  afterwards. */
+void cache_close(struct cache_entry *e, int commit);
+
+//-- Hits -----------------------------------------------------------
+/** Fills in `dec` with the cached instructions of the code section at
+ *  `offset`.  Returns `dec`, or NULL if they aren't cached. */
+struct code_decoded *cache_code(struct cache_entry *e, size_t offset,
+                                struct code_decoded *dec);
+
+/** Fills in up to `max` entries of `dec` with all the cached code sections,
+ *  in order.  Returns how many there were. */
+int cache_codes(struct cache_entry *e, struct code_decoded *dec, int max);
+
+/** Rebuilds the debug section at `offset` from its cached tables.  Returns
+ *  it, or NULL if it isn't cached. */
+struct debug_block *cache_debug_block(struct cache_entry *e, size_t offset);
+
+//-- Misses ---------------------------------------------------------
+/** Adds the decoded instructions of `code` (parsed from the input). */
+void cache_add_code(struct cache_entry *e, struct code_block *code);
+
+/** Adds the tables of `debug` (parsed from the input). */
+void cache_add_debug(struct cache_entry *e, struct debug_block *debug);
+
+#endif
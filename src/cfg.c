@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "arena.h"
+#include "decode.h"
+#include "records.h"
+#include "timings.h"
+
+enum cfg_format cfg_format = CFG_NONE;
+
+int cfg_parse_args(int argc, char *argv[]) {
+  int k = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--cfg", 5) == 0 && (argv[i][5] == '=' || argv[i][5] == 0)) {
+      const char *f = argv[i][5] == '='? &argv[i][6]
+                    : i + 1 < argc? argv[++i]
+                    : "";
+      if      (strcmp(f, "dot")  == 0) cfg_format = CFG_DOT;
+      else if (strcmp(f, "json") == 0) cfg_format = CFG_JSON;
+      else {
+        fprintf(stderr, "Unknown graph format '%s' (try dot or json).\n", f);
+        return -1;
+      }
+    }
+    else argv[k++] = argv[i];
+  }
+  argv[k] = NULL;
+  return k;
+}
+
+
+//-- Building -------------------------------------------------------
+/** How an instruction ends a block, if it does. */
+enum cfg_exit {
+  EXIT_NONE,
+  EXIT_RETURN,
+  EXIT_JUMP,
+  EXIT_BRANCH,
+  EXIT_JUMPMAP,
+};
+
+enum cfg_exit instr_exit(const struct ir_instr *instr) {
+  if (instr->op == 0x0030) return EXIT_RETURN;
+  if (instr->op == 0x0082 && !(instr->flags & IR_BROKEN)) return EXIT_JUMPMAP;
+  if (!(instr->flags & IR_BRANCH) || instr->op == 0x0031) return EXIT_NONE; // Calls return
+  // Jump and Trampoline always jump, as in the VM
+  return instr->op == 0x0033 || instr->op == 0x0081? EXIT_JUMP : EXIT_BRANCH;
+}
+
+/** Adds an edge from block `from` to the block starting at word `target`,
+ *  unless there already is one (JumpMaps often repeat targets). */
+void cfg_add_edge(struct cfg *cfg, const int *block_at, int n, int from,
+                  i32 target, enum cfg_edge_kind kind) {
+  int to = target >= 0 && target < n? block_at[target] : -1;
+  if (to < 0) {
+    cfg->blocks[from].flags |= CFG_UNRESOLVED;
+    return;
+  }
+
+  struct cfg_block *b = &cfg->blocks[from];
+  for (u32 e = b->succ; e < b->succ + b->nsucc; e++) {
+    if (cfg->edges[e].to == to) return;
+  }
+  cfg->edges[cfg->nedges++] = (struct cfg_edge) { from, to, kind };
+  b->nsucc++;
+}
+
+struct cfg *build_cfg(struct code_block *code) {
+  int n = code->ninstrs;
+  struct code_ir *ir = get_code_ir(code);
+
+  // Labels are where control can arrive from elsewhere
+  u32 *labels = calloc(n + code->nmovement + 1, sizeof(u32));
+  assign_labels(labels, code, ir);
+
+  struct cfg *cfg = palloc(sizeof(struct cfg));
+  cfg->functions = palloc(sizeof(struct cfg_function) * ir->ninstrs + 1);
+  cfg->blocks    = palloc(sizeof(struct cfg_block) * ir->ninstrs + 1);
+  cfg->edges     = palloc(sizeof(struct cfg_edge) * (2 * ir->ninstrs + ir->ntargets) + 1);
+  cfg->nfunctions = cfg->nblocks = cfg->nedges = 0;
+
+  //-- Split into blocks
+  int *block_at = malloc(sizeof(int) * (n + 1));
+  for (int i = 0; i <= n; i++) block_at[i] = -1;
+
+  int ends = 1; // Did the previous instruction end its block?
+  for (int k = 0; k < ir->ninstrs; k++) {
+    struct ir_instr *instr = &ir->instrs[k];
+    u32 i = instr->pos;
+
+    if (instr->op == 0x002E || cfg->nfunctions == 0) {
+      if (cfg->nfunctions > 0) {
+        struct cfg_function *prev = &cfg->functions[cfg->nfunctions - 1];
+        prev->end = i;
+        prev->nblocks = cfg->nblocks - prev->first;
+      }
+      cfg->functions[cfg->nfunctions++] = (struct cfg_function) { i, n, cfg->nblocks, 0 };
+      ends = 1;
+    }
+
+    if (ends || labels[i] != 0) {
+      if (cfg->nblocks > 0) cfg->blocks[cfg->nblocks - 1].end = i;
+      block_at[i] = cfg->nblocks;
+      cfg->blocks[cfg->nblocks++] = (struct cfg_block) {
+        .start = i, .end = n, .first = k, .function = cfg->nfunctions - 1,
+      };
+    }
+    cfg->blocks[cfg->nblocks - 1].ninstrs++;
+    ends = instr_exit(instr) != EXIT_NONE;
+  }
+  if (cfg->nfunctions > 0) {
+    struct cfg_function *last = &cfg->functions[cfg->nfunctions - 1];
+    last->nblocks = cfg->nblocks - last->first;
+  }
+
+  //-- Successors, in block order
+  for (int b = 0; b < cfg->nblocks; b++) {
+    struct cfg_block *block = &cfg->blocks[b];
+    struct ir_instr *last = &ir->instrs[block->first + block->ninstrs - 1];
+    block->succ = cfg->nedges;
+
+    switch (instr_exit(last)) {
+      case EXIT_RETURN:
+        block->flags |= CFG_EXIT;
+        break;
+
+      case EXIT_JUMP:
+        cfg_add_edge(cfg, block_at, n, b, last->target, CFG_JUMP);
+        break;
+
+      case EXIT_JUMPMAP:
+        for (u32 j = 0; j < last->ntargets; j++) {
+          cfg_add_edge(cfg, block_at, n, b, ir->targets[last->target + j],
+                       j == 0? CFG_DEFAULT : CFG_CASE);
+        }
+        break;
+
+      case EXIT_BRANCH:
+        cfg_add_edge(cfg, block_at, n, b, last->target, CFG_TAKEN);
+        // Fall through
+      case EXIT_NONE:
+        if (b + 1 < cfg->nblocks) cfg_add_edge(cfg, block_at, n, b, block->end, CFG_FALLTHROUGH);
+        break;
+    }
+  }
+
+  //-- Predecessors: the edges counting-sorted by target
+  cfg->preds = palloc(sizeof(u32) * cfg->nedges + 1);
+  for (int e = 0; e < cfg->nedges; e++) cfg->blocks[cfg->edges[e].to].npred++;
+  u32 pos = 0;
+  for (int b = 0; b < cfg->nblocks; b++) {
+    cfg->blocks[b].pred = pos;
+    pos += cfg->blocks[b].npred;
+    cfg->blocks[b].npred = 0;
+  }
+  for (int e = 0; e < cfg->nedges; e++) {
+    struct cfg_block *to = &cfg->blocks[cfg->edges[e].to];
+    cfg->preds[to->pred + to->npred++] = e;
+  }
+
+  free(block_at);
+  free(labels);
+  return cfg;
+}
+
+void free_cfg(struct cfg *cfg) {
+  if (cfg == NULL) return;
+  pfree(cfg->functions);
+  pfree(cfg->blocks);
+  pfree(cfg->edges);
+  pfree(cfg->preds);
+  pfree(cfg);
+}
+
+
+//-- Export ---------------------------------------------------------
+const char *cfg_edge_names[] = { "fallthrough", "jump", "taken", "default", "case" };
+
+/** Writes `s` escaped for a quoted DOT string. */
+void dot_string(struct render *r, const char *s) {
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') render_char(r, '\\');
+    render_char(r, *s);
+  }
+}
+
+void render_cfg_dot(struct render *r, const char *path, const char *name,
+                    struct code_block *code, struct debug_block *debug,
+                    struct cfg *cfg) {
+  struct code_ir *ir = get_code_ir(code);
+
+  render_str(r, "digraph \"");
+  dot_string(r, path);
+  render_char(r, ':');
+  dot_string(r, name);
+  render_str(r, "\" {\n  node [shape=box, fontname=monospace];\n");
+
+  for (int f = 0; f < cfg->nfunctions; f++) {
+    struct cfg_function *func = &cfg->functions[f];
+    const struct debug_symbol *sym = debug != NULL? lookup_sym(debug, func->start * 4, 0x0009, 0) : NULL;
+
+    render_fmt(r, "  subgraph cluster_%d {\n    label=\"", f);
+    if (sym != NULL) {
+      dot_string(r, sym->name);
+    } else {
+      render_str(r, "Func_");
+      render_hex(r, func->start * 4, 4, '0');
+    }
+    render_str(r, "\";\n");
+
+    for (int b = func->first; b < func->first + func->nblocks; b++) {
+      struct cfg_block *block = &cfg->blocks[b];
+      render_fmt(r, "    b%d [label=\"$", b);
+      render_hex(r, block->start * 4, 4, '0');
+      render_str(r, "\\l");
+      for (int k = block->first; k < block->first + block->ninstrs; k++) {
+        const char *op = ir->instrs[k].op >= 0? ir_op_name(ir->instrs[k].op) : NULL;
+        if (op != NULL) {
+          dot_string(r, op);
+        } else {
+          render_char(r, '$');
+          render_hex(r, code->instrs[ir->instrs[k].pos] & 0xFFFF, 4, '0');
+        }
+        render_str(r, "\\l");
+      }
+      render_char(r, '"');
+      if (block->flags & CFG_EXIT) render_str(r, ", peripheries=2");
+      if (block->flags & CFG_UNRESOLVED) render_str(r, ", color=red");
+      render_str(r, "];\n");
+    }
+    render_str(r, "  }\n");
+  }
+
+  for (int e = 0; e < cfg->nedges; e++) {
+    struct cfg_edge *edge = &cfg->edges[e];
+    render_fmt(r, "  b%d -> b%d", edge->from, edge->to);
+    switch (edge->kind) {
+      case CFG_FALLTHROUGH: render_str(r, " [style=dashed]");     break;
+      case CFG_TAKEN:       render_str(r, " [color=darkgreen]");  break;
+      case CFG_DEFAULT:     render_str(r, " [label=\"default\"]"); break;
+      default: break;
+    }
+    render_str(r, ";\n");
+  }
+  render_str(r, "}\n");
+}
+
+/** Writes a JSON array of `n` block indices, taken from `edges` (through
+ *  `idx` if not NULL) on the `to` or `from` side. */
+void json_blocks(struct render *r, const struct cfg_edge *edges, const u32 *idx,
+                 u32 first, u32 n, int to) {
+  render_char(r, '[');
+  for (u32 i = 0; i < n; i++) {
+    const struct cfg_edge *e = &edges[idx != NULL? idx[first + i] : first + i];
+    if (i > 0) render_char(r, ',');
+    render_int(r, to? e->to : e->from, 0);
+  }
+  render_char(r, ']');
+}
+
+void render_cfg_json(struct render *r, const char *path, const char *name,
+                     struct debug_block *debug, struct cfg *cfg) {
+  render_str(r, "{\"path\":");
+  json_string(r, path);
+  render_str(r, ",\"block\":");
+  json_string(r, name);
+
+  render_str(r, ",\"functions\":[");
+  for (int f = 0; f < cfg->nfunctions; f++) {
+    struct cfg_function *func = &cfg->functions[f];
+    const struct debug_symbol *sym = debug != NULL? lookup_sym(debug, func->start * 4, 0x0009, 0) : NULL;
+    render_str(r, f > 0? ",{\"name\":" : "{\"name\":");
+    if (sym != NULL) {
+      json_string(r, sym->name);
+    } else {
+      render_str(r, "\"Func_");
+      render_hex(r, func->start * 4, 4, '0');
+      render_char(r, '"');
+    }
+    render_fmt(r, ",\"addr\":%u,\"end\":%u,\"first\":%d,\"nblocks\":%d}",
+               func->start * 4, func->end * 4, func->first, func->nblocks);
+  }
+
+  render_str(r, "],\"blocks\":[");
+  for (int b = 0; b < cfg->nblocks; b++) {
+    struct cfg_block *block = &cfg->blocks[b];
+    render_fmt(r, "%s{\"addr\":%u,\"end\":%u,\"function\":%d,\"ninstrs\":%d,\"exit\":%s,\"unresolved\":%s,\"succs\":",
+               b > 0? "," : "", block->start * 4, block->end * 4, block->function, block->ninstrs,
+               block->flags & CFG_EXIT? "true" : "false",
+               block->flags & CFG_UNRESOLVED? "true" : "false");
+    json_blocks(r, cfg->edges, NULL, block->succ, block->nsucc, 1);
+    render_str(r, ",\"preds\":");
+    json_blocks(r, cfg->edges, cfg->preds, block->pred, block->npred, 0);
+    render_char(r, '}');
+  }
+
+  render_str(r, "],\"edges\":[");
+  for (int e = 0; e < cfg->nedges; e++) {
+    struct cfg_edge *edge = &cfg->edges[e];
+    render_fmt(r, "%s{\"from\":%d,\"to\":%d,\"kind\":\"%s\"}", e > 0? "," : "",
+               edge->from, edge->to, cfg_edge_names[edge->kind]);
+  }
+  render_str(r, "]}\n");
+}
+
+void render_cfg(struct render *r, enum cfg_format format, const char *path,
+                const char *name, struct code_block *code,
+                struct debug_block *debug) {
+  TIMING_BEGIN(span, PHASE_PRINT);
+  struct cfg *cfg = build_cfg(code);
+  if (format == CFG_DOT) render_cfg_dot(r, path, name, code, debug, cfg);
+  else render_cfg_json(r, path, name, debug, cfg);
+  free_cfg(cfg);
+  TIMING_END(span, 0, 0);
+}
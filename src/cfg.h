@@ -0,0 +1,84 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include "poketools.h"
+#include "render.h"
+#include "formats/script.h"
+
+/** Control-flow graphs: each function of a code block (from one `Begin` to
+ *  the next) split into basic blocks, with successor and predecessor edges.
+ *  Blocks start wherever `assign_labels` puts a label and after every
+ *  instruction that ends one (returns, jumps, conditional branches and
+ *  JumpMaps).  Everything lives in flat arrays indexed by block number. */
+
+/** How control gets from one block to another. */
+enum cfg_edge_kind {
+  CFG_FALLTHROUGH,    // Into the next block
+  CFG_JUMP,           // Unconditional jump (or Trampoline)
+  CFG_TAKEN,          // Conditional branch, taken
+  CFG_DEFAULT,        // JumpMap fallback
+  CFG_CASE,           // JumpMap choice
+};
+
+#define CFG_EXIT       0x01 // Ends in a Return
+#define CFG_UNRESOLVED 0x02 // Jumps somewhere no block starts (e.g. into
+                            // the middle of an instruction)
+
+struct cfg_block {
+  u32 start, end;     // Word range [start, end) in `code->instrs`
+  int first;          // First instruction in the IR
+  int ninstrs;
+  int function;
+  u32 succ, nsucc;    // Outgoing edges: range in `edges`
+  u32 pred, npred;    // Incoming edges: range in `preds`
+  u32 flags;
+};
+
+struct cfg_edge {
+  int from, to;       // Block indices
+  enum cfg_edge_kind kind;
+};
+
+struct cfg_function {
+  u32 start, end;     // Word range [start, end)
+  int first;          // First block
+  int nblocks;
+};
+
+struct cfg {
+  int nfunctions;
+  struct cfg_function *functions;
+  int nblocks;
+  struct cfg_block *blocks;
+  int nedges;
+  struct cfg_edge *edges; // Sorted by `from`
+  u32 *preds;             // Edge indices, sorted by `to`
+};
+
+/** Export formats, chosen with `--cfg`. */
+enum cfg_format {
+  CFG_NONE,           // No graph; print the listing as usual
+  CFG_DOT,            // Graphviz
+  CFG_JSON,           // One JSON object per code block
+};
+
+/** The graph export format; set by `--cfg`. */
+extern enum cfg_format cfg_format;
+
+/** Removes `--cfg <dot|json>` from the command line, applying it.  Returns
+ *  the new `argc`, or -1 on a bad option. */
+int cfg_parse_args(int argc, char *argv[]);
+
+/** Builds the control-flow graph of `code`, in time linear in its size. */
+struct cfg *build_cfg(struct code_block *code);
+
+/** Frees a graph built by `build_cfg`. */
+void free_cfg(struct cfg *cfg);
+
+/** Writes the graph of `code` (read from `path`, the block named `name`)
+ *  in the format `format`, naming functions from `debug` if not NULL. */
+void render_cfg(struct render *r, enum cfg_format format, const char *path,
+                const char *name, struct code_block *code,
+                struct debug_block *debug);
+
+#endif
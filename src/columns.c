@@ -0,0 +1,129 @@
+#include <string.h>
+
+#include "columns.h"
+#include "arena.h"
+#include "decode.h"
+
+struct code_columns *build_code_columns(struct code_block *code) {
+  struct code_ir *ir = get_code_ir(code);
+  int n = ir->ninstrs, nwords = (n + 63) / 64;
+  size_t padded = 64 * (size_t) nwords;
+
+  struct code_columns *c = palloc(sizeof(struct code_columns));
+  memset(c, 0, sizeof(struct code_columns));
+  c->n = n;
+  c->nwords = nwords;
+  c->op        = memset(palloc(sizeof(u16) * padded), 0, sizeof(u16) * padded);
+  c->high_half = memset(palloc(sizeof(u16) * padded), 0, sizeof(u16) * padded);
+  c->pos       = memset(palloc(sizeof(u32) * padded), 0, sizeof(u32) * padded);
+  c->target    = memset(palloc(sizeof(i32) * padded), 0xFF, sizeof(i32) * padded);
+
+  for (int k = 0; k < n; k++) {
+    struct ir_instr *instr = &ir->instrs[k];
+    u32 w = code->instrs[instr->pos];
+    c->op[k] = w & 0xFFFF;
+    c->high_half[k] = w >> 16;
+    c->pos[k] = instr->pos;
+    if (instr->flags & IR_BRANCH) c->target[k] = instr->target;
+
+    int b = c->op[k] < COLUMNS_NOPS? c->op[k] : COLUMNS_NOPS;
+    if (c->counts[b]++ == 0) {
+      c->bitmaps[b] = memset(palloc(sizeof(u64) * nwords), 0, sizeof(u64) * nwords);
+    }
+    c->bitmaps[b][k / 64] |= 1ULL << (k % 64);
+  }
+  return c;
+}
+
+struct code_columns *get_code_columns(struct code_block *code) {
+  if (code->columns == NULL) code->columns = build_code_columns(code);
+  return code->columns;
+}
+
+
+//-- Filters --------------------------------------------------------
+/** Packs 64 bytes that are each 0 or 1 into a bit mask. */
+static inline u64 pack_bits(const u8 *eq) {
+  u64 m = 0;
+  for (int j = 0; j < 64; j += 8) {
+    u64 x;
+    memcpy(&x, eq + j, sizeof(u64));
+    m |= ((x * 0x0102040810204080ULL) >> 56) << j;
+  }
+  return m;
+}
+
+/** Of the candidates `m` among the 64 entries at `p`, those equal to `x`.
+ *  A few are looked at one by one; otherwise all 64 are compared at once, in
+ *  a loop the compiler vectorizes. */
+u64 column_eq16(const u16 *p, u16 x, u64 m) {
+  if (__builtin_popcountll(m) <= 8) {
+    u64 res = 0;
+    for (u64 b = m; b != 0; b &= b - 1) {
+      int j = __builtin_ctzll(b);
+      if (p[j] == x) res |= 1ULL << j;
+    }
+    return res;
+  }
+  u8 eq[64];
+  for (int j = 0; j < 64; j++) eq[j] = p[j] == x;
+  return pack_bits(eq) & m;
+}
+
+u64 column_eq32(const i32 *p, i32 x, u64 m) {
+  if (__builtin_popcountll(m) <= 8) {
+    u64 res = 0;
+    for (u64 b = m; b != 0; b &= b - 1) {
+      int j = __builtin_ctzll(b);
+      if (p[j] == x) res |= 1ULL << j;
+    }
+    return res;
+  }
+  u8 eq[64];
+  for (int j = 0; j < 64; j++) eq[j] = p[j] == x;
+  return pack_bits(eq) & m;
+}
+
+/** The instructions [64 * w, 64 * w + 64) of `c` that match `f`, as bits. */
+u64 columns_chunk(const struct code_columns *c, const struct column_filter *f, int w) {
+  u64 m;
+  if (f->op < 0) {
+    int left = c->n - 64 * w;
+    m = left >= 64? ~0ULL : (1ULL << left) - 1;
+  } else {
+    m = c->bitmaps[f->op < COLUMNS_NOPS? f->op : COLUMNS_NOPS][w];
+    if (m != 0 && f->op >= COLUMNS_NOPS) m = column_eq16(c->op + 64 * w, f->op, m);
+  }
+  if (m != 0 && f->high_half >= 0) m = column_eq16(c->high_half + 64 * w, f->high_half, m);
+  if (m != 0 && f->target >= 0) m = column_eq32(c->target + 64 * w, f->target, m);
+  return m;
+}
+
+/** Whether no instruction of `c` can match `f`, going by the counts. */
+int columns_none(const struct code_columns *c, const struct column_filter *f) {
+  if (f->op < 0) return 0;
+  if (f->op > 0xFFFF) return 1;
+  return c->counts[f->op < COLUMNS_NOPS? f->op : COLUMNS_NOPS] == 0;
+}
+
+int columns_filter(const struct code_columns *c, const struct column_filter *f,
+                   int *out) {
+  if (columns_none(c, f)) return 0;
+  int n = 0;
+  for (int w = 0; w < c->nwords; w++) {
+    for (u64 m = columns_chunk(c, f, w); m != 0; m &= m - 1) {
+      out[n++] = 64 * w + __builtin_ctzll(m);
+    }
+  }
+  return n;
+}
+
+int columns_count(const struct code_columns *c, const struct column_filter *f) {
+  if (columns_none(c, f)) return 0;
+  if (f->op >= 0 && f->op < COLUMNS_NOPS && f->high_half < 0 && f->target < 0) {
+    return c->counts[f->op];
+  }
+  int n = 0;
+  for (int w = 0; w < c->nwords; w++) n += __builtin_popcountll(columns_chunk(c, f, w));
+  return n;
+}
@@ -0,0 +1,52 @@
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include "poketools.h"
+#include "formats/script.h"
+
+/** A code block's instructions as columns: one dense array per field,
+ *  indexed by instruction, and a bitmap per opcode of the instructions that
+ *  have it.  Looking for an opcode reads only its bitmap (a bit per
+ *  instruction), then the entries of the other columns it points at, rather
+ *  than every instruction in turn; filters on a whole column are plain loops
+ *  over a flat array, which the compiler vectorizes.  Built from the IR on
+ *  demand, so code that never scans never pays for it. */
+
+// Opcodes with a bitmap each; the rest (unknown ones) share the last one
+#define COLUMNS_NOPS 0x100
+
+struct code_columns {
+  int n;              // Instructions
+  int nwords;         // u64s per bitmap: columns are padded to 64 * nwords
+  u16 *op;            // Low half of the first word, known opcode or not
+  u16 *high_half;     // High half of the first word
+  u32 *pos;           // Word index in `code->instrs`; the operands follow
+  i32 *target;        // Branch target (word index), or -1 (also JumpMaps)
+  u64 *bitmaps[COLUMNS_NOPS + 1]; // NULL for opcodes that don't occur
+  u32 counts[COLUMNS_NOPS + 1];   // Bits set in each bitmap
+};
+
+/** What to look for: each field is -1 to match anything. */
+struct column_filter {
+  i32 op;
+  i32 high_half;
+  i32 target;
+};
+
+/** Builds the columns of `code` from its IR. */
+struct code_columns *build_code_columns(struct code_block *code);
+
+/** Returns the columns of `code`, building them on first use; cached in
+ *  `code` like the IR. */
+struct code_columns *get_code_columns(struct code_block *code);
+
+/** Stores the indices of the instructions of `c` that match `f` in `out`
+ *  (which needs room for all of them: at most `c->n`, or the count of
+ *  `f->op`), in order.  Returns how many there are. */
+int columns_filter(const struct code_columns *c, const struct column_filter *f,
+                   int *out);
+
+/** Counts the instructions of `c` that match `f`. */
+int columns_count(const struct code_columns *c, const struct column_filter *f);
+
+#endif
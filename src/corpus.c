@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "corpus.h"
+#include "arena.h"
+#include "columns.h"
+#include "decode.h"
+#include "indexfile.h"
+#include "pattern.h"
+#include "formats/script.h"
+#include "formats/zonedata.h"
+
+const char *corpus_block_names[] = { "code", "code1", "code2" };
+
+// Raw postings, as streamed from `corpus_postings` to `corpus_build` (see
+// indexfile.h):
+//   'P' u8 kind, u8 block, u16 op, u32 addr, then
+//       u32 value, or u16 len, name             -- one posting
+#define RAW_POSTING 'P'
+
+
+//-- Raw postings ---------------------------------------------------
+void raw_posting_begin(FILE *out, enum corpus_kind kind, int block, u16 op,
+                       u32 addr) {
+  u8 head[4] = { RAW_POSTING, kind, block };
+  fwrite(head, 1, 3, out);
+  fwrite(&op, sizeof(u16), 1, out);
+  fwrite(&addr, sizeof(u32), 1, out);
+}
+
+void raw_posting(FILE *out, enum corpus_kind kind, int block, u16 op, u32 addr,
+                 u32 value) {
+  raw_posting_begin(out, kind, block, op, addr);
+  fwrite(&value, sizeof(u32), 1, out);
+}
+
+void raw_name(FILE *out, int block, u16 op, u32 addr, const char *name) {
+  raw_posting_begin(out, KEY_NAME, block, op, addr);
+  raw_string(out, name);
+}
+
+/** Writes the postings of the code section `code` (block `block`), with
+ *  names from `debug` (if not NULL). */
+void index_code(FILE *out, int block, struct code_block *code,
+                struct debug_block *debug) {
+  u32 *ins = code->instrs;
+  int n = code->ninstrs;
+  struct code_ir *ir = get_code_ir(code);
+
+  for (int k = 0; k < ir->ninstrs; k++) {
+    struct ir_instr *instr = &ir->instrs[k];
+    u32 i = instr->pos, addr = 4 * i;
+    u16 op = ins[i] & 0xFFFF, hh = ins[i] >> 16;
+    const struct debug_symbol *sym;
+
+    // Unknown opcodes are indexed too; that's half the point
+    raw_posting(out, KEY_OP, block, op, addr, op);
+    if (k + PATTERN_NGRAM <= ir->ninstrs) {
+      u16 ops[PATTERN_NGRAM];
+      for (int j = 0; j < PATTERN_NGRAM; j++) ops[j] = ins[ir->instrs[k + j].pos] & 0xFFFF;
+      raw_posting(out, KEY_NGRAM, block, op, addr, pattern_ngram_hash(ops));
+    }
+    if (instr->op == -1 || instr->flags & IR_BROKEN) continue;
+
+    // The high half: an identifier, or a constant
+    u32 type = ref_type(instr->op);
+    if (type != 0) {
+      if (type == 0x0001) raw_posting(out, KEY_GLOBAL, block, op, addr, hh);
+      sym = debug != NULL? lookup_sym(debug, (i16) hh, type, addr) : NULL;
+      if (sym != NULL) raw_name(out, block, op, addr, sym->name);
+    } else if (instr->uses_high_half) {
+      // As printed: signed for CPushConst and CAdjustStack
+      u32 v = op == 0x00BC || op == 0x00BF? (u32) (i16) hh : hh;
+      raw_posting(out, KEY_IMM, block, op, addr, v);
+    }
+
+    // Operands: JumpMap choices, branch targets' names, or constants
+    if (instr->op == 0x0082) {
+      for (u32 j = 0; j < ins[i + 1]; j++) {
+        raw_posting(out, KEY_IMM, block, op, addr, ins[i + 3 + 2*j]);
+      }
+    } else if (instr->flags & IR_BRANCH) {
+      sym = debug != NULL && instr->target >= 0 && instr->target < n
+          ? lookup_sym(debug, 4 * instr->target, 0x0009, 0) : NULL;
+      if (sym != NULL) raw_name(out, block, op, addr, sym->name);
+    } else if (op != 0x008A && op != 0x008E && op != 0x0096) { // Not floats
+      for (u32 j = 0; j < instr->nargs; j++) {
+        raw_posting(out, KEY_IMM, block, op, addr, ins[i + 1 + j]);
+      }
+    }
+
+    // Function definitions
+    if (instr->op == 0x002E && debug != NULL) {
+      sym = lookup_sym(debug, addr, 0x0009, 0);
+      if (sym != NULL) raw_name(out, block, op, addr, sym->name);
+    }
+  }
+}
+
+/** Maps and parses the script or zone at `path`, storing its code blocks
+ *  by block number (see `corpus_block_names`; NULL where there is none) in
+ *  `code`, and its debug section (or NULL) in `*debug`.  Returns 0, or -1
+ *  (having said why) if it isn't one. */
+int corpus_load(struct mapped_file *file, const char *path,
+                struct code_block *code[3], struct debug_block **debug) {
+  if (map_file(file, path) < 0) {
+    fprintf(stderr, "Couldn't open '%s' for reading.\n", path);
+    return -1;
+  }
+
+  u32 magic = 0;
+  if (file->size >= sizeof(u32)) memcpy(&magic, file->data, sizeof(u32));
+
+  code[0] = code[1] = code[2] = NULL;
+  *debug = NULL;
+
+  if (magic == 0x00044F5A) {
+    struct zonedata *zone = parse_zonedata(file->data, file->size);
+    if (zone != NULL) {
+      code[1] = zone->code1;
+      code[2] = zone->code2;
+    }
+  } else {
+    // A script: its code and debug sections
+    size_t start = 0;
+    while (file->size - start >= 2 * sizeof(u32)) {
+      u32 size, section_magic;
+      memcpy(&size,          file->data + start,               sizeof(u32));
+      memcpy(&section_magic, file->data + start + sizeof(u32), sizeof(u32));
+
+      size_t n = file->size - start;
+      if (section_magic == 0x0A0AF1E0) code[0] = parse_code_block(file->data + start, n, NULL);
+      else if (section_magic == 0x0A0AF1EF) *debug = parse_debug_block(file->data + start, n, NULL);
+      else break;
+
+      if (size == 0 || size > n) break;
+      start += size;
+    }
+  }
+
+  if (code[0] == NULL && code[1] == NULL) {
+    fprintf(stderr, "%s: Not a script or zone.\n", path);
+    unmap_file(file);
+    return -1;
+  }
+  return 0;
+}
+
+/** Writes the raw postings of the script or zone at `path` to `out`. */
+int corpus_postings(FILE *out, const char *path) {
+  struct mapped_file file;
+  struct code_block *code[3];
+  struct debug_block *debug;
+  if (corpus_load(&file, path, code, &debug) < 0) return 2;
+
+  fputc(RAW_FILE, out);
+  raw_string(out, path);
+  for (int block = 0; block < 3; block++) {
+    // Zones' debug info isn't known
+    if (code[block] != NULL) index_code(out, block, code[block], block == 0? debug : NULL);
+  }
+
+  // What was parsed goes with the batch worker's arena
+  unmap_file(&file);
+  return 0;
+}
+
+
+//-- Scanning -------------------------------------------------------
+struct column_filter corpus_scan_filters[0x100];
+int corpus_scan_nfilters;
+int corpus_scan_count_only;
+u64 corpus_scan_total;
+
+/** Compares instruction indices. */
+int compare_ints(const void *a, const void *b) {
+  return *(const int *) a - *(const int *) b;
+}
+
+int corpus_scan(FILE *out, const char *path) {
+  struct mapped_file file;
+  struct code_block *code[3];
+  struct debug_block *debug;
+  if (corpus_load(&file, path, code, &debug) < 0) return 2;
+
+  u64 total = 0;
+  for (int block = 0; block < 3; block++) {
+    if (code[block] == NULL) continue;
+    struct code_columns *c = get_code_columns(code[block]);
+
+    if (corpus_scan_count_only) {
+      for (int f = 0; f < corpus_scan_nfilters; f++) {
+        total += columns_count(c, &corpus_scan_filters[f]);
+      }
+      continue;
+    }
+
+    // Each filter's matches are in order; several are merged
+    int *found = palloc(sizeof(int) * c->n), n = 0;
+    for (int f = 0; f < corpus_scan_nfilters; f++) {
+      n += columns_filter(c, &corpus_scan_filters[f], found + n);
+    }
+    if (corpus_scan_nfilters > 1) qsort(found, n, sizeof(int), compare_ints);
+    total += n;
+
+    for (int j = 0; j < n; j++) {
+      int k = found[j];
+      const char *name = ir_op_name(c->op[k]);
+      fprintf(out, "%s  %s+%04x  ", path, corpus_block_names[block], 4 * c->pos[k]);
+      if (name != NULL) fprintf(out, "%s\n", name);
+      else fprintf(out, "$%04x\n", c->op[k]);
+    }
+    pfree(found);
+  }
+  __atomic_add_fetch(&corpus_scan_total, total, __ATOMIC_RELAXED);
+
+  unmap_file(&file);
+  return 0;
+}
+
+
+//-- Pattern search -------------------------------------------------
+struct pattern corpus_grep_pattern;
+int corpus_grep_count_only;
+u64 corpus_grep_total;
+
+int corpus_grep(FILE *out, const char *path) {
+  struct mapped_file file;
+  struct code_block *code[3];
+  struct debug_block *debug;
+  if (corpus_load(&file, path, code, &debug) < 0) return 2;
+
+  const struct pattern *p = &corpus_grep_pattern;
+  u64 total = 0;
+  for (int block = 0; block < 3; block++) {
+    if (code[block] == NULL) continue;
+    struct code_ir *ir = get_code_ir(code[block]);
+    int *found = palloc(sizeof(int) * ir->ninstrs + 1);
+    int n = pattern_find(p, code[block], found);
+    total += n;
+
+    for (int j = 0; !corpus_grep_count_only && j < n; j++) {
+      int k = found[j];
+      u32 vars[PATTERN_MAX_VARS];
+      pattern_match_at(p, code[block], k, vars);
+
+      fprintf(out, "%s  %s+%04x  ", path, corpus_block_names[block], 4 * ir->instrs[k].pos);
+      for (int i = 0; i < p->n; i++) {
+        u16 op = code[block]->instrs[ir->instrs[k + i].pos] & 0xFFFF;
+        const char *name = ir_op_name(op);
+        if (i > 0) fputs("; ", out);
+        if (name != NULL) fputs(name, out);
+        else fprintf(out, "$%04x", op);
+      }
+      for (int v = 0; v < p->nvars; v++) fprintf(out, "%s%s=$%x", v == 0? "  " : " ", p->vars[v], vars[v]);
+      fputc('\n', out);
+    }
+    pfree(found);
+  }
+  __atomic_add_fetch(&corpus_grep_total, total, __ATOMIC_RELAXED);
+
+  unmap_file(&file);
+  return 0;
+}
+
+
+//-- Building -------------------------------------------------------
+/** A posting, while building. */
+struct build_posting {
+  u32 kind;
+  u32 value;          // KEY_NAME: offset of the name in the names buffer
+  struct corpus_posting posting;
+};
+
+const char *sort_names; // For `build_comparator`
+
+int build_comparator(const void *a, const void *b) {
+  const struct build_posting *p1 = a, *p2 = b;
+  if (p1->kind != p2->kind) return p1->kind < p2->kind? -1 : 1;
+  if (p1->kind == KEY_NAME) {
+    int c = strcmp(sort_names + p1->value, sort_names + p2->value);
+    if (c != 0) return c;
+  } else if (p1->value != p2->value) {
+    return p1->value < p2->value? -1 : 1;
+  }
+  if (p1->posting.file != p2->posting.file) return p1->posting.file < p2->posting.file? -1 : 1;
+  if (p1->posting.block != p2->posting.block) return p1->posting.block < p2->posting.block? -1 : 1;
+  return (p1->posting.addr > p2->posting.addr) - (p1->posting.addr < p2->posting.addr);
+}
+
+int corpus_build(FILE *in, const char *path) {
+  struct index_buf strings = { 0 }, names = { 0 }, files = { 0 };
+  size_t npostings = 0, cap = 0;
+  struct build_posting *postings = NULL;
+  u32 nfiles = 0;
+
+  buf_put(&strings, "", 1); // Offset 0 is never a real string
+
+  //-- Read the raw postings
+  int type;
+  while ((type = fgetc(in)) != EOF) {
+    if (type == RAW_FILE) {
+      long off = read_raw_string(in, &strings);
+      if (off < 0) break;
+      u32 path_off = off;
+      buf_put(&files, &path_off, sizeof(u32));
+      nfiles++;
+      continue;
+    }
+
+    u8 head[2];
+    struct build_posting p = { 0 };
+    if (type != RAW_POSTING || nfiles == 0
+        || fread(head, 1, 2, in) != 2
+        || fread(&p.posting.op, sizeof(u16), 1, in) != 1
+        || fread(&p.posting.addr, sizeof(u32), 1, in) != 1) break;
+    p.kind = head[0];
+    p.posting.block = head[1];
+    p.posting.file = nfiles - 1;
+
+    if (p.kind == KEY_NAME) {
+      long off = read_raw_string(in, &names);
+      if (off < 0) break;
+      p.value = off;
+    } else if (fread(&p.value, sizeof(u32), 1, in) != 1) {
+      break;
+    }
+
+    if (npostings == cap) {
+      cap = cap? 2 * cap : 4096;
+      postings = realloc(postings, cap * sizeof(struct build_posting));
+    }
+    postings[npostings++] = p;
+  }
+
+  //-- Sort them into keys
+  sort_names = (const char *) names.p;
+  qsort(postings, npostings, sizeof(struct build_posting), build_comparator);
+
+  struct index_buf keys = { 0 };
+  struct corpus_posting *out_postings = malloc((npostings + 1) * sizeof(struct corpus_posting));
+  struct corpus_key key = { 0 };
+  for (size_t i = 0; i < npostings; i++) {
+    struct build_posting *p = &postings[i];
+    int same = i > 0 && p->kind == key.kind
+               && (p->kind == KEY_NAME? strcmp(sort_names + p->value, sort_names + postings[i - 1].value) == 0
+                                      : p->value == key.value);
+    if (!same) {
+      if (i > 0) buf_put(&keys, &key, sizeof(struct corpus_key));
+      key = (struct corpus_key) { p->kind, p->value, i, 0 };
+      if (p->kind == KEY_NAME) {
+        const char *name = sort_names + p->value;
+        key.value = buf_put(&strings, name, strlen(name) + 1);
+      }
+    }
+    key.npostings++;
+    out_postings[i] = p->posting;
+  }
+  if (npostings > 0) buf_put(&keys, &key, sizeof(struct corpus_key));
+
+  //-- Write the index
+  struct index_writer w;
+  int res = -1;
+  if (index_begin(&w, path, sizeof(struct corpus_header)) == 0) {
+    struct corpus_header hd = {
+      .magic        = CORPUS_MAGIC,
+      .version      = CORPUS_VERSION,
+      .nfiles       = nfiles,
+      .nkeys        = keys.len / sizeof(struct corpus_key),
+      .npostings    = npostings,
+      .strings_size = strings.len,
+    };
+    hd.files_off    = index_section(&w, files.p, files.len);
+    hd.keys_off     = index_section(&w, keys.p, keys.len);
+    hd.postings_off = index_section(&w, out_postings, sizeof(struct corpus_posting) * npostings);
+    hd.strings_off  = index_section(&w, strings.p, strings.len);
+    res = index_end(&w, &hd, sizeof(hd));
+  }
+
+  // Cleanup
+  free(out_postings);
+  free(postings);
+  free(keys.p);
+  free(files.p);
+  free(names.p);
+  free(strings.p);
+
+  return res;
+}
+
+
+//-- Querying -------------------------------------------------------
+int corpus_open(struct corpus_index *ix, const char *path) {
+  if (map_file(&ix->map, path) < 0) return -1;
+
+  const struct corpus_header *hd = (const struct corpus_header *) ix->map.data;
+  size_t size = ix->map.size;
+  if (size < sizeof(struct corpus_header) || hd->magic != CORPUS_MAGIC
+      || hd->version != CORPUS_VERSION
+      || hd->files_off + (u64) hd->nfiles * sizeof(u32) > size
+      || hd->keys_off + (u64) hd->nkeys * sizeof(struct corpus_key) > size
+      || hd->postings_off + (u64) hd->npostings * sizeof(struct corpus_posting) > size
+      || hd->strings_off + hd->strings_size > size
+      || hd->strings_size == 0 || ix->map.data[hd->strings_off + hd->strings_size - 1] != 0) {
+    unmap_file(&ix->map);
+    return -1;
+  }
+
+  // Every path and name must lie within the strings, and every key's
+  // postings within the postings
+  const u32 *files = (const u32 *) (ix->map.data + hd->files_off);
+  const struct corpus_key *keys = (const struct corpus_key *) (ix->map.data + hd->keys_off);
+  int ok = 1;
+  for (u32 i = 0; ok && i < hd->nfiles; i++) ok = files[i] < hd->strings_size;
+  for (u32 i = 0; ok && i < hd->nkeys; i++) {
+    ok = keys[i].first + (u64) keys[i].npostings <= hd->npostings
+         && (keys[i].kind != KEY_NAME || keys[i].value < hd->strings_size);
+  }
+  if (!ok) {
+    unmap_file(&ix->map);
+    return -1;
+  }
+
+  ix->header   = hd;
+  ix->files    = files;
+  ix->keys     = keys;
+  ix->postings = (const struct corpus_posting *) (ix->map.data + hd->postings_off);
+  ix->strings  = (const char *) (ix->map.data + hd->strings_off);
+  return 0;
+}
+
+void corpus_close(struct corpus_index *ix) {
+  unmap_file(&ix->map);
+}
+
+const char *corpus_file(struct corpus_index *ix, u32 i) {
+  // Postings aren't checked when the index is opened: there are too many
+  return i < ix->header->nfiles? ix->strings + ix->files[i] : "";
+}
+
+/** Compares `key` with the one being looked for. */
+int key_cmp(struct corpus_index *ix, const struct corpus_key *key,
+            enum corpus_kind kind, u32 value, const char *name, int prefix) {
+  if (key->kind != kind) return key->kind < kind? -1 : 1;
+  if (kind == KEY_NAME) {
+    const char *s = ix->strings + key->value;
+    return prefix? strncmp(s, name, strlen(name)) : strcmp(s, name);
+  }
+  return (key->value > value) - (key->value < value);
+}
+
+int corpus_find(struct corpus_index *ix, enum corpus_kind kind, u32 value,
+                const char *name, int prefix, const struct corpus_key **first) {
+  int lo = 0, hi = ix->header->nkeys;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (key_cmp(ix, &ix->keys[mid], kind, value, name, prefix) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+
+  int n = 0;
+  while (lo + n < (int) ix->header->nkeys
+         && key_cmp(ix, &ix->keys[lo + n], kind, value, name, prefix) == 0) n++;
+
+  *first = &ix->keys[lo];
+  return n;
+}
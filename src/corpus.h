@@ -0,0 +1,136 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "poketools.h"
+#include "columns.h"
+#include "mapfile.h"
+#include "pattern.h"
+
+/** A search index over a corpus of scripts and zones: for each opcode,
+ *  immediate value, global ID, debug symbol name and n-gram of opcodes (see
+ *  pattern.h), every place (file, code block and offset) it is used.  The
+ *  index is one file, built in a single pass over the corpus and mapped as
+ *  it is for queries:
+ *
+ *    header | files (u32 path offsets) | keys | postings | strings
+ *
+ *  Keys are sorted by kind, then by value (or name), and each owns a run of
+ *  postings sorted by file and offset, so a lookup is a binary search. */
+
+#define CORPUS_MAGIC   0x31494B50 // "PKI1"
+#define CORPUS_VERSION 2
+
+/** What a key is. */
+enum corpus_kind {
+  KEY_OP = 1,   // Opcode (low half of the first word, known or not)
+  KEY_IMM,      // Immediate value: a constant high half or operand word
+  KEY_GLOBAL,   // ID of a global
+  KEY_NAME,     // Name of a debug symbol, referenced or defined
+  KEY_NGRAM,    // Hash of the opcodes of PATTERN_NGRAM instructions in a
+                // row, from this one on
+};
+
+struct corpus_header {
+  u32 magic;
+  u32 version;
+  u32 nfiles;
+  u32 nkeys;
+  u32 npostings;
+  u32 strings_size;
+  u64 files_off, keys_off, postings_off, strings_off;
+};
+
+struct corpus_key {
+  u32 kind;
+  u32 value;          // KEY_NAME: offset of the name in the strings
+  u32 first;          // First posting
+  u32 npostings;
+};
+
+struct corpus_posting {
+  u32 file;
+  u32 addr;           // Byte offset of the instruction within its block
+  u16 op;             // Opcode of the instruction
+  u8  block;          // See `corpus_block_names`
+  u8  unused;
+};
+
+/** Names of the code blocks postings are in: a script's, or a zone's two. */
+extern const char *corpus_block_names[];
+
+/** A mapped index. */
+struct corpus_index {
+  struct mapped_file map;
+  const struct corpus_header *header;
+  const u32 *files;
+  const struct corpus_key *keys;
+  const struct corpus_posting *postings;
+  const char *strings;
+};
+
+//-- Building -------------------------------------------------------
+/** Writes the raw postings of the script or zone at `path` to `out` (a
+ *  `batch_fn`, so the corpus can be walked by `batch_run`).  Returns 0 on
+ *  success, or nonzero if the file couldn't be read. */
+int corpus_postings(FILE *out, const char *path);
+
+/** Builds the index at `path` from the raw postings of any number of files,
+ *  read from `in`.  Returns 0 on success, or -1 if it couldn't be written. */
+int corpus_build(FILE *in, const char *path);
+
+//-- Scanning -------------------------------------------------------
+// Scans go over the files themselves rather than an index, using their
+// instructions as columns (see columns.h): slower than a lookup, but they
+// need no index, and can ask for more than one key at a time.
+
+/** What `corpus_scan` looks for: instructions matching any of the filters
+ *  (as many as are set), and whether to count them rather than list them. */
+extern struct column_filter corpus_scan_filters[0x100];
+extern int corpus_scan_nfilters;
+extern int corpus_scan_count_only;
+
+/** Instructions found by `corpus_scan`, over every file. */
+extern u64 corpus_scan_total;
+
+/** Writes the instructions of the script or zone at `path` that match the
+ *  scan filters to `out`, as `ptindex query` lists postings (a `batch_fn`).
+ *  Returns 0 on success, or nonzero if the file couldn't be read. */
+int corpus_scan(FILE *out, const char *path);
+
+//-- Pattern search -------------------------------------------------
+// Like scans, over the files themselves; an index narrows down which files
+// to look at (see `ptindex grep`).
+
+/** What `corpus_grep` looks for, and whether to count matches rather than
+ *  list them. */
+extern struct pattern corpus_grep_pattern;
+extern int corpus_grep_count_only;
+
+/** Matches found by `corpus_grep`, over every file. */
+extern u64 corpus_grep_total;
+
+/** Writes the places in the script or zone at `path` where the pattern
+ *  matches to `out`, with the values of its variables (a `batch_fn`).
+ *  Returns 0 on success, or nonzero if the file couldn't be read. */
+int corpus_grep(FILE *out, const char *path);
+
+//-- Querying -------------------------------------------------------
+/** Maps the index at `path`.  Returns 0 on success, or -1 if it couldn't be
+ *  read or isn't an index. */
+int corpus_open(struct corpus_index *ix, const char *path);
+
+void corpus_close(struct corpus_index *ix);
+
+/** Finds the keys of `kind` with the given `value` (or, for KEY_NAME, the
+ *  given `name`, or any name starting with it if `prefix` is set).  Stores
+ *  the first in `*first`, and returns how many there are. */
+int corpus_find(struct corpus_index *ix, enum corpus_kind kind, u32 value,
+                const char *name, int prefix, const struct corpus_key **first);
+
+/** Returns the path of file `i` of the index, or "" if there is none. */
+const char *corpus_file(struct corpus_index *ix, u32 i);
+
+#endif
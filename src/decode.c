@@ -0,0 +1,321 @@
+#include <stdlib.h>
+
+#include "decode.h"
+#include "arena.h"
+#include "timings.h"
+#include "poketools.h"
+#include "formats/script.h"
+
+//-- Single instructions --------------------------------------------
+/** Decodes the instruction at `code` into `instr`.  Returns nonzero if the
+ *  opcode is known (otherwise `instr->op` is -1). */
+int decode(struct instr *instr, u32 *code) {
+  u32 v  = *code;
+  u16 vh = v >> 16,
+      vl = v & 0xFFFF;
+
+  *instr = (struct instr) {
+    .op             = vl,
+    .high_half      = vh,
+    .uses_high_half = 0,
+    .nargs          = 0,
+    .args           = code + 1,
+  };
+
+  switch (vl) {
+    case 0x0009:                                    break;
+    case 0x000B: instr->nargs = 1;                  break; //   Often $b0029
+    case 0x000C:                                    break;
+    case 0x000E: instr->nargs = 1;                  break; //   Always a fairly low, int-aligned negative value
+    case 0x0017:                                    break;
+    case 0x0020:                                    break;
+    case 0x0022:                                    break;
+    case 0x0024:                                    break;
+ // case 0x0025: instr->uses_high_half = 1;         break; //   Happens in no zonefiles
+    case 0x0027: instr->nargs = 1;                  break; // PushConst -- looks like operand is either u32, 2×u16 or float
+    case 0x002B:                                    break;
+    case 0x002E:                                    break; // Begin
+    case 0x0030:                                    break; // Return
+    case 0x0031: instr->nargs = 1;                  break; // Call
+    case 0x0033: instr->nargs = 1;                  break; // Jump
+ // case 0x0034: instr->nargs = 1;                  break; // Jump??
+    case 0x0035: instr->nargs = 1;                  break; // JumpNE -- only ever forward
+    case 0x0036: instr->nargs = 1;                  break; // JumpEq -- only ever forward
+    case 0x0037: instr->nargs = 1;                  break; // Jump?? -- very frequently $20; occasionally high (~$100, $200, $300); only ever forward
+    case 0x0038: instr->nargs = 1;                  break; // Jump?? -- only ever forward
+    case 0x003D: instr->nargs = 1;                  break; // Jump?? -- only ever forward; often $10
+    case 0x003E: instr->nargs = 1;                  break; // Jump?? -- only ever forward
+    case 0x003F: instr->nargs = 1;                  break; // Jump?? -- only ever forward
+    case 0x0040: instr->nargs = 1;                  break; // Jump?? -- only ever forward; often fairly high
+    case 0x004E:                                    break; // Add?
+    case 0x0051:                                    break; // Cmp?
+    case 0x0059:                                    break; // PushFalse
+    case 0x0069: instr->nargs = 1;                  break; //   Only ever invoked with $ffff or very rarely $fff3 as the operand
+    case 0x0075: instr->nargs = 1;                  break; //   Only ever invoked with fairly low, int-aligned operand
+    case 0x0077: instr->nargs = 1;                  break; //   -||-
+    case 0x0078: instr->nargs = 1;                  break; //   Only ever invoked with $0c as the operand
+    case 0x0081: instr->nargs = 1;                  break; // Trampoline
+    case 0x0082: instr->nargs = 2*code[1] + 2;      break; // JumpMap
+    case 0x0087: instr->nargs = 2;                  break; // DoCommand?
+    case 0x0089:                                    break; // LineNo
+    case 0x008A: instr->nargs = 2;                  break;
+    case 0x008E: instr->nargs = 3;                  break;
+    case 0x0096: instr->nargs = 5;                  break;
+    case 0x009B: instr->nargs = 2;                  break; // Copy? -- both operands are small, positive or negative, int-aligned
+    case 0x009D: instr->nargs = 2;                  break; //   Low negative int-aligned, relatively low occasionally with high word as $0005
+    case 0x00A2: instr->uses_high_half = 1;         break; // GetGlobal2
+    case 0x00A3: instr->uses_high_half = 1;         break; // GetGlobal
+    case 0x00A4: instr->uses_high_half = 1;         break; // GetLocal
+    case 0x00AB: instr->uses_high_half = 1;         break; // PushTrue
+    case 0x00AC: instr->uses_high_half = 1;         break; // CmpConst2
+ // case 0x00AE: instr->uses_high_half = 1;         break; //            -- never used in zonefile
+    case 0x00AF: instr->uses_high_half = 1;         break; // SetGlobal
+    case 0x00B1: instr->uses_high_half = 1;         break; // SetLocal?
+    case 0x00B8: instr->uses_high_half = 1;         break; //   Only ever used with $02 as the operand
+    case 0x00B9: instr->uses_high_half = 1;         break; //   Only ever used with $02 as the operand
+    case 0x00BC: instr->uses_high_half = 1;         break; // PushConst
+    case 0x00BD: instr->uses_high_half = 1;         break; // GetGlobal3
+    case 0x00BE: instr->uses_high_half = 1;         break; // GetArg
+    case 0x00BF: instr->uses_high_half = 1;         break; // ResetLocal
+    case 0x00C5: instr->uses_high_half = 1;         break; //   Non-aligned, often small, always positive operand
+    case 0x00C6: instr->uses_high_half = 1;         break; //   Non-aligned, always small, always positive operand
+ // case 0x00C8: instr->uses_high_half = 1;         break; // CmpLocal   -- never used in zonefile
+    case 0x00C9: instr->uses_high_half = 1;         break; // CmpConst
+ // case 0x00CC: instr->uses_high_half = 1;         break; //            -- never used in zonefile
+ // case 0x00D4: instr->uses_high_half = 1;         break; //            -- never used in zonefile
+    case 0x00D2:                                    break; // Script Begin
+    default:
+      instr->op = -1;
+  }
+
+  return instr->op != -1;
+}
+
+
+//-- Decoded code blocks --------------------------------------------
+/** Returns nonzero if `op` is a relative jump/call (as far as labels go). */
+int is_branch(i32 op) {
+  switch (op) {
+    case 0x0031: case 0x0033: case 0x0034: case 0x0035: case 0x0036:
+    case 0x0037: case 0x0038:
+    case 0x003D: case 0x003E:
+    case 0x0040: case 0x005A:
+    case 0x0081:
+      return 1;
+  }
+  return 0;
+}
+
+/** Returns the mnemonic of the opcode `op`, or NULL if it has none. */
+const char *ir_op_name(i32 op) {
+  switch (op) {
+    case 0x0027: return "CPushConst";
+    case 0x002E: return "Begin";
+    case 0x0030: return "Return";
+    case 0x0031: return "Call";
+    case 0x0033: return "Jump";
+    case 0x0034: return "Jump??";
+    case 0x0035: return "JumpNE";
+    case 0x0036: return "JumpEq";
+    case 0x0037: return "Jump??";
+    case 0x0038: return "Jump??";
+    case 0x003D: return "Jump??";
+    case 0x003E: return "Jump??";
+    case 0x0040: return "Jump??";
+    case 0x004E: return "Add?";
+    case 0x0051: return "Cmp?";
+    case 0x0059: return "DPushFalse";
+    case 0x0081: return "Trampoline";
+    case 0x0082: return "JumpMap";
+    case 0x0087: return "DoCommand?";
+    case 0x0089: return "LineNo";
+    case 0x00A2: return "TGetGlobal2";
+    case 0x00A3: return "DGetGlobal";
+    case 0x00A4: return "DGetLocal";
+    case 0x00AB: return "DPushConst";
+    case 0x00AC: return "CmpConst2";
+    case 0x00AF: return "DSetGlobal";
+    case 0x00B1: return "DSetLocal";
+    case 0x00BC: return "CPushConst";
+    case 0x00BD: return "CGetGlobal";
+    case 0x00BE: return "CGetLocal";
+    case 0x00BF: return "CAdjustStack";
+    case 0x00C8: return "CmpLocal";
+    case 0x00C9: return "CmpConst";
+    case 0x00D2: return "Script Begin";
+  }
+  return NULL;
+}
+
+/** Returns the symbol type of the identifier the opcode `op` refers to, or 0
+ *  if it doesn't refer to one. */
+u32 ref_type(i32 op) {
+  switch (op) {
+    case 0x00A2: case 0x00A3: case 0x00AF: case 0x00BD:
+      return 0x0001;
+    case 0x00A4: case 0x00B1: case 0x00BE: case 0x00C8:
+      return 0x0101;
+  }
+  return 0;
+}
+
+/** Decodes every instruction of `code` into a newly-allocated IR. */
+struct code_ir *build_code_ir(struct code_block *code) {
+  TIMING_BEGIN(span, PHASE_DECODE);
+  u32 *ins = code->instrs;
+  int n     = code->ninstrs,
+      total = code->ninstrs + code->nmovement; // Operands may spill over
+
+  struct code_ir *ir = palloc(sizeof(struct code_ir));
+  int cap = n / 2 + 1, tcap = 16;
+  ir->ninstrs = 0;
+  ir->instrs = palloc(sizeof(struct ir_instr) * cap);
+  ir->ntargets = 0;
+  ir->targets = palloc(sizeof(i32) * tcap);
+
+  struct instr instr;
+  for (int i = 0; i < n; ) {
+    // A JumpMap's size is read from its first operand
+    int truncated = (ins[i] & 0xFFFF) == 0x0082 && i + 1 >= total;
+    if (truncated) instr = (struct instr) { .op = -1 };
+    else decode(&instr, &ins[i]);
+
+    struct ir_instr *out;
+    if (ir->ninstrs == cap) {
+      ir->instrs = prealloc(ir->instrs, sizeof(struct ir_instr) * cap,
+                            sizeof(struct ir_instr) * 2 * cap);
+      cap *= 2;
+    }
+    out = &ir->instrs[ir->ninstrs++];
+    *out = (struct ir_instr) {
+      .pos            = i,
+      .op             = instr.op,
+      .high_half      = instr.high_half,
+      .uses_high_half = instr.uses_high_half,
+      .flags          = truncated? IR_TRUNCATED : 0,
+      .nargs          = instr.nargs,
+      .target         = -1,
+      .ntargets       = 0,
+    };
+
+    if (instr.op == 0x0082) { // JumpMaps
+      // Targets are relative to the word holding each offset: the fallback
+      // at i + 2, then each choice's at i + 4 + 2*j.
+      int choices = (int) ins[i + 1];
+      out->flags |= IR_JUMPMAP;
+      out->target = ir->ntargets;
+
+      for (int k = 0; k <= choices && i + 2 + 2*k < total; k++) {
+        int idx = i + 2 + 2*k;
+        if (ir->ntargets == tcap) {
+          ir->targets = prealloc(ir->targets, sizeof(i32) * tcap, sizeof(i32) * 2 * tcap);
+          tcap *= 2;
+        }
+        ir->targets[ir->ntargets++] = idx + (int) ins[idx]/4 - 1;
+        out->ntargets++;
+      }
+
+      // The printer gives up on maps with choices that run off the code
+      int broken = choices < 0 || out->ntargets < (long) choices + 1;
+      for (int k = 1; !broken && k <= choices; k++) {
+        if (ir->targets[out->target + k] - 1 >= n) broken = 1;
+      }
+      if (broken) {
+        out->flags |= IR_BROKEN;
+        out->nargs = 0;
+      }
+
+    } else if (i + instr.nargs >= total) {
+      out->flags |= IR_TRUNCATED;
+      out->op = -1;
+      out->nargs = 0;
+
+    } else if (is_branch(instr.op)) {
+      out->flags |= IR_BRANCH;
+      out->target = i + (int) ins[i + 1]/4;
+    }
+
+    i += out->nargs + 1;
+  }
+
+  TIMING_COUNT(instrs, ir->ninstrs);
+  TIMING_END(span, n * sizeof(u32), 0);
+  return ir;
+}
+
+/** Returns the IR of `code`, decoding it on first use. */
+struct code_ir *get_code_ir(struct code_block *code) {
+  if (code->ir == NULL) code->ir = build_code_ir(code);
+  return code->ir;
+}
+
+/** Frees an IR built by `build_code_ir`. */
+void free_code_ir(struct code_ir *ir) {
+  if (ir == NULL) return;
+  pfree(ir->instrs);
+  pfree(ir->targets);
+  pfree(ir);
+}
+
+/** Returns the index of the instruction at word `pos` in `ir`, or -1. */
+int ir_index_of(struct code_ir *ir, u32 pos) {
+  int lo = 0, hi = ir->ninstrs;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (ir->instrs[mid].pos < pos) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo < ir->ninstrs && ir->instrs[lo].pos == pos? lo : -1;
+}
+
+
+//-- Labels ---------------------------------------------------------
+/** Marks the labels of `code` in `labels`. */
+void assign_labels(u32 *labels, struct code_block *code, struct code_ir *ir) {
+  TIMING_BEGIN(span, PHASE_LABELS);
+  int n = code->ninstrs;
+
+  // First mark all targets for jump instructions
+  for (int k = 0; k < ir->ninstrs; k++) {
+    struct ir_instr *instr = &ir->instrs[k];
+    u32 i = instr->pos;
+
+    switch (instr->op) {
+      case 0x002E: { // Begin
+        labels[i] = -1;
+      } break;
+
+      case 0x0031: case 0x0033: case 0x0034: case 0x0035: case 0x0036:
+      case 0x0037: case 0x0038:
+      case 0x003D: case 0x003E:
+      case 0x0040: case 0x005A: { // Jumps
+        u32 target = instr->target;
+        if (target < n && labels[target] == 0) labels[target] = 1;
+      } break;
+
+      case 0x0081: { // Trampoline
+        u32 target = instr->target;
+        if (target < n) labels[target] = 1;
+      } break;
+
+      case 0x0082: { // JumpMaps
+        labels[i] = 1;
+        for (int j = 0; j < instr->ntargets; j++) {
+          if (i + 2 + 2*j >= n) break;
+          u32 target = ir->targets[instr->target + j];
+          if (target < n && labels[target] == 0) labels[target] = 1;
+        }
+      } break;
+    }
+  }
+
+  // Then, compute proper label indices within each function
+  u32 counter = 0;
+  for (int i = 0; i < n; i++) {
+    switch (labels[i]) {
+      case -1: counter = 0;           break; // Begin: function label
+      case  1: labels[i] = ++counter; break; // Local label
+    }
+  }
+  TIMING_END(span, 0, 0);
+}
@@ -0,0 +1,79 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include "poketools.h"
+#include "formats/script.h"
+
+//-- Single instructions --------------------------------------------
+struct instr {
+  i32 op;
+  i32 high_half;
+  int uses_high_half;
+  int nargs;
+  u32 *args;
+};
+
+/** Decodes the instruction at `code` into `instr`.  Returns nonzero if the
+ *  opcode is known (otherwise `instr->op` is -1). */
+int decode(struct instr *instr, u32 *code);
+
+
+//-- Decoded code blocks --------------------------------------------
+#define IR_BRANCH    0x01 // `target` is a branch target
+#define IR_JUMPMAP   0x02 // `target` indexes `targets` (fallback, then choices)
+#define IR_BROKEN    0x04 // JumpMap whose choices run off the code; treated
+                          // as a single word
+#define IR_TRUNCATED 0x08 // Operands run past the end of the block; treated
+                          // as an unknown single word
+
+/** A decoded instruction. */
+struct ir_instr {
+  u32 pos;            // Word index of the opcode in `code->instrs`
+  i32 op;             // Opcode, or -1 if unknown
+  u16 high_half;
+  u8  uses_high_half;
+  u8  flags;
+  u32 nargs;          // Number of operand words that follow
+  i32 target;         // Branch target (word index), or first JumpMap target
+  u32 ntargets;       // Number of JumpMap targets present
+};
+
+/** A code block decoded once into a flat instruction array. */
+struct code_ir {
+  int ninstrs;
+  struct ir_instr *instrs;
+  int ntargets;
+  i32 *targets;       // JumpMap targets; word indices, or -1 if unresolved
+};
+
+/** Decodes every instruction of `code` into a newly-allocated IR. */
+struct code_ir *build_code_ir(struct code_block *code);
+
+/** Returns the IR of `code`, decoding it on first use.  The IR is cached in
+ *  `code`, and shared by the label pass, the printer and any other analysis. */
+struct code_ir *get_code_ir(struct code_block *code);
+
+/** Frees an IR built by `build_code_ir`. */
+void free_code_ir(struct code_ir *ir);
+
+/** Returns the index of the instruction at word `pos` in `ir`, or -1 if no
+ *  instruction starts there. */
+int ir_index_of(struct code_ir *ir, u32 pos);
+
+/** Returns the mnemonic of the opcode `op`, or NULL if it has none. */
+const char *ir_op_name(i32 op);
+
+/** Returns the symbol type of the identifier the opcode `op` refers to in
+ *  its high half (0x0001 for globals, 0x0101 for locals), or 0 if it doesn't
+ *  refer to one. */
+u32 ref_type(i32 op);
+
+
+//-- Labels ---------------------------------------------------------
+/** Marks the branch targets of `code` in `labels`, which must have room for
+ *  `code->ninstrs + code->nmovement + 1` zeroed entries: -1 where a function
+ *  begins, and otherwise the number (1, 2, ...) of each local label within
+ *  its function. */
+void assign_labels(u32 *labels, struct code_block *code, struct code_ir *ir);
+
+#endif
@@ -0,0 +1,520 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "diff.h"
+#include "decode.h"
+#include "arena.h"
+#include "intern.h"
+
+#define FMT_HEAD    "\x1B[1m"
+#define FMT_REMOVED "\x1B[31m"
+#define FMT_ADDED   "\x1B[32m"
+#define FMT_COMMENT "\x1B[38;5;243m"
+#define FMT_END     "\x1B[m"
+
+// Changed functions bigger than this (old instructions times new ones, after
+// the common start and end) are shown as replaced outright
+#define DIFF_MAX_CELLS (1 << 22)
+
+//-- Fingerprints ---------------------------------------------------
+/** Mixes `v` into the hash `h`. */
+u64 diff_mix(u64 h, u64 v) {
+  h = (h ^ v) * 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 32;
+  return h * 0xC4CEB9FE1A85EC53ULL;
+}
+
+u64 diff_string_hash(const char *s) {
+  u64 h = 0xCBF29CE484222325ULL; // FNV-1a
+  for (; *s; s++) h = (h ^ (u8) *s) * 0x100000001B3ULL;
+  return h;
+}
+
+/** Hashes the name `s` from the debug info of `b`, as `diff_string_hash`
+ *  does; interned names have it already. */
+u64 diff_name_hash(struct diff_block *b, const char *s) {
+  return b->debug->interned? intern_hash(s) : diff_string_hash(s);
+}
+
+/** Returns the function starting at word `target` of `b`, by name, or NULL
+ *  if it has none. */
+const char *diff_function_name(struct diff_block *b, i32 target) {
+  if (b->debug == NULL || target < 0) return NULL;
+  const struct debug_symbol *sym = lookup_sym(b->debug, target * 4, 0x0009, 0);
+  return sym != NULL? sym->name : NULL;
+}
+
+/** Returns whether the word `target` is inside `f`. */
+int diff_inside(struct diff_function *f, i32 target) {
+  return target >= (i32) f->start && target < (i32) f->end;
+}
+
+/** Hashes the branch target `target` of an instruction of `f`: if it's
+ *  inside `f`, by its offset (if `exact`, or else not at all), and otherwise
+ *  by the name of the function there (all unnamed ones are alike). */
+u64 diff_target_hash(struct diff_block *b, struct diff_function *f, i32 target,
+                     int exact) {
+  if (diff_inside(f, target)) return diff_mix(1, exact? target - f->start : 0);
+  const char *name = diff_function_name(b, target);
+  return diff_mix(2, name != NULL? diff_name_hash(b, name) : 0);
+}
+
+/** Returns whether operand word `idx` of `instr` holds a branch offset. */
+int diff_is_offset(struct ir_instr *instr, u32 idx) {
+  u32 k = idx - instr->pos;
+  if (instr->flags & IR_JUMPMAP) return k >= 2 && k % 2 == 0;
+  return instr->flags & IR_BRANCH && k == 1;
+}
+
+/** Hashes the instruction `instr` of `f`, with its branch targets in place
+ *  of their offsets.  Unless `exact`, targets inside `f` all hash the same,
+ *  so code added or removed before them doesn't count. */
+u64 diff_instr_hash(struct diff_block *b, struct diff_function *f,
+                    struct code_ir *ir, struct ir_instr *instr, int exact) {
+  u32 *ins = b->code->instrs;
+  if (instr->op < 0) return diff_mix(3, ins[instr->pos]);
+
+  u64 h = diff_mix(instr->op, instr->uses_high_half? instr->high_half : 0x10000);
+  for (u32 idx = instr->pos + 1; idx <= instr->pos + instr->nargs; idx++) {
+    if (!diff_is_offset(instr, idx)) h = diff_mix(h, ins[idx]);
+  }
+  if (instr->flags & IR_BRANCH) h = diff_mix(h, diff_target_hash(b, f, instr->target, exact));
+  if (instr->flags & IR_JUMPMAP) {
+    for (u32 j = 0; j < instr->ntargets; j++) {
+      h = diff_mix(h, diff_target_hash(b, f, ir->targets[instr->target + j], exact));
+    }
+  }
+  return h;
+}
+
+void diff_split(struct diff_block *b, struct code_block *code,
+                struct debug_block *debug) {
+  struct code_ir *ir = get_code_ir(code);
+  b->code = code;
+  b->debug = debug;
+  b->nfunctions = 0;
+  b->functions = palloc(sizeof(struct diff_function) * ir->ninstrs + 1);
+
+  // Code before the first `Begin` makes a function of its own
+  for (int k = 0; k < ir->ninstrs; k++) {
+    struct ir_instr *instr = &ir->instrs[k];
+    if (instr->op == 0x002E || k == 0) {
+      if (b->nfunctions > 0) b->functions[b->nfunctions - 1].end = instr->pos;
+      b->functions[b->nfunctions++] = (struct diff_function) {
+        .start = instr->pos, .end = code->ninstrs, .first = k,
+        .name = diff_function_name(b, instr->pos), .match = -1,
+      };
+    }
+    b->functions[b->nfunctions - 1].ninstrs++;
+  }
+
+  // The ends must be known before targets can be told apart
+  for (int i = 0; i < b->nfunctions; i++) {
+    struct diff_function *f = &b->functions[i];
+    u64 h = f->ninstrs;
+    for (int k = f->first; k < f->first + f->ninstrs; k++) {
+      h = diff_mix(h, diff_instr_hash(b, f, ir, &ir->instrs[k], 1));
+    }
+    f->hash = h;
+  }
+}
+
+
+//-- Matching -------------------------------------------------------
+/** A hash table from keys to the functions of a block with that key, in
+ *  order, as chains through `next`.  Functions are unlinked as they are
+ *  paired, so each lookup only ever sees unpaired ones. */
+struct diff_table {
+  int interned;       // Whether names on both sides are interned
+  u32 mask;
+  int *head;
+  int *next;
+  u64 *keys;
+};
+
+void diff_table_init(struct diff_table *t, int n) {
+  u32 size = 16;
+  t->interned = 0;
+  while (size < 2 * (u32) n) size *= 2;
+  t->mask = size - 1;
+  t->head = malloc(sizeof(int) * size);
+  t->next = malloc(sizeof(int) * n + 1);
+  t->keys = malloc(sizeof(u64) * n + 1);
+  for (u32 i = 0; i < size; i++) t->head[i] = -1;
+}
+
+void diff_table_free(struct diff_table *t) {
+  free(t->head);
+  free(t->next);
+  free(t->keys);
+}
+
+/** Adds the functions of `b` that are still unpaired (and, if `named`,
+ *  have names), keyed by fingerprint or by name. */
+void diff_table_fill(struct diff_table *t, struct diff_block *b, int named) {
+  // Added last to first, so chains are in order
+  for (int i = b->nfunctions - 1; i >= 0; i--) {
+    struct diff_function *f = &b->functions[i];
+    if (f->match >= 0 || (named && f->name == NULL)) continue;
+    t->keys[i] = named? diff_name_hash(b, f->name) : f->hash;
+    u32 slot = t->keys[i] & t->mask;
+    t->next[i] = t->head[slot];
+    t->head[slot] = i;
+  }
+}
+
+/** Takes the first function under `key` out of `t` and returns its index,
+ *  or -1 if there is none.  With `name`, the names must match too: interned
+ *  ones by pointer. */
+int diff_table_take(struct diff_table *t, struct diff_block *b, u64 key,
+                    const char *name) {
+  int *link = &t->head[key & t->mask];
+  for (int i = *link; i >= 0; link = &t->next[i], i = *link) {
+    if (t->keys[i] != key) continue;
+    if (name != NULL && b->functions[i].name != name
+        && (t->interned || strcmp(b->functions[i].name, name) != 0)) continue;
+    *link = t->next[i];
+    return i;
+  }
+  return -1;
+}
+
+void diff_pair(struct diff_block *old, int i, struct diff_block *new, int j) {
+  old->functions[i].match = j;
+  new->functions[j].match = i;
+  old->functions[i].same = new->functions[j].same = old->functions[i].hash == new->functions[j].hash;
+}
+
+void diff_match(struct diff_block *old, struct diff_block *new) {
+  struct diff_table t;
+  diff_table_init(&t, old->nfunctions);
+
+  // Unchanged functions, wherever they are now
+  diff_table_fill(&t, old, 0);
+  for (int j = 0; j < new->nfunctions; j++) {
+    int i = diff_table_take(&t, old, new->functions[j].hash, NULL);
+    if (i >= 0) diff_pair(old, i, new, j);
+  }
+
+  // Changed ones with the same name
+  for (u32 s = 0; s <= t.mask; s++) t.head[s] = -1;
+  t.interned = old->debug != NULL && new->debug != NULL
+               && old->debug->interned && new->debug->interned;
+  diff_table_fill(&t, old, 1);
+  for (int j = 0; j < new->nfunctions; j++) {
+    struct diff_function *f = &new->functions[j];
+    if (f->match >= 0 || f->name == NULL) continue;
+    int i = diff_table_take(&t, old, diff_name_hash(new, f->name), f->name);
+    if (i >= 0) diff_pair(old, i, new, j);
+  }
+  diff_table_free(&t);
+
+  // Unnamed ones, in order, between the ones paired so far
+  int prev = -1;
+  for (int j = 0; j < new->nfunctions; j++) {
+    struct diff_function *f = &new->functions[j];
+    if (f->match >= 0) {
+      prev = f->match;
+      continue;
+    }
+    int i = prev + 1;
+    if (f->name != NULL || i >= old->nfunctions) continue;
+    if (old->functions[i].match >= 0 || old->functions[i].name != NULL) continue;
+    diff_pair(old, i, new, j);
+    prev = i;
+  }
+}
+
+
+//-- Output ---------------------------------------------------------
+/** Writes the name of function `f`. */
+void render_function_name(struct render *r, struct diff_function *f) {
+  if (f->name != NULL) {
+    render_str(r, f->name);
+  } else {
+    render_str(r, "Func_");
+    render_hex(r, f->start * 4, 4, '0');
+  }
+}
+
+/** Writes the branch target `target` of an instruction of `f`, the way
+ *  `diff_target_hash` sees it. */
+void render_diff_target(struct render *r, struct diff_block *b,
+                        struct diff_function *f, i32 target) {
+  if (diff_inside(f, target)) {
+    render_str(r, "@+");
+    render_hex(r, (target - f->start) * 4, 0, '0');
+    return;
+  }
+  const char *name = diff_function_name(b, target);
+  render_str(r, name != NULL? name : "@?");
+}
+
+/** Writes one line for instruction `k` of the IR, in function `f` of `b`:
+ *  the marker `mark`, its offset in `f`, and the instruction with branch
+ *  offsets replaced by targets. */
+void render_diff_line(struct render *r, struct diff_block *b,
+                      struct diff_function *f, int k, char mark) {
+  struct code_ir *ir = b->code->ir;
+  struct ir_instr *instr = &ir->instrs[k];
+  u32 *ins = b->code->instrs;
+
+  if (mark != ' ') render_sgr(r, mark == '-'? FMT_REMOVED : FMT_ADDED);
+  render_str(r, "    ");
+  render_char(r, mark);
+  render_str(r, " +");
+  render_hex(r, (instr->pos - f->start) * 4, 4, '0');
+  render_str(r, "  ");
+
+  const char *name = ir_op_name(instr->op);
+  if (instr->op < 0 || name == NULL) {
+    render_str(r, "Unknown ");
+    render_hex(r, ins[instr->pos], 8, '0');
+  } else {
+    render_str(r, name);
+    if (instr->uses_high_half) {
+      render_str(r, " $");
+      render_hex(r, instr->high_half, 4, '0');
+    }
+    for (u32 idx = instr->pos + 1; idx <= instr->pos + instr->nargs; idx++) {
+      if (diff_is_offset(instr, idx)) continue;
+      render_char(r, ' ');
+      render_hex(r, ins[idx], 8, '0');
+    }
+    if (instr->flags & IR_BRANCH) {
+      render_str(r, " -> ");
+      render_diff_target(r, b, f, instr->target);
+    }
+    for (u32 j = 0; instr->flags & IR_JUMPMAP && j < instr->ntargets; j++) {
+      render_str(r, j == 0? " -> " : ", ");
+      render_diff_target(r, b, f, ir->targets[instr->target + j]);
+    }
+  }
+  if (mark != ' ') render_sgr(r, FMT_END);
+  render_char(r, '\n');
+}
+
+/** A step of an edit script: an instruction kept (`=`), removed (`-`) or
+ *  added (`+`), by its index in the old or new IR. */
+struct diff_edit {
+  char kind;
+  int a, b;
+};
+
+/** Hashes the instructions of function `f` of `b` into a new array, going
+ *  by what their branch targets are rather than where. */
+u64 *diff_instr_hashes(struct diff_block *b, struct diff_function *f) {
+  u64 *h = malloc(sizeof(u64) * f->ninstrs + 1);
+  for (int k = 0; k < f->ninstrs; k++) {
+    h[k] = diff_instr_hash(b, f, b->code->ir, &b->code->ir->instrs[f->first + k], 0);
+  }
+  return h;
+}
+
+/** Returns the index of the instruction of `ir` that word `pos` is part of
+ *  (the last one starting at or before it). */
+int diff_instr_at(struct code_ir *ir, u32 pos) {
+  int lo = 0, hi = ir->ninstrs;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (ir->instrs[mid].pos <= pos) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo - 1;
+}
+
+/** Returns whether the branch targets inside `fa` and `fb` of the aligned
+ *  instructions `ka` and `kb` are aligned too, going by `to_b` (the
+ *  instruction of `fb` each one of `fa` is aligned with, or -1). */
+int diff_same_targets(struct diff_block *a, struct diff_function *fa, int ka,
+                      struct diff_block *b, struct diff_function *fb, int kb,
+                      const int *to_b) {
+  struct ir_instr *ia = &a->code->ir->instrs[ka],
+                  *ib = &b->code->ir->instrs[kb];
+  i32 *ta = &ia->target, *tb = &ib->target;
+  u32 n = 1;
+  if (ia->flags & IR_JUMPMAP) {
+    if (ia->ntargets != ib->ntargets) return 0;
+    ta = &a->code->ir->targets[ia->target];
+    tb = &b->code->ir->targets[ib->target];
+    n = ia->ntargets;
+  } else if (!(ia->flags & IR_BRANCH)) {
+    return 1;
+  }
+
+  for (u32 j = 0; j < n; j++) {
+    if (!diff_inside(fa, ta[j]) || !diff_inside(fb, tb[j])) continue; // Hashed by name
+
+    // Possibly into the middle of an instruction, which must then be
+    // entered at the same word
+    int ta_k = diff_instr_at(a->code->ir, ta[j]),
+        tb_k = diff_instr_at(b->code->ir, tb[j]);
+    if (to_b[ta_k - fa->first] != tb_k
+        || ta[j] - a->code->ir->instrs[ta_k].pos != tb[j] - b->code->ir->instrs[tb_k].pos) return 0;
+  }
+  return 1;
+}
+
+/** Builds the edit script from `fa` to `fb` into `edits` (which must have
+ *  room for both functions' instructions), returning its length.  The
+ *  longest common subsequence, after taking off the common start and end,
+ *  of the instructions going by what they branch to; then those that branch
+ *  to instructions that aren't aligned with each other count as changed. */
+int diff_edits(struct diff_edit *edits, struct diff_block *a, struct diff_function *fa,
+               struct diff_block *b, struct diff_function *fb) {
+  u64 *ha = diff_instr_hashes(a, fa),
+      *hb = diff_instr_hashes(b, fb);
+  int na = fa->ninstrs, nb = fb->ninstrs, nedits = 0;
+
+  int pre = 0, post = 0;
+  while (pre < na && pre < nb && ha[pre] == hb[pre]) pre++;
+  while (post < na - pre && post < nb - pre && ha[na - 1 - post] == hb[nb - 1 - post]) post++;
+  for (int k = 0; k < pre; k++) edits[nedits++] = (struct diff_edit) { '=', fa->first + k, fb->first + k };
+
+  // lcs[i][j]: of the middles of `a` from `i` and `b` from `j`
+  int ma = na - pre - post, mb = nb - pre - post;
+  u32 *lcs = NULL;
+  if ((u64) (ma + 1) * (mb + 1) <= DIFF_MAX_CELLS) lcs = calloc((size_t) (ma + 1) * (mb + 1), sizeof(u32));
+  #define LCS(i, j) lcs[(size_t) (i) * (mb + 1) + (j)]
+  for (int i = ma - 1; lcs != NULL && i >= 0; i--) {
+    for (int j = mb - 1; j >= 0; j--) {
+      LCS(i, j) = ha[pre + i] == hb[pre + j]? LCS(i + 1, j + 1) + 1
+                : LCS(i + 1, j) > LCS(i, j + 1)? LCS(i + 1, j) : LCS(i, j + 1);
+    }
+  }
+
+  int i = 0, j = 0;
+  while (lcs != NULL && i < ma && j < mb) {
+    if (ha[pre + i] == hb[pre + j]) {
+      edits[nedits++] = (struct diff_edit) { '=', fa->first + pre + i++, fb->first + pre + j++ };
+    } else if (LCS(i + 1, j) >= LCS(i, j + 1)) {
+      edits[nedits++] = (struct diff_edit) { '-', fa->first + pre + i++, -1 };
+    } else {
+      edits[nedits++] = (struct diff_edit) { '+', -1, fb->first + pre + j++ };
+    }
+  }
+  #undef LCS
+  for (; i < ma; i++) edits[nedits++] = (struct diff_edit) { '-', fa->first + pre + i, -1 };
+  for (; j < mb; j++) edits[nedits++] = (struct diff_edit) { '+', -1, fb->first + pre + j };
+
+  for (int k = post; k > 0; k--) {
+    edits[nedits++] = (struct diff_edit) { '=', fa->first + na - k, fb->first + nb - k };
+  }
+  free(lcs);
+  free(ha);
+  free(hb);
+
+  // Every `=` may become a `-` and a `+`, which still fits
+  int *to_b = malloc(sizeof(int) * na + 1);
+  for (int k = 0; k < na; k++) to_b[k] = -1;
+  for (int k = 0; k < nedits; k++) {
+    if (edits[k].kind == '=') to_b[edits[k].a - fa->first] = edits[k].b;
+  }
+  struct diff_edit *kept = malloc(sizeof(struct diff_edit) * nedits + 1);
+  memcpy(kept, edits, sizeof(struct diff_edit) * nedits);
+  int n = nedits;
+  nedits = 0;
+  for (int k = 0; k < n; k++) {
+    struct diff_edit e = kept[k];
+    if (e.kind == '=' && !diff_same_targets(a, fa, e.a, b, fb, e.b, to_b)) {
+      edits[nedits++] = (struct diff_edit) { '-', e.a, -1 };
+      edits[nedits++] = (struct diff_edit) { '+', -1, e.b };
+    } else {
+      edits[nedits++] = e;
+    }
+  }
+  free(kept);
+  free(to_b);
+  return nedits;
+}
+
+/** Writes the changes from function `fa` of `a` to `fb` of `b`. */
+void render_function_diff(struct render *r, struct diff_block *a, struct diff_function *fa,
+                          struct diff_block *b, struct diff_function *fb, int context) {
+  render_sgr(r, FMT_HEAD);
+  render_str(r, "  ~ ");
+  render_function_name(r, fb);
+  render_sgr(r, FMT_END);
+  render_fmt(r, "  (%d -> %d instructions)\n", fa->ninstrs, fb->ninstrs);
+
+  struct diff_edit *edits = malloc(sizeof(struct diff_edit) * (fa->ninstrs + fb->ninstrs) + 1);
+  int n = diff_edits(edits, a, fa, b, fb);
+
+  // Distance to the nearest change, looking back and ahead
+  int *near = malloc(sizeof(int) * n + 1);
+  for (int k = 0, d = n + context + 1; k < n; k++) {
+    d = edits[k].kind != '='? 0 : d + 1;
+    near[k] = d;
+  }
+  for (int k = n - 1, d = n + context + 1; k >= 0; k--) {
+    d = edits[k].kind != '='? 0 : d + 1;
+    if (d < near[k]) near[k] = d;
+  }
+
+  int skipped = 0;
+  for (int k = 0; k < n; k++) {
+    if (near[k] > context) {
+      skipped = 1;
+      continue;
+    }
+    if (skipped) {
+      render_sgr(r, FMT_COMMENT);
+      render_str(r, "      ...\n");
+      render_sgr(r, FMT_END);
+      skipped = 0;
+    }
+    struct diff_edit *e = &edits[k];
+    if (e->kind == '-') render_diff_line(r, a, fa, e->a, '-');
+    else render_diff_line(r, b, fb, e->b, e->kind == '+'? '+' : ' ');
+  }
+  if (skipped) {
+    render_sgr(r, FMT_COMMENT);
+    render_str(r, "      ...\n");
+    render_sgr(r, FMT_END);
+  }
+  free(near);
+  free(edits);
+}
+
+/** Writes a function added (`mark` '+') or removed ('-'). */
+void render_function_only(struct render *r, struct diff_function *f, char mark) {
+  render_sgr(r, mark == '-'? FMT_REMOVED : FMT_ADDED);
+  render_str(r, "  ");
+  render_char(r, mark);
+  render_char(r, ' ');
+  render_function_name(r, f);
+  render_fmt(r, "  (%d instructions)\n", f->ninstrs);
+  render_sgr(r, FMT_END);
+}
+
+int render_diff(struct render *r, const char *name, struct diff_block *old,
+                struct diff_block *new, int context, struct diff_summary *sum) {
+  int same = 0;
+  for (int j = 0; j < new->nfunctions; j++) same += new->functions[j].same;
+  sum->same += same;
+  if (same == old->nfunctions && same == new->nfunctions) return 0;
+
+  render_sgr(r, FMT_HEAD);
+  render_str(r, "=== ");
+  render_str(r, name);
+  render_sgr(r, FMT_END);
+  render_char(r, '\n');
+
+  // In the new order, then whatever was removed
+  for (int j = 0; j < new->nfunctions; j++) {
+    struct diff_function *f = &new->functions[j];
+    if (f->match < 0) {
+      render_function_only(r, f, '+');
+      sum->added++;
+    } else if (!f->same) {
+      render_function_diff(r, old, &old->functions[f->match], new, f, context);
+      sum->changed++;
+    }
+  }
+  for (int i = 0; i < old->nfunctions; i++) {
+    if (old->functions[i].match >= 0) continue;
+    render_function_only(r, &old->functions[i], '-');
+    sum->removed++;
+  }
+  return 1;
+}
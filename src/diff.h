@@ -0,0 +1,59 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include "poketools.h"
+#include "render.h"
+#include "formats/script.h"
+
+/** Structural diffs of code blocks, function by function.  A block is split
+ *  into functions at each `Begin`, and every function gets a fingerprint
+ *  that doesn't depend on where it is: branch targets inside it count by
+ *  their offset from its start, and targets outside it (calls, mostly) by
+ *  the name of the function they go to, if known.  So moving a function, or
+ *  changing another one, leaves its fingerprint alone, and functions with
+ *  the same fingerprint in both blocks are taken as unchanged without a
+ *  closer look.  The rest are paired up by name (or, unnamed, by their
+ *  order between unchanged ones), and only those are diffed instruction by
+ *  instruction. */
+
+/** A function of a code block. */
+struct diff_function {
+  u32 start, end;     // Word range [start, end) in `code->instrs`
+  int first;          // First instruction in the IR
+  int ninstrs;
+  const char *name;   // From the debug info, or NULL
+  u64 hash;           // Fingerprint of all its instructions
+  int match;          // Index of the function paired with it, or -1
+  int same;           // Whether that one has the same fingerprint
+};
+
+/** A code block split into functions. */
+struct diff_block {
+  struct code_block *code;
+  struct debug_block *debug;
+  int nfunctions;
+  struct diff_function *functions;
+};
+
+/** Totals over the blocks diffed. */
+struct diff_summary {
+  int same, changed, added, removed;
+};
+
+/** Splits `code` into fingerprinted functions, named from `debug` if not
+ *  NULL. */
+void diff_split(struct diff_block *b, struct code_block *code,
+                struct debug_block *debug);
+
+/** Pairs up the functions of `old` and `new` (setting their `match` and
+ *  `same`). */
+void diff_match(struct diff_block *old, struct diff_block *new);
+
+/** Writes what changed between the paired blocks `old` and `new` (the
+ *  block named `name`) to `r`, with `context` unchanged instructions around
+ *  each change, and adds it up in `sum`.  Returns whether anything did: if
+ *  not, nothing is written. */
+int render_diff(struct render *r, const char *name, struct diff_block *old,
+                struct diff_block *new, int context, struct diff_summary *sum);
+
+#endif
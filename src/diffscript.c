@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "poketools.h"
+#include "batch.h"
+#include "diff.h"
+#include "mapfile.h"
+#include "render.h"
+#include "timings.h"
+#include "formats/script.h"
+#include "formats/zonedata.h"
+
+/** The two sides: two files, or two directories whose files are paired by
+ *  their paths below them. */
+const char *old_root, *new_root;
+int diff_dirs = 0;
+int diff_context = 3;
+
+// Totals, added to by every job
+struct diff_summary diff_total;
+int files_same = 0, files_differ = 0, files_only = 0;
+
+/** The code blocks of a script or zone. */
+struct diff_input {
+  struct mapped_file file;
+  int ncode;
+  struct code_block *code[2];
+  struct debug_block *debug;
+};
+
+/** Maps and parses the script or zone at `path` into `in`.  Returns 0, or
+ *  -1 (having said why) if it isn't one. */
+int diff_load(struct diff_input *in, const char *path) {
+  if (map_file(&in->file, path) < 0) {
+    fprintf(stderr, "Couldn't open '%s' for reading.\n", path);
+    return -1;
+  }
+
+  u32 magic = 0;
+  if (in->file.size >= sizeof(u32)) memcpy(&magic, in->file.data, sizeof(u32));
+
+  in->ncode = 0;
+  in->debug = NULL;
+  if (magic == 0x00044F5A) {
+    struct zonedata *zone = parse_zonedata(in->file.data, in->file.size);
+    if (zone != NULL) {
+      in->code[0] = zone->code1;
+      in->code[1] = zone->code2;
+      in->ncode = 2;
+    }
+  } else {
+    // A script: its code section, and its debug section for names
+    u8 *data = in->file.data;
+    size_t start = 0;
+    while (in->file.size - start >= 2 * sizeof(u32)) {
+      u32 size, section_magic;
+      memcpy(&size,          data + start,               sizeof(u32));
+      memcpy(&section_magic, data + start + sizeof(u32), sizeof(u32));
+
+      if (section_magic == 0x0A0AF1E0 && in->ncode == 0) {
+        in->code[0] = parse_code_block(data + start, in->file.size - start, NULL);
+        in->ncode = in->code[0] != NULL;
+      } else if (section_magic == 0x0A0AF1EF && in->debug == NULL) {
+        in->debug = parse_debug_block(data + start, in->file.size - start, NULL);
+      } else break;
+      if (size == 0 || size > in->file.size - start) break;
+      start += size;
+    }
+  }
+
+  if (in->ncode == 0) {
+    fprintf(stderr, "%s: Not a script or zone.\n", path);
+    unmap_file(&in->file);
+    return -1;
+  }
+  return 0;
+}
+
+/** Diffs the two versions of `path` (a `batch_fn`): below the roots when
+ *  comparing directories, or the roots themselves. */
+int diffscript(FILE *out, const char *path) {
+  char old_path[4096], new_path[4096];
+  if (diff_dirs) {
+    snprintf(old_path, sizeof(old_path), "%s/%s", old_root, path);
+    snprintf(new_path, sizeof(new_path), "%s/%s", new_root, path);
+  } else {
+    snprintf(old_path, sizeof(old_path), "%s", old_root);
+    snprintf(new_path, sizeof(new_path), "%s", new_root);
+  }
+
+  // Files on one side only
+  int in_old = access(old_path, F_OK) == 0,
+      in_new = access(new_path, F_OK) == 0;
+  if (in_old != in_new) {
+    fprintf(out, "Only in %s: %s\n", in_old? old_root : new_root, path);
+    __atomic_add_fetch(&files_only, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  struct diff_input a, b;
+  if (diff_load(&a, old_path) < 0) return 2;
+  if (diff_load(&b, new_path) < 0) {
+    unmap_file(&a.file);
+    return 2;
+  }
+
+  struct render r;
+  render_init(&r, out);
+  struct diff_summary sum = { 0 };
+  int written = 0;
+
+  if (a.ncode != b.ncode) {
+    render_fmt(&r, "=== %s: a %s and a %s\n", path, a.ncode > 1? "zone" : "script",
+               b.ncode > 1? "zone" : "script");
+    written = 1;
+  } else {
+    // Names only help if both sides have them
+    if (a.debug == NULL || b.debug == NULL) a.debug = b.debug = NULL;
+    for (int k = 0; k < a.ncode; k++) {
+      struct diff_block old, new;
+      diff_split(&old, a.code[k], a.debug);
+      diff_split(&new, b.code[k], b.debug);
+      diff_match(&old, &new);
+
+      char name[4200];
+      if (a.ncode > 1) snprintf(name, sizeof(name), "%s (code%d)", path, k + 1);
+      else snprintf(name, sizeof(name), "%s", path);
+      written |= render_diff(&r, name, &old, &new, diff_context, &sum);
+    }
+  }
+  render_flush(&r);
+
+  __atomic_add_fetch(written? &files_differ : &files_same, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&diff_total.same,    sum.same,    __ATOMIC_RELAXED);
+  __atomic_add_fetch(&diff_total.changed, sum.changed, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&diff_total.added,   sum.added,   __ATOMIC_RELAXED);
+  __atomic_add_fetch(&diff_total.removed, sum.removed, __ATOMIC_RELAXED);
+
+  unmap_file(&a.file);
+  unmap_file(&b.file);
+  return 0;
+}
+
+/** Adds the paths of the files below `root`, relative to it, to `list`. */
+void add_relative(struct batch_list *list, const char *root) {
+  struct batch_list below = { 0 };
+  batch_add(&below, root);
+  size_t skip = strlen(root) + 1;
+  for (int i = 0; i < below.n; i++) {
+    batch_push(list, below.paths[i] + skip);
+    free(below.paths[i]);
+  }
+  free(below.paths);
+}
+
+int compare_paths(const void *a, const void *b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+int is_dir(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+int main(int argc, char *argv[]) {
+  argc = render_parse_args(argc, argv);
+  if (argc >= 0) argc = timings_parse_args(argc, argv);
+  debug_intern_names = 1; // Names are matched up across files
+
+  int nthreads = sysconf(_SC_NPROCESSORS_ONLN), nargs = 0;
+  for (int i = 1; argc >= 0 && i < argc; i++) {
+    if (strcmp(argv[i], "-U") == 0 && i + 1 < argc) diff_context = atoi(argv[++i]);
+    else if (strncmp(argv[i], "-j", 2) == 0) {
+      const char *n = argv[i][2]? &argv[i][2] : ++i < argc? argv[i] : NULL;
+      if (n == NULL || (nthreads = atoi(n)) < 1) argc = -1;
+    }
+    else if (nargs == 0 && ++nargs) old_root = argv[i];
+    else if (nargs == 1 && ++nargs) new_root = argv[i];
+    else argc = -1;
+  }
+  if (argc < 0 || nargs != 2 || is_dir(old_root) != is_dir(new_root)) {
+    fprintf(stderr, "usage: %s [-j <threads>] [-U <context>] [--no-color] [--timings[=json]] <old> <new>\n"
+                    "Compares two scripts or zones, or two directories of them, function by function.\n", argv[0]);
+    return 1;
+  }
+
+  // Directories: every path below either, in order
+  struct batch_list list = { 0 };
+  diff_dirs = is_dir(old_root);
+  if (diff_dirs) {
+    struct batch_list all = { 0 };
+    add_relative(&all, old_root);
+    add_relative(&all, new_root);
+    qsort(all.paths, all.n, sizeof(char *), compare_paths);
+    for (int i = 0; i < all.n; i++) {
+      if (list.n == 0 || strcmp(all.paths[i], list.paths[list.n - 1]) != 0) batch_push(&list, all.paths[i]);
+      free(all.paths[i]);
+    }
+    free(all.paths);
+  } else {
+    batch_push(&list, new_root);
+  }
+
+  int failures = batch_run(&list, diffscript, nthreads, 0, stdout);
+  fflush(stdout);
+  fprintf(stderr, "%d files: %d the same, %d different, %d on one side only",
+          list.n, files_same, files_differ, files_only);
+  if (failures > 0) fprintf(stderr, ", %d failed", failures);
+  fprintf(stderr, "\nfunctions: %d the same, %d changed, %d added, %d removed\n",
+          diff_total.same, diff_total.changed, diff_total.added, diff_total.removed);
+
+  for (int i = 0; i < list.n; i++) free(list.paths[i]);
+  free(list.paths);
+  return failures > 0? 2 : files_differ + files_only > 0;
+}
@@ -1,35 +1,56 @@
-#include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "script.h"
+#include "varint.h"
 #include "../poketools.h"
+#include "../arena.h"
+#include "../intern.h"
+#include "../timings.h"
 
 #define SEXT(x,b) ((!((x) >> (b)) - 1) << (b) | (x))
 
+int debug_intern_names = 0;
+
 
 //-- Helpers --------------------------------------------------------
 /** Duplicates memory. */
 void *memdup(void *p, int nbytes) {
-  void *res = malloc(nbytes);
+  void *res = palloc(nbytes);
   memcpy(res, p, nbytes);
   return res;
 }
 
-/** Reads a null-terminated string into `buf` (buffer of length `n`). */
-void read_string(char *buf, int n, FILE *f) {
-  int ch, i;
-
-  for (i = 0; i < n; i++) {
-    ch = fgetc(f);
-    if (ch == 0x00) break;
-    buf[i] = ch;
+/** Reads a null-terminated string of any length from `f`, and returns it
+ *  interned. */
+char *read_interned(FILE *f) {
+  char buf[256], *s = buf;
+  size_t n = 0, cap = sizeof(buf);
+  int ch;
+
+  while ((ch = getc(f)) != EOF && ch != 0x00) {
+    if (n == cap) {
+      s = s == buf? memcpy(malloc(2 * cap), buf, n) : realloc(s, 2 * cap);
+      cap *= 2;
+    }
+    s[n++] = ch;
   }
-  buf[i] = 0;
 
-  return;
+  const char *res = intern(s, n);
+  if (s != buf) free(s);
+  return (char *) res;
+}
+
+/** Parses a null-terminated string in place at `*p` (not past `end`), and
+ *  advances `*p` past it.  Returns NULL if the string is unterminated. */
+char *parse_string(u8 **p, const u8 *end) {
+  char *str = (char *) *p;
+  u8 *nul = memchr(*p, 0x00, end - *p);
+  if (nul == NULL) return NULL;
+  *p = nul + 1;
+  return str;
 }
 
 
@@ -40,12 +61,12 @@ struct code_block *read_code_block(FILE *f) {
 
   //-- Read header
   struct code_header hd_code;
-  fread(&hd_code, sizeof(struct code_header), 1, f);
-  assert(hd_code.magic == 0x0A0AF1E0);
+  if (fread(&hd_code, sizeof(struct code_header), 1, f) != 1) return NULL;
+  if (hd_code.magic != 0x0A0AF1E0) return NULL;
 
   // Read "extra"/unknown bytes
   int nextra = (hd_code.header_size - 0x20) / sizeof(u32);
-  u32 *extra = malloc(nextra * sizeof(u32));
+  u32 *extra = palloc(nextra * sizeof(u32));
   fread(extra, sizeof(u32), nextra, f);
 
   //-- Read code
@@ -56,7 +77,7 @@ struct code_block *read_code_block(FILE *f) {
   int extracted_length = (hd_code.extracted_size - hd_code.header_size) / sizeof(u32),
       code_length      = (hd_code.extracted_code_size - hd_code.header_size) / sizeof(u32);
 
-  u32 *extracted = malloc(extracted_length * sizeof(u32));
+  u32 *extracted = palloc(extracted_length * sizeof(u32));
 
   // Read & decompress the instructions
   u32 i = 0, j = 0, x = 0;
@@ -73,7 +94,7 @@ struct code_block *read_code_block(FILE *f) {
   }
 
   //-- Return section struct
-  struct code_block *res = malloc(sizeof(struct code_block));
+  struct code_block *res = palloc(sizeof(struct code_block));
   res->header = memdup(&hd_code, sizeof(struct code_header));
   res->nextra = nextra;
   res->extra = extra;
@@ -81,10 +102,119 @@ struct code_block *read_code_block(FILE *f) {
   res->instrs = extracted;
   res->nmovement = extracted_length - code_length;
   res->movement = extracted + code_length;
+  res->size = ftell(f) - section_start;
+  res->ir = NULL;
+  res->columns = NULL;
 
   return res;
 }
 
+/** Parses a code section in place from the `n` bytes at `p`.  The header (and
+ *  "extra" words, if aligned) point into `p`; only the instructions are newly
+ *  allocated.  Stores the number of bytes consumed in `*nread`, and returns
+ *  NULL if the section is malformed or truncated. */
+struct code_block *parse_code_block(u8 *p, size_t n, size_t *nread) {
+  return parse_code_block_decoded(p, n, nread, NULL);
+}
+
+/** Like `parse_code_block`, but takes the instructions from `dec` (if not
+ *  NULL) instead of decoding them. */
+struct code_block *parse_code_block_decoded(u8 *p, size_t n, size_t *nread,
+                                            const struct code_decoded *dec) {
+  //-- Parse header
+  if (n < sizeof(struct code_header)) return NULL;
+  struct code_header *hd_code = (struct code_header *) p;
+  if (hd_code->magic != 0x0A0AF1E0) return NULL;
+  if (hd_code->header_size < 0x20 || hd_code->header_size > n) return NULL;
+  if (hd_code->extracted_code_size < hd_code->header_size
+      || hd_code->extracted_size < hd_code->extracted_code_size) return NULL;
+
+  // "Extra"/unknown words; only copied if they'd be misaligned in place
+  int nextra = (hd_code->header_size - 0x20) / sizeof(u32);
+  u32 *extra = (u32 *) (p + 0x20);
+  if ((uintptr_t) extra % sizeof(u32) != 0) {
+    extra = memdup(extra, nextra * sizeof(u32));
+  }
+
+  //-- Parse code
+  int extracted_length = (hd_code->extracted_size - hd_code->header_size) / sizeof(u32),
+      code_length      = (hd_code->extracted_code_size - hd_code->header_size) / sizeof(u32);
+
+  u32 *extracted;
+
+  size_t size;
+
+  if (dec != NULL) {
+    // Already decoded
+    if (dec->nwords != extracted_length || dec->nread > n) return NULL;
+    extracted = dec->words;
+    size = dec->nread;
+
+  } else {
+    // Decompress the instructions
+    extracted = palloc(extracted_length * sizeof(u32));
+    TIMING_BEGIN(span, PHASE_DECOMPRESS);
+    size_t ndecoded,
+           nstream = varint_decode(extracted, extracted_length,
+                                   p + hd_code->header_size,
+                                   n - hd_code->header_size, &ndecoded);
+    TIMING_END(span, nstream, ndecoded * sizeof(u32));
+    if (ndecoded != extracted_length) {
+      pfree(extracted);
+      return NULL;
+    }
+
+    size = hd_code->header_size + nstream;
+  }
+
+  if (nread != NULL) *nread = size;
+
+  //-- Return section struct
+  struct code_block *res = palloc(sizeof(struct code_block));
+  res->header = hd_code;
+  res->nextra = nextra;
+  res->extra = extra;
+  res->ninstrs = code_length;
+  res->instrs = extracted;
+  res->nmovement = extracted_length - code_length;
+  res->movement = extracted + code_length;
+  res->size = size;
+  res->ir = NULL;
+  res->columns = NULL;
+
+  return res;
+}
+
+
+/** Returns the number of bytes `encode_code_block` writes for `code`. */
+size_t code_block_encoded_size(const struct code_block *code) {
+  return 0x20 + code->nextra * sizeof(u32)
+         + varint_encoded_size(code->instrs, code->ninstrs)
+         + varint_encoded_size(code->movement, code->nmovement);
+}
+
+/** Encodes the code section `code` into the buffer at `out`, which must have
+ *  room for `code_block_encoded_size(code)` bytes.  Returns the number of
+ *  bytes written. */
+size_t encode_code_block(u8 *out, const struct code_block *code) {
+  u32 header_size = 0x20 + code->nextra * sizeof(u32);
+
+  // Everything but the sizes is copied from the original header
+  struct code_header hd = *code->header;
+  hd.header_size = header_size;
+  hd.extracted_code_size = header_size + code->ninstrs * sizeof(u32);
+  hd.extracted_size = hd.extracted_code_size + code->nmovement * sizeof(u32);
+
+  u8 *p = out + header_size;
+  p += varint_encode(p, code->instrs, code->ninstrs);
+  p += varint_encode(p, code->movement, code->nmovement);
+
+  hd.section_size = p - out;
+  memcpy(out, &hd, sizeof(struct code_header));
+  memcpy(out + 0x20, code->extra, code->nextra * sizeof(u32));
+
+  return p - out;
+}
 
 //-- Debug section --------------------------------------------------
 struct debug_raw_symbol {
@@ -97,26 +227,24 @@ struct debug_raw_symbol {
 
 /** Reads a (newly-allocated) debug section from `f` and returns it. */
 struct debug_block *read_debug_block(FILE *f) {
+  long section_start = ftell(f);
+
   //-- Read header
   struct debug_header hd;
-  fread(&hd, sizeof(struct debug_header), 1, f);
-  assert(hd.magic == 0x0A0AF1EF);
-  assert(hd.count_unk1 == 0); // Not yet supported--haven't seen this yet
-
-  char buf[BUFSIZ];
-  int n;
+  if (fread(&hd, sizeof(struct debug_header), 1, f) != 1) return NULL;
+  if (hd.magic != 0x0A0AF1EF) return NULL;
+  if (hd.count_unk1 != 0) return NULL; // Not yet supported--haven't seen this yet
 
-  struct debug_file   *files   = malloc(sizeof(struct debug_file)   * hd.count_files);
-  struct debug_lineno *linenos = malloc(sizeof(struct debug_lineno) * hd.count_linenos);
-  struct debug_symbol *symbols = malloc(sizeof(struct debug_symbol) * hd.count_symbols);
-  struct debug_type   *types   = malloc(sizeof(struct debug_type)   * hd.count_types);
+  struct debug_file   *files   = palloc(sizeof(struct debug_file)   * hd.count_files);
+  struct debug_lineno *linenos = palloc(sizeof(struct debug_lineno) * hd.count_linenos);
+  struct debug_symbol *symbols = palloc(sizeof(struct debug_symbol) * hd.count_symbols);
+  struct debug_type   *types   = palloc(sizeof(struct debug_type)   * hd.count_types);
 
   // Files
   for (int i = 0; i < hd.count_files; i++) {
     u32 start;
     fread(&start, sizeof(u32), 1, f);
-    read_string(buf, BUFSIZ, f);
-    files[i] = (struct debug_file) { start, strdup(buf) };
+    files[i] = (struct debug_file) { start, read_interned(f) };
   }
 
   // LineNos
@@ -131,28 +259,25 @@ struct debug_block *read_debug_block(FILE *f) {
   for (int i = 0; i < hd.count_symbols; i++) {
     struct debug_raw_symbol entry;
     fread(&entry, sizeof(struct debug_raw_symbol), 1, f);
-    read_string(buf, BUFSIZ, f);
     symbols[i] = (struct debug_symbol) {
                    entry.id, entry.unk1, entry.start, entry.end,
-                   entry.type, strdup(buf) };
+                   entry.type, read_interned(f) };
   }
 
   // Types
   for (int i = 0; i < hd.count_types; i++) {
     u16 id;
     fread(&id, sizeof(u16), 1, f);
-    read_string(buf, BUFSIZ, f);
-    types[i] = (struct debug_type) { id, strdup(buf) };
+    types[i] = (struct debug_type) { id, read_interned(f) };
   }
 
   // Padding
   for (int i = 0; i < 7; i++) {
-    u8 pad = fgetc(f);
-    assert(pad == 0);
+    if (fgetc(f) != 0) return NULL;
   }
 
   //-- Return debug struct
-  struct debug_block *res = malloc(sizeof(struct debug_block));
+  struct debug_block *res = palloc(sizeof(struct debug_block));
   res->header = memdup(&hd, sizeof(struct debug_header));
   res->nfiles = hd.count_files;
   res->files = files;
@@ -162,8 +287,110 @@ struct debug_block *read_debug_block(FILE *f) {
   res->symbols = symbols;
   res->ntypes = hd.count_types;
   res->types = types;
+  res->index = NULL;
+  res->addrs = NULL;
+  res->size = ftell(f) - section_start;
+  res->interned = 1;
+  build_debug_index(res);
+
+  return res;
+}
+
+/** Parses a debug section in place from the `n` bytes at `p`.  The header,
+ *  line numbers and all names point into `p`.  Stores the number of bytes
+ *  consumed in `*nread`, and returns NULL if the section is malformed or
+ *  truncated. */
+struct debug_block *parse_debug_block(u8 *p, size_t n, size_t *nread) {
+  //-- Parse header
+  if (n < sizeof(struct debug_header)) return NULL;
+  struct debug_header *hd = (struct debug_header *) p;
+  if (hd->magic != 0x0A0AF1EF) return NULL;
+  if (hd->count_unk1 != 0) return NULL; // Not yet supported--haven't seen this yet
+
+  TIMING_BEGIN(span, PHASE_DEBUG);
+  u8 *q = p + sizeof(struct debug_header),
+     *end = p + n;
+
+  struct debug_file   *files   = palloc(sizeof(struct debug_file)   * hd->count_files);
+  struct debug_symbol *symbols = palloc(sizeof(struct debug_symbol) * hd->count_symbols);
+  struct debug_type   *types   = palloc(sizeof(struct debug_type)   * hd->count_types);
+  struct debug_lineno *linenos;
+
+  #define NEED(nbytes) if (end - q < (nbytes)) goto fail;
+  #define STRING(var)  if ((var = parse_string(&q, end)) == NULL) goto fail; \
+                       if (debug_intern_names) var = (char *) intern(var, (char *) q - var - 1);
+
+  // Files
+  for (int i = 0; i < hd->count_files; i++) {
+    NEED(sizeof(u32));
+    memcpy(&files[i].start, q, sizeof(u32));
+    q += sizeof(u32);
+    STRING(files[i].name);
+  }
+
+  // LineNos (packed, so used in place)
+  NEED(sizeof(struct debug_lineno) * hd->count_linenos);
+  linenos = (struct debug_lineno *) q;
+  q += sizeof(struct debug_lineno) * hd->count_linenos;
+
+  // Symbols
+  for (int i = 0; i < hd->count_symbols; i++) {
+    NEED(sizeof(struct debug_raw_symbol));
+    struct debug_raw_symbol *entry = (struct debug_raw_symbol *) q;
+    q += sizeof(struct debug_raw_symbol);
+    symbols[i] = (struct debug_symbol) {
+                   entry->id, entry->unk1, entry->start, entry->end,
+                   entry->type, NULL };
+    STRING(symbols[i].name);
+  }
+
+  // Types
+  for (int i = 0; i < hd->count_types; i++) {
+    NEED(sizeof(u16));
+    u16 id;
+    memcpy(&id, q, sizeof(u16));
+    types[i].id = id;
+    q += sizeof(u16);
+    STRING(types[i].name);
+  }
+
+  // Padding
+  NEED(7);
+  for (int i = 0; i < 7; i++) {
+    if (*q++ != 0) goto fail;
+  }
+
+  #undef NEED
+  #undef STRING
+
+  if (nread != NULL) *nread = q - p;
+
+  //-- Return debug struct
+  struct debug_block *res = palloc(sizeof(struct debug_block));
+  res->header = hd;
+  res->nfiles = hd->count_files;
+  res->files = files;
+  res->nlinenos = hd->count_linenos;
+  res->linenos = linenos;
+  res->nsymbols = hd->count_symbols;
+  res->symbols = symbols;
+  res->ntypes = hd->count_types;
+  res->types = types;
+  res->index = NULL;
+  res->addrs = NULL;
+  res->size = q - p;
+  res->interned = debug_intern_names;
+  build_debug_index(res);
 
+  TIMING_END(span, res->size, 0);
   return res;
+
+fail:
+  pfree(files);
+  pfree(symbols);
+  pfree(types);
+  TIMING_END(span, 0, 0);
+  return NULL;
 }
 
 
@@ -186,12 +413,136 @@ int symbols_comparator(const void *sym1_, const void *sym2_) {
 }
 
 
+//-- Symbol index ---------------------------------------------------
+/** Hashes a symbol's (id, type) key. */
+u32 symbol_hash(u32 id, u32 type) {
+  u32 h = id * 0x9E3779B1 ^ type * 0x85EBCA6B;
+  return h ^ h >> 15;
+}
+
+struct symbol_key {
+  u32 type, id, start;
+  int i;
+};
+
+/** Comparator for symbol keys: by type, then ID, then start, and finally by
+ *  position in the symbol table. */
+int key_comparator(const void *key1_, const void *key2_) {
+  const struct symbol_key *key1 = key1_,
+                          *key2 = key2_;
+
+  if (key1->type  != key2->type)  return key1->type  < key2->type?  -1 : +1;
+  if (key1->id    != key2->id)    return key1->id    < key2->id?    -1 : +1;
+  if (key1->start != key2->start) return key1->start < key2->start? -1 : +1;
+  return key1->i - key2->i;
+}
+
+/** Builds the symbol index of `debug` (replacing any existing one). */
+void build_debug_index(struct debug_block *debug) {
+  TIMING_BEGIN(span, PHASE_SORT);
+  int n = debug->nsymbols;
+  struct debug_index *index = palloc(sizeof(struct debug_index));
+
+  // Sorted copy of the symbol table, as used by the disassembler
+  index->sorted = palloc(sizeof(struct debug_symbol) * n + 1);
+  memcpy(index->sorted, debug->symbols, sizeof(struct debug_symbol) * n);
+  qsort(index->sorted, n, sizeof(struct debug_symbol), symbols_comparator);
+
+  // Group symbol indices by key
+  struct symbol_key *keys = malloc(sizeof(struct symbol_key) * n + 1);
+  for (int i = 0; i < n; i++) {
+    struct debug_symbol *sym = &debug->symbols[i];
+    keys[i] = (struct symbol_key) { sym->type, sym->id, sym->start, i };
+  }
+  qsort(keys, n, sizeof(struct symbol_key), key_comparator);
+
+  index->by_key = palloc(sizeof(int) * n + 1);
+  for (int i = 0; i < n; i++) index->by_key[i] = keys[i].i;
+  free(keys);
+
+  // Hash each group's key to its range, tracking the running max end
+  index->nslots = 1;
+  while (index->nslots < 2 * n) index->nslots *= 2;
+  index->slots = palloc(sizeof(struct debug_index_slot) * index->nslots);
+  for (int i = 0; i < index->nslots; i++) index->slots[i].start = -1;
+
+  index->max_end = palloc(sizeof(u32) * n + 1);
+  u32 mask = index->nslots - 1;
+
+  for (int i = 0; i < n; ) {
+    struct debug_symbol *first = &debug->symbols[index->by_key[i]];
+
+    int j = i;
+    u32 max_end = 0;
+    for (; j < n; j++) {
+      struct debug_symbol *sym = &debug->symbols[index->by_key[j]];
+      if (sym->id != first->id || sym->type != first->type) break;
+      if (sym->end > max_end) max_end = sym->end;
+      index->max_end[j] = max_end;
+    }
+
+    u32 h = symbol_hash(first->id, first->type) & mask;
+    while (index->slots[h].start >= 0) h = (h + 1) & mask;
+    index->slots[h] = (struct debug_index_slot) { first->id, first->type, i, j };
+
+    i = j;
+  }
+
+  debug->index = index;
+  TIMING_END(span, 0, 0);
+}
+
+/** Look up a symbol through the index of `debug`. */
+const struct debug_symbol *lookup_sym_indexed(struct debug_block *debug,
+                                              u32 id, u32 type, u32 pos) {
+  struct debug_index *index = debug->index;
+  u32 mask = index->nslots - 1,
+      h = symbol_hash(id, type) & mask;
+
+  // Find the group for this key
+  struct debug_index_slot *slot;
+  for (;; h = (h + 1) & mask) {
+    slot = &index->slots[h];
+    if (slot->start < 0) return NULL;
+    if (slot->id == id && slot->type == type) break;
+  }
+
+  int best = -1;
+
+  if (type == 0x0009) {
+    // Position doesn't matter; take the first one in the table
+    for (int j = slot->start; j < slot->end; j++) {
+      if (best < 0 || index->by_key[j] < best) best = index->by_key[j];
+    }
+    return &debug->symbols[best];
+  }
+
+  // Binary search for the last symbol starting at or before `pos`...
+  int lo = slot->start, hi = slot->end;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (debug->symbols[index->by_key[mid]].start <= pos) lo = mid + 1;
+    else hi = mid;
+  }
+
+  // ...then walk back over those that might still cover it
+  for (int j = lo - 1; j >= slot->start && index->max_end[j] > pos; j--) {
+    int k = index->by_key[j];
+    if (pos < debug->symbols[k].end && (best < 0 || k < best)) best = k;
+  }
+
+  return best < 0? NULL : &debug->symbols[best];
+}
+
 /** Look up a symbol from a debug section `debug`.  Finds the symbol with the
  *  given `id`, of the given `type`, that is defined at position `pos`
  *  (ignored for functions).
  */
 const struct debug_symbol *lookup_sym(struct debug_block *debug,
                                       int id, int type, int pos) {
+  TIMING_COUNT(lookups, 1);
+  if (debug->index != NULL) return lookup_sym_indexed(debug, id, type, pos);
+
   for (int i = 0; i < debug->nsymbols; i++) {
     struct debug_symbol *sym = &debug->symbols[i];
  // printf("sym={id=%04x type=%04x start=%04x end=%04x} id=%04x type=%04x pos=%04x\n",
@@ -3,6 +3,7 @@
 
 #include "../poketools.h"
 
+#include <stddef.h>
 #include <stdio.h>
 
 
@@ -28,6 +29,9 @@ struct code_block {
   u32 *instrs;
   int nmovement;
   u32 *movement;
+  size_t size;        // Bytes the section takes up in its file
+  struct code_ir *ir; // Decoded instructions, see `get_code_ir`
+  struct code_columns *columns; // The IR as columns, see `get_code_columns`
 };
 
 
@@ -67,6 +71,19 @@ struct debug_type {
   char *name;
 };
 
+/** Prebuilt lookup structures for a debug section's symbols. */
+struct debug_index {
+  struct debug_symbol *sorted; // Sorted by `symbols_comparator`
+  int *by_key;                 // Symbol indices, grouped by (type, id) and
+                               // sorted by start within each group
+  u32 *max_end;                // Running max of `end` within each group
+  int nslots;                  // Power of two
+  struct debug_index_slot {
+    u32 id, type;
+    int start, end;            // The group's range in `by_key`
+  } *slots;                    // Open-addressed hash on (id, type)
+};
+
 struct debug_block {
   struct debug_header *header;
   int nfiles;
@@ -77,23 +94,78 @@ struct debug_block {
   struct debug_symbol *symbols;
   int ntypes;
   struct debug_type *types;
+  struct debug_index *index;
+  struct debug_addrs *addrs; // Address tables, see `get_debug_addrs`
+  size_t size;        // Bytes the section takes up in its file
+  int interned;       // Whether all names are interned (see intern.h)
+};
+
+
+/** Instructions decoded ahead of time (e.g. cached) for the code section at
+ *  byte `offset` of its file, to be used instead of decoding its own. */
+struct code_decoded {
+  size_t offset;
+  size_t nread;                // Bytes the whole section takes up
+  size_t nwords;               // Instructions and movement data
+  u32 *words;
 };
 
 
 //-- Functions ------------------------------------------------------
-/** Reads a (newly-allocated) code section from `f` and returns it. */
+/** Whether `parse_debug_block` interns names (see intern.h) rather than
+ *  pointing them into the section: for tools that keep or compare the
+ *  names of many files.  `read_debug_block` always does.  Off by default. */
+extern int debug_intern_names;
+
+/** Reads a (newly-allocated) code section from `f` and returns it, or NULL
+ *  if it doesn't look like one. */
 struct code_block *read_code_block(FILE *f);
 
-/** Reads a (newly-allocated) debug section from `f` and returns it. */
+/** Reads a (newly-allocated) debug section from `f` and returns it, or NULL
+ *  if it is malformed or unsupported.  Its names are interned. */
 struct debug_block *read_debug_block(FILE *f);
 
+/** Parses a code section in place from the `n` bytes at `p`.  The result
+ *  points into `p`, which must outlive it.  Stores the number of bytes
+ *  consumed in `*nread` (if non-NULL), and returns NULL if the section is
+ *  malformed or truncated. */
+struct code_block *parse_code_block(u8 *p, size_t n, size_t *nread);
+
+/** Like `parse_code_block`, but takes the instructions from `dec` (if not
+ *  NULL) instead of decoding them; the result points into `dec->words`. */
+struct code_block *parse_code_block_decoded(u8 *p, size_t n, size_t *nread,
+                                            const struct code_decoded *dec);
+
+/** Returns the number of bytes `encode_code_block` writes for `code`. */
+size_t code_block_encoded_size(const struct code_block *code);
+
+/** Encodes the code section `code` into the buffer at `out`, which must have
+ *  room for `code_block_encoded_size(code)` bytes: the reverse of
+ *  `parse_code_block`.  The instructions and movement data are recompressed
+ *  at their minimal lengths, and the header's size fields are recomputed;
+ *  the rest of the header and the "extra" words are copied as they are.
+ *  Returns the number of bytes written. */
+size_t encode_code_block(u8 *out, const struct code_block *code);
+
+/** Parses a debug section in place from the `n` bytes at `p`.  The result
+ *  (including all names, unless `debug_intern_names` is set) points into
+ *  `p`, which must outlive it.  Stores the
+ *  number of bytes consumed in `*nread` (if non-NULL), and returns NULL if the
+ *  section is malformed or truncated. */
+struct debug_block *parse_debug_block(u8 *p, size_t n, size_t *nread);
+
 /** Comparator for symbols.  Compares primarily by type (asc), secondarily by
  *  start position (asc), and finally by ID (asc).  */
 int symbols_comparator(const void *sym1, const void *sym2);
 
+/** Builds the symbol index of `debug` (replacing any existing one).  This is
+ *  done by `read_debug_block` and `parse_debug_block`. */
+void build_debug_index(struct debug_block *debug);
+
 /** Look up a symbol from a debug section `debug`.  Finds the symbol with the
  *  given `id`, of the given `type`, that is defined at position `pos`
- *  (ignored for functions).
+ *  (ignored for functions).  If several symbols match, the first one in the
+ *  symbol table wins.  Uses the index if `debug` has one, in O(log n) time.
  */
 const struct debug_symbol *lookup_sym(struct debug_block *debug,
                                       int id, int type, int pos);
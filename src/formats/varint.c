@@ -0,0 +1,299 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VARINT_X86 1
+#endif
+
+#include "varint.h"
+#include "../poketools.h"
+
+
+//-- Helpers --------------------------------------------------------
+/** Sign-extends the low 7 bits of the (first) byte `b`. */
+static inline u32 sext7(u32 b) {
+  return (u32) ((i32) (b << 25) >> 25);
+}
+
+/** Decodes a single value at `*p` (not past `end`) the slow way, advancing
+ *  `*p` past it.  Returns 0 (leaving `*p` alone) if it is unterminated. */
+static inline int decode_one(u32 *x, const u8 **p, const u8 *end) {
+  const u8 *q = *p;
+  if (q == end) return 0;
+
+  u32 v = sext7(*q);
+  while (*q++ & 0x80) {
+    if (q == end) return 0;
+    v = v << 7 | (*q & 0x7F);
+  }
+
+  *x = v;
+  *p = q;
+  return 1;
+}
+
+/** Decodes the value starting at `p`, which has length `len` (1..8), using
+ *  the 8 bytes at `p`.  Gathers all eight 7-bit groups, then keeps the first
+ *  `len` of them and sign-extends, without branching on the length. */
+static inline u32 decode_word(const u8 *p, int len) {
+  u64 w;
+  memcpy(&w, p, sizeof(u64));
+
+  // Most significant group first: b0 ends up in the top byte
+  u64 g = __builtin_bswap64(w) & 0x7F7F7F7F7F7F7F7FULL;
+  g = (g & 0x007F007F007F007FULL) | (g & 0x7F007F007F007F00ULL) >> 1;
+  g = (g & 0x00003FFF00003FFFULL) | (g & 0x3FFF00003FFF0000ULL) >> 2;
+  g = (g & 0x000000000FFFFFFFULL) | (g & 0x0FFFFFFF00000000ULL) >> 4;
+
+  return (u32) ((i64) (g << 8) >> (64 - 7*len));
+}
+
+/** Decodes every value terminated within the window at `p`, where `term`
+ *  has bit k set iff byte k is the final byte of a value.  At least 8 bytes
+ *  past the last terminator must be readable.  Returns the number of bytes
+ *  consumed. */
+static inline int decode_window(u32 **out, const u8 *p, u32 term) {
+  int s = 0;
+  u32 *o = *out;
+
+  while (term) {
+    int e = __builtin_ctz(term);
+    if (e - s >= 8) { // Longer than 8 bytes--only in broken streams
+      const u8 *q = p + s;
+      decode_one(o++, &q, p + e + 1);
+    } else {
+      *o++ = decode_word(p + s, e - s + 1);
+    }
+    s = e + 1;
+    term &= term - 1;
+  }
+
+  *out = o;
+  return s;
+}
+
+
+//-- Scalar ---------------------------------------------------------
+/** Portable, branch-light scalar kernel.  Finds each value's length from an
+ *  8-byte word at a time, and decodes it without looping over its bytes. */
+size_t varint_decode_scalar(u32 *out, size_t nout, const u8 *in, size_t nin,
+                            size_t *ndecoded) {
+  const u8 *p = in, *end = in + nin;
+  size_t i = 0;
+
+  while (i < nout && end - p >= 8) {
+    u64 w;
+    memcpy(&w, p, sizeof(u64));
+    u64 term = ~w & 0x8080808080808080ULL;
+
+    if (term == 0) { // Longer than 8 bytes--only in broken streams
+      if (!decode_one(&out[i], &p, end)) break;
+      i++;
+      continue;
+    }
+
+    int len = __builtin_ctzll(term) / 8 + 1;
+    out[i++] = decode_word(p, len);
+    p += len;
+  }
+
+  // Tail
+  while (i < nout && decode_one(&out[i], &p, end)) i++;
+
+  *ndecoded = i;
+  return p - in;
+}
+
+
+//-- SSE2 -----------------------------------------------------------
+#ifdef VARINT_X86
+/** Stores the 16 single-byte values in `v`. */
+__attribute__((target("sse2")))
+static inline void store_singles_sse2(u32 *out, __m128i v) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_unpacklo_epi8(v, zero),
+          hi = _mm_unpackhi_epi8(v, zero);
+
+  // Sign-extend from bit 6, then widen to 32 bits
+  lo = _mm_srai_epi16(_mm_slli_epi16(lo, 9), 9);
+  hi = _mm_srai_epi16(_mm_slli_epi16(hi, 9), 9);
+  __m128i lo_sign = _mm_srai_epi16(lo, 15),
+          hi_sign = _mm_srai_epi16(hi, 15);
+
+  _mm_storeu_si128((__m128i *) (out +  0), _mm_unpacklo_epi16(lo, lo_sign));
+  _mm_storeu_si128((__m128i *) (out +  4), _mm_unpackhi_epi16(lo, lo_sign));
+  _mm_storeu_si128((__m128i *) (out +  8), _mm_unpacklo_epi16(hi, hi_sign));
+  _mm_storeu_si128((__m128i *) (out + 12), _mm_unpackhi_epi16(hi, hi_sign));
+}
+
+/** Stores the 8 two-byte values in `v`. */
+__attribute__((target("sse2")))
+static inline void store_doubles_sse2(u32 *out, __m128i v) {
+  // Each 16-bit lane holds (first | final << 8); the final byte's high bit
+  // is clear, so shifting it down needs no masking.
+  __m128i first = _mm_and_si128(v, _mm_set1_epi16(0x7F)),
+          final = _mm_srli_epi16(v, 8);
+  __m128i x = _mm_or_si128(_mm_slli_epi16(first, 7), final);
+
+  // Sign-extend from bit 13, then widen to 32 bits
+  x = _mm_srai_epi16(_mm_slli_epi16(x, 2), 2);
+  __m128i sign = _mm_srai_epi16(x, 15);
+
+  _mm_storeu_si128((__m128i *) (out + 0), _mm_unpacklo_epi16(x, sign));
+  _mm_storeu_si128((__m128i *) (out + 4), _mm_unpackhi_epi16(x, sign));
+}
+
+/** SSE2 kernel.  Takes 16-byte windows at a time, with fast paths for runs
+ *  of one- and two-byte values and a mask-driven loop for mixed windows. */
+__attribute__((target("sse2")))
+size_t varint_decode_sse2(u32 *out, size_t nout, const u8 *in, size_t nin,
+                          size_t *ndecoded) {
+  const u8 *p = in, *end = in + nin;
+  u32 *o = out, *oend = out + nout;
+
+  while (oend - o >= 16 && end - p >= 16 + 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    u32 cont = _mm_movemask_epi8(v);
+
+    if (cont == 0) {
+      store_singles_sse2(o, v);
+      o += 16;
+      p += 16;
+    } else if (cont == 0x5555) {
+      store_doubles_sse2(o, v);
+      o += 8;
+      p += 16;
+    } else if (cont == 0xFFFF) { // No value ends in this window
+      if (!decode_one(o, &p, end)) break;
+      o++;
+    } else {
+      p += decode_window(&o, p, ~cont & 0xFFFF);
+    }
+  }
+
+  // Tail
+  size_t n;
+  p += varint_decode_scalar(o, oend - o, p, end - p, &n);
+  *ndecoded = (o - out) + n;
+  return p - in;
+}
+
+
+//-- AVX2 -----------------------------------------------------------
+/** AVX2 kernel.  Like the SSE2 one, but on 32-byte windows. */
+__attribute__((target("avx2")))
+size_t varint_decode_avx2(u32 *out, size_t nout, const u8 *in, size_t nin,
+                          size_t *ndecoded) {
+  const u8 *p = in, *end = in + nin;
+  u32 *o = out, *oend = out + nout;
+
+  while (oend - o >= 32 && end - p >= 32 + 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    u32 cont = _mm256_movemask_epi8(v);
+
+    if (cont == 0) {
+      // (b ^ 0x40) - 0x40 sign-extends a 7-bit byte to 8 bits
+      __m256i bias = _mm256_set1_epi8(0x40);
+      __m256i x = _mm256_sub_epi8(_mm256_xor_si256(v, bias), bias);
+      __m128i lo = _mm256_castsi256_si128(x),
+              hi = _mm256_extracti128_si256(x, 1);
+      _mm256_storeu_si256((__m256i *) (o +  0), _mm256_cvtepi8_epi32(lo));
+      _mm256_storeu_si256((__m256i *) (o +  8), _mm256_cvtepi8_epi32(_mm_srli_si128(lo, 8)));
+      _mm256_storeu_si256((__m256i *) (o + 16), _mm256_cvtepi8_epi32(hi));
+      _mm256_storeu_si256((__m256i *) (o + 24), _mm256_cvtepi8_epi32(_mm_srli_si128(hi, 8)));
+      o += 32;
+      p += 32;
+    } else if (cont == 0x55555555) {
+      __m256i first = _mm256_and_si256(v, _mm256_set1_epi16(0x7F)),
+              final = _mm256_srli_epi16(v, 8);
+      __m256i x = _mm256_or_si256(_mm256_slli_epi16(first, 7), final);
+      x = _mm256_srai_epi16(_mm256_slli_epi16(x, 2), 2);
+      _mm256_storeu_si256((__m256i *) (o + 0), _mm256_cvtepi16_epi32(_mm256_castsi256_si128(x)));
+      _mm256_storeu_si256((__m256i *) (o + 8), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(x, 1)));
+      o += 16;
+      p += 32;
+    } else if (cont == 0xFFFFFFFF) { // No value ends in this window
+      if (!decode_one(o, &p, end)) break;
+      o++;
+    } else {
+      p += decode_window(&o, p, ~cont);
+    }
+  }
+
+  // Finish off with 16-byte windows
+  size_t n;
+  p += varint_decode_sse2(o, oend - o, p, end - p, &n);
+  *ndecoded = (o - out) + n;
+  return p - in;
+}
+
+int varint_have_sse2(void) { return __builtin_cpu_supports("sse2"); }
+int varint_have_avx2(void) { return __builtin_cpu_supports("avx2"); }
+
+#else
+size_t varint_decode_sse2(u32 *out, size_t nout, const u8 *in, size_t nin,
+                          size_t *ndecoded) {
+  return varint_decode_scalar(out, nout, in, nin, ndecoded);
+}
+
+size_t varint_decode_avx2(u32 *out, size_t nout, const u8 *in, size_t nin,
+                          size_t *ndecoded) {
+  return varint_decode_scalar(out, nout, in, nin, ndecoded);
+}
+
+int varint_have_sse2(void) { return 0; }
+int varint_have_avx2(void) { return 0; }
+#endif
+
+
+//-- Dispatch -------------------------------------------------------
+varint_decoder *varint_kernel = varint_decode_scalar;
+
+/** Picks the fastest kernel supported by the running CPU, once, before any
+ *  threads exist. */
+__attribute__((constructor))
+static void varint_select_kernel(void) {
+#ifdef VARINT_X86
+  __builtin_cpu_init();
+#endif
+  varint_kernel = varint_have_avx2()? varint_decode_avx2
+                : varint_have_sse2()? varint_decode_sse2
+                :                     varint_decode_scalar;
+}
+
+/** Decompresses a 7-bit varint stream, using the fastest kernel supported by
+ *  the running CPU. */
+size_t varint_decode(u32 *out, size_t nout, const u8 *in, size_t nin,
+                     size_t *ndecoded) {
+  return varint_kernel(out, nout, in, nin, ndecoded);
+}
+
+
+//-- Encoding -------------------------------------------------------
+/** Returns the minimal number of bytes (1..5) `x` is stored in. */
+int varint_length(u32 x) {
+  // Bits needed besides the sign bit, which the first group sign-extends
+  u32 y = x ^ (u32) ((i32) x >> 31);
+  int bits = y? 32 - __builtin_clz(y) : 0;
+  return bits / 7 + 1;
+}
+
+/** Returns the number of bytes `varint_encode` writes for `n` values. */
+size_t varint_encoded_size(const u32 *in, size_t n) {
+  size_t size = 0;
+  for (size_t i = 0; i < n; i++) size += varint_length(in[i]);
+  return size;
+}
+
+/** Compresses `n` values into a 7-bit varint stream at their minimal
+ *  lengths. */
+size_t varint_encode(u8 *out, const u32 *in, size_t n) {
+  u8 *o = out;
+  for (size_t i = 0; i < n; i++) {
+    u32 x = in[i];
+    int len = varint_length(x);
+    for (int k = len - 1; k > 0; k--) *o++ = 0x80 | (x >> 7*k & 0x7F);
+    *o++ = x & 0x7F;
+  }
+  return o - out;
+}
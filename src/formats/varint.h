@@ -0,0 +1,52 @@
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <stddef.h>
+
+#include "../poketools.h"
+
+/** Signature shared by all varint decompression kernels.  Decodes up to
+ *  `nout` values from the `nin` bytes at `in` into `out`, stores the number of
+ *  values decoded in `*ndecoded`, and returns the number of bytes consumed.
+ *  Decoding stops early (without consuming it) at a value that isn't
+ *  terminated within the input. */
+typedef size_t varint_decoder(u32 *out, size_t nout, const u8 *in, size_t nin,
+                              size_t *ndecoded);
+
+/** Decompresses the 7-bit varint stream used by code sections.  Each value
+ *  is stored most significant group first; every byte but the last has its
+ *  high bit set, and the first byte's 7 bits are sign-extended.  Uses the
+ *  fastest kernel supported by the running CPU. */
+varint_decoder varint_decode;
+
+/** Portable, branch-light scalar kernel. */
+varint_decoder varint_decode_scalar;
+
+/** SSE2 kernel (falls back to scalar on non-x86 targets). */
+varint_decoder varint_decode_sse2;
+
+/** AVX2 kernel (falls back to scalar on non-x86 targets).  Only call this if
+ *  `varint_have_avx2()` is nonzero. */
+varint_decoder varint_decode_avx2;
+
+/** Returns nonzero if the running CPU supports the SSE2 kernel. */
+int varint_have_sse2(void);
+
+/** Returns nonzero if the running CPU supports the AVX2 kernel. */
+int varint_have_avx2(void);
+
+/** Returns the minimal number of bytes (1..5) the value `x` takes up in the
+ *  stream. */
+int varint_length(u32 x);
+
+/** Returns the number of bytes `varint_encode` writes for the `n` values at
+ *  `in`. */
+size_t varint_encoded_size(const u32 *in, size_t n);
+
+/** Compresses the `n` values at `in` into a 7-bit varint stream at `out`,
+ *  each at its minimal length, so that `varint_decode` gives them back.
+ *  `out` must have room for `varint_encoded_size(in, n)` bytes.  Returns the
+ *  number of bytes written. */
+size_t varint_encode(u8 *out, const u32 *in, size_t n);
+
+#endif
@@ -1,65 +1,74 @@
-#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "zonedata.h"
 #include "script.h"
 #include "../poketools.h"
 #include "../hexdump.h"
+#include "../arena.h"
+
+/** Notes in `zone` that the section at `at` was read to `delta` bytes past
+ *  its size, unless an earlier one already was. */
+void zone_note_unread(struct zonedata *zone, size_t at, long delta) {
+  if (delta == 0 || zone->warn_delta != 0) return;
+  zone->warn_at = at;
+  zone->warn_delta = delta;
+}
 
 struct zonedata *read_zonedata(FILE *f) {
-  struct zonedata *res = malloc(sizeof(struct zonedata));
+  struct zonedata *res = palloc(sizeof(struct zonedata));
+  res->warn_at = 0;
+  res->warn_delta = 0;
 
   long section_start, section_end, section_size;
 
 
   //-- Header -------------------------
-  res->header = malloc(sizeof(struct zone_header));
+  res->header = palloc(sizeof(struct zone_header));
   struct zone_header *hd = res->header;
-  fread(hd, sizeof(struct zone_header), 1, f);
+  if (fread(hd, sizeof(struct zone_header), 1, f) != 1) return NULL;
 
-  assert(hd->magic == 0x00044F5A);
+  if (hd->magic != 0x00044F5A) return NULL;
 
 
   //-- Unk1 section -------------------
-  res->unk1 = malloc(sizeof(struct zone_unk1));
-  res->unk1->header = malloc(sizeof(struct zone_unk1_header));
+  res->unk1 = palloc(sizeof(struct zone_unk1));
+  res->unk1->header = palloc(sizeof(struct zone_unk1_header));
   struct zone_unk1_header *unk1_hd = res->unk1->header;
 
-  for (int i = 0; i < 3; i++) assert(unk1_hd->pad[i] == 0);
-
   section_start = ftell(f);
 
-  fread(unk1_hd, sizeof(struct zone_unk1_header), 1, f);
+  if (fread(unk1_hd, sizeof(struct zone_unk1_header), 1, f) != 1) return NULL;
+  for (int i = 0; i < 3; i++) {
+    if (unk1_hd->pad[i] != 0) return NULL;
+  }
 
   res->unk1->nentry1 = unk1_hd->num_unk1;
-  res->unk1->entry1 = malloc(sizeof(struct zone_unk1_entry_1) * unk1_hd->num_unk1);
+  res->unk1->entry1 = palloc(sizeof(struct zone_unk1_entry_1) * unk1_hd->num_unk1);
   fread(res->unk1->entry1, sizeof(struct zone_unk1_entry_1), unk1_hd->num_unk1, f);
 
   res->unk1->nentry2 = unk1_hd->num_unk2;
-  res->unk1->entry2 = malloc(sizeof(struct zone_unk1_entry_2) * unk1_hd->num_unk2);
+  res->unk1->entry2 = palloc(sizeof(struct zone_unk1_entry_2) * unk1_hd->num_unk2);
   fread(res->unk1->entry2, sizeof(struct zone_unk1_entry_2), unk1_hd->num_unk2, f);
 
   res->unk1->nentry3 = unk1_hd->num_unk3;
-  res->unk1->entry3 = malloc(sizeof(struct zone_unk1_entry_3) * unk1_hd->num_unk3);
+  res->unk1->entry3 = palloc(sizeof(struct zone_unk1_entry_3) * unk1_hd->num_unk3);
   fread(res->unk1->entry3, sizeof(struct zone_unk1_entry_3), unk1_hd->num_unk3, f);
 
   res->unk1->nentry4 = unk1_hd->num_unk4;
-  res->unk1->entry4 = malloc(sizeof(struct zone_unk1_entry_4) * unk1_hd->num_unk4);
+  res->unk1->entry4 = palloc(sizeof(struct zone_unk1_entry_4) * unk1_hd->num_unk4);
   fread(res->unk1->entry4, sizeof(struct zone_unk1_entry_4), unk1_hd->num_unk4, f);
 
   res->unk1->nentry5 = unk1_hd->num_unk5;
-  res->unk1->entry5 = malloc(sizeof(struct zone_unk1_entry_4) * unk1_hd->num_unk5);
+  res->unk1->entry5 = palloc(sizeof(struct zone_unk1_entry_4) * unk1_hd->num_unk5);
   fread(res->unk1->entry5, sizeof(struct zone_unk1_entry_4), unk1_hd->num_unk5, f);
 
   // Check if we read the entire section properly.
   section_end = ftell(f);
   section_size = unk1_hd->size + 4;
 
-  if (section_end != section_start + section_size) {
-    fprintf(stderr, "\x1B[33mwarning: unk1 section not read properly (size delta is %ld, @ $%lx)\x1B[m\n", 
-            section_end - (section_start + section_size), ftell(f));
-  }
+  zone_note_unread(res, section_start, section_end - (section_start + section_size));
   fseek(f, section_start + section_size, SEEK_SET);
 
 
@@ -73,10 +82,7 @@ struct zonedata *read_zonedata(FILE *f) {
   section_end = ftell(f);
   section_size = res->code1->header->section_size;
 
-  if (section_end != section_start + section_size) {
-    fprintf(stderr, "\x1B[33mwarning: code1 section not read properly (size delta is %ld)\x1B[m\n", 
-            section_end - (section_start + section_size));
-  }
+  zone_note_unread(res, section_start, section_end - (section_start + section_size));
   fseek(f, section_start + section_size, SEEK_SET);
   fseek(f, (4 - ftell(f) % 4) % 4, SEEK_CUR); // Round to full word
 
@@ -85,3 +91,226 @@ struct zonedata *read_zonedata(FILE *f) {
 
   return res;
 }
+
+//-- unk1 schema -----------------------------------------
+#define FIELD_NAME(type, name) #name,
+#define FIELD_SIZE(type, name) sizeof(type),
+#define TABLE_FIELDS(k, count, type, FIELDS) \
+  const char *const zone_unk1_field_names_##k[] = { FIELDS(FIELD_NAME) }; \
+  const u8 zone_unk1_field_sizes_##k[] = { FIELDS(FIELD_SIZE) };
+ZONE_UNK1_TABLES(TABLE_FIELDS)
+
+#define TABLE(k, count, type, FIELDS) \
+  [k] = { sizeof(zone_unk1_field_sizes_##k), sizeof(struct type), \
+          zone_unk1_field_names_##k, zone_unk1_field_sizes_##k },
+const struct zone_unk1_table zone_unk1_tables[ZONE_UNK1_NTABLES + 1] = {
+  ZONE_UNK1_TABLES(TABLE)
+};
+
+#undef FIELD_NAME
+#undef FIELD_SIZE
+#undef TABLE_FIELDS
+#undef TABLE
+
+const u8 *zone_unk1_entries(const struct zone_unk1 *unk1, int k, int *n) {
+  switch (k) {
+    #define ENTRIES(k, count, type, FIELDS) \
+      case k: *n = unk1->nentry##k; return (const u8 *) unk1->entry##k;
+    ZONE_UNK1_TABLES(ENTRIES)
+    #undef ENTRIES
+  }
+  *n = 0;
+  return NULL;
+}
+
+/** Returns the end of the entries of the unk1 section with the header `hd`
+ *  at `start`, going by their counts. */
+size_t zone_unk1_end(const struct zone_unk1_header *hd, size_t start) {
+  #define SIZE(k, count, type, FIELDS) + sizeof(struct type) * hd->count
+  return start + sizeof(struct zone_unk1_header) ZONE_UNK1_TABLES(SIZE);
+  #undef SIZE
+}
+
+/** Parses the unk1 section at `start` in place from the `n` bytes at `p`,
+ *  storing the end of its entries in `*end`.  Returns NULL if the section
+ *  (by its size or by its entries) runs past `n`. */
+struct zone_unk1 *parse_zone_unk1(u8 *p, size_t n, size_t start, size_t *end) {
+  if (n < start || n - start < sizeof(struct zone_unk1_header)) return NULL;
+
+  struct zone_unk1_header *unk1_hd = (struct zone_unk1_header *) (p + start);
+  *end = zone_unk1_end(unk1_hd, start);
+  if (*end > n || start + (size_t) unk1_hd->size + 4 > n) return NULL;
+
+  struct zone_unk1 *unk1 = palloc(sizeof(struct zone_unk1));
+  u8 *q = p + start + sizeof(struct zone_unk1_header);
+
+  #define ENTRIES(k, count, type, FIELDS) \
+    unk1->nentry##k = unk1_hd->count; \
+    unk1->entry##k = (struct type *) q; \
+    q += sizeof(struct type) * unk1_hd->count;
+
+  unk1->header = unk1_hd;
+  ZONE_UNK1_TABLES(ENTRIES)
+
+  #undef ENTRIES
+
+  return unk1;
+}
+
+/** Parses zone data in place from the `n` bytes at `p`.  The header and all
+ *  unk1 tables point into `p`; only the code sections' instructions are newly
+ *  allocated.  Returns NULL if the data is malformed or truncated. */
+struct zonedata *parse_zonedata(u8 *p, size_t n) {
+  return parse_zonedata_decoded(p, n, NULL, 0);
+}
+
+/** Returns the decoded instructions in `dec` for the code section at
+ *  `offset`, or NULL if there are none. */
+const struct code_decoded *find_decoded(const struct code_decoded *dec, int ndec,
+                                        size_t offset) {
+  for (int i = 0; i < ndec; i++) {
+    if (dec[i].offset == offset) return &dec[i];
+  }
+  return NULL;
+}
+
+/** Like `parse_zonedata`, but takes the code sections' instructions from
+ *  `dec` where available. */
+struct zonedata *parse_zonedata_decoded(u8 *p, size_t n,
+                                        const struct code_decoded *dec, int ndec) {
+  size_t section_start, section_end, section_size, nread;
+
+
+  //-- Header -------------------------
+  if (n < sizeof(struct zone_header)) return NULL;
+  struct zone_header *hd = (struct zone_header *) p;
+  if (hd->magic != 0x00044F5A) return NULL;
+
+
+  //-- Unk1 section -------------------
+  section_start = sizeof(struct zone_header);
+  struct zone_unk1 *unk1 = parse_zone_unk1(p, n, section_start, &section_end);
+  if (unk1 == NULL) return NULL;
+  section_size = (size_t) unk1->header->size + 4;
+
+
+  //-- Code sections ------------------
+  struct zonedata *res = palloc(sizeof(struct zonedata));
+  res->header = hd;
+  res->unk1 = unk1;
+  res->warn_at = 0;
+  res->warn_delta = 0;
+
+  // Check if we read the entire section properly.
+  zone_note_unread(res, section_start, (long) section_end - (long) (section_start + section_size));
+
+  section_start += section_size;
+
+  res->code1 = parse_code_block_decoded(p + section_start, n - section_start, &nread,
+                                        find_decoded(dec, ndec, section_start));
+  if (res->code1 == NULL) goto fail;
+
+  // Check if we read the entire section properly.
+  section_size = res->code1->header->section_size;
+
+  zone_note_unread(res, section_start, (long) nread - (long) section_size);
+  section_start += section_size;
+  section_start += (4 - section_start % 4) % 4; // Round to full word
+  if (section_start > n) goto fail;
+
+  res->code2 = parse_code_block_decoded(p + section_start, n - section_start, &nread,
+                                        find_decoded(dec, ndec, section_start));
+  if (res->code2 == NULL) goto fail;
+
+  return res;
+
+fail:
+  pfree(unk1);
+  pfree(res);
+  return NULL;
+}
+
+
+//-- Header-only access ---------------------------------------------
+/** Checks the code section header at `start` in the `n` bytes at `p`,
+ *  storing its size in `*size`.  Returns the problems found, with `bad` for
+ *  a header that isn't one. */
+u32 scan_code_header(const u8 *p, size_t n, size_t start, size_t *size, u32 bad) {
+  if (start > n || n - start < sizeof(struct code_header)) return ZONE_TRUNCATED;
+  const struct code_header *hd = (const struct code_header *) (p + start);
+  if (hd->magic != 0x0A0AF1E0 || hd->header_size < 0x20
+      || hd->section_size < hd->header_size) return bad;
+  *size = hd->section_size;
+  return start + *size > n? ZONE_TRUNCATED : 0;
+}
+
+u32 scan_zonedata(struct zone_layout *l, const u8 *p, size_t n) {
+  memset(l, 0, sizeof(struct zone_layout));
+  if (n < sizeof(struct zone_header)) return ZONE_TRUNCATED;
+  const struct zone_header *hd = (const struct zone_header *) p;
+  if (hd->magic != 0x00044F5A) return ZONE_BAD_MAGIC;
+
+  u32 res = 0;
+  if (hd->file_size != n || hd->file_size2 != n) res |= ZONE_BAD_FILE_SIZE;
+
+  // unk1: its size against its entry counts
+  l->unk1_start = sizeof(struct zone_header);
+  if (n - l->unk1_start < sizeof(struct zone_unk1_header)) return res | ZONE_TRUNCATED;
+  const struct zone_unk1_header *unk1_hd = (const struct zone_unk1_header *) (p + l->unk1_start);
+  l->unk1_size = (size_t) unk1_hd->size + 4;
+  size_t end = zone_unk1_end(unk1_hd, l->unk1_start);
+  if (end != l->unk1_start + l->unk1_size) res |= ZONE_BAD_UNK1;
+  if (end > n || l->unk1_start + l->unk1_size > n) return res | ZONE_TRUNCATED;
+
+  // The code sections, the second word-aligned after the first
+  l->code1_start = l->unk1_start + l->unk1_size;
+  res |= scan_code_header(p, n, l->code1_start, &l->code1_size, ZONE_BAD_CODE1);
+  if (res & (ZONE_TRUNCATED | ZONE_BAD_CODE1)) return res;
+
+  l->code2_start = l->code1_start + l->code1_size;
+  l->code2_start += (4 - l->code2_start % 4) % 4;
+  if (hd->code2_offset != l->code2_start) res |= ZONE_BAD_CODE2_OFFSET;
+  res |= scan_code_header(p, n, l->code2_start, &l->code2_size, ZONE_BAD_CODE2);
+  if (res & (ZONE_TRUNCATED | ZONE_BAD_CODE2)) return res;
+
+  if (l->code2_start + l->code2_size != n) res |= ZONE_TRAILING;
+  return res;
+}
+
+int open_zonedata(struct zone_handle *z, u8 *p, size_t n) {
+  memset(z, 0, sizeof(struct zone_handle));
+  z->problems = scan_zonedata(&z->layout, p, n);
+  if (z->problems & (ZONE_TRUNCATED | ZONE_BAD_MAGIC)) return -1;
+  z->data = p;
+  z->size = n;
+  z->header = (struct zone_header *) p;
+  return 0;
+}
+
+struct zone_unk1 *zone_get_unk1(struct zone_handle *z) {
+  if (z->unk1 == NULL && !(z->tried & 1)) {
+    size_t end;
+    z->tried |= 1;
+    z->unk1 = parse_zone_unk1(z->data, z->size, z->layout.unk1_start, &end);
+  }
+  return z->unk1;
+}
+
+/** Parses the code section `k` (1 or 2) of `z` into `*code` on first use. */
+struct code_block *zone_get_code(struct zone_handle *z, struct code_block **code,
+                             int k, size_t start, u32 bad) {
+  if (*code == NULL && !(z->tried & 1 << k) && !(z->problems & bad)) {
+    size_t nread;
+    z->tried |= 1 << k;
+    *code = parse_code_block(z->data + start, z->size - start, &nread);
+  }
+  return *code;
+}
+
+struct code_block *zone_get_code1(struct zone_handle *z) {
+  return zone_get_code(z, &z->code1, 1, z->layout.code1_start, ZONE_BAD_CODE1);
+}
+
+struct code_block *zone_get_code2(struct zone_handle *z) {
+  return zone_get_code(z, &z->code2, 2, z->layout.code2_start, ZONE_BAD_CODE2);
+}
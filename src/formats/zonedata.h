@@ -1,9 +1,12 @@
 #ifndef ZONEDATA_H
 #define ZONEDATA_H
 
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "../poketools.h"
+#include "script.h"
 
 //-- Types ------------------------------------------------
 // Raw (packed) types
@@ -65,11 +68,163 @@ struct zonedata {
   struct zone_unk1   *unk1;
   struct code_block  *code1;
   struct code_block  *code2;
+
+  size_t warn_at;               // Where the first section not read to its size
+  long warn_delta;              //   starts, and by how much; 0 if none
+};
+
+/** Where the sections of a zone file are, going by their headers alone.
+ *  Offsets and sizes are in bytes; code2 starts at the first word boundary
+ *  after code1. */
+struct zone_layout {
+  size_t unk1_start, unk1_size;
+  size_t code1_start, code1_size;
+  size_t code2_start, code2_size;
+};
+
+// Problems `scan_zonedata` finds, as bits
+#define ZONE_TRUNCATED        0x01 // A section runs past the end of the file
+#define ZONE_BAD_MAGIC        0x02 // Not a zone file at all
+#define ZONE_BAD_FILE_SIZE    0x04 // `file_size` or `file_size2` isn't the size
+#define ZONE_BAD_UNK1         0x08 // unk1's size doesn't match its entry counts
+#define ZONE_BAD_CODE1        0x10 // No code section header where code1 starts
+#define ZONE_BAD_CODE2        0x20 // ... or where code2 starts
+#define ZONE_BAD_CODE2_OFFSET 0x40 // `code2_offset` isn't where code2 starts
+#define ZONE_TRAILING         0x80 // Bytes follow code2
+
+/** A zone file opened lazily: only the headers are read up front, and each
+ *  section is parsed (in place, like `parse_zonedata`) the first time it is
+ *  asked for.  Sections that are never asked for are never touched, so
+ *  neither are their pages of a mapped file. */
+struct zone_handle {
+  u8 *data;
+  size_t size;
+  struct zone_header *header;
+  struct zone_layout layout;
+  u32 problems;       // From `scan_zonedata`
+
+  // Parsed on first use
+  struct zone_unk1  *unk1;
+  struct code_block *code1;
+  struct code_block *code2;
+  u32 tried;          // Bit k: section k was parsed (or failed to)
 };
 
+//-- unk1 schema ------------------------------------------
+/** The unk1 tables and the fields of their entries, declared once.  The
+ *  entry structs are checked against them, and the typed rows and their
+ *  decoders below, readzone's listing and the columnar export (zonetab.h)
+ *  are all expanded from them.  What the fields mean isn't known yet, so
+ *  they are named by position: naming (or retyping) one here does so
+ *  everywhere.
+ *
+ *  X(k, count, type, FIELDS): table k has `count` (a field of the unk1
+ *  header) entries of `struct type`, with the fields FIELDS lists. */
+#define ZONE_UNK1_TABLES(X) \
+  X(1, num_unk1, zone_unk1_entry_1, ZONE_UNK1_FIELDS_1) \
+  X(2, num_unk2, zone_unk1_entry_2, ZONE_UNK1_FIELDS_2) \
+  X(3, num_unk3, zone_unk1_entry_3, ZONE_UNK1_FIELDS_3) \
+  X(4, num_unk4, zone_unk1_entry_4, ZONE_UNK1_FIELDS_4) \
+  X(5, num_unk5, zone_unk1_entry_4, ZONE_UNK1_FIELDS_4)
+
+#define ZONE_UNK1_NTABLES 5
+
+/** F(type, name) for each field of an entry, in order. */
+#define ZONE_UNK1_FIELDS_1(F) \
+  F(u16, f0) F(u16, f1) F(u16, f2) F(u16, f3) F(u16, f4) F(u16, f5) \
+  F(u16, f6) F(u16, f7) F(u16, f8) F(u16, f9)
+
+#define ZONE_UNK1_FIELDS_2(F) \
+  F(u16, f0) F(u16, f1) F(u16, f2) F(u16, f3) F(u16, f4) F(u16, f5) \
+  F(u16, f6) F(u16, f7) F(u16, f8) F(u16, f9) F(u16, f10) F(u16, f11) \
+  F(u16, f12) F(u16, f13) F(u16, f14) F(u16, f15) F(u16, f16) F(u16, f17) \
+  F(u16, f18) F(u16, f19) F(u16, f20) F(u16, f21) F(u16, f22) F(u16, f23)
+
+#define ZONE_UNK1_FIELDS_3(F) \
+  F(u16, f0) F(u16, f1) F(u16, f2) F(u16, f3) F(u16, f4) F(u16, f5) \
+  F(u16, f6) F(u16, f7) F(u16, f8) F(u16, f9) F(u16, f10) F(u16, f11)
+
+#define ZONE_UNK1_FIELDS_4(F) \
+  F(u16, f0) F(u16, f1) F(u16, f2) F(u16, f3) F(u16, f4) F(u16, f5) \
+  F(u16, f6) F(u16, f7) F(u16, f8) F(u16, f9) F(u16, f10) F(u16, f11)
+
+// A typed row of each table, `struct zone_unk1_row_<k>`
+#define ZONE_UNK1_ROW_FIELD(type, name) type name;
+#define ZONE_UNK1_ROW(k, count, type, FIELDS) \
+  struct zone_unk1_row_##k { FIELDS(ZONE_UNK1_ROW_FIELD) };
+ZONE_UNK1_TABLES(ZONE_UNK1_ROW)
+
+// The entry structs must be laid out as their fields say
+#define ZONE_UNK1_FIELD_SIZE(type, name) + sizeof(type)
+#define ZONE_UNK1_CHECK(k, count, type, FIELDS) \
+  _Static_assert(sizeof(struct type) == 0 FIELDS(ZONE_UNK1_FIELD_SIZE), \
+                 "unk1 table " #k " doesn't match its fields");
+ZONE_UNK1_TABLES(ZONE_UNK1_CHECK)
+
+/** `zone_unk1_decode_<k>(p, row)` decodes the entry of table k at `p` into
+ *  `row`, and returns the end of it.  Each is specialized to its table, with
+ *  every field at a constant offset. */
+#define ZONE_UNK1_DECODE_FIELD(type, name) \
+  memcpy(&row->name, p, sizeof(type)); p += sizeof(type);
+#define ZONE_UNK1_DECODER(k, count, type, FIELDS) \
+  static inline const u8 *zone_unk1_decode_##k(const u8 *p, struct zone_unk1_row_##k *row) { \
+    FIELDS(ZONE_UNK1_DECODE_FIELD) \
+    return p; \
+  }
+ZONE_UNK1_TABLES(ZONE_UNK1_DECODER)
+
+/** What the schema says of a table, for code that goes over all of them. */
+struct zone_unk1_table {
+  int nfields;
+  size_t entry_size;
+  const char *const *field_names;
+  const u8 *field_sizes;
+};
+
+/** Indexed by table number (from 1). */
+extern const struct zone_unk1_table zone_unk1_tables[ZONE_UNK1_NTABLES + 1];
+
+/** The entries of table `k` of `unk1`, storing how many there are in `*n`. */
+const u8 *zone_unk1_entries(const struct zone_unk1 *unk1, int k, int *n);
+
 
 //-- Functions --------------------------------------------
+/** Reads (newly-allocated) zone data from `f`.  A section not read to its
+ *  size is only noted in `warn_at` and `warn_delta`.  Returns NULL if it is
+ *  malformed. */
 struct zonedata *read_zonedata(FILE *f);
 
+/** Parses zone data in place from the `n` bytes at `p`.  The result points
+ *  into `p`, which must outlive it.  A section not read to its size is only
+ *  noted in `warn_at` and `warn_delta`, as for `read_zonedata`.  Returns NULL
+ *  if the data is malformed or truncated. */
+struct zonedata *parse_zonedata(u8 *p, size_t n);
+
+/** Like `parse_zonedata`, but takes the instructions of the code sections
+ *  from the `ndec` entries of `dec` (matched by offset) where available. */
+struct zonedata *parse_zonedata_decoded(u8 *p, size_t n,
+                                        const struct code_decoded *dec, int ndec);
+
+/** Parses the unk1 section at `start` in place from the `n` bytes at `p`,
+ *  storing the end of its entries in `*end`.  Returns NULL if truncated. */
+struct zone_unk1 *parse_zone_unk1(u8 *p, size_t n, size_t start, size_t *end);
+
+//-- Header-only access -----------------------------------
+/** Finds the sections of the zone file in the `n` bytes at `p` from the
+ *  file, unk1 and code section headers alone, without decompressing
+ *  anything, and checks the sizes they give against each other.  Returns
+ *  the problems found (`ZONE_*` bits), or 0. */
+u32 scan_zonedata(struct zone_layout *l, const u8 *p, size_t n);
+
+/** Opens the zone file in the `n` bytes at `p` (which must outlive `z`) for
+ *  lazy access.  Returns 0, or -1 if it isn't a zone file or is truncated;
+ *  other problems are left in `z->problems`. */
+int open_zonedata(struct zone_handle *z, u8 *p, size_t n);
+
+/** The sections of `z`, parsed on first use.  NULL if malformed. */
+struct zone_unk1  *zone_get_unk1(struct zone_handle *z);
+struct code_block *zone_get_code1(struct zone_handle *z);
+struct code_block *zone_get_code2(struct zone_handle *z);
+
 
 #endif
@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "indexfile.h"
+
+//-- Raw streams ----------------------------------------------------
+void raw_string(FILE *out, const char *s) {
+  size_t n = strlen(s);
+  if (n > 0xFFFF) n = 0xFFFF;
+  u16 len = n;
+  fwrite(&len, sizeof(u16), 1, out);
+  fwrite(s, 1, n, out);
+}
+
+long read_raw_string(FILE *in, struct index_buf *b) {
+  u16 len;
+  char s[0x10000];
+  if (fread(&len, sizeof(u16), 1, in) != 1 || fread(s, 1, len, in) != len) return -1;
+  s[len] = 0;
+  return buf_put(b, s, len + 1);
+}
+
+int read_raw_bytes(FILE *in, size_t n, struct index_buf *b) {
+  char chunk[4096];
+  while (n > 0) {
+    size_t k = n < sizeof(chunk)? n : sizeof(chunk);
+    if (fread(chunk, 1, k, in) != k) return -1;
+    buf_put(b, chunk, k);
+    n -= k;
+  }
+  return 0;
+}
+
+
+//-- Buffers --------------------------------------------------------
+size_t buf_put(struct index_buf *b, const void *p, size_t n) {
+  if (b->len + n > b->cap) {
+    b->cap = b->cap? 2 * b->cap : 4096;
+    while (b->len + n > b->cap) b->cap *= 2;
+    b->p = realloc(b->p, b->cap);
+  }
+  memcpy(b->p + b->len, p, n);
+  b->len += n;
+  return b->len - n;
+}
+
+
+//-- Writing --------------------------------------------------------
+int index_begin(struct index_writer *w, const char *path, size_t size) {
+  w->path = path;
+  w->tmp = malloc(strlen(path) + 8);
+  sprintf(w->tmp, "%s.tmp", path);
+  w->out = fopen(w->tmp, "wb");
+  if (w->out == NULL) {
+    free(w->tmp);
+    return -1;
+  }
+
+  // The header is only known at the end
+  for (size_t i = 0; i < size; i++) fputc(0, w->out);
+  return 0;
+}
+
+u64 index_section(struct index_writer *w, const void *p, size_t n) {
+  while (ftell(w->out) % 8 != 0) fputc(0, w->out);
+  u64 off = ftell(w->out);
+  fwrite(p, 1, n, w->out);
+  return off;
+}
+
+void index_rewrite(struct index_writer *w, u64 off, const void *p, size_t n) {
+  long end = ftell(w->out);
+  fseek(w->out, off, SEEK_SET);
+  fwrite(p, 1, n, w->out);
+  fseek(w->out, end, SEEK_SET);
+}
+
+int index_end(struct index_writer *w, const void *header, size_t size) {
+  index_rewrite(w, 0, header, size);
+  int ok = !ferror(w->out);
+  if (fclose(w->out) != 0) ok = 0;
+  if (ok && rename(w->tmp, w->path) < 0) ok = 0;
+  if (!ok) remove(w->tmp);
+  free(w->tmp);
+  return ok? 0 : -1;
+}
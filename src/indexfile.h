@@ -0,0 +1,73 @@
+#ifndef INDEXFILE_H
+#define INDEXFILE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "poketools.h"
+
+/** What the files `ptindex` builds (the corpus index, the unk1 tables and
+ *  the symbol map) have in common.  Each is built in two steps: batch
+ *  workers stream raw records about their files to the builder, which
+ *  collects them into buffers, and then writes the file in one go (see
+ *  `index_begin`).
+ *
+ *  A raw stream is a sequence of records, each a type byte and what that
+ *  type has; every stream starts each of its files with
+ *
+ *    'F' u16 len, path */
+
+#define RAW_FILE 'F'
+
+/** Writes the string `s` to a raw stream, as a u16 length and its bytes
+ *  (cut to 65535). */
+void raw_string(FILE *out, const char *s);
+
+/** A growable byte buffer. */
+struct index_buf {
+  size_t len, cap;
+  u8 *p;
+};
+
+/** Appends `n` bytes to `b`, and returns their offset. */
+size_t buf_put(struct index_buf *b, const void *p, size_t n);
+
+/** Reads a raw string from `in` into `b` (NUL-terminated), and returns its
+ *  offset, or -1 at the end of the input. */
+long read_raw_string(FILE *in, struct index_buf *b);
+
+/** Reads `n` bytes from `in` into `b`.  Returns 0, or -1 if they are cut
+ *  short. */
+int read_raw_bytes(FILE *in, size_t n, struct index_buf *b);
+
+
+//-- Writing --------------------------------------------------------
+// Every file starts with a header that has the offsets of its sections, and
+// each section starts on an 8-byte boundary, so the file can be mapped and
+// used as it is.  It is written to `<path>.tmp` first, and then renamed, so
+// an old file is replaced in one go.
+
+/** A file being written. */
+struct index_writer {
+  FILE *out;
+  const char *path;
+  char *tmp;
+};
+
+/** Starts writing the file at `path`, leaving room for a header of `size`
+ *  bytes.  Returns 0, or -1 if it can't be written. */
+int index_begin(struct index_writer *w, const char *path, size_t size);
+
+/** Writes a section of the `n` bytes at `p`.  Returns its offset. */
+u64 index_section(struct index_writer *w, const void *p, size_t n);
+
+/** Writes the `n` bytes at `p` over what was written at `off` (once the
+ *  offsets in them are known). */
+void index_rewrite(struct index_writer *w, u64 off, const void *p, size_t n);
+
+/** Writes the header of `size` bytes at `header`, and replaces the file
+ *  with what was written.  Returns 0, or -1 if any of it couldn't be
+ *  written (leaving any old file as it was). */
+int index_end(struct index_writer *w, const void *header, size_t size);
+
+#endif
@@ -0,0 +1,143 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+#define INTERN_SHARDS 64         // Power of two
+#define INTERN_CHUNK  (1 << 16)
+
+/** An interned string, with what is known about it.  Callers only ever see
+ *  `s`. */
+struct intern_entry {
+  u64 hash;
+  u32 id;
+  u32 len;
+  char s[];
+};
+
+/** A shard of the pool: an open-addressed hash table of its entries, and
+ *  the chunk they are being allocated from. */
+struct intern_shard {
+  pthread_mutex_t lock;
+  struct intern_entry **slots;
+  u32 mask, n;                 // Slots minus one, entries
+  char *chunk;
+  size_t left;                 // Bytes left in `chunk`
+  size_t bytes;
+};
+
+struct intern_shard intern_shards[INTERN_SHARDS] = {
+  [0 ... INTERN_SHARDS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+u32 intern_next_id = 0;
+
+/** The 64-bit FNV-1a hash of the `n` bytes at `s`. */
+u64 intern_hash_bytes(const char *s, size_t n) {
+  u64 h = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < n; i++) h = (h ^ (u8) s[i]) * 0x100000001B3ULL;
+  return h;
+}
+
+/** The shard of strings with hash `h`: by its top bits, as the slots go by
+ *  the bottom ones. */
+struct intern_shard *intern_shard(u64 h) {
+  return &intern_shards[h >> 58 & (INTERN_SHARDS - 1)];
+}
+
+/** Returns the slot of `sh` holding the `n` bytes at `s` (of hash `h`), or
+ *  the empty one where they would go.  The shard must be locked. */
+struct intern_entry **intern_slot(struct intern_shard *sh, const char *s,
+                                  size_t n, u64 h) {
+  for (u32 i = h & sh->mask;; i = (i + 1) & sh->mask) {
+    struct intern_entry *e = sh->slots[i];
+    if (e == NULL || (e->hash == h && e->len == n && memcmp(e->s, s, n) == 0)) {
+      return &sh->slots[i];
+    }
+  }
+}
+
+/** Doubles the hash table of `sh` (or makes its first one). */
+void intern_grow(struct intern_shard *sh) {
+  u32 nslots = sh->slots != NULL? 2 * (sh->mask + 1) : 256;
+  struct intern_entry **old = sh->slots;
+  u32 nold = old != NULL? sh->mask + 1 : 0;
+
+  sh->slots = calloc(nslots, sizeof(struct intern_entry *));
+  sh->mask = nslots - 1;
+  for (u32 i = 0; i < nold; i++) {
+    if (old[i] == NULL) continue;
+    u32 j = old[i]->hash & sh->mask;
+    while (sh->slots[j] != NULL) j = (j + 1) & sh->mask;
+    sh->slots[j] = old[i];
+  }
+  free(old);
+}
+
+const char *intern(const char *s, size_t n) {
+  u64 h = intern_hash_bytes(s, n);
+  struct intern_shard *sh = intern_shard(h);
+
+  pthread_mutex_lock(&sh->lock);
+  if (4 * (sh->n + 1) > 3 * (sh->mask + 1) || sh->slots == NULL) intern_grow(sh);
+  struct intern_entry **slot = intern_slot(sh, s, n, h);
+  if (*slot == NULL) {
+    size_t size = (offsetof(struct intern_entry, s) + n + 1 + 7) & ~(size_t) 7;
+    if (size > sh->left) {
+      size_t chunk = size > INTERN_CHUNK? size : INTERN_CHUNK;
+      sh->chunk = malloc(chunk);
+      sh->left = chunk;
+    }
+    struct intern_entry *e = (struct intern_entry *) sh->chunk;
+    sh->chunk += size;
+    sh->left -= size;
+    sh->bytes += size;
+
+    e->hash = h;
+    e->id = __atomic_add_fetch(&intern_next_id, 1, __ATOMIC_RELAXED);
+    e->len = n;
+    memcpy(e->s, s, n);
+    e->s[n] = 0;
+    *slot = e;
+    sh->n++;
+  }
+  const char *res = (*slot)->s;
+  pthread_mutex_unlock(&sh->lock);
+  return res;
+}
+
+const char *intern_find(const char *s) {
+  size_t n = strlen(s);
+  u64 h = intern_hash_bytes(s, n);
+  struct intern_shard *sh = intern_shard(h);
+
+  pthread_mutex_lock(&sh->lock);
+  struct intern_entry *e = sh->slots != NULL? *intern_slot(sh, s, n, h) : NULL;
+  pthread_mutex_unlock(&sh->lock);
+  return e != NULL? e->s : NULL;
+}
+
+/** The entry of the interned string `name`. */
+static inline const struct intern_entry *intern_entry(const char *name) {
+  return (const struct intern_entry *) (name - offsetof(struct intern_entry, s));
+}
+
+u32 intern_id(const char *name) {
+  return intern_entry(name)->id;
+}
+
+u64 intern_hash(const char *name) {
+  return intern_entry(name)->hash;
+}
+
+void intern_stats(u32 *count, size_t *bytes) {
+  *count = 0;
+  *bytes = 0;
+  for (int i = 0; i < INTERN_SHARDS; i++) {
+    pthread_mutex_lock(&intern_shards[i].lock);
+    *count += intern_shards[i].n;
+    *bytes += intern_shards[i].bytes;
+    pthread_mutex_unlock(&intern_shards[i].lock);
+  }
+}
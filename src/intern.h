@@ -0,0 +1,39 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+
+#include "poketools.h"
+
+/** A process-wide pool of interned strings: each distinct string is stored
+ *  once, however many files it turns up in, and the same string always
+ *  gives back the same pointer.  So interned names compare equal exactly
+ *  when their pointers do, and each one carries a small id and its hash,
+ *  which cost nothing to look up.
+ *
+ *  The pool is safe to use from any number of threads: it is split into
+ *  shards by hash, each with its own lock, so threads interning different
+ *  names rarely wait on each other.  Strings are never freed; the pool is
+ *  for names (symbols, files, types), of which a corpus only has so many. */
+
+/** Returns the interned copy of the `n` bytes at `s` (which need not be
+ *  null-terminated; the copy is), adding it if it is new. */
+const char *intern(const char *s, size_t n);
+
+/** Returns the interned copy of `s`, or NULL if it has never been
+ *  interned.  Doesn't add anything. */
+const char *intern_find(const char *s);
+
+/** The id of the interned string `name`: ids are handed out from 1 up, in
+ *  the order strings are first interned. */
+u32 intern_id(const char *name);
+
+/** The hash of the interned string `name`, as stored with it: the 64-bit
+ *  FNV-1a hash of its bytes. */
+u64 intern_hash(const char *name);
+
+/** Stores how many strings the pool holds, and the bytes they take up
+ *  (with their ids and hashes, but not the hash tables). */
+void intern_stats(u32 *count, size_t *bytes);
+
+#endif
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE // fopencookie
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libpoketools.h"
+#include "poketools.h"
+#include "arena.h"
+#include "cfg.h"
+#include "loadfile.h"
+#include "mapfile.h"
+#include "records.h"
+#include "render.h"
+#include "script_pp.h"
+#include "formats/script.h"
+
+struct pt_context {
+  struct arena arena;         // Everything loaded lives here
+  pt_sink *sink;
+  void *user;
+  int sink_failed;
+  int color;
+
+  struct mapped_file file;    // `pt_load_file`'s mapping, if any
+  struct loaded_file loaded;
+
+  char error[256];
+  char warning[256];          // About the last load
+};
+
+/** Records a failure in `ctx`.  Returns -1. */
+int pt_fail(struct pt_context *ctx, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(ctx->error, sizeof(ctx->error), fmt, ap);
+  va_end(ap);
+  return -1;
+}
+
+//-- Context --------------------------------------------------------
+struct pt_context *pt_context_new(void) {
+  struct pt_context *ctx = calloc(1, sizeof(struct pt_context));
+  return ctx;
+}
+
+void pt_reset(struct pt_context *ctx) {
+  if (ctx->file.data != NULL) unmap_file(&ctx->file);
+  ctx->file = (struct mapped_file) { NULL, 0 };
+  arena_release(&ctx->arena);
+  ctx->loaded = (struct loaded_file) { 0 };
+  ctx->warning[0] = 0;
+}
+
+void pt_context_free(struct pt_context *ctx) {
+  if (ctx == NULL) return;
+  pt_reset(ctx);
+  arena_free(&ctx->arena);
+  free(ctx);
+}
+
+void pt_set_sink(struct pt_context *ctx, pt_sink *sink, void *user) {
+  ctx->sink = sink;
+  ctx->user = user;
+}
+
+void pt_set_color(struct pt_context *ctx, int color) {
+  ctx->color = color;
+}
+
+const char *pt_error(const struct pt_context *ctx) {
+  return ctx->error;
+}
+
+const char *pt_warning(const struct pt_context *ctx) {
+  return ctx->warning;
+}
+
+
+//-- Loading --------------------------------------------------------
+/** Parses the `n` bytes at `p`, which must outlive what's loaded. */
+int pt_parse(struct pt_context *ctx, u8 *p, size_t n) {
+  struct loaded_file *f = &ctx->loaded;
+  const char *err = load_file(f, p, n);
+  if (err != NULL && f->at != (size_t) -1) {
+    return pt_fail(ctx, "%s: %s at position $%04lx", f->name, err, (long) f->at);
+  }
+  if (err != NULL) return pt_fail(ctx, "%s: %s", f->name, err);
+  if (f->warn_delta != 0) {
+    snprintf(ctx->warning, sizeof(ctx->warning),
+             "%s: Section at position $%04lx not read properly (size delta is %ld)",
+             f->name, (long) f->warn_at, f->warn_delta);
+  }
+  return 0;
+}
+
+/** Loads with `ctx`'s arena as this thread's parse arena, which is then
+ *  restored: the caller may be parsing into an arena of its own. */
+int pt_load_with_arena(struct pt_context *ctx, u8 *p, size_t n, int copy,
+                       const char *name) {
+  struct arena *saved = parse_arena;
+  parse_arena = &ctx->arena;
+  ctx->loaded.name = pstrdup(name != NULL? name : "-");
+  if (copy) p = memcpy(palloc(n), p, n);
+  int res = pt_parse(ctx, p, n);
+  parse_arena = saved;
+  return res;
+}
+
+int pt_load(struct pt_context *ctx, const void *data, size_t n, const char *name) {
+  pt_reset(ctx);
+  int res = pt_load_with_arena(ctx, (u8 *) data, n, 1, name);
+  if (res < 0) pt_reset(ctx);
+  return res;
+}
+
+int pt_load_file(struct pt_context *ctx, const char *path) {
+  pt_reset(ctx);
+  if (map_file(&ctx->file, path) < 0) {
+    ctx->file = (struct mapped_file) { NULL, 0 };
+    return pt_fail(ctx, "Couldn't open '%s' for reading", path);
+  }
+  int res = pt_load_with_arena(ctx, ctx->file.data, ctx->file.size, 0, path);
+  if (res < 0) pt_reset(ctx);
+  return res;
+}
+
+
+//-- Output ---------------------------------------------------------
+ssize_t pt_sink_write(void *cookie, const char *buf, size_t n) {
+  struct pt_context *ctx = cookie;
+  if (ctx->sink_failed || ctx->sink(ctx->user, buf, n) != 0) {
+    ctx->sink_failed = 1;
+    return 0;
+  }
+  return n;
+}
+
+/** Writes everything loaded in the form `what` to `r`.  Returns 0, or -1 if
+ *  some code couldn't be disassembled. */
+int pt_render_to(struct pt_context *ctx, struct render *r, enum pt_output what) {
+  struct loaded_file *f = &ctx->loaded;
+  switch (what) {
+    case PT_LISTING: return render_loaded_file(r, f, RENDER_TEXT, NULL, NULL);
+    case PT_NDJSON:  return render_loaded_file(r, f, RENDER_NDJSON, NULL, NULL);
+    case PT_BINARY:  return render_loaded_file(r, f, RENDER_BINARY, NULL, NULL);
+
+    case PT_DEBUG:
+      if (f->debug != NULL) render_debug(r, f->debug);
+      break;
+
+    case PT_CFG_DOT:
+    case PT_CFG_JSON:
+      for (int k = 0; k < f->ncode; k++) {
+        render_cfg(r, what == PT_CFG_DOT? CFG_DOT : CFG_JSON, f->name,
+                   f->code_names[k], f->code[k], f->debug);
+      }
+      break;
+  }
+  return 0;
+}
+
+int pt_render(struct pt_context *ctx, enum pt_output what) {
+  if (ctx->loaded.ncode == 0 && ctx->loaded.debug == NULL) return pt_fail(ctx, "Nothing loaded");
+
+  FILE *out = stdout;
+  if (ctx->sink != NULL) {
+    cookie_io_functions_t io = { .write = pt_sink_write };
+    out = fopencookie(ctx, "w", io);
+    if (out == NULL) return pt_fail(ctx, "Couldn't open the sink");
+    setvbuf(out, NULL, _IONBF, 0); // The renderer buffers already
+  }
+  ctx->sink_failed = 0;
+
+  // The IR and symbol index are built on demand, into the context's arena;
+  // the renderer is big, so it isn't put on the caller's stack
+  struct arena *saved = parse_arena;
+  parse_arena = &ctx->arena;
+  struct render *r = malloc(sizeof(struct render));
+  render_init(r, out);
+  r->color = ctx->color;
+  int res = pt_render_to(ctx, r, what);
+  render_flush(r);
+  free(r);
+  parse_arena = saved;
+
+  if (out != stdout) fclose(out);
+  else fflush(out);
+
+  if (res < 0) return pt_fail(ctx, "%s: Can't disassemble the code section", ctx->loaded.name);
+  if (ctx->sink_failed) return pt_fail(ctx, "The sink failed");
+  return 0;
+}
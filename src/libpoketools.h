@@ -0,0 +1,67 @@
+#ifndef LIBPOKETOOLS_H
+#define LIBPOKETOOLS_H
+
+#include <stddef.h>
+
+/** The parsers and printers behind the command-line tools, for use from
+ *  other programs (as `libpoketools.a` or `libpoketools.so`).
+ *
+ *  All state lives in a context: what is loaded, where output goes, and the
+ *  options that the tools take from the command line.  Nothing is global, so
+ *  any number of contexts can be used at once from different threads, as long
+ *  as each is only used by one thread at a time.  Failures are returned (as
+ *  -1, with a message from `pt_error`), never asserted. */
+
+struct pt_context;
+
+/** Receives `n` bytes of output.  Returns 0, or nonzero to fail the call
+ *  that is writing. */
+typedef int pt_sink(void *user, const char *data, size_t n);
+
+/** What `pt_render` writes. */
+enum pt_output {
+  PT_LISTING,         // Disassembly, as `readscript` prints it
+  PT_DEBUG,           // The debug section, if any
+  PT_NDJSON,          // Records as JSON lines (see records.h)
+  PT_BINARY,          // Records in binary
+  PT_CFG_DOT,         // Control-flow graphs, for Graphviz
+  PT_CFG_JSON,        // Control-flow graphs as JSON
+};
+
+/** Creates an empty context, writing to stdout in plain text.  Returns NULL
+ *  if out of memory. */
+struct pt_context *pt_context_new(void);
+
+/** Frees `ctx` and everything loaded into it. */
+void pt_context_free(struct pt_context *ctx);
+
+/** Sends the output of `ctx` to `sink`, which gets `user` back with every
+ *  call; NULL goes back to stdout. */
+void pt_set_sink(struct pt_context *ctx, pt_sink *sink, void *user);
+
+/** Sets whether listings are colored with SGR sequences (off by default). */
+void pt_set_color(struct pt_context *ctx, int color);
+
+/** Loads a script or zone file (told apart by its magic number) from the
+ *  `n` bytes at `data`, which are copied, replacing whatever `ctx` held.
+ *  `name` names it in the output.  Returns 0, or -1 if it is malformed. */
+int pt_load(struct pt_context *ctx, const void *data, size_t n, const char *name);
+
+/** Like `pt_load`, but maps the file at `path` (until the next load). */
+int pt_load_file(struct pt_context *ctx, const char *path);
+
+/** Writes what's loaded to the sink in the form `what`.  Returns 0, or -1 if
+ *  nothing is loaded, the code can't be disassembled, or the sink failed. */
+int pt_render(struct pt_context *ctx, enum pt_output what);
+
+/** Frees everything loaded into `ctx`, keeping its memory for reuse. */
+void pt_reset(struct pt_context *ctx);
+
+/** The message for the last failure in `ctx`. */
+const char *pt_error(const struct pt_context *ctx);
+
+/** What was odd about the last file loaded (like a section whose size in
+ *  its header isn't what was read of it), or "" if nothing was. */
+const char *pt_warning(const struct pt_context *ctx);
+
+#endif
@@ -0,0 +1,101 @@
+#include <string.h>
+
+#include "loadfile.h"
+#include "records.h"
+#include "script_pp.h"
+#include "formats/zonedata.h"
+
+//-- Loading --------------------------------------------------------
+/** Parses the sections of the script in the `n` bytes at `p` into `f`. */
+const char *load_script_sections(struct loaded_file *f, u8 *p, size_t n) {
+  size_t section_start = 0;
+  while (n - section_start >= 2 * sizeof(u32)) {
+    u8 *q = p + section_start;
+    size_t nread = 0;
+    f->at = section_start;
+
+    u32 size, magic;
+    memcpy(&size,  q,               sizeof(u32));
+    memcpy(&magic, q + sizeof(u32), sizeof(u32));
+    if (size == 0 || size > n - section_start) return "Bad section size";
+    switch (magic) {
+      case 0x0A0AF1E0:
+        if (f->ncode > 0) return "More than one code section";
+        f->code[0] = parse_code_block(q, n - section_start, &nread);
+        if (f->code[0] == NULL) break;
+        f->code_names[0] = "code";
+        f->ncode = 1;
+        break;
+
+      case 0x0A0AF1EF:
+        f->debug = parse_debug_block(q, n - section_start, &nread);
+        break;
+
+      default:
+        return "Bad section magic number";
+    }
+    if (nread == 0) return "Malformed section";
+    if (nread != size && f->warn_delta == 0) {
+      f->warn_at = section_start;
+      f->warn_delta = (long) nread - (long) size;
+    }
+    section_start += size;
+  }
+
+  f->at = (size_t) -1;
+  if (f->ncode == 0 && f->debug == NULL) return "No sections";
+  return NULL;
+}
+
+const char *load_file(struct loaded_file *f, u8 *p, size_t n) {
+  f->ncode = 0;
+  f->debug = NULL;
+  f->at = (size_t) -1;
+  f->warn_delta = 0;
+
+  u32 magic = 0;
+  if (n >= sizeof(u32)) memcpy(&magic, p, sizeof(u32));
+  if (magic != 0x00044F5A) return load_script_sections(f, p, n);
+
+  struct zonedata *zone = parse_zonedata(p, n);
+  if (zone == NULL) return "Malformed zone data";
+  f->code[0] = zone->code1;
+  f->code[1] = zone->code2;
+  f->code_names[0] = "code1";
+  f->code_names[1] = "code2";
+  f->ncode = 2;
+  f->warn_at = zone->warn_at;
+  f->warn_delta = zone->warn_delta;
+  return NULL;
+}
+
+
+//-- Output ---------------------------------------------------------
+int render_loaded_file(struct render *r, struct loaded_file *f,
+                       enum render_format format, const u32 *start, const u32 *end) {
+  int res = 0;
+  if (format == RENDER_TEXT) {
+    int shown = 0;
+    for (int k = 0; k < f->ncode; k++) {
+      if (start != NULL && start[k] >= end[k]) continue;
+      if (f->ncode > 1) render_fmt(r, "%s------ %s ------\n", shown++? "\n" : "", f->code_names[k]);
+      if (start == NULL) res |= render_disassembly(r, f->code[k], f->debug);
+      else res |= render_disassembly_range(r, f->code[k], f->debug, start[k], end[k]);
+    }
+    if (f->ncode == 0 && start == NULL) render_debug(r, f->debug);
+    return res;
+  }
+
+  struct records w;
+  records_init(&w, r, format);
+  records_file(&w, f->name);
+  if (f->debug != NULL && start == NULL) records_symbols(&w, f->debug);
+  for (int k = 0; k < f->ncode; k++) {
+    if (start == NULL) records_code(&w, f->code_names[k], f->code[k], f->debug);
+    else if (start[k] < end[k]) {
+      records_code_range(&w, f->code_names[k], f->code[k], f->debug, start[k], end[k]);
+    }
+  }
+  records_free(&w);
+  return res;
+}
@@ -0,0 +1,40 @@
+#ifndef LOADFILE_H
+#define LOADFILE_H
+
+#include <stddef.h>
+
+#include "poketools.h"
+#include "render.h"
+#include "formats/script.h"
+
+/** Whole script and zone files, as `libpoketools` and `ptserve` load and
+ *  write them: told apart by their magic numbers, parsed into the parse
+ *  arena, and written out in any of the output formats. */
+
+struct loaded_file {
+  const char *name;             // For the output
+  int ncode;
+  const char *code_names[2];
+  struct code_block *code[2];
+  struct debug_block *debug;
+
+  size_t at;                    // Where the section a failure is about starts
+  size_t warn_at;               // Where the first section not read to its size
+  long warn_delta;              //   starts, and by how much; 0 if none
+};
+
+/** Parses the script or zone in the `n` bytes at `p` (which must outlive
+ *  it) into `f`.  The sections of a script are skipped by the size in their
+ *  headers, as `readscript` does, so a section not read to its size (of a
+ *  script or a zone) is only noted in `warn_at` and `warn_delta`.  Returns NULL, or why not (the
+ *  section it is about at `at`, if any). */
+const char *load_file(struct loaded_file *f, u8 *p, size_t n);
+
+/** Writes `f` to `r` in `format`: all of it, or if `start` isn't NULL, only
+ *  the byte addresses [start[k], end[k]) of each code block `k` (nothing if
+ *  start[k] >= end[k]).  Returns 0, or -1 if some code couldn't be
+ *  disassembled. */
+int render_loaded_file(struct render *r, struct loaded_file *f,
+                       enum render_format format, const u32 *start, const u32 *end);
+
+#endif
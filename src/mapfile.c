@@ -0,0 +1,51 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapfile.h"
+#include "timings.h"
+
+/** Maps the file at `path` into memory.  Returns 0 on success, or -1 (with
+ *  `errno` set) on failure. */
+int map_file(struct mapped_file *m, const char *path) {
+  TIMING_BEGIN(span, PHASE_IO);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    TIMING_END(span, 0, 0);
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    TIMING_END(span, 0, 0);
+    return -1;
+  }
+
+  m->size = st.st_size;
+  m->data = NULL;
+
+  // Empty files can't be mapped, but are still perfectly valid (if useless)
+  if (m->size > 0) {
+    void *p = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      close(fd);
+      TIMING_END(span, 0, 0);
+      return -1;
+    }
+    madvise(p, m->size, MADV_WILLNEED);
+    m->data = p;
+  }
+
+  close(fd);
+  TIMING_END(span, m->size, 0);
+  return 0;
+}
+
+/** Unmaps a file previously mapped with `map_file`. */
+void unmap_file(struct mapped_file *m) {
+  if (m->data != NULL) munmap(m->data, m->size);
+  m->data = NULL;
+  m->size = 0;
+}
@@ -0,0 +1,22 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <stddef.h>
+
+#include "poketools.h"
+
+/** A read-only memory mapping of an entire file. */
+struct mapped_file {
+  u8 *data;
+  size_t size;
+};
+
+/** Maps the file at `path` into memory.  Returns 0 on success, or -1 (with
+ *  `errno` set) on failure. */
+int map_file(struct mapped_file *m, const char *path);
+
+/** Unmaps a file previously mapped with `map_file`.  Anything parsed in place
+ *  from the mapping must not be used afterwards. */
+void unmap_file(struct mapped_file *m);
+
+#endif
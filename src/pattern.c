@@ -0,0 +1,213 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pattern.h"
+#include "columns.h"
+#include "decode.h"
+
+//-- Parsing --------------------------------------------------------
+/** Parses a number as printed in listings (`$1f`) or in C (`0x1f`, `31`,
+ *  `-1`) from the `n` bytes at `s`.  Returns 0 on success. */
+int pattern_parse_value(const char *s, size_t n, u32 *value) {
+  char buf[24], *end;
+  if (n == 0 || n >= sizeof(buf)) return -1;
+  memcpy(buf, s, n);
+  buf[n] = 0;
+  long long v = buf[0] == '$'? strtoll(buf + 1, &end, 16) : strtoll(buf, &end, 0);
+  if (*end != 0 || (buf[0] == '$' && n == 1)) return -1;
+  *value = (u32) v;
+  return 0;
+}
+
+/** Adds the opcodes called `name` (the `n` bytes at it) to `pi`.  Returns
+ *  how many there are. */
+int pattern_parse_name(struct pattern_instr *pi, const char *name, size_t n) {
+  for (int op = 0; op < 0x100; op++) {
+    const char *s = ir_op_name(op);
+    if (s != NULL && strlen(s) == n && memcmp(s, name, n) == 0 && pi->nops < PATTERN_MAX_OPS) {
+      pi->ops[pi->nops++] = op;
+    }
+  }
+  return pi->nops;
+}
+
+/** Parses the instruction of `p` in the `n` bytes at `s`.  Returns NULL, or
+ *  what is wrong with it. */
+const char *pattern_parse_instr(struct pattern *p, struct pattern_instr *pi,
+                                const char *s, size_t n) {
+  const char *end = s + n, *tok[PATTERN_MAX_OPERANDS + 2];
+  size_t len[PATTERN_MAX_OPERANDS + 2];
+  int ntok = 0;
+  while (s < end) {
+    while (s < end && isspace((u8) *s)) s++;
+    if (s == end) break;
+    if (ntok == PATTERN_MAX_OPERANDS + 2) return "Too many operands";
+    tok[ntok] = s;
+    while (s < end && !isspace((u8) *s)) s++;
+    len[ntok] = s - tok[ntok];
+    ntok++;
+  }
+  if (ntok == 0) return "Empty instruction";
+
+  // The opcode: mnemonics may take two words ("Script Begin")
+  *pi = (struct pattern_instr) { 0 };
+  u32 value;
+  int first = 1;
+  if (len[0] == 1 && tok[0][0] == '*') {
+    // Any instruction
+  } else if (pattern_parse_value(tok[0], len[0], &value) == 0) {
+    pi->ops[pi->nops++] = value & 0xFFFF;
+  } else if (ntok > 1 && pattern_parse_name(pi, tok[0], tok[1] + len[1] - tok[0]) > 0) {
+    first = 2;
+  } else if (pattern_parse_name(pi, tok[0], len[0]) == 0) {
+    return "Unknown opcode";
+  }
+  if (ntok - first > PATTERN_MAX_OPERANDS) return "Too many operands";
+
+  for (int i = first; i < ntok; i++) {
+    struct pattern_operand *o = &pi->operands[pi->noperands++];
+    if (len[i] == 1 && tok[i][0] == '*') {
+      o->kind = PATTERN_ANY;
+    } else if (pattern_parse_value(tok[i], len[i], &o->value) == 0) {
+      o->kind = PATTERN_VALUE;
+    } else if (isalpha((u8) tok[i][0]) || tok[i][0] == '_') {
+      // A variable: the same name is the same variable
+      if (len[i] >= sizeof(p->vars[0])) return "Variable name too long";
+      int v = 0;
+      while (v < p->nvars && (strlen(p->vars[v]) != len[i] || memcmp(p->vars[v], tok[i], len[i]) != 0)) v++;
+      if (v == p->nvars) {
+        if (p->nvars == PATTERN_MAX_VARS) return "Too many variables";
+        memcpy(p->vars[v], tok[i], len[i]);
+        p->vars[v][len[i]] = 0;
+        p->nvars++;
+      }
+      o->kind = PATTERN_VAR;
+      o->value = v;
+    } else {
+      return "Bad operand";
+    }
+  }
+  return NULL;
+}
+
+const char *pattern_parse(struct pattern *p, const char *s) {
+  *p = (struct pattern) { 0 };
+  for (;;) {
+    const char *semi = strchr(s, ';');
+    size_t n = semi != NULL? (size_t) (semi - s) : strlen(s);
+    if (p->n == PATTERN_MAX_INSTRS) return "Too many instructions";
+    const char *err = pattern_parse_instr(p, &p->instrs[p->n++], s, n);
+    if (err != NULL) return err;
+    if (semi == NULL) return NULL;
+    s = semi + 1;
+  }
+}
+
+
+//-- Matching -------------------------------------------------------
+int pattern_operands(struct code_block *code, int k, u32 *out) {
+  struct ir_instr *instr = &get_code_ir(code)->instrs[k];
+  u32 *ins = code->instrs;
+  int n = 0;
+
+  if (instr->uses_high_half) {
+    // As printed: signed for CPushConst and CAdjustStack
+    u16 hh = instr->high_half;
+    out[n++] = instr->op == 0x00BC || instr->op == 0x00BF? (u32) (i16) hh : hh;
+  }
+  for (u32 j = 0; j < instr->nargs && n < PATTERN_MAX_OPERANDS; j++) {
+    out[n++] = ins[instr->pos + 1 + j];
+  }
+  return n;
+}
+
+int pattern_match_at(const struct pattern *p, struct code_block *code, int k,
+                     u32 vars[PATTERN_MAX_VARS]) {
+  struct code_ir *ir = get_code_ir(code);
+  if (k < 0 || k + p->n > ir->ninstrs) return 0;
+
+  u8 bound[PATTERN_MAX_VARS] = { 0 };
+  for (int j = 0; j < p->n; j++) {
+    const struct pattern_instr *pi = &p->instrs[j];
+    u16 op = code->instrs[ir->instrs[k + j].pos] & 0xFFFF;
+
+    if (pi->nops > 0) {
+      int i = 0;
+      while (i < pi->nops && pi->ops[i] != op) i++;
+      if (i == pi->nops) return 0;
+    }
+    if (pi->noperands == 0) continue;
+
+    u32 operands[PATTERN_MAX_OPERANDS];
+    if (pattern_operands(code, k + j, operands) < pi->noperands) return 0;
+    for (int i = 0; i < pi->noperands; i++) {
+      const struct pattern_operand *o = &pi->operands[i];
+      if (o->kind == PATTERN_VALUE && operands[i] != o->value) return 0;
+      if (o->kind == PATTERN_VAR) {
+        if (bound[o->value] && vars[o->value] != operands[i]) return 0;
+        bound[o->value] = 1;
+        vars[o->value] = operands[i];
+      }
+    }
+  }
+  return 1;
+}
+
+int pattern_find(const struct pattern *p, struct code_block *code, int *out) {
+  struct code_columns *c = get_code_columns(code);
+  u32 vars[PATTERN_MAX_VARS];
+  int n = 0;
+
+  // Anchor on the instruction whose opcodes are the rarest
+  int anchor = -1;
+  u32 best = UINT32_MAX;
+  for (int j = 0; j < p->n; j++) {
+    const struct pattern_instr *pi = &p->instrs[j];
+    if (pi->nops == 0) continue;
+    u32 count = 0;
+    for (int i = 0; i < pi->nops; i++) {
+      count += c->counts[pi->ops[i] < COLUMNS_NOPS? pi->ops[i] : COLUMNS_NOPS];
+    }
+    if (count < best) best = count, anchor = j;
+  }
+
+  if (anchor < 0) {
+    for (int k = 0; k + p->n <= c->n; k++) {
+      if (pattern_match_at(p, code, k, vars)) out[n++] = k;
+    }
+    return n;
+  }
+
+  const struct pattern_instr *pi = &p->instrs[anchor];
+  for (int w = 0; best > 0 && w < c->nwords; w++) {
+    u64 m = 0;
+    for (int i = 0; i < pi->nops; i++) {
+      u64 *bits = c->bitmaps[pi->ops[i] < COLUMNS_NOPS? pi->ops[i] : COLUMNS_NOPS];
+      if (bits != NULL) m |= bits[w];
+    }
+    for (; m != 0; m &= m - 1) {
+      int k = 64 * w + __builtin_ctzll(m) - anchor;
+      if (pattern_match_at(p, code, k, vars)) out[n++] = k;
+    }
+  }
+  return n;
+}
+
+
+//-- N-grams --------------------------------------------------------
+u32 pattern_ngram_hash(const u16 *ops) {
+  u64 x = ops[0] | (u64) ops[1] << 16 | (u64) ops[2] << 32;
+  return (x * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+
+int pattern_ngrams(const struct pattern *p, u32 *out) {
+  int n = 0;
+  for (int j = 0; j + PATTERN_NGRAM <= p->n; j++) {
+    u16 ops[PATTERN_NGRAM];
+    int i = 0;
+    for (; i < PATTERN_NGRAM && p->instrs[j + i].nops == 1; i++) ops[i] = p->instrs[j + i].ops[0];
+    if (i == PATTERN_NGRAM) out[n++] = pattern_ngram_hash(ops);
+  }
+  return n;
+}
@@ -0,0 +1,86 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include "poketools.h"
+#include "formats/script.h"
+
+/** Patterns over decoded instructions, for finding idioms in code without
+ *  going through its listing.  A pattern is a sequence of instructions,
+ *  separated by `;`, each an opcode followed by constraints on its operands:
+ *
+ *    DGetGlobal X; CmpConst $0005; JumpNE
+ *
+ *  The opcode is a mnemonic (which may name several, like `Jump??`), a
+ *  number (`$a3`, `0xa3`), or `*` for any instruction.  Operands are what
+ *  the listing shows, in order: the high half if the instruction has one,
+ *  then its operand words (for branches, the offset).  Each operand is
+ *  a value, `*` for any, or a name: a variable, which matches anything the
+ *  first time and the same value every time after.  Operands left out match
+ *  anything.
+ *
+ *  Matching runs on a block's columns (see columns.h): only where the
+ *  pattern's rarest opcode is are the other instructions looked at. */
+
+#define PATTERN_MAX_INSTRS   16
+#define PATTERN_MAX_OPERANDS 8
+#define PATTERN_MAX_OPS      16
+#define PATTERN_MAX_VARS     8
+
+enum pattern_operand_kind {
+  PATTERN_ANY,
+  PATTERN_VALUE,
+  PATTERN_VAR,
+};
+
+struct pattern_instr {
+  int nops;           // 0 for any instruction
+  u16 ops[PATTERN_MAX_OPS];
+  int noperands;
+  struct pattern_operand {
+    enum pattern_operand_kind kind;
+    u32 value;        // PATTERN_VALUE: the value; PATTERN_VAR: its number
+  } operands[PATTERN_MAX_OPERANDS];
+};
+
+struct pattern {
+  int n;
+  struct pattern_instr instrs[PATTERN_MAX_INSTRS];
+  int nvars;
+  char vars[PATTERN_MAX_VARS][16];
+};
+
+/** Parses the pattern `s` into `p`.  Returns NULL, or what is wrong with it. */
+const char *pattern_parse(struct pattern *p, const char *s);
+
+/** Returns whether `p` matches the instructions of `code` from the `k`th (of
+ *  its IR) on, storing the values of its variables in `vars`. */
+int pattern_match_at(const struct pattern *p, struct code_block *code, int k,
+                     u32 vars[PATTERN_MAX_VARS]);
+
+/** Stores where `p` matches `code` (as indices into its IR) in `out`, which
+ *  needs room for one per instruction, in order.  Returns how many there
+ *  are. */
+int pattern_find(const struct pattern *p, struct code_block *code, int *out);
+
+/** Stores the operands of instruction `k` of the IR of `code` in `out`, as
+ *  patterns see them (see above).  Returns how many there are, at most
+ *  PATTERN_MAX_OPERANDS. */
+int pattern_operands(struct code_block *code, int k, u32 *out);
+
+
+//-- N-grams --------------------------------------------------------
+// Every run of PATTERN_NGRAM opcodes in a row, hashed, is a key of the
+// corpus index (see corpus.h): looking up those of a pattern gives the files
+// it can match in, without opening the others.
+
+#define PATTERN_NGRAM 3
+
+/** Hashes the PATTERN_NGRAM opcodes at `ops`. */
+u32 pattern_ngram_hash(const u16 *ops);
+
+/** Stores the hashes of the n-grams every match of `p` must contain in
+ *  `out` (which needs room for PATTERN_MAX_INSTRS): those of its runs of
+ *  single opcodes.  Returns how many there are. */
+int pattern_ngrams(const struct pattern *p, u32 *out);
+
+#endif
@@ -0,0 +1,568 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "poketools.h"
+#include "batch.h"
+#include "corpus.h"
+#include "decode.h"
+#include "render.h"
+#include "symmap.h"
+#include "timings.h"
+#include "zonetab.h"
+
+/** Builds the index at `index` from the files named on the command line. */
+int build(const char *index, int argc, char *argv[]) {
+  struct batch_list list = { 0 };
+  int nthreads;
+  argc = timings_parse_args(argc, argv);
+  if (batch_parse_args(&list, &nthreads, argc, argv) < 0) return 1;
+
+  // The raw postings of every file, in list order
+  FILE *tmp = tmpfile();
+  if (tmp == NULL) {
+    fprintf(stderr, "Couldn't create a temporary file.\n");
+    return 2;
+  }
+  int failures = batch_run(&list, corpus_postings, nthreads, 0, tmp);
+  if (failures > 0) fprintf(stderr, "%d of %d files failed.\n", failures, list.n);
+
+  rewind(tmp);
+  int status = 0;
+  if (corpus_build(tmp, index) < 0) {
+    fprintf(stderr, "Couldn't write '%s'.\n", index);
+    status = 2;
+  }
+  fclose(tmp);
+
+  for (int i = 0; i < list.n; i++) free(list.paths[i]);
+  free(list.paths);
+  return status;
+}
+
+/** Builds the file at `path` from the files named on the command line: what
+ *  `fn` writes for each of them, put together by `build_fn`.  For the unk1
+ *  tables and symbol maps. */
+int build_with(const char *path, batch_fn *fn, int (*build_fn)(FILE *, const char *),
+               int argc, char *argv[]) {
+  struct batch_list list = { 0 };
+  int nthreads;
+  argc = timings_parse_args(argc, argv);
+  if (argc < 0 || batch_parse_args(&list, &nthreads, argc, argv) < 0) return 1;
+
+  FILE *tmp = tmpfile();
+  if (tmp == NULL) {
+    fprintf(stderr, "Couldn't create a temporary file.\n");
+    return 2;
+  }
+  int failures = batch_run(&list, fn, nthreads, 0, tmp);
+  if (failures > 0) fprintf(stderr, "%d of %d files failed.\n", failures, list.n);
+
+  rewind(tmp);
+  int status = 0;
+  if (build_fn(tmp, path) < 0) {
+    fprintf(stderr, "Couldn't write '%s'.\n", path);
+    status = 2;
+  }
+  fclose(tmp);
+
+  for (int i = 0; i < list.n; i++) free(list.paths[i]);
+  free(list.paths);
+  return status;
+}
+
+/** Parses a number as printed in listings (`$1f`) or in C (`0x1f`, `31`,
+ *  `-1`).  Returns 0 on success. */
+int parse_value(const char *s, u32 *value) {
+  char *end;
+  long long v = s[0] == '$'? strtoll(s + 1, &end, 16) : strtoll(s, &end, 0);
+  if (*s == 0 || *end != 0) return -1;
+  *value = (u32) v;
+  return 0;
+}
+
+/** Parses an opcode, by value or mnemonic, into `ops`: a mnemonic can name
+ *  several (the Jump?? family, say), and `*` matches any.  Returns how many
+ *  there are. */
+int parse_ops(const char *s, i32 *ops) {
+  u32 value;
+  if (strcmp(s, "*") == 0) ops[0] = -1;
+  else if (parse_value(s, &value) == 0) ops[0] = value & 0xFFFF;
+  else {
+    int n = 0;
+    for (int op = 0; op < 0x100; op++) {
+      const char *name = ir_op_name(op);
+      if (name != NULL && strcmp(name, s) == 0) ops[n++] = op;
+    }
+    return n;
+  }
+  return 1;
+}
+
+/** Scans the files named on the command line (after `[-c] [--target
+ *  <addr>] <op>[:<high half>]`) for matching instructions. */
+int scan(int argc, char *argv[]) {
+  // Our options; the rest is a batch command line
+  i32 target = -1;
+  const char *what = NULL;
+  int k = 1;
+  for (int i = 1; i < argc; i++) {
+    u32 addr;
+    if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--count") == 0) corpus_scan_count_only = 1;
+    else if (strcmp(argv[i], "--target") == 0 && i + 1 < argc) {
+      if (parse_value(argv[++i], &addr) < 0) return 1;
+      target = addr / 4;
+    }
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      argv[k++] = argv[i++];
+      argv[k++] = argv[i];
+    }
+    else if (what == NULL && argv[i][0] != '-') what = argv[i];
+    else argv[k++] = argv[i];
+  }
+  argv[k] = NULL;
+  if (what == NULL) return 1;
+
+  char *op = strdup(what), *hh = strchr(op, ':');
+  u32 high_half = 0;
+  if (hh != NULL) *hh++ = 0;
+  i32 ops[0x100];
+  int nops = parse_ops(op, ops);
+  if (nops == 0 || (hh != NULL && parse_value(hh, &high_half) < 0)) {
+    fprintf(stderr, "Bad instruction '%s'.\n", what);
+    free(op);
+    return 1;
+  }
+  for (int i = 0; i < nops; i++) {
+    corpus_scan_filters[i] = (struct column_filter) {
+      ops[i], hh != NULL? (i32) (high_half & 0xFFFF) : -1, target
+    };
+  }
+  corpus_scan_nfilters = nops;
+  free(op);
+
+  struct batch_list list = { 0 };
+  int nthreads;
+  argc = timings_parse_args(k, argv);
+  if (argc < 0 || batch_parse_args(&list, &nthreads, argc, argv) < 0) return 1;
+
+  int failures = batch_run(&list, corpus_scan, nthreads, 0, stdout);
+  if (corpus_scan_count_only) printf("%llu\n", (unsigned long long) corpus_scan_total);
+  fflush(stdout);
+  if (failures > 0) fprintf(stderr, "%d of %d files failed.\n", failures, list.n);
+
+  for (int i = 0; i < list.n; i++) free(list.paths[i]);
+  free(list.paths);
+  return failures > 0? 2 : corpus_scan_total > 0? 0 : 3;
+}
+
+/** Adds the files of `ix` that have postings under every one of the `n`
+ *  n-gram hashes in `ngrams` to `list`: the only ones a pattern with those
+ *  n-grams can match in.  With no n-grams, that's all of them. */
+void ngram_files(struct corpus_index *ix, const u32 *ngrams, int n,
+                 struct batch_list *list) {
+  if (n == 0) {
+    for (u32 f = 0; f < ix->header->nfiles; f++) batch_push(list, corpus_file(ix, f));
+    return;
+  }
+  const struct corpus_key *keys[PATTERN_MAX_INSTRS] = { NULL };
+  for (int i = 0; i < n; i++) {
+    if (corpus_find(ix, KEY_NGRAM, ngrams[i], NULL, 0, &keys[i]) == 0) return;
+  }
+
+  // The files of the rarest one, if every other one has postings there too
+  int rarest = 0;
+  for (int i = 1; i < n; i++) {
+    if (keys[i]->npostings < keys[rarest]->npostings) rarest = i;
+  }
+  const struct corpus_posting *p = &ix->postings[keys[rarest]->first];
+  for (u32 j = 0; j < keys[rarest]->npostings; j++) {
+    u32 file = p[j].file;
+    if (j > 0 && file == p[j - 1].file) continue;
+
+    int everywhere = 1;
+    for (int i = 0; everywhere && i < n; i++) {
+      // Postings are sorted by file: find the first one at or after it
+      const struct corpus_posting *q = &ix->postings[keys[i]->first];
+      u32 lo = 0, hi = keys[i]->npostings;
+      while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if (q[mid].file < file) lo = mid + 1;
+        else hi = mid;
+      }
+      everywhere = lo < keys[i]->npostings && q[lo].file == file;
+    }
+    if (everywhere) batch_push(list, corpus_file(ix, file));
+  }
+}
+
+/** Searches for a pattern (see pattern.h) in the files named on the command
+ *  line, or in those of an index (after `[-c] [--index <index>]
+ *  <pattern>`), which only looks at the files that have the pattern's
+ *  n-grams. */
+int grep(int argc, char *argv[]) {
+  // Our options; the rest is a batch command line
+  const char *what = NULL, *index = NULL;
+  int k = 1, nthreads = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--count") == 0) corpus_grep_count_only = 1;
+    else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc) index = argv[++i];
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      if ((nthreads = atoi(argv[++i])) < 1) return 1;
+    }
+    else if (what == NULL && argv[i][0] != '-') what = argv[i];
+    else argv[k++] = argv[i];
+  }
+  argv[k] = NULL;
+  if (what == NULL) return 1;
+
+  const char *err = pattern_parse(&corpus_grep_pattern, what);
+  if (err != NULL) {
+    fprintf(stderr, "Bad pattern '%s': %s.\n", what, err);
+    return 1;
+  }
+
+  struct batch_list list = { 0 };
+  argc = timings_parse_args(k, argv);
+  if (argc < 0) return 1;
+  if (index != NULL) {
+    // The files come from the index
+    if (argc > 1) return 1;
+    struct corpus_index ix;
+    if (corpus_open(&ix, index) < 0) {
+      fprintf(stderr, "Couldn't read index '%s'.\n", index);
+      return 2;
+    }
+    u32 ngrams[PATTERN_MAX_INSTRS];
+    int n = pattern_ngrams(&corpus_grep_pattern, ngrams);
+    ngram_files(&ix, ngrams, n, &list);
+    corpus_close(&ix);
+    if (nthreads == 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  } else {
+    int n;
+    if (batch_parse_args(&list, &n, argc, argv) < 0) return 1;
+    if (nthreads == 0) nthreads = n;
+  }
+
+  int failures = batch_run(&list, corpus_grep, nthreads, 0, stdout);
+  if (corpus_grep_count_only) printf("%llu\n", (unsigned long long) corpus_grep_total);
+  fflush(stdout);
+  if (failures > 0) fprintf(stderr, "%d of %d files failed.\n", failures, list.n);
+
+  for (int i = 0; i < list.n; i++) free(list.paths[i]);
+  free(list.paths);
+  return failures > 0? 2 : corpus_grep_total > 0? 0 : 3;
+}
+
+/** Lists (or counts) the rows of table `id` of the table file at `path` that
+ *  match every `<field>=<value>` condition in `conds`. */
+int rows(const char *path, const char *id, int nconds, char *conds[], int count) {
+  struct corpus_tables t;
+  if (tables_open(&t, path) < 0) {
+    fprintf(stderr, "Couldn't read table file '%s'.\n", path);
+    return 2;
+  }
+
+  u32 k;
+  const struct tables_table *table = parse_value(id, &k) == 0? tables_table(&t, k) : NULL;
+  if (table == NULL) {
+    fprintf(stderr, "No table '%s'.\n", id);
+    tables_close(&t);
+    return 1;
+  }
+
+  // Each condition narrows down the rows, a column at a time
+  u8 *keep = malloc(table->nrows + 1);
+  memset(keep, 1, table->nrows);
+  for (int i = 0; i < nconds; i++) {
+    char *eq = strchr(conds[i], '=');
+    u32 value;
+    if (eq != NULL) *eq = 0;
+    const struct tables_column *c = eq != NULL? tables_column(&t, table, conds[i]) : NULL;
+    if (c == NULL || parse_value(eq + 1, &value) < 0) {
+      if (eq != NULL) *eq = '=';
+      fprintf(stderr, "Bad condition '%s'.\n", conds[i]);
+      free(keep);
+      tables_close(&t);
+      return 1;
+    }
+
+    const u8 *p = t.map.data + c->off;
+    u32 n = table->nrows;
+    switch (c->width) {
+      case 1: for (u32 j = 0; j < n; j++) keep[j] &= p[j] == value; break;
+      case 2: for (u32 j = 0; j < n; j++) keep[j] &= ((const u16 *) p)[j] == value; break;
+      case 4: for (u32 j = 0; j < n; j++) keep[j] &= ((const u32 *) p)[j] == value; break;
+    }
+  }
+
+  struct render *r = malloc(sizeof(struct render));
+  render_init(r, stdout);
+  const struct tables_column *cols = &t.columns[table->first_column];
+  u32 total = 0;
+  for (u32 j = 0; j < table->nrows; j++) {
+    if (!keep[j]) continue;
+    total++;
+    if (count) continue;
+
+    render_str(r, tables_zone(&t, tables_value(&t, &cols[0], j)));
+    render_str(r, "  ");
+    render_int(r, table->id, 0);
+    render_char(r, ':');
+    render_int(r, tables_value(&t, &cols[1], j), 2);
+    render_char(r, ':');
+    for (u32 c = 2; c < table->ncolumns; c++) {
+      render_char(r, ' ');
+      render_hex(r, tables_value(&t, &cols[c], j), 2 * cols[c].width, ' ');
+    }
+    render_char(r, '\n');
+  }
+  if (count) render_fmt(r, "%u\n", total);
+
+  render_flush(r);
+  free(r);
+  free(keep);
+  tables_close(&t);
+  return total > 0? 0 : 3;
+}
+
+/** Opens the symbol map at `path` and finds `script` in it.  Returns the
+ *  script, or NULL (having said why, and closed `m`). */
+const struct symmap_script *open_script(struct corpus_symmap *m, const char *path,
+                                        const char *script) {
+  if (symmap_open(m, path) < 0) {
+    fprintf(stderr, "Couldn't read symbol map '%s'.\n", path);
+    return NULL;
+  }
+  const struct symmap_script *s = symmap_script(m, script);
+  if (s == NULL) {
+    fprintf(stderr, "No script '%s' in '%s'.\n", script, path);
+    symmap_close(m);
+  }
+  return s;
+}
+
+/** Writes where each of the `n` addresses in `args` of `script` comes from,
+ *  going by the symbol map at `path`: the file and line, and the function
+ *  and how far into it. */
+int addrs(const char *path, const char *script, int n, char *args[]) {
+  struct corpus_symmap m;
+  const struct symmap_script *s = open_script(&m, path, script);
+  if (s == NULL) return 2;
+
+  struct render *r = malloc(sizeof(struct render));
+  render_init(r, stdout);
+  int status = 0;
+  for (int i = 0; i < n; i++) {
+    u32 addr;
+    if (parse_value(args[i], &addr) < 0) {
+      fprintf(stderr, "Bad address '%s'.\n", args[i]);
+      status = 1;
+      continue;
+    }
+
+    const struct addr_run *run = symmap_addr(&m, s, addr);
+    const struct symmap_name *file = run != NULL? symmap_file(&m, s, run->file) : NULL,
+                             *function = run != NULL? symmap_function(&m, s, run->function) : NULL;
+    render_char(r, '$');
+    render_hex(r, addr, 4, '0');
+    render_str(r, "  ");
+    render_str(r, file != NULL? symmap_string(&m, file->name) : "?");
+    render_char(r, ':');
+    if (run != NULL && run->line >= 0) render_int(r, run->line, 0);
+    else render_char(r, '?');
+    render_str(r, "  ");
+    if (function != NULL) {
+      render_str(r, symmap_string(&m, function->name));
+      render_str(r, "+$");
+      render_hex(r, addr - function->addr, 0, '0');
+    } else {
+      render_char(r, '?');
+    }
+    render_char(r, '\n');
+  }
+
+  render_flush(r);
+  free(r);
+  symmap_close(&m);
+  return status;
+}
+
+/** Writes the address ranges of `spec` (`<file>:<line>`) of `script`, going
+ *  by the symbol map at `path`. */
+int line(const char *path, const char *script, const char *spec) {
+  const char *colon = strrchr(spec, ':');
+  u32 lineno;
+  if (colon == NULL || parse_value(colon + 1, &lineno) < 0) {
+    fprintf(stderr, "Bad line '%s'.\n", spec);
+    return 1;
+  }
+
+  struct corpus_symmap m;
+  const struct symmap_script *s = open_script(&m, path, script);
+  if (s == NULL) return 2;
+
+  char *name = strndup(spec, colon - spec);
+  i32 file = symmap_find_file(&m, s, name);
+  int n = 0;
+  const struct addr_range *ranges = file >= 0? symmap_line(&m, s, file, lineno, &n) : NULL;
+  for (int i = 0; i < n; i++) {
+    if (ranges[i].end == UINT32_MAX) printf("$%04x-\n", ranges[i].start);
+    else printf("$%04x-$%04x\n", ranges[i].start, ranges[i].end);
+  }
+
+  free(name);
+  symmap_close(&m);
+  return n > 0? 0 : 3;
+}
+
+/** Writes the postings of `key`. */
+void print_postings(struct render *r, struct corpus_index *ix,
+                    const struct corpus_key *key) {
+  for (u32 i = 0; i < key->npostings; i++) {
+    const struct corpus_posting *p = &ix->postings[key->first + i];
+    const char *name = ir_op_name(p->op);
+
+    render_str(r, corpus_file(ix, p->file));
+    render_str(r, "  ");
+    render_str(r, corpus_block_names[p->block < 3? p->block : 0]);
+    render_char(r, '+');
+    render_hex(r, p->addr, 4, '0');
+    render_str(r, "  ");
+    if (name != NULL) {
+      render_str(r, name);
+    } else {
+      render_char(r, '$');
+      render_hex(r, p->op, 4, '0');
+    }
+    render_char(r, '\n');
+  }
+}
+
+/** Answers a query on the index at `index`. */
+int query(const char *index, const char *kind_name, const char *arg, int count) {
+  struct corpus_index ix;
+  if (corpus_open(&ix, index) < 0) {
+    fprintf(stderr, "Couldn't read index '%s'.\n", index);
+    return 2;
+  }
+
+  static const char *kind_names[] = { NULL, "op", "imm", "global", "name" };
+  enum corpus_kind kind = 0;
+  for (int k = KEY_OP; k <= KEY_NAME; k++) {
+    if (strcmp(kind_name, kind_names[k]) == 0) kind = k;
+  }
+
+  // The values to look up: an opcode may be given by mnemonic, which can
+  // name several (the Jump?? family, say)
+  u32 values[0x100];
+  int nvalues = 0;
+  if (kind == KEY_OP && parse_value(arg, &values[0]) < 0) {
+    for (int op = 0; op < 0x100; op++) {
+      const char *name = ir_op_name(op);
+      if (name != NULL && strcmp(name, arg) == 0) values[nvalues++] = op;
+    }
+  } else if (kind == KEY_NAME || parse_value(arg, &values[0]) == 0) {
+    nvalues = 1;
+  }
+
+  if (kind == 0 || nvalues == 0) {
+    fprintf(stderr, kind == 0? "Unknown key kind '%s'.\n" : "Bad value '%s'.\n",
+            kind == 0? kind_name : arg);
+    corpus_close(&ix);
+    return 1;
+  }
+
+  // Names may end with `*` to match a prefix
+  char *name = NULL;
+  int prefix = 0;
+  if (kind == KEY_NAME) {
+    name = strdup(arg);
+    size_t len = strlen(name);
+    if (len > 0 && name[len - 1] == '*') {
+      name[len - 1] = 0;
+      prefix = 1;
+    }
+  }
+
+  struct render *r = malloc(sizeof(struct render));
+  render_init(r, stdout);
+  u32 total = 0;
+
+  for (int v = 0; v < nvalues; v++) {
+    const struct corpus_key *keys;
+    int n = corpus_find(&ix, kind, values[v], name, prefix, &keys);
+    for (int k = 0; k < n; k++) {
+      total += keys[k].npostings;
+      if (!count) print_postings(r, &ix, &keys[k]);
+    }
+  }
+  if (count) render_fmt(r, "%u\n", total);
+
+  render_flush(r);
+  free(r);
+  free(name);
+  corpus_close(&ix);
+  return total > 0? 0 : 3;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc >= 4 && strcmp(argv[1], "build") == 0) {
+    // `-o <index>` is ours; the rest is a batch command line
+    const char *index = NULL;
+    int k = 1;
+    for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) index = argv[++i];
+      else argv[k++] = argv[i];
+    }
+    argv[k] = NULL;
+    if (index != NULL) {
+      int status = build(index, k - 1, argv + 1);
+      if (status != 1) return status;
+    }
+  } else if (argc >= 4 && (strcmp(argv[1], "tables") == 0 || strcmp(argv[1], "symmap") == 0)) {
+    int tables = strcmp(argv[1], "tables") == 0;
+    const char *path = NULL;
+    int k = 1;
+    for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) path = argv[++i];
+      else argv[k++] = argv[i];
+    }
+    argv[k] = NULL;
+    if (path != NULL) {
+      int status = tables? build_with(path, tables_entries, tables_build, k - 1, argv + 1)
+                         : build_with(path, symmap_tables, symmap_build, k - 1, argv + 1);
+      if (status != 1) return status;
+    }
+  } else if (argc >= 4 && strcmp(argv[1], "rows") == 0) {
+    int count = strcmp(argv[2], "-c") == 0 || strcmp(argv[2], "--count") == 0;
+    if (argc >= 4 + count) return rows(argv[2 + count], argv[3 + count], argc - 4 - count, argv + 4 + count, count);
+  } else if (argc >= 5 && strcmp(argv[1], "addr") == 0) {
+    return addrs(argv[2], argv[3], argc - 4, argv + 4);
+  } else if (argc == 5 && strcmp(argv[1], "line") == 0) {
+    return line(argv[2], argv[3], argv[4]);
+  } else if (argc >= 3 && strcmp(argv[1], "grep") == 0) {
+    int status = grep(argc - 1, argv + 1);
+    if (status != 1) return status;
+  } else if (argc >= 4 && strcmp(argv[1], "scan") == 0) {
+    int status = scan(argc - 1, argv + 1);
+    if (status != 1) return status;
+  } else if (argc >= 5 && strcmp(argv[1], "query") == 0) {
+    int count = strcmp(argv[2], "-c") == 0 || strcmp(argv[2], "--count") == 0;
+    if (argc == 5 + count) return query(argv[2 + count], argv[3 + count], argv[4 + count], count);
+  }
+
+  fprintf(stderr, "usage: %s build [-j <threads>] [--timings[=json]] -o <index> <file|dir|->...\n"
+                  "       %s query [-c] <index> <op|imm|global|name> <value>\n"
+                  "       %s scan [-c] [-j <threads>] [--target <addr>] <op|*>[:<high half>] <file|dir|->...\n"
+                  "       %s grep [-c] [-j <threads>] <pattern> <file|dir|->...\n"
+                  "       %s grep [-c] [-j <threads>] --index <index> <pattern>\n"
+                  "       %s tables [-j <threads>] -o <tables> <file|dir|->...\n"
+                  "       %s rows [-c] <tables> <table> [<field>=<value>...]\n"
+                  "       %s symmap [-j <threads>] -o <map> <file|dir|->...\n"
+                  "       %s addr <map> <script> <addr>...\n"
+                  "       %s line <map> <script> <file>:<line>\n",
+          argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+  return 1;
+}
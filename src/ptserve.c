@@ -0,0 +1,782 @@
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "poketools.h"
+#include "addrmap.h"
+#include "arena.h"
+#include "cache.h"
+#include "decode.h"
+#include "diff.h"
+#include "intern.h"
+#include "loadfile.h"
+#include "mapfile.h"
+#include "render.h"
+#include "formats/script.h"
+
+/** Disassembly without the re-parsing: `--watch` keeps a mirror of listings
+ *  up to date as the scripts and zones below a directory change, and
+ *  `--socket` answers requests for files, functions and address ranges from
+ *  an in-memory cache of parsed files. */
+
+//-- Parsed files ---------------------------------------------------
+/** A parsed script or zone, with everything parsed from it in its own arena.
+ *  The IR, symbol index and function table are built up front, so rendering
+ *  only reads it, and any number of threads can share it. */
+struct serve_file {
+  char *path;
+  struct stat st;               // As it was when mapped
+  struct arena arena;
+  struct mapped_file file;
+  struct loaded_file loaded;
+  struct diff_block blocks[2];  // The code blocks split into functions
+
+  // In the cache
+  int refs;
+  size_t cost;
+  struct serve_file *prev, *next;
+};
+
+/** Maps the file at `path` into `f`.  Returns 0, or -1 if it can't be
+ *  read. */
+int serve_map(struct serve_file *f, const char *path) {
+  f->path = strdup(path);
+  // Stat first: if the file changes in between, the next look sees it
+  if (stat(path, &f->st) < 0 || map_file(&f->file, path) < 0) {
+    f->file = (struct mapped_file) { NULL, 0 };
+    return -1;
+  }
+  return 0;
+}
+
+/** Parses the mapped file of `f` into its arena, and builds everything
+ *  rendering needs.  Returns NULL, or why not. */
+const char *serve_parse(struct serve_file *f) {
+  struct arena *saved = parse_arena;
+  parse_arena = &f->arena;
+
+  struct loaded_file *l = &f->loaded;
+  l->name = f->path;
+  const char *err = load_file(l, f->file.data, f->file.size);
+  if (err == NULL) {
+    if (l->warn_delta != 0) {
+      fprintf(stderr, "%s: warning: section at position $%04lx not read properly (size delta is %ld).\n",
+              f->path, (long) l->warn_at, l->warn_delta);
+    }
+    if (l->debug != NULL) {
+      build_debug_index(l->debug);
+      get_debug_addrs(l->debug);
+    }
+    for (int k = 0; k < l->ncode; k++) {
+      get_code_ir(l->code[k]);
+      diff_split(&f->blocks[k], l->code[k], l->debug);
+    }
+  }
+
+  parse_arena = saved;
+  f->cost = f->file.size + f->arena.used;
+  return err;
+}
+
+/** Frees `f` and everything parsed from it. */
+void serve_free(struct serve_file *f) {
+  if (f->file.data != NULL) unmap_file(&f->file);
+  arena_free(&f->arena);
+  free(f->path);
+  free(f);
+}
+
+
+//-- Rendering ------------------------------------------------------
+/** What to show of a file: per code block, the byte addresses [start, end)
+ *  (nothing if start >= end), or all of it. */
+struct serve_query {
+  enum render_format format;
+  int whole;
+  u32 start[2], end[2];
+};
+
+/** Writes what `q` asks for of `f` to `r`.  Returns 0, or -1 if some code
+ *  couldn't be disassembled. */
+int serve_render(struct render *r, struct serve_file *f, struct serve_query *q) {
+  return render_loaded_file(r, &f->loaded, q->format,
+                            q->whole? NULL : q->start, q->whole? NULL : q->end);
+}
+
+/** Parses an address: `$` and hex digits, or a C integer constant.  Returns
+ *  0, or -1 if it isn't one. */
+int parse_address(const char *s, u32 *v) {
+  char *end;
+  unsigned long x = *s == '$'? strtoul(s + 1, &end, 16) : strtoul(s, &end, 0);
+  if (*s == 0 || *end != 0 || x > UINT32_MAX) return -1;
+  *v = x;
+  return 0;
+}
+
+/** Sets `q` to the functions of `f` named `spec`, or (`$addr`) containing
+ *  that address.  Returns how many there are. */
+int serve_find_function(struct serve_file *f, const char *spec, struct serve_query *q) {
+  u32 addr;
+  int by_addr = *spec == '$' && parse_address(spec, &addr) == 0, found = 0;
+  const char *name = by_addr? NULL : intern_find(spec); // Names are interned
+  if (!by_addr && name == NULL) return 0;
+  for (int k = 0; k < f->loaded.ncode; k++) {
+    struct diff_block *b = &f->blocks[k];
+    for (int j = 0; j < b->nfunctions; j++) {
+      struct diff_function *fn = &b->functions[j];
+      if (by_addr? 4 * fn->start <= addr && addr < 4 * fn->end
+                 : fn->name == name) {
+        q->start[k] = 4 * fn->start;
+        q->end[k] = 4 * fn->end;
+        found++;
+        break;
+      }
+    }
+  }
+  return found;
+}
+
+
+/** Writes where byte address `addr` of `f` comes from: its file and line,
+ *  and the function and how far into it, each `?` if unknown. */
+void serve_addr(struct render *r, struct serve_file *f, u32 addr) {
+  struct debug_addrs *a = f->loaded.debug != NULL? f->loaded.debug->addrs : NULL;
+  const struct addr_run *run = a != NULL? addr_find_run(a->runs, a->nruns, addr) : NULL;
+
+  render_char(r, '$');
+  render_hex(r, addr, 4, '0');
+  render_str(r, "  ");
+  render_str(r, run != NULL && run->file >= 0? f->loaded.debug->files[run->file].name : "?");
+  render_char(r, ':');
+  if (run != NULL && run->line >= 0) render_int(r, run->line, 0);
+  else render_char(r, '?');
+  render_str(r, "  ");
+  if (run != NULL && run->function >= 0) {
+    const struct debug_symbol *sym = a->functions[run->function];
+    render_str(r, sym->name);
+    render_str(r, "+$");
+    render_hex(r, addr - sym->id, 0, '0');
+  } else {
+    render_char(r, '?');
+  }
+  render_char(r, '\n');
+}
+
+
+//-- Cache ----------------------------------------------------------
+/** The parsed files, most recently used first, and what they take up.  The
+ *  cache holds a reference to each, and so does every request using one, so
+ *  a file evicted (or found to have changed) while in use is only freed
+ *  when the last request is done with it. */
+pthread_mutex_t lru_lock = PTHREAD_MUTEX_INITIALIZER;
+struct serve_file *lru_head, *lru_tail;
+size_t lru_used, lru_limit = 256 << 20;
+u64 lru_hits, lru_misses;
+
+void lru_unlink(struct serve_file *f) {
+  if (f->prev != NULL) f->prev->next = f->next;
+  else lru_head = f->next;
+  if (f->next != NULL) f->next->prev = f->prev;
+  else lru_tail = f->prev;
+  f->prev = f->next = NULL;
+}
+
+void lru_push(struct serve_file *f) {
+  f->prev = NULL;
+  f->next = lru_head;
+  if (lru_head != NULL) lru_head->prev = f;
+  else lru_tail = f;
+  lru_head = f;
+}
+
+/** Drops a reference to `f`, freeing it with the last one.  Called with the
+ *  lock held. */
+void lru_unref(struct serve_file *f) {
+  if (--f->refs == 0) serve_free(f);
+}
+
+/** Takes `f` out of the cache.  Called with the lock held. */
+void lru_remove(struct serve_file *f) {
+  lru_unlink(f);
+  lru_used -= f->cost;
+  lru_unref(f);
+}
+
+struct serve_file *lru_find(const char *path) {
+  for (struct serve_file *f = lru_head; f != NULL; f = f->next) {
+    if (strcmp(f->path, path) == 0) return f;
+  }
+  return NULL;
+}
+
+int same_file(const struct stat *a, const struct stat *b) {
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size
+      && a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/** Returns the parsed file at `path`, from the cache if it hasn't changed
+ *  since, with a reference for the caller to drop with `lru_release`.
+ *  Returns NULL (and why in `*err`) if it can't be parsed. */
+struct serve_file *lru_get(const char *path, const char **err) {
+  struct stat st;
+  if (stat(path, &st) < 0) {
+    *err = "Can't open it";
+    return NULL;
+  }
+
+  pthread_mutex_lock(&lru_lock);
+  struct serve_file *f = lru_find(path);
+  if (f != NULL && !same_file(&f->st, &st)) {
+    lru_remove(f);
+    f = NULL;
+  }
+  if (f != NULL) {
+    lru_unlink(f);
+    lru_push(f);
+    f->refs++;
+    lru_hits++;
+  }
+  pthread_mutex_unlock(&lru_lock);
+  if (f != NULL) return f;
+
+  // Parse it without holding up everyone else
+  f = calloc(1, sizeof(struct serve_file));
+  if (serve_map(f, path) < 0) *err = "Can't open it";
+  else *err = serve_parse(f);
+  if (*err != NULL) {
+    serve_free(f);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&lru_lock);
+  lru_misses++;
+  struct serve_file *other = lru_find(path);
+  if (other != NULL) lru_remove(other); // Parsed at the same time, or older
+  f->refs = 2;
+  lru_push(f);
+  lru_used += f->cost;
+  while (lru_used > lru_limit && lru_tail != f) lru_remove(lru_tail);
+  pthread_mutex_unlock(&lru_lock);
+  return f;
+}
+
+void lru_release(struct serve_file *f) {
+  pthread_mutex_lock(&lru_lock);
+  lru_unref(f);
+  pthread_mutex_unlock(&lru_lock);
+}
+
+
+//-- Daemon ---------------------------------------------------------
+/** Answers the request `line`, writing the response to `r`.  Returns NULL,
+ *  or why it can't be answered (in which case what was written is to be
+ *  dropped).
+ *
+ *    file <path> [format]
+ *    func <path> <name|$addr> [format]
+ *    range <path> <start> <end> [format]
+ *    addr <path> <addr>...        (up to four)
+ *    stats
+ *
+ *  Addresses are byte offsets into the code, as `$` and hex digits or C
+ *  integer constants; a range is [start, end).  The format is `text`,
+ *  `json` or `binary` (see records.h), by default the daemon's own.  `addr`
+ *  answers a line per address, as `ptindex addr` does. */
+const char *serve_request(struct render *r, char *line) {
+  char *argv[6], *save;
+  int argc = 0;
+  for (char *t = strtok_r(line, " \t\r\n", &save); t != NULL; t = strtok_r(NULL, " \t\r\n", &save)) {
+    if (argc == 6) return "Too many arguments";
+    argv[argc++] = t;
+  }
+  if (argc == 0) return "Empty request";
+
+  if (strcmp(argv[0], "stats") == 0) {
+    pthread_mutex_lock(&lru_lock);
+    int nfiles = 0;
+    for (struct serve_file *f = lru_head; f != NULL; f = f->next) nfiles++;
+    render_fmt(r, "files %d\nbytes %zu\nlimit %zu\nhits %llu\nmisses %llu\n", nfiles,
+               lru_used, lru_limit, (unsigned long long) lru_hits, (unsigned long long) lru_misses);
+    pthread_mutex_unlock(&lru_lock);
+
+    u32 nnames;
+    size_t name_bytes;
+    intern_stats(&nnames, &name_bytes);
+    render_fmt(r, "names %u\nname_bytes %zu\n", nnames, name_bytes);
+    return NULL;
+  }
+
+  if (strcmp(argv[0], "addr") == 0) {
+    if (argc < 3) return "Wrong number of arguments";
+    u32 addrs[4];
+    for (int i = 2; i < argc; i++) {
+      if (parse_address(argv[i], &addrs[i - 2]) < 0) return "Bad address";
+    }
+
+    const char *err = NULL;
+    struct serve_file *f = lru_get(argv[1], &err);
+    if (f == NULL) return err;
+    for (int i = 2; i < argc; i++) serve_addr(r, f, addrs[i - 2]);
+    lru_release(f);
+    return NULL;
+  }
+
+  int nargs = strcmp(argv[0], "file") == 0?  2
+            : strcmp(argv[0], "func") == 0?  3
+            : strcmp(argv[0], "range") == 0? 4
+            :                                0;
+  if (nargs == 0) return "Unknown request";
+
+  struct serve_query q = { .format = render_format };
+  if (argc == nargs + 1) {
+    const char *fmt = argv[--argc];
+    if      (strcmp(fmt, "text")   == 0) q.format = RENDER_TEXT;
+    else if (strcmp(fmt, "json")   == 0) q.format = RENDER_NDJSON;
+    else if (strcmp(fmt, "binary") == 0) q.format = RENDER_BINARY;
+    else return "Unknown format";
+  }
+  if (argc != nargs) return "Wrong number of arguments";
+
+  u32 start = 0, end = 0;
+  if (nargs == 4 && (parse_address(argv[2], &start) < 0 || parse_address(argv[3], &end) < 0)) {
+    return "Bad address";
+  }
+
+  const char *err = NULL;
+  struct serve_file *f = lru_get(argv[1], &err);
+  if (f == NULL) return err;
+
+  if (nargs == 2) q.whole = 1;
+  else if (nargs == 4) {
+    for (int k = 0; k < f->loaded.ncode; k++) {
+      q.start[k] = start;
+      q.end[k] = end;
+    }
+  } else if (serve_find_function(f, argv[2], &q) == 0) {
+    err = "No such function";
+  }
+
+  if (err == NULL && serve_render(r, f, &q) < 0) err = "Can't disassemble the code section(s)";
+  lru_release(f);
+  return err;
+}
+
+/** Answers the requests of the client on `fd`, one per line, until it
+ *  hangs up.  Each response is "ok <n>" and a newline followed by `n` bytes
+ *  of output, or "error <why>" and a newline.  Closes `fd`. */
+void serve_client(int fd, struct render *r) {
+  int wfd = dup(fd);
+  FILE *in = fdopen(fd, "r"), *out = wfd >= 0? fdopen(wfd, "w") : NULL;
+  if (in == NULL || out == NULL) {
+    if (in != NULL) fclose(in);
+    else close(fd);
+    if (out != NULL) fclose(out);
+    else if (wfd >= 0) close(wfd);
+    return;
+  }
+
+  char *line = NULL, *buf = NULL;
+  size_t cap = 0, n = 0;
+  while (getline(&line, &cap, in) > 0) {
+    FILE *mem = open_memstream(&buf, &n);
+    render_init(r, mem);
+    const char *err = serve_request(r, line);
+    render_flush(r);
+    fclose(mem);
+
+    if (err != NULL) fprintf(out, "error %s\n", err);
+    else {
+      fprintf(out, "ok %zu\n", n);
+      fwrite(buf, 1, n, out);
+    }
+    free(buf);
+    buf = NULL;
+    if (fflush(out) != 0) break;
+  }
+
+  free(line);
+  fclose(in);
+  fclose(out);
+}
+
+/** A worker of the daemon's pool: takes clients off the listening socket
+ *  (shared by all of them) one at a time. */
+void *serve_worker(void *arg) {
+  int sock = *(int *) arg;
+  struct render *r = malloc(sizeof(struct render)); // Too big for the stack
+  for (;;) {
+    int fd = accept(sock, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      perror("accept");
+      break;
+    }
+    serve_client(fd, r);
+  }
+  free(r);
+  return NULL;
+}
+
+/** Serves requests on the Unix socket at `path` with `nthreads` workers,
+ *  until killed. */
+int serve(const char *path, int nthreads) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path '%s' is too long.\n", path);
+    return 1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path); // Left over from a previous run
+  if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0
+      || listen(sock, 64) < 0) {
+    fprintf(stderr, "Couldn't listen on '%s': %s\n", path, strerror(errno));
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN); // Clients hanging up show as failed writes
+  fprintf(stderr, "Listening on %s with %d threads.\n", path, nthreads);
+
+  pthread_t *threads = malloc(sizeof(pthread_t) * nthreads);
+  for (int i = 0; i < nthreads; i++) pthread_create(&threads[i], NULL, serve_worker, &sock);
+  for (int i = 0; i < nthreads; i++) pthread_join(threads[i], NULL);
+  free(threads);
+  close(sock);
+  unlink(path);
+  return 1;
+}
+
+
+//-- Watch mode -----------------------------------------------------
+/** The directory watched, where its listings go, and the watched
+ *  directories below it (relative paths, by inotify watch descriptor). */
+const char *watch_root, *watch_out;
+int watch_fd;
+char **watch_dirs;
+int nwatch_dirs;
+
+/** The content hash of each file listed, by relative path. */
+struct watch_entry {
+  char *rel;
+  u64 hash[2];
+  struct watch_entry *next;
+};
+struct watch_entry **watch_table;
+int watch_nslots, watch_n;
+
+struct watch_entry **watch_slot(const char *rel) {
+  u64 h = 0xCBF29CE484222325ULL;
+  for (const char *p = rel; *p; p++) h = (h ^ (u8) *p) * 0x100000001B3ULL;
+  struct watch_entry **e = &watch_table[h & (watch_nslots - 1)];
+  while (*e != NULL && strcmp((*e)->rel, rel) != 0) e = &(*e)->next;
+  return e;
+}
+
+/** The entry for `rel`, added if new. */
+struct watch_entry *watch_entry(const char *rel) {
+  if (watch_n >= watch_nslots) {
+    // Grow: rehash into twice the slots
+    struct watch_entry **old = watch_table;
+    int nold = watch_nslots;
+    watch_nslots = nold? 2 * nold : 1024;
+    watch_table = calloc(watch_nslots, sizeof(struct watch_entry *));
+    for (int i = 0; i < nold; i++) {
+      for (struct watch_entry *e = old[i], *next; e != NULL; e = next) {
+        next = e->next;
+        struct watch_entry **slot = watch_slot(e->rel);
+        e->next = NULL;
+        *slot = e;
+      }
+    }
+    free(old);
+  }
+
+  struct watch_entry **slot = watch_slot(rel);
+  if (*slot == NULL) {
+    *slot = calloc(1, sizeof(struct watch_entry));
+    (*slot)->rel = strdup(rel);
+    watch_n++;
+  }
+  return *slot;
+}
+
+void watch_forget(const char *rel) {
+  if (watch_nslots == 0) return;
+  struct watch_entry **slot = watch_slot(rel);
+  if (*slot == NULL) return;
+  struct watch_entry *e = *slot;
+  *slot = e->next;
+  free(e->rel);
+  free(e);
+  watch_n--;
+}
+
+/** Where the listing of `rel` goes. */
+void watch_output_path(char *buf, size_t n, const char *rel) {
+  snprintf(buf, n, "%s/%s.%s", watch_out, rel, render_format == RENDER_TEXT? "txt"
+                                             : render_format == RENDER_NDJSON? "ndjson"
+                                             :                                 "bin");
+}
+
+/** Creates the directories leading up to `path`. */
+void make_parents(const char *path) {
+  char buf[PATH_MAX];
+  snprintf(buf, sizeof(buf), "%s", path);
+  for (char *p = buf + 1; *p; p++) {
+    if (*p != '/') continue;
+    *p = 0;
+    mkdir(buf, 0777);
+    *p = '/';
+  }
+}
+
+double now_ms(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+/** Lists the file `rel` again if its contents changed since it last was:
+ *  to a temporary file next to the old listing, which then replaces it, so
+ *  readers never see half of one.  Returns 0, or -1 (having said why) if it
+ *  couldn't be. */
+int watch_update(const char *rel, struct render *r) {
+  double t0 = now_ms();
+  char path[PATH_MAX], dst[PATH_MAX], tmp[PATH_MAX + 8];
+  snprintf(path, sizeof(path), "%s/%s", watch_root, rel);
+
+  struct serve_file *f = calloc(1, sizeof(struct serve_file));
+  if (serve_map(f, path) < 0) {
+    // Gone again already; its removal is on the way
+    serve_free(f);
+    return 0;
+  }
+
+  u64 hash[2];
+  content_hash(f->file.data, f->file.size, hash);
+  struct watch_entry *e = watch_entry(rel);
+  if (e->hash[0] == hash[0] && e->hash[1] == hash[1]) {
+    serve_free(f);
+    return 0;
+  }
+
+  const char *err = serve_parse(f);
+  if (err != NULL) {
+    fprintf(stderr, "%s: %s.\n", rel, err);
+    serve_free(f);
+    return -1;
+  }
+
+  watch_output_path(dst, sizeof(dst), rel);
+  snprintf(tmp, sizeof(tmp), "%s.tmp", dst);
+  make_parents(dst);
+  FILE *out = fopen(tmp, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Couldn't open '%s' for writing.\n", tmp);
+    serve_free(f);
+    return -1;
+  }
+
+  struct serve_query q = { .format = render_format, .whole = 1 };
+  render_init(r, out);
+  int res = serve_render(r, f, &q);
+  render_flush(r);
+  if (fclose(out) != 0 || res < 0) {
+    fprintf(stderr, res < 0? "%s: Can't disassemble the code section(s).\n"
+                           : "%s: Couldn't write the listing.\n", rel);
+    unlink(tmp);
+    serve_free(f);
+    return -1;
+  }
+  rename(tmp, dst);
+  serve_free(f);
+
+  e->hash[0] = hash[0];
+  e->hash[1] = hash[1];
+  fprintf(stderr, "%s: listed in %.1f ms\n", rel, now_ms() - t0);
+  return 0;
+}
+
+/** Removes the listing of the removed file `rel`. */
+void watch_remove(const char *rel) {
+  char dst[PATH_MAX];
+  watch_output_path(dst, sizeof(dst), rel);
+  if (unlink(dst) == 0) fprintf(stderr, "%s: removed\n", rel);
+  watch_forget(rel);
+}
+
+/** Removes the listings of everything below the removed directory `rel`. */
+void watch_remove_dir(const char *rel) {
+  size_t n = strlen(rel);
+  for (int i = 0; i < watch_nslots; i++) {
+    for (struct watch_entry *e = watch_table[i], *next; e != NULL; e = next) {
+      next = e->next;
+      if (strncmp(e->rel, rel, n) == 0 && e->rel[n] == '/') watch_remove(e->rel);
+    }
+  }
+  char dst[PATH_MAX];
+  snprintf(dst, sizeof(dst), "%s/%s", watch_out, rel);
+  rmdir(dst); // If nothing else is in it
+}
+
+/** Joins `dir` (relative, maybe "") and `name` into the `n` bytes at
+ *  `buf`.  Returns 0, or -1 if they don't fit. */
+int join_rel(char *buf, size_t n, const char *dir, const char *name) {
+  int k = snprintf(buf, n, "%s%s%s", dir, *dir? "/" : "", name);
+  return k >= 0 && (size_t) k < n? 0 : -1;
+}
+
+/** Watches the directory `rel` and everything below it, listing the files
+ *  in it.  The watch goes first, so no change made meanwhile is missed. */
+void watch_dir(const char *rel, struct render *r) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s%s%s", watch_root, *rel? "/" : "", rel);
+  int wd = inotify_add_watch(watch_fd, path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM
+                                             | IN_DELETE | IN_CREATE | IN_ONLYDIR);
+  if (wd < 0) {
+    fprintf(stderr, "Couldn't watch '%s': %s\n", path, strerror(errno));
+    return;
+  }
+  if (wd >= nwatch_dirs) {
+    watch_dirs = realloc(watch_dirs, sizeof(char *) * (wd + 1));
+    while (nwatch_dirs <= wd) watch_dirs[nwatch_dirs++] = NULL;
+  }
+  free(watch_dirs[wd]);
+  watch_dirs[wd] = strdup(rel);
+
+  DIR *d = opendir(path);
+  if (d == NULL) return;
+  struct dirent *de;
+  while ((de = readdir(d)) != NULL) {
+    if (de->d_name[0] == '.') continue; // Also editors' swap files and such
+    char sub[PATH_MAX], full[PATH_MAX];
+    if (join_rel(sub, sizeof(sub), rel, de->d_name) < 0
+        || join_rel(full, sizeof(full), watch_root, sub) < 0) {
+      fprintf(stderr, "%s/%s: Path too long; skipped.\n", path, de->d_name);
+      continue;
+    }
+    struct stat st;
+    if (stat(full, &st) < 0) continue;
+    if (S_ISDIR(st.st_mode)) watch_dir(sub, r);
+    else if (S_ISREG(st.st_mode)) watch_update(sub, r);
+  }
+  closedir(d);
+}
+
+/** Lists everything below `root` to `out`, then keeps the listings up to
+ *  date as files change, until killed. */
+int watch(const char *root, const char *out) {
+  // Listings written into the watched tree would be watched themselves
+  char real_root[PATH_MAX], real_out[PATH_MAX];
+  mkdir(out, 0777);
+  if (realpath(root, real_root) == NULL || realpath(out, real_out) == NULL) {
+    fprintf(stderr, "Couldn't find '%s' or '%s'.\n", root, out);
+    return 1;
+  }
+  size_t n = strlen(real_root);
+  if (strncmp(real_out, real_root, n) == 0 && (real_out[n] == '/' || real_out[n] == 0)) {
+    fprintf(stderr, "The output directory can't be inside '%s'.\n", root);
+    return 1;
+  }
+  watch_root = root;
+  watch_out = out;
+
+  watch_fd = inotify_init1(IN_CLOEXEC);
+  if (watch_fd < 0) {
+    perror("inotify_init1");
+    return 1;
+  }
+
+  struct render *r = malloc(sizeof(struct render));
+  double t0 = now_ms();
+  watch_dir("", r);
+  fprintf(stderr, "Watching %d files in %s (listed in %.0f ms).\n", watch_n, root, now_ms() - t0);
+
+  char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+  for (;;) {
+    ssize_t len = read(watch_fd, buf, sizeof(buf));
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      perror("read");
+      break;
+    }
+
+    for (char *p = buf; p < buf + len; ) {
+      struct inotify_event *ev = (struct inotify_event *) p;
+      p += sizeof(struct inotify_event) + ev->len;
+      if (ev->mask & IN_Q_OVERFLOW) {
+        // Events were lost: go over everything, unchanged files are cheap
+        fprintf(stderr, "Too many changes at once; rescanning.\n");
+        watch_dir("", r);
+        continue;
+      }
+      if (ev->wd < 0 || ev->wd >= nwatch_dirs || watch_dirs[ev->wd] == NULL) continue;
+      if (ev->mask & IN_IGNORED) {
+        free(watch_dirs[ev->wd]);
+        watch_dirs[ev->wd] = NULL;
+        continue;
+      }
+      if (ev->len == 0 || ev->name[0] == '.') continue;
+
+      char rel[PATH_MAX];
+      if (join_rel(rel, sizeof(rel), watch_dirs[ev->wd], ev->name) < 0) continue;
+      if (ev->mask & IN_ISDIR) {
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO)) watch_dir(rel, r);
+        else if (ev->mask & IN_MOVED_FROM) watch_remove_dir(rel);
+      } else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        watch_update(rel, r);
+      } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        watch_remove(rel);
+      }
+    }
+  }
+
+  free(r);
+  close(watch_fd);
+  return 1;
+}
+
+
+int main(int argc, char *argv[]) {
+  argc = render_parse_args(argc, argv);
+  debug_intern_names = 1; // Kept across files, and looked up by name
+
+  const char *watch_dir_arg = NULL, *out = NULL, *socket_path = NULL;
+  int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads < 4) nthreads = 4; // Clients mostly sit idle on their connections
+  for (int i = 1; argc >= 0 && i < argc; i++) {
+    if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) watch_dir_arg = argv[++i];
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) out = argv[++i];
+    else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) socket_path = argv[++i];
+    else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) lru_limit = (size_t) atol(argv[++i]) << 20;
+    else if (strncmp(argv[i], "-j", 2) == 0) {
+      const char *n = argv[i][2]? &argv[i][2] : ++i < argc? argv[i] : NULL;
+      if (n == NULL || (nthreads = atoi(n)) < 1) argc = -1;
+    }
+    else argc = -1;
+  }
+
+  if (argc >= 0 && watch_dir_arg != NULL && out != NULL && socket_path == NULL) {
+    return watch(watch_dir_arg, out);
+  }
+  if (argc >= 0 && socket_path != NULL && watch_dir_arg == NULL && out == NULL) {
+    return serve(socket_path, nthreads);
+  }
+  fprintf(stderr, "usage: %s [--no-color] [--format <text|json|binary>] --watch <dir> -o <outdir>\n"
+                  "       %s [--no-color] [--format <text|json|binary>] [-j <threads>] [--memory <MiB>] --socket <path>\n"
+                  "Keeps listings of the scripts and zones below <dir> up to date in <outdir>, or\n"
+                  "serves listings from a cache of parsed files over a Unix socket.\n",
+          argv[0], argv[0]);
+  return 1;
+}
@@ -0,0 +1,85 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "poketools.h"
+#include "batch.h"
+#include "stats.h"
+#include "timings.h"
+
+// Each batch thread gathers into its own statistics, merged at the end
+#define MAX_SHARDS 1024
+
+pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+struct stats *shards[MAX_SHARDS];
+int nshards = 0;
+__thread struct stats *local_stats = NULL;
+
+/** Adds the file at `path` to the calling thread's statistics. */
+int gather(FILE *out, const char *path) {
+  (void) out;
+  if (local_stats == NULL) {
+    local_stats = stats_new();
+    pthread_mutex_lock(&shards_lock);
+    shards[nshards++] = local_stats;
+    pthread_mutex_unlock(&shards_lock);
+  }
+  return stats_add_file(local_stats, path);
+}
+
+int main(int argc, char *argv[]) {
+  // Our own options: `-s <file>` to save, and `-m <file>` to merge in
+  // statistics saved before
+  argc = timings_parse_args(argc, argv);
+  const char *save_path = NULL;
+  const char *merge_paths[argc];
+  int nmerge = 0, k = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) save_path = argv[++i];
+    else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) merge_paths[nmerge++] = argv[++i];
+    else argv[k++] = argv[i];
+  }
+  argv[k] = NULL;
+  argc = k;
+
+  struct batch_list list = { 0 };
+  int nthreads;
+  if ((argc > 1 || nmerge == 0) && batch_parse_args(&list, &nthreads, argc, argv) < 0) {
+    fprintf(stderr, "usage: %s [-j <threads>] [-s <stats>] [-m <stats>]... [--timings[=json]] [<file|dir|->...]\n", argv[0]);
+    return 1;
+  }
+  if (nthreads > MAX_SHARDS) nthreads = MAX_SHARDS;
+
+  int status = 0;
+  if (list.n > 0) {
+    int failures = batch_run(&list, gather, nthreads, 0, stdout);
+    if (failures > 0) {
+      fprintf(stderr, "%d of %d files failed.\n", failures, list.n);
+      status = 2;
+    }
+  }
+
+  struct stats *s = stats_new();
+  for (int i = 0; i < nshards; i++) {
+    stats_merge(s, shards[i]);
+    free(shards[i]);
+  }
+  for (int i = 0; i < nmerge; i++) {
+    if (stats_load(s, merge_paths[i]) < 0) {
+      fprintf(stderr, "Couldn't read statistics from '%s'.\n", merge_paths[i]);
+      status = 2;
+    }
+  }
+
+  if (save_path != NULL && stats_save(s, save_path) < 0) {
+    fprintf(stderr, "Couldn't write '%s'.\n", save_path);
+    status = 2;
+  }
+  stats_report(stdout, s);
+
+  free(s);
+  for (int i = 0; i < list.n; i++) free(list.paths[i]);
+  free(list.paths);
+  return status;
+}
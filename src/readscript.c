@@ -3,62 +3,138 @@
 #include <string.h>
 
 #include "poketools.h"
+#include "batch.h"
+#include "cache.h"
+#include "cfg.h"
+#include "mapfile.h"
+#include "records.h"
+#include "render.h"
 #include "script_pp.h"
 #include "formats/script.h"
 
-int main(int argc, char *argv[]) {
-  if (argc != 2) {
-    fprintf(stderr, "Usage: %s <filename>\n", argv[0]);
-    return 1;
-  }
-
-  FILE *f = fopen(argv[1], "r");
-  if (f == NULL) {
-    fprintf(stderr, "Couldn't open '%s' for reading.", argv[1]);
+/** Disassembles the script at `path` to `out`. */
+int readscript(FILE *out, const char *path) {
+  struct mapped_file file;
+  if (map_file(&file, path) < 0) {
+    fprintf(stderr, "Couldn't open '%s' for reading.\n", path);
     return 2;
   }
 
   struct code_block *code = NULL;
   struct debug_block *debug = NULL;
 
-  //-- Read sections
-  while (1) {
-    long section_start = ftell(f);
+  struct cache_entry cache;
+  cache_open(&cache, file.data, file.size);
 
-    u32 size, magic;
-    fread(&size,  sizeof(u32), 1, f);
-    fread(&magic, sizeof(u32), 1, f);
+  //-- Parse sections
+  size_t section_start = 0;
+  while (file.size - section_start >= 2 * sizeof(u32)) {
+    u8 *p = file.data + section_start;
+    size_t n = file.size - section_start, nread = 0;
 
-    if (feof(f) || ferror(f)) break;
+    u32 size, magic;
+    memcpy(&size,  p,               sizeof(u32));
+    memcpy(&magic, p + sizeof(u32), sizeof(u32));
 
-    fseek(f, -8L, SEEK_CUR);
+    // Use what's cached, if anything
+    struct code_decoded dec;
     switch (magic) {
-      case 0x0A0AF1E0: code = read_code_block(f); break;
-      case 0x0A0AF1EF: debug = read_debug_block(f); break;
+      case 0x0A0AF1E0:
+        code = parse_code_block_decoded(p, n, &nread, cache_code(&cache, section_start, &dec));
+        if (code == NULL && cache.hit) code = parse_code_block(p, n, &nread);
+        if (code != NULL) cache_add_code(&cache, code);
+        break;
+
+      case 0x0A0AF1EF:
+        debug = cache_debug_block(&cache, section_start);
+        if (debug != NULL) {
+          nread = debug->size;
+        } else {
+          debug = parse_debug_block(p, n, &nread);
+          if (debug != NULL) cache_add_debug(&cache, debug);
+        }
+        break;
+
       default:
-        fprintf(stderr, "Bad section magic number at position $%04lx: %08x\n",
-                        ftell(f), magic);
+        fprintf(stderr, "%s: Bad section magic number at position $%04lx: %08x\n",
+                        path, (long) section_start, magic);
+        cache_close(&cache, 0);
+        unmap_file(&file);
         return 2;
     }
 
-    // Check if `read_*_block` read the entire section properly.
-    long section_end = ftell(f);
+    if ((magic == 0x0A0AF1E0 && code == NULL)
+        || (magic == 0x0A0AF1EF && debug == NULL)) {
+      fprintf(stderr, "%s: Malformed section at position $%04lx\n",
+                      path, (long) section_start);
+      cache_close(&cache, 0);
+      unmap_file(&file);
+      return 2;
+    }
 
-    if (section_end != section_start + size) {
-      fprintf(stderr, "\x1B[33mwarning: section not read properly (size delta is %ld)\x1B[m\n", 
-              section_end - (section_start + size));
+    // Check if `parse_*_block` read the entire section properly.
+    if (nread != size) {
+      fprintf(stderr, "%swarning: section not read properly (size delta is %ld)%s\n",
+              render_color? "\x1B[33m" : "", (long) nread - (long) size,
+              render_color? "\x1B[m" : "");
     }
 
-    fseek(f, section_start + size, SEEK_SET);
+    if (size == 0) break;
+    section_start += size;
+  }
+
+  //-- Control-flow graph
+  if (cfg_format != CFG_NONE) {
+    struct render r;
+    render_init(&r, out);
+    if (code != NULL) render_cfg(&r, cfg_format, path, "code", code, debug);
+    render_flush(&r);
+    cache_close(&cache, 1);
+    unmap_file(&file);
+    return 0;
+  }
+
+  //-- Machine-readable records
+  if (render_format != RENDER_TEXT) {
+    struct render r;
+    struct records w;
+    render_init(&r, out);
+    records_init(&w, &r, render_format);
+
+    records_file(&w, path);
+    if (debug != NULL) records_symbols(&w, debug);
+    if (code != NULL)  records_code(&w, "code", code, debug);
+
+    records_free(&w);
+    render_flush(&r);
+    cache_close(&cache, 1);
+    unmap_file(&file);
+    return 0;
   }
 
   //-- Print code (or debug if only debug info)
+  int res = 0;
   switch ((code != NULL) << 1 | (debug != NULL)) {
- // case 3: print_debug(debug); putchar('\n'); disassemble(code, debug); break;
-    case 3: disassemble(code, debug); break;
-    case 2: disassemble(code, NULL); break;
-    case 1: print_debug(debug); break;
+ // case 3: print_debug(out, debug); fputc('\n', out); disassemble(out, code, debug); break;
+    case 3: res = disassemble(out, code, debug); break;
+    case 2: res = disassemble(out, code, NULL); break;
+    case 1: print_debug(out, debug); break;
     default:
       fprintf(stderr, "No blocks read!\n");
   }
+  if (res < 0) fprintf(stderr, "%s: Can't disassemble the code section.\n", path);
+
+  cache_close(&cache, 1);
+  unmap_file(&file);
+  return res < 0? 2 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  argc = render_parse_args(argc, argv);
+  if (argc >= 0) argc = cache_parse_args(argc, argv);
+  if (argc >= 0) argc = cfg_parse_args(argc, argv);
+  if (argc < 0) return 1;
+  if (render_format != RENDER_TEXT || cfg_format != CFG_NONE) batch_headers = 0; // Records and graphs name their file
+
+  return batch_main(readscript, argc, argv);
 }
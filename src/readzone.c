@@ -1,84 +1,233 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "formats/zonedata.h"
 #include "formats/script.h"
 #include "script_pp.h"
 #include "hexdump.h"
 #include "poketools.h"
+#include "batch.h"
+#include "cache.h"
+#include "cfg.h"
+#include "mapfile.h"
+#include "records.h"
+#include "render.h"
 
-void print_entry_line(int i, u16 *fields, int n) {
-  printf("  %2d:", i);
-  for (int j = 0; j < n; j++) printf(" %4x", fields[j]);
-  printf("\n");
+/** Reads field `j` of table `t` from `*p`, and moves `*p` past it. */
+u32 read_unk1_field(const struct zone_unk1_table *t, int j, const u8 **p) {
+  u32 v = 0;
+  memcpy(&v, *p, t->field_sizes[j]);
+  *p += t->field_sizes[j];
+  return v;
 }
 
-int main(int argc, char *argv[]) {
-  if (argc != 2) {
-    fprintf(stderr, "usage: %s <filename>\n", argv[0]);
-    return 1;
+/** Prints entry `i` of table `t`, at `entry`. */
+void print_entry_line(struct render *r, int i, const u8 *entry,
+                      const struct zone_unk1_table *t) {
+  render_str(r, "  ");
+  render_int(r, i, 2);
+  render_char(r, ':');
+  for (int j = 0; j < t->nfields; j++) {
+    render_char(r, ' ');
+    render_hex(r, read_unk1_field(t, j, &entry), 2 * t->field_sizes[j], ' ');
+  }
+  render_char(r, '\n');
+}
+
+/** Prints a `===> title <===` section heading. */
+void print_heading(struct render *r, const char *title) {
+  render_str(r, "===> ");
+  render_sgr(r, "\x1B[1m");
+  render_str(r, title);
+  render_sgr(r, "\x1B[m");
+  render_str(r, " <===\n");
+}
+
+/** Writes the `unk1` records of table `k` of `unk1`. */
+void write_unk1_records(struct records *w, const struct zone_unk1 *unk1, int k) {
+  const struct zone_unk1_table *t = &zone_unk1_tables[k];
+  int n;
+  const u8 *p = zone_unk1_entries(unk1, k, &n);
+  for (int i = 0; i < n; i++) {
+    rec_begin(w, REC_UNK1);
+    rec_int(w, "table", k);
+    rec_int(w, "index", i);
+    rec_array_begin(w, "fields", t->nfields);
+    for (int j = 0; j < t->nfields; j++) {
+      u32 v = read_unk1_field(t, j, &p);
+      if (t->field_sizes[j] == 2) rec_elem16(w, v);
+      else rec_elem(w, v);
+    }
+    rec_array_end(w);
+    rec_end(w);
   }
+}
+
+/** Writes the zone `zone` (read from `path`) as machine-readable records. */
+void write_zone_records(struct render *r, const char *path, struct zonedata *zone) {
+  struct records w;
+  records_init(&w, r, render_format);
+
+  records_file(&w, path);
+  for (int k = 1; k <= ZONE_UNK1_NTABLES; k++) write_unk1_records(&w, zone->unk1, k);
+  records_code(&w, "code1", zone->code1, NULL);
+  records_code(&w, "code2", zone->code2, NULL);
+
+  records_free(&w);
+}
 
-  FILE *f = fopen(argv[1], "r");
-  if (f == NULL) {
-    fprintf(stderr, "Couldn't open '%s' for reading.", argv[1]);
+/** Set by `--scan`: only check each zone's headers, without parsing it. */
+int scan_only = 0;
+
+const char *zone_problem_names[] = {
+  "truncated", "bad magic", "file_size", "unk1 size", "code1 header",
+  "code2 header", "code2_offset", "trailing bytes",
+};
+
+/** Checks the headers and section sizes of the zone at `path` against each
+ *  other and the file's size, reading nothing else.  Returns nonzero (after
+ *  saying what's off on stderr) if they don't agree. */
+int scanzone(FILE *out, const char *path) {
+  struct mapped_file file;
+  if (map_file(&file, path) < 0) {
+    fprintf(stderr, "Couldn't open '%s' for reading.\n", path);
     return 2;
   }
 
-  struct zonedata *zone = read_zonedata(f);
+  struct zone_layout l;
+  u32 problems = scan_zonedata(&l, file.data, file.size);
+  if (problems == 0) {
+    fprintf(out, "%s: ok\n", path);
+    unmap_file(&file);
+    return 0;
+  }
 
-  //-- Print header -------------------
-  struct zone_header *hd = zone->header;
+  fprintf(stderr, "%s:", path);
+  for (int k = 0; k < 8; k++) {
+    if (problems & 1 << k) fprintf(stderr, " %s", zone_problem_names[k]);
+  }
+  if (problems & (ZONE_BAD_FILE_SIZE | ZONE_BAD_CODE2_OFFSET)) {
+    struct zone_header *hd = (struct zone_header *) file.data;
+    fprintf(stderr, "  (file_size=%x %x, code2_offset=%x; size %zx, code2 at %zx)",
+            hd->file_size, hd->file_size2, hd->code2_offset, file.size, l.code2_start);
+  }
+  fputc('\n', stderr);
+  unmap_file(&file);
+  return 1;
+}
 
-  printf("===> \x1B[1mHeader\x1B[m <===\n");
-  printf("  unk1=%04x  unk2=%04x  code2_offset=%04x  filesize=(%x %x)\n",
-         hd->unk1, hd->unk2, hd->code2_offset, hd->file_size, hd->file_size2);
-  printf("  unk3=\n");
-  for (int i = 0; i < 0x1C; i++) {
-    if (i % 7 == 0) printf("    ");
-    printf(" %4x", hd->unk3[i]);
-    if (i % 7 == 6) printf("\n");
+/** Prints the zone at `path` to `out`. */
+int readzone(FILE *out, const char *path) {
+  if (scan_only) return scanzone(out, path);
+
+  struct mapped_file file;
+  if (map_file(&file, path) < 0) {
+    fprintf(stderr, "Couldn't open '%s' for reading.\n", path);
+    return 2;
   }
-  printf("\n");
 
-  //-- Print unk1 section -------------
-  printf("===> \x1B[1munk1\x1B[m <===\n");
-  for (int i = 0; i < zone->unk1->nentry1; i++) {
-    struct zone_unk1_entry_1 *ent = &zone->unk1->entry1[i];
-    print_entry_line(i, ent->fields, 10);
+  // Use the cached code sections, if any
+  struct cache_entry cache;
+  struct code_decoded dec[2];
+  cache_open(&cache, file.data, file.size);
+  int ndec = cache_codes(&cache, dec, 2);
+
+  struct zonedata *zone = parse_zonedata_decoded(file.data, file.size, dec, ndec);
+  if (zone == NULL && ndec > 0) zone = parse_zonedata(file.data, file.size);
+  if (zone == NULL) {
+    fprintf(stderr, "Malformed zone data in '%s'.\n", path);
+    cache_close(&cache, 0);
+    unmap_file(&file);
+    return 2;
+  }
+  cache_add_code(&cache, zone->code1);
+  cache_add_code(&cache, zone->code2);
+
+  // Check if every section was read properly
+  if (zone->warn_delta != 0) {
+    fprintf(stderr, "%swarning: section at position $%04lx not read properly (size delta is %ld)%s\n",
+            render_color? "\x1B[33m" : "", (long) zone->warn_at, zone->warn_delta,
+            render_color? "\x1B[m" : "");
   }
-  printf("  ----\n");
 
-  for (int i = 0; i < zone->unk1->nentry2; i++) {
-    struct zone_unk1_entry_2 *ent = &zone->unk1->entry2[i];
-    print_entry_line(i, ent->fields, 24);
+  struct render r;
+  render_init(&r, out);
+
+  if (cfg_format != CFG_NONE) {
+    render_cfg(&r, cfg_format, path, "code1", zone->code1, NULL);
+    render_cfg(&r, cfg_format, path, "code2", zone->code2, NULL);
+    render_flush(&r);
+    cache_close(&cache, 1);
+    unmap_file(&file);
+    return 0;
   }
-  printf("  ----\n");
 
-  for (int i = 0; i < zone->unk1->nentry3; i++) {
-    struct zone_unk1_entry_3 *ent = &zone->unk1->entry3[i];
-    print_entry_line(i, ent->fields, 12);
+  if (render_format != RENDER_TEXT) {
+    write_zone_records(&r, path, zone);
+    render_flush(&r);
+    cache_close(&cache, 1);
+    unmap_file(&file);
+    return 0;
   }
-  printf("  ----\n");
 
-  for (int i = 0; i < zone->unk1->nentry4; i++) {
-    struct zone_unk1_entry_4 *ent = &zone->unk1->entry4[i];
-    print_entry_line(i, ent->fields, 12);
+  //-- Print header -------------------
+  struct zone_header *hd = zone->header;
+
+  print_heading(&r, "Header");
+  render_fmt(&r, "  unk1=%04x  unk2=%04x  code2_offset=%04x  filesize=(%x %x)\n",
+                 hd->unk1, hd->unk2, hd->code2_offset, hd->file_size, hd->file_size2);
+  render_str(&r, "  unk3=\n");
+  for (int i = 0; i < 0x1C; i++) {
+    if (i % 7 == 0) render_str(&r, "    ");
+    render_char(&r, ' ');
+    render_hex(&r, hd->unk3[i], 4, ' ');
+    if (i % 7 == 6) render_char(&r, '\n');
   }
-  printf("  ----\n");
+  render_char(&r, '\n');
 
-  for (int i = 0; i < zone->unk1->nentry5; i++) {
-    struct zone_unk1_entry_4 *ent = &zone->unk1->entry5[i];
-    print_entry_line(i, ent->fields, 12);
+  //-- Print unk1 section -------------
+  print_heading(&r, "unk1");
+  for (int k = 1; k <= ZONE_UNK1_NTABLES; k++) {
+    const struct zone_unk1_table *t = &zone_unk1_tables[k];
+    int n;
+    const u8 *p = zone_unk1_entries(zone->unk1, k, &n);
+    for (int i = 0; i < n; i++) print_entry_line(&r, i, p + i * t->entry_size, t);
+    render_str(&r, k < ZONE_UNK1_NTABLES? "  ----\n" : "\n");
   }
-  printf("\n");
 
   //-- Print code sections ------------
-  printf("===> \x1B[1mcode1\x1B[m <===\n");
-//print_code(zone->code1);
-  disassemble(zone->code1, NULL);
-  printf("\n");
-
-  printf("===> \x1B[1mcode2\x1B[m <===\n");
-  disassemble(zone->code2, NULL);
-//print_code(zone->code2);
+  print_heading(&r, "code1");
+//print_code(out, zone->code1);
+  int res = render_disassembly(&r, zone->code1, NULL);
+  render_char(&r, '\n');
+
+  print_heading(&r, "code2");
+  res |= render_disassembly(&r, zone->code2, NULL);
+//print_code(out, zone->code2);
+
+  render_flush(&r);
+  if (res < 0) fprintf(stderr, "%s: Can't disassemble the code sections.\n", path);
+  cache_close(&cache, 1);
+  unmap_file(&file);
+  return res < 0? 2 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  argc = render_parse_args(argc, argv);
+  if (argc >= 0) argc = cache_parse_args(argc, argv);
+  if (argc >= 0) argc = cfg_parse_args(argc, argv);
+  if (argc < 0) return 1;
+  if (render_format != RENDER_TEXT || cfg_format != CFG_NONE) batch_headers = 0; // Records and graphs name their file
+
+  // `--scan` checks headers only, a line per file
+  int k = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--scan") == 0) scan_only = 1;
+    else argv[k++] = argv[i];
+  }
+  argv[argc = k] = NULL;
+  batch_options = "[--scan] ";
+  if (scan_only) batch_headers = 0;
+
+  return batch_main(readzone, argc, argv);
 }
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "records.h"
+#include "decode.h"
+#include "timings.h"
+
+const char *record_names[] = {
+  [REC_FILE]    = "file",
+  [REC_BLOCK]   = "block",
+  [REC_LABEL]   = "label",
+  [REC_INSTR]   = "instr",
+  [REC_JUMPMAP] = "jumpmap",
+  [REC_SYMBOL]  = "symbol",
+  [REC_UNK1]    = "unk1",
+};
+
+void records_init(struct records *w, struct render *r, enum render_format format) {
+  *w = (struct records) { .r = r, .format = format };
+}
+
+void records_free(struct records *w) {
+  free(w->rec);
+  w->rec = NULL;
+  w->len = w->cap = 0;
+}
+
+
+//-- Building records -----------------------------------------------
+/** Appends `n` bytes to the binary record being built. */
+void rec_put(struct records *w, const void *p, size_t n) {
+  if (w->len + n > w->cap) {
+    w->cap = w->cap? 2 * w->cap : 256;
+    while (w->len + n > w->cap) w->cap *= 2;
+    w->rec = realloc(w->rec, w->cap);
+  }
+  memcpy(w->rec + w->len, p, n);
+  w->len += n;
+}
+
+/** Appends `x` as a little-endian integer of `n` bytes. */
+void rec_put_le(struct records *w, u32 x, int n) {
+  u8 b[4] = { x, x >> 8, x >> 16, x >> 24 };
+  rec_put(w, b, n);
+}
+
+/** Writes `s` as a JSON string. */
+void json_string(struct render *r, const char *s) {
+  render_char(r, '"');
+  for (const char *p = s; *p; p++) {
+    const char *q = p;
+    while (*q && *q != '"' && *q != '\\' && (u8) *q >= 0x20) q++;
+    render_strn(r, p, q - p);
+    p = q;
+    if (!*p) break;
+
+    switch (*p) {
+      case '"':  render_str(r, "\\\""); break;
+      case '\\': render_str(r, "\\\\"); break;
+      case '\n': render_str(r, "\\n");  break;
+      case '\t': render_str(r, "\\t");  break;
+      default:
+        render_str(r, "\\u00");
+        render_hex(r, (u8) *p, 2, '0');
+    }
+  }
+  render_char(r, '"');
+}
+
+/** Starts the JSON field `key`. */
+void json_key(struct records *w, const char *key) {
+  render_str(w->r, w->nfields++? ",\"" : "\"");
+  render_str(w->r, key);
+  render_str(w->r, "\":");
+}
+
+void rec_begin(struct records *w, enum record_type type) {
+  if (w->format == RENDER_BINARY) {
+    w->len = 0;
+    rec_put_le(w, 0, 4); // Length; filled in by `rec_end`
+    rec_put_le(w, type, 1);
+  } else {
+    w->nfields = 0;
+    render_char(w->r, '{');
+    json_key(w, "type");
+    json_string(w->r, record_names[type]);
+  }
+}
+
+void rec_end(struct records *w) {
+  if (w->format == RENDER_BINARY) {
+    u32 len = w->len - 4;
+    u8 b[4] = { len, len >> 8, len >> 16, len >> 24 };
+    memcpy(w->rec, b, 4);
+    render_raw(w->r, w->rec, w->len);
+  } else {
+    render_str(w->r, "}\n");
+  }
+}
+
+void rec_int(struct records *w, const char *key, i64 v) {
+  if (w->format == RENDER_BINARY) {
+    rec_put_le(w, v, 4);
+  } else {
+    json_key(w, key);
+    render_int(w->r, v, 0);
+  }
+}
+
+void rec_str(struct records *w, const char *key, const char *s) {
+  if (w->format == RENDER_BINARY) {
+    size_t n = strlen(s);
+    if (n > 0xFFFF) n = 0xFFFF;
+    rec_put_le(w, n, 2);
+    rec_put(w, s, n);
+  } else {
+    json_key(w, key);
+    json_string(w->r, s);
+  }
+}
+
+void rec_array_begin(struct records *w, const char *key, u32 n) {
+  if (w->format == RENDER_BINARY) {
+    rec_put_le(w, n, 4);
+  } else {
+    json_key(w, key);
+    render_char(w->r, '[');
+    w->nfields = -1; // No comma before the first element
+  }
+}
+
+void rec_elem(struct records *w, i64 v) {
+  if (w->format == RENDER_BINARY) {
+    rec_put_le(w, v, 4);
+  } else {
+    if (w->nfields++ >= 0) render_char(w->r, ',');
+    render_int(w->r, v, 0);
+  }
+}
+
+void rec_elem16(struct records *w, u16 v) {
+  if (w->format == RENDER_BINARY) {
+    rec_put_le(w, v, 2);
+  } else {
+    rec_elem(w, v);
+  }
+}
+
+void rec_array_end(struct records *w) {
+  if (w->format != RENDER_BINARY) {
+    render_char(w->r, ']');
+    w->nfields = 1;
+  }
+}
+
+
+//-- Scripts --------------------------------------------------------
+void records_file(struct records *w, const char *path) {
+  rec_begin(w, REC_FILE);
+  rec_int(w, "version", RECORDS_VERSION);
+  rec_str(w, "path", path);
+  rec_end(w);
+}
+
+void records_symbols(struct records *w, struct debug_block *debug) {
+  for (int i = 0; i < debug->nsymbols; i++) {
+    struct debug_symbol *sym = &debug->symbols[i];
+    rec_begin(w, REC_SYMBOL);
+    rec_int(w, "id", (i32) sym->id);
+    rec_str(w, "kind", sym->type == 0x0001? "global"
+                     : sym->type == 0x0009? "function"
+                     : sym->type == 0x0101? "local"
+                     :                      "");
+    rec_int(w, "start", sym->start);
+    rec_int(w, "end", sym->end);
+    rec_str(w, "name", sym->name);
+    rec_end(w);
+  }
+}
+
+/** Returns the byte offset of `target`, or -1 if it lies outside the `n`
+ *  words of code. */
+i64 target_addr(i32 target, int n) {
+  return target >= 0 && target < n? 4 * (i64) target : -1;
+}
+
+void records_label(struct records *w, struct debug_block *debug, u32 *labels,
+                   int i) {
+  char name[32];
+  const char *kind;
+  const struct debug_symbol *sym = NULL;
+
+  if (labels[i] == -1) {
+    kind = "function";
+    if (debug != NULL) sym = lookup_sym(debug, i*4, 0x0009, 0);
+    if (sym == NULL) sprintf(name, "Func_%04x", i * 4);
+  } else {
+    kind = "local";
+    sprintf(name, ".l%d", labels[i]);
+  }
+
+  rec_begin(w, REC_LABEL);
+  rec_int(w, "addr", 4 * (i64) i);
+  rec_str(w, "kind", kind);
+  rec_str(w, "name", sym != NULL? sym->name : name);
+  rec_end(w);
+}
+
+void records_code(struct records *w, const char *name, struct code_block *code,
+                  struct debug_block *debug) {
+  records_code_range(w, name, code, debug, 0, UINT32_MAX);
+}
+
+void records_code_range(struct records *w, const char *name, struct code_block *code,
+                        struct debug_block *debug, u32 start, u32 end) {
+  TIMING_BEGIN(span, PHASE_PRINT);
+  u32 *ins = code->instrs;
+  int n = code->ninstrs;
+
+  struct code_ir *ir = get_code_ir(code);
+  u32 *labels = calloc(n + code->nmovement + 1, sizeof(u32));
+  assign_labels(labels, code, ir);
+
+  rec_begin(w, REC_BLOCK);
+  rec_str(w, "name", name);
+  rec_int(w, "ninstrs", n);
+  rec_end(w);
+
+  int line_i = 0, lineno = -1;
+  for (int k = 0; k < ir->ninstrs; k++) {
+    struct ir_instr *instr = &ir->instrs[k];
+    int i = instr->pos;
+
+    while (debug != NULL && line_i < debug->nlinenos
+           && debug->linenos[line_i].start <= 4*i) {
+      lineno = debug->linenos[line_i++].lineno;
+    }
+    if (4*i >= end) break;
+    if (4*i < start) continue;
+
+    // Labels may also point into a JumpMap's operands
+    for (int j = 0; j <= instr->nargs; j++) {
+      if (labels[i + j] != 0) records_label(w, debug, labels, i + j);
+    }
+
+    if (instr->op == 0x0082 && !(instr->flags & IR_BROKEN)) {
+      int choices = ins[i + 1];
+      i32 *targets = &ir->targets[instr->target];
+
+      rec_begin(w, REC_JUMPMAP);
+      rec_int(w, "addr", 4 * (i64) i);
+      rec_array_begin(w, "cases", choices);
+      for (int j = 0; j < choices; j++) rec_elem(w, (i32) ins[i + 3 + 2*j]);
+      rec_array_end(w);
+      rec_array_begin(w, "targets", choices + 1);
+      for (int j = 0; j <= choices; j++) rec_elem(w, target_addr(targets[j], n));
+      rec_array_end(w);
+      rec_int(w, "line", lineno);
+      rec_end(w);
+      continue;
+    }
+
+    const char *op_name = ir_op_name(instr->op);
+    const struct debug_symbol *sym = NULL;
+    u32 type = ref_type(instr->op);
+    if (type != 0 && debug != NULL) {
+      sym = lookup_sym(debug, (i16) instr->high_half, type, i * 4);
+    }
+
+    rec_begin(w, REC_INSTR);
+    rec_int(w, "addr", 4 * (i64) i);
+    rec_int(w, "op", instr->op);
+    rec_str(w, "name", op_name != NULL && !(instr->flags & IR_BROKEN)? op_name : "");
+    rec_array_begin(w, "words", instr->nargs + 1);
+    for (int j = 0; j <= instr->nargs; j++) rec_elem(w, ins[i + j]);
+    rec_array_end(w);
+    rec_int(w, "target", instr->flags & IR_BRANCH? target_addr(instr->target, n) : -1);
+    rec_str(w, "ref", sym != NULL? sym->name : "");
+    rec_int(w, "line", lineno);
+    rec_end(w);
+  }
+
+  free(labels);
+  TIMING_END(span, 0, 0);
+}
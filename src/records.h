@@ -0,0 +1,96 @@
+#ifndef RECORDS_H
+#define RECORDS_H
+
+#include "poketools.h"
+#include "render.h"
+#include "formats/script.h"
+
+/** Machine-readable output: a stream of records, written incrementally
+ *  through a renderer, so memory use doesn't depend on the size of the
+ *  input.  Each record has a fixed list of fields:
+ *
+ *    file    version, path
+ *    block   name, ninstrs
+ *    label   addr, kind ("function" or "local"), name
+ *    instr   addr, op, name, words, target, ref, line
+ *    jumpmap addr, cases, targets, line
+ *    symbol  id, kind ("global", "function" or "local"), start, end, name
+ *    unk1    table, index, fields
+ *
+ *  Addresses (`addr`, `target`, `targets`) are byte offsets into the block's
+ *  code, `words` are the raw instruction words, and `ref` names the global
+ *  or local an instruction refers to.  A field with no value is -1 or "".
+ *
+ *  As NDJSON, each record is a JSON object on a line of its own, with the
+ *  record type in its "type" field.
+ *
+ *  As binary, each record is a u32 length (of what follows it), a u8 record
+ *  type (`enum record_type`), then its fields in order: numbers as 4-byte
+ *  little-endian integers, strings as a u16 length and that many bytes,
+ *  and arrays as a u32 count and that many 4-byte integers (2-byte ones for
+ *  `unk1` fields). */
+enum record_type {
+  REC_FILE = 1,
+  REC_BLOCK,
+  REC_LABEL,
+  REC_INSTR,
+  REC_JUMPMAP,
+  REC_SYMBOL,
+  REC_UNK1,
+};
+
+#define RECORDS_VERSION 1
+
+/** A record writer. */
+struct records {
+  struct render *r;
+  enum render_format format;
+
+  // The record being built (binary), or whether a field was written (NDJSON)
+  u8 *rec;
+  size_t len, cap;
+  int nfields;
+};
+
+/** Initializes `w` to write records to `r` in the given `format`. */
+void records_init(struct records *w, struct render *r, enum render_format format);
+
+/** Frees `w`'s buffers. */
+void records_free(struct records *w);
+
+//-- Building records -----------------------------------------------
+/** Writes `s` as a JSON string. */
+void json_string(struct render *r, const char *s);
+
+void rec_begin(struct records *w, enum record_type type);
+void rec_end(struct records *w);
+
+void rec_int(struct records *w, const char *key, i64 v);
+void rec_str(struct records *w, const char *key, const char *s);
+
+/** Array fields: `rec_array_begin`, then exactly `n` elements, then
+ *  `rec_array_end`. */
+void rec_array_begin(struct records *w, const char *key, u32 n);
+void rec_elem(struct records *w, i64 v);
+void rec_elem16(struct records *w, u16 v);
+void rec_array_end(struct records *w);
+
+//-- Scripts --------------------------------------------------------
+/** Writes the `file` record that starts each input's output. */
+void records_file(struct records *w, const char *path);
+
+/** Writes a `symbol` record for each symbol in `debug`. */
+void records_symbols(struct records *w, struct debug_block *debug);
+
+/** Writes the `block` record of `code`, then a record per label and
+ *  instruction, using debug info from `debug` (if not NULL) for names and
+ *  line numbers. */
+void records_code(struct records *w, const char *name, struct code_block *code,
+                  struct debug_block *debug);
+
+/** Like `records_code`, but only the labels and instructions at byte
+ *  addresses [start, end). */
+void records_code_range(struct records *w, const char *name, struct code_block *code,
+                        struct debug_block *debug, u32 start, u32 end);
+
+#endif
@@ -0,0 +1,145 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "render.h"
+#include "timings.h"
+
+int render_color = 1;
+enum render_format render_format = RENDER_TEXT;
+
+void render_init(struct render *r, FILE *out) {
+  r->out = out;
+  r->color = render_color;
+  r->vis = 0;
+  r->p = r->buf;
+}
+
+void render_flush(struct render *r) {
+  TIMING_COUNT(phases[PHASE_PRINT].bytes_out, r->p - r->buf);
+  fwrite(r->buf, 1, r->p - r->buf, r->out);
+  r->p = r->buf;
+}
+
+/** Makes room for `n` more bytes in the buffer. */
+void render_reserve(struct render *r, size_t n) {
+  if ((size_t) (r->buf + RENDER_BUFSIZ - r->p) < n) render_flush(r);
+}
+
+int render_parse_args(int argc, char *argv[]) {
+  int k = 1;
+  for (int i = 1; i < argc; i++) {
+    if      (strcmp(argv[i], "--no-color") == 0) render_color = 0;
+    else if (strcmp(argv[i], "--color")    == 0) render_color = 1;
+    else if (strncmp(argv[i], "--format", 8) == 0) {
+      const char *f = argv[i][8] == '='? &argv[i][9]
+                    : argv[i][8] == 0 && i + 1 < argc? argv[++i]
+                    : "";
+      if      (strcmp(f, "text")   == 0) render_format = RENDER_TEXT;
+      else if (strcmp(f, "json")   == 0) render_format = RENDER_NDJSON;
+      else if (strcmp(f, "binary") == 0) render_format = RENDER_BINARY;
+      else {
+        fprintf(stderr, "Unknown output format '%s' (try text, json or binary).\n", f);
+        return -1;
+      }
+    }
+    else argv[k++] = argv[i];
+  }
+  argv[k] = NULL;
+  return k;
+}
+
+
+//-- Output ---------------------------------------------------------
+void render_char(struct render *r, char c) {
+  render_reserve(r, 1);
+  *r->p++ = c;
+  r->vis++;
+}
+
+void render_raw(struct render *r, const void *s, size_t n) {
+  if (n > RENDER_BUFSIZ) {
+    render_flush(r);
+    fwrite(s, 1, n, r->out);
+    return;
+  }
+  render_reserve(r, n);
+  memcpy(r->p, s, n);
+  r->p += n;
+}
+
+void render_strn(struct render *r, const char *s, size_t n) {
+  render_raw(r, s, n);
+  r->vis += n;
+}
+
+void render_str(struct render *r, const char *s) {
+  render_strn(r, s, strlen(s));
+}
+
+void render_sgr(struct render *r, const char *sgr) {
+  if (r->color) render_raw(r, sgr, strlen(sgr));
+}
+
+void render_repeat(struct render *r, char c, int n) {
+  while (n > 0) {
+    int k = n < RENDER_BUFSIZ? n : RENDER_BUFSIZ;
+    render_reserve(r, k);
+    memset(r->p, c, k);
+    r->p += k;
+    r->vis += k;
+    n -= k;
+  }
+}
+
+void render_pad(struct render *r, long vis) {
+  render_repeat(r, ' ', vis - r->vis);
+}
+
+void render_hex(struct render *r, u32 v, int width, char fill) {
+  char tmp[8];
+  int n = 0;
+  do {
+    tmp[sizeof(tmp) - ++n] = "0123456789abcdef"[v & 0xF];
+    v >>= 4;
+  } while (v);
+
+  render_repeat(r, fill, width - n);
+  render_strn(r, tmp + sizeof(tmp) - n, n);
+}
+
+void render_int(struct render *r, i64 v, int width) {
+  char tmp[24];
+  int n = 0;
+  u64 u = v < 0? -(u64) v : (u64) v;
+  do {
+    tmp[sizeof(tmp) - ++n] = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (v < 0) tmp[sizeof(tmp) - ++n] = '-';
+
+  render_repeat(r, ' ', width - n);
+  render_strn(r, tmp + sizeof(tmp) - n, n);
+}
+
+void render_fmt(struct render *r, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  size_t room = r->buf + RENDER_BUFSIZ - r->p;
+  int n = vsnprintf(r->p, room, fmt, ap);
+  va_end(ap);
+  if (n < 0) return;
+
+  if ((size_t) n >= room) {
+    // Didn't fit; flush and try again (or write it directly if it never will)
+    render_flush(r);
+    va_start(ap, fmt);
+    if (n < RENDER_BUFSIZ) vsnprintf(r->p, RENDER_BUFSIZ, fmt, ap);
+    else                   vfprintf(r->out, fmt, ap);
+    va_end(ap);
+    if (n >= RENDER_BUFSIZ) { r->vis += n; return; }
+  }
+
+  r->p += n;
+  r->vis += n;
+}
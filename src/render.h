@@ -0,0 +1,74 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdio.h>
+
+#include "poketools.h"
+
+#define RENDER_BUFSIZ (1 << 16)
+
+/** A buffered text output stream.  Text is collected in a large buffer and
+ *  written out in one go when it fills up, and the visible width of everything
+ *  written is tracked as it is emitted (SGR sequences don't count), so columns
+ *  can be padded without re-scanning strings. */
+struct render {
+  FILE *out;
+  int color;          // Emit SGR sequences?
+  long vis;           // Visible characters written so far
+  char *p;            // Write position in `buf`
+  char buf[RENDER_BUFSIZ];
+};
+
+/** Output formats, chosen with `--format`. */
+enum render_format {
+  RENDER_TEXT,        // Human-readable listing
+  RENDER_NDJSON,      // One JSON record per line
+  RENDER_BINARY,      // Length-prefixed binary records
+};
+
+/** Whether new renderers emit SGR sequences; cleared by `--no-color`. */
+extern int render_color;
+
+/** The output format; set by `--format`. */
+extern enum render_format render_format;
+
+/** Initializes `r` to write to `out`. */
+void render_init(struct render *r, FILE *out);
+
+/** Writes out everything buffered in `r`. */
+void render_flush(struct render *r);
+
+/** Removes the rendering options (`--color`, `--no-color` and
+ *  `--format <text|json|binary>`) from the command line, applying them.
+ *  Returns the new `argc`, or -1 on a bad option. */
+int render_parse_args(int argc, char *argv[]);
+
+//-- Output ---------------------------------------------------------
+void render_char(struct render *r, char c);
+void render_strn(struct render *r, const char *s, size_t n);
+void render_str(struct render *r, const char *s);
+
+/** Writes `n` bytes that don't take up any visible space. */
+void render_raw(struct render *r, const void *s, size_t n);
+
+/** Writes the SGR sequence `sgr`, or nothing in plain-text mode. */
+void render_sgr(struct render *r, const char *sgr);
+
+/** Writes `n` copies of `c`. */
+void render_repeat(struct render *r, char c, int n);
+
+/** Pads with spaces up to the visible position `vis`. */
+void render_pad(struct render *r, long vis);
+
+/** Writes `v` in lowercase hex, padded with `fill` to `width` digits. */
+void render_hex(struct render *r, u32 v, int width, char fill);
+
+/** Writes `v` in decimal, right-aligned to `width` characters. */
+void render_int(struct render *r, i64 v, int width);
+
+/** Writes printf-style formatted text, which must not contain SGR
+ *  sequences.  For anything the helpers above don't cover. */
+void render_fmt(struct render *r, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+
+#endif
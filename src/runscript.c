@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "poketools.h"
+#include "batch.h"
+#include "decode.h"
+#include "mapfile.h"
+#include "vm.h"
+#include "formats/script.h"
+#include "formats/zonedata.h"
+
+u64 max_steps = 1000000;    // Per function; 0 for no limit
+int trace = 0;
+const char *only = NULL;    // Function to run, by name or `$addr`
+
+/** Prints DoCommand? calls, for `--trace`. */
+int trace_command(struct vm *vm, u32 cmd, int nargs, const i32 *args) {
+  FILE *out = vm->user;
+  fprintf(out, "    $%04x: DoCommand %u(", vm->ops[vm->pc].pos * 4, cmd);
+  for (int i = 0; i < nargs; i++) fprintf(out, i? ", %d" : "%d", args[i]);
+  fprintf(out, ")\n");
+  return 0;
+}
+
+/** Runs the functions of `code` (or just the one asked for), printing how
+ *  each run ended. */
+void run_code(FILE *out, struct code_block *code, struct debug_block *debug) {
+  int n = code->ninstrs;
+  u32 *labels = calloc(n + code->nmovement + 1, sizeof(u32));
+  assign_labels(labels, code, get_code_ir(code));
+
+  struct vm *vm = malloc(sizeof(struct vm));
+  vm_init(vm, code);
+  vm->user = out;
+  if (trace) vm_register(vm, -1, trace_command);
+
+  for (int i = 0; i < n; i++) {
+    if (labels[i] != -1) continue;
+
+    char name[32];
+    const struct debug_symbol *sym = debug != NULL? lookup_sym(debug, i*4, 0x0009, 0) : NULL;
+    if (sym == NULL) sprintf(name, "Func_%04x", i * 4);
+
+    const char *fname = sym != NULL? sym->name : name;
+    if (only != NULL) {
+      if (only[0] == '$'? strtoul(only + 1, NULL, 16) != i * 4 : strcmp(only, fname) != 0) continue;
+    }
+
+    memset(vm->globals, 0, sizeof(i32) * VM_GLOBALS);
+    vm->steps = 0;
+    vm_call(vm, i * 4);
+    if (trace) fprintf(out, "  %s:\n", fname);
+    enum vm_status status = vm_run(vm, max_steps);
+
+    fprintf(out, "  %-24s ", fname);
+    switch (status) {
+      case VM_DONE:
+        fprintf(out, "done     %10llu steps", (unsigned long long) vm->steps);
+        if (vm->sp > 0) fprintf(out, ", top %d", vm->stack[vm->sp - 1]);
+        break;
+      case VM_STEPPED:
+        fprintf(out, "stepped  %10llu steps, at $%04x", (unsigned long long) vm->steps,
+                vm->ops[vm->pc].pos * 4);
+        break;
+      case VM_ERROR:
+        fprintf(out, "error    %10llu steps, at $%04x: %s", (unsigned long long) vm->steps,
+                vm->error_pos, vm->error);
+        break;
+    }
+    fputc('\n', out);
+  }
+
+  vm_free(vm);
+  free(vm);
+  free(labels);
+}
+
+/** Runs the script or zone at `path`. */
+int runscript(FILE *out, const char *path) {
+  struct mapped_file file;
+  if (map_file(&file, path) < 0) {
+    fprintf(stderr, "Couldn't open '%s' for reading.\n", path);
+    return 2;
+  }
+
+  u32 magic = 0;
+  if (file.size >= sizeof(u32)) memcpy(&magic, file.data, sizeof(u32));
+
+  struct code_block *code = NULL, *code2 = NULL;
+  struct debug_block *debug = NULL;
+  if (magic == 0x00044F5A) {
+    struct zonedata *zone = parse_zonedata(file.data, file.size);
+    if (zone != NULL) {
+      code = zone->code1;
+      code2 = zone->code2;
+    }
+  } else {
+    // A script: its code section, and its debug section for names
+    size_t start = 0;
+    while (file.size - start >= 2 * sizeof(u32)) {
+      u32 size, section_magic;
+      memcpy(&size,          file.data + start,               sizeof(u32));
+      memcpy(&section_magic, file.data + start + sizeof(u32), sizeof(u32));
+
+      if (section_magic == 0x0A0AF1E0 && code == NULL) {
+        code = parse_code_block(file.data + start, file.size - start, NULL);
+      } else if (section_magic == 0x0A0AF1EF && debug == NULL) {
+        debug = parse_debug_block(file.data + start, file.size - start, NULL);
+      } else break;
+      if (size == 0 || size > file.size - start) break;
+      start += size;
+    }
+  }
+
+  if (code == NULL) {
+    fprintf(stderr, "%s: Not a script or zone.\n", path);
+    unmap_file(&file);
+    return 2;
+  }
+
+  // A run going wrong is a result, not a failure of the tool
+  if (code2 != NULL) fprintf(out, "code1:\n");
+  run_code(out, code, debug);
+  if (code2 != NULL) {
+    fprintf(out, "code2:\n");
+    run_code(out, code2, NULL);
+  }
+
+  unmap_file(&file);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  // Our own options: `--steps <n>`, `--trace` and `-f <function>`
+  int k = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) max_steps = strtoull(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "--trace") == 0) trace = 1;
+    else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) only = argv[++i];
+    else argv[k++] = argv[i];
+  }
+  argv[k] = NULL;
+  argc = k;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s [-j <threads>] [--steps <n>] [--trace] [-f <function|$addr>] <script|zone|dir|->...\n", argv[0]);
+    return 1;
+  }
+  return batch_main(runscript, argc, argv);
+}
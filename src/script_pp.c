@@ -1,11 +1,13 @@
-#include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "poketools.h"
+#include "decode.h"
 #include "hexdump.h"
+#include "render.h"
+#include "timings.h"
 #include "formats/script.h"
 
 #define FMT_FUNC    "\x1B[38;5;221m"
@@ -16,305 +18,258 @@
 #define FMT_COMMENT "\x1B[38;5;243m"
 #define FMT_END     "\x1B[m"
 
-/** Prints the given debug section `debug` to stdout. */
-void print_debug(struct debug_block *debug) {
+/** Prints the given debug section `debug` to `r`. */
+void render_debug(struct render *r, struct debug_block *debug) {
+  TIMING_BEGIN(span, PHASE_PRINT);
   struct debug_header *hd = debug->header;
 
-  printf("\n------ \x1B[1mDebug\x1B[m ------\n");
-  printf("  #unk1: %2d   #files: %2d   #linenos: %2d   #symbols: %2d   #types: %2d\n",
-         hd->count_unk1, hd->count_files, hd->count_linenos, hd->count_symbols, hd->count_types);
-  printf("  Unknowns: %08x\n", hd->unk1);
+  render_str(r, "\n------ ");
+  render_sgr(r, "\x1B[1m");
+  render_str(r, "Debug");
+  render_sgr(r, FMT_END);
+  render_str(r, " ------\n");
+  render_fmt(r, "  #unk1: %2d   #files: %2d   #linenos: %2d   #symbols: %2d   #types: %2d\n",
+                hd->count_unk1, hd->count_files, hd->count_linenos, hd->count_symbols, hd->count_types);
+  render_fmt(r, "  Unknowns: %08x\n", hd->unk1);
 
   // Files
-  printf("\nFiles:\n");
+  render_str(r, "\nFiles:\n");
   for (int i = 0; i < debug->nfiles; i++) {
     struct debug_file *file = &debug->files[i];
-    printf("  [%08x] %s\n", file->start, file->name);
+    render_fmt(r, "  [%08x] %s\n", file->start, file->name);
   }
 
   // LineNos
-  printf("\nLineNos: (%d linenos)\n", debug->nlinenos);
+  render_fmt(r, "\nLineNos: (%d linenos)\n", debug->nlinenos);
 
   // Symbols
-  printf("\nSymbols:\n");
+  render_str(r, "\nSymbols:\n");
   for (int i = 0; i < debug->nsymbols; i++) {
     struct debug_symbol *symbol = &debug->symbols[i];
-    printf("  [%08x] %04x (%04x..%04x) %04x %s\n",
-           symbol->id, symbol->unk1, symbol->start, symbol->end,
-           symbol->type, symbol->name);
+    render_fmt(r, "  [%08x] %04x (%04x..%04x) %04x %s\n",
+                  symbol->id, symbol->unk1, symbol->start, symbol->end,
+                  symbol->type, symbol->name);
   }
 
   // Types
-  printf("\nTypes:\n");
+  render_str(r, "\nTypes:\n");
   for (int i = 0; i < debug->ntypes; i++) {
     struct debug_type *type = &debug->types[i];
-    printf("%4d %s\n", type->id, type->name);
+    render_fmt(r, "%4d %s\n", type->id, type->name);
   }
+  TIMING_END(span, 0, 0);
 }
 
-
-//-- New disassembler implementation --------------------------------
-struct instr {
-  i32 op;
-  i32 high_half;
-  int uses_high_half;
-  int nargs;
-  u32 *args;
-};
-int decode(struct instr *instr, u32 *code) {
-  u32 v  = *code;
-  u16 vh = v >> 16,
-      vl = v & 0xFFFF;
-
-  *instr = (struct instr) {
-    .op             = vl,
-    .high_half      = vh,
-    .uses_high_half = 0,
-    .nargs          = 0,
-    .args           = code + 1,
-  };
-
-  switch (vl) {
-    case 0x0009:                                    break;
-    case 0x000B: instr->nargs = 1;                  break; //   Often $b0029
-    case 0x000C:                                    break;
-    case 0x000E: instr->nargs = 1;                  break; //   Always a fairly low, int-aligned negative value
-    case 0x0017:                                    break;
-    case 0x0020:                                    break;
-    case 0x0022:                                    break;
-    case 0x0024:                                    break;
- // case 0x0025: instr->uses_high_half = 1;         break; //   Happens in no zonefiles
-    case 0x0027: instr->nargs = 1;                  break; // PushConst -- looks like operand is either u32, 2×u16 or float
-    case 0x002B:                                    break;
-    case 0x002E:                                    break; // Begin
-    case 0x0030:                                    break; // Return
-    case 0x0031: instr->nargs = 1;                  break; // Call
-    case 0x0033: instr->nargs = 1;                  break; // Jump
- // case 0x0034: instr->nargs = 1;                  break; // Jump??
-    case 0x0035: instr->nargs = 1;                  break; // JumpNE -- only ever forward
-    case 0x0036: instr->nargs = 1;                  break; // JumpEq -- only ever forward
-    case 0x0037: instr->nargs = 1;                  break; // Jump?? -- very frequently $20; occasionally high (~$100, $200, $300); only ever forward
-    case 0x0038: instr->nargs = 1;                  break; // Jump?? -- only ever forward
-    case 0x003D: instr->nargs = 1;                  break; // Jump?? -- only ever forward; often $10
-    case 0x003E: instr->nargs = 1;                  break; // Jump?? -- only ever forward
-    case 0x003F: instr->nargs = 1;                  break; // Jump?? -- only ever forward
-    case 0x0040: instr->nargs = 1;                  break; // Jump?? -- only ever forward; often fairly high
-    case 0x004E:                                    break; // Add?
-    case 0x0051:                                    break; // Cmp?
-    case 0x0059:                                    break; // PushFalse
-    case 0x0069: instr->nargs = 1;                  break; //   Only ever invoked with $ffff or very rarely $fff3 as the operand
-    case 0x0075: instr->nargs = 1;                  break; //   Only ever invoked with fairly low, int-aligned operand
-    case 0x0077: instr->nargs = 1;                  break; //   -||-
-    case 0x0078: instr->nargs = 1;                  break; //   Only ever invoked with $0c as the operand
-    case 0x0081: instr->nargs = 1;                  break; // Trampoline
-    case 0x0082: instr->nargs = 2*code[1] + 2;      break; // JumpMap
-    case 0x0087: instr->nargs = 2;                  break; // DoCommand?
-    case 0x0089:                                    break; // LineNo
-    case 0x008A: instr->nargs = 2;                  break;
-    case 0x008E: instr->nargs = 3;                  break;
-    case 0x0096: instr->nargs = 5;                  break;
-    case 0x009B: instr->nargs = 2;                  break; // Copy? -- both operands are small, positive or negative, int-aligned
-    case 0x009D: instr->nargs = 2;                  break; //   Low negative int-aligned, relatively low occasionally with high word as $0005
-    case 0x00A2: instr->uses_high_half = 1;         break; // GetGlobal2
-    case 0x00A3: instr->uses_high_half = 1;         break; // GetGlobal
-    case 0x00A4: instr->uses_high_half = 1;         break; // GetLocal
-    case 0x00AB: instr->uses_high_half = 1;         break; // PushTrue
-    case 0x00AC: instr->uses_high_half = 1;         break; // CmpConst2
- // case 0x00AE: instr->uses_high_half = 1;         break; //            -- never used in zonefile
-    case 0x00AF: instr->uses_high_half = 1;         break; // SetGlobal
-    case 0x00B1: instr->uses_high_half = 1;         break; // SetLocal?
-    case 0x00B8: instr->uses_high_half = 1;         break; //   Only ever used with $02 as the operand
-    case 0x00B9: instr->uses_high_half = 1;         break; //   Only ever used with $02 as the operand
-    case 0x00BC: instr->uses_high_half = 1;         break; // PushConst
-    case 0x00BD: instr->uses_high_half = 1;         break; // GetGlobal3
-    case 0x00BE: instr->uses_high_half = 1;         break; // GetArg
-    case 0x00BF: instr->uses_high_half = 1;         break; // ResetLocal
-    case 0x00C5: instr->uses_high_half = 1;         break; //   Non-aligned, often small, always positive operand
-    case 0x00C6: instr->uses_high_half = 1;         break; //   Non-aligned, always small, always positive operand
- // case 0x00C8: instr->uses_high_half = 1;         break; // CmpLocal   -- never used in zonefile
-    case 0x00C9: instr->uses_high_half = 1;         break; // CmpConst
- // case 0x00CC: instr->uses_high_half = 1;         break; //            -- never used in zonefile
- // case 0x00D4: instr->uses_high_half = 1;         break; //            -- never used in zonefile
-    case 0x00D2:                                    break; // Script Begin
-    default:
-      instr->op = -1;
-  }
-
-  return instr->op != -1;
+/** Prints the given debug section `debug` to `out`. */
+void print_debug(FILE *out, struct debug_block *debug) {
+  struct render r;
+  render_init(&r, out);
+  render_debug(&r, debug);
+  render_flush(&r);
 }
 
-void disasm_assign_labels_(u32 *labels, struct code_block *code) {
-  u32 *ins = code->instrs;
-  int n = code->ninstrs;
-
-  // First mark all targets for jump instructions
-  struct instr instr;
-  for (int i = 0; i < n; i += instr.nargs + 1) {
-    decode(&instr, &ins[i]);
 
-    switch (instr.op) {
-      case 0x002E: { // Begin
-        labels[i] = -1;
-      } break;
-
-      case 0x0031: case 0x0033: case 0x0034: case 0x0035: case 0x0036:
-      case 0x0037: case 0x0038:
-      case 0x003D: case 0x003E:
-      case 0x0040: case 0x005A: { // Jumps
-        u32 target = i + (int) ins[i + 1]/4;
-        if (target < n && labels[target] == 0) labels[target] = 1;
-      } break;
-
-      case 0x0081: { // Trampoline
-        u32 target = i + (int) ins[i + 1]/4;
-        if (target < n) labels[target] = 1;
-      } break;
-
-      case 0x0082: { // JumpMaps
-        labels[i] = 1;
-        int choices = ins[i + 1];
-        u32 target;
-
-        #define SAFE_LOOKUP(target, idx) { \
-          if (!(0 < idx && idx < n)) break; \
-          target = (idx) + (int) ins[idx]/4 - 1; \
-        }
-
-        for (int j = 0; j < choices; j++) {
-          SAFE_LOOKUP(target, i + 2 + 2*j);
-          if (target < n && labels[target] == 0) labels[target] = 1;
-        }
-        SAFE_LOOKUP(target, i + 2 + 2*choices);
-        if (target < n && labels[target] == 0) labels[target] = 1;
-
-        #undef SAFE_LOOKUP
-      } break;
-    }
-  }
-
-  // Then, compute proper label indices within each function
-  u32 counter = 0;
-  for (int i = 0; i < n; i++) {
-    switch (labels[i]) {
-      case -1: counter = 0;           break; // Begin: function label
-      case  1: labels[i] = ++counter; break; // Local label
-    }
-  }
-}
-
-
-char identifier_buf[BUFSIZ];
-char *disasm_lookup_identifier_(struct debug_block *debug, u32 id, u32 type, int i) {
-  const char *fmt = type == 0x101? FMT_LOCAL : FMT_GLOBAL;
+//-- New disassembler implementation --------------------------------
+/** Writes the name of the identifier `id` of symbol type `type`, as seen
+ *  from word `i`. */
+void disasm_identifier_(struct render *r, struct debug_block *debug,
+                        u32 id, u32 type, int i) {
+  render_sgr(r, type == 0x101? FMT_LOCAL : FMT_GLOBAL);
 
   const struct debug_symbol *sym = NULL;
   if (debug != NULL) sym = lookup_sym(debug, id, type, i * 4);
 
   if (sym != NULL) {
-    sprintf(identifier_buf, "%s%s%s", fmt, sym->name, FMT_END);
+    render_str(r, sym->name);
   } else {
-    sprintf(identifier_buf, "%s$%04hx%s", fmt, (u16) (id & 0xFFFF), FMT_END);
+    render_char(r, '$');
+    render_hex(r, id & 0xFFFF, 4, '0');
   }
-  return identifier_buf;
+  render_sgr(r, FMT_END);
 }
 
-char label_buf[BUFSIZ];
-char *disasm_lookup_label_(struct debug_block *debug, u32 *labels, int i) {
+/** Writes the label of word `i`, if it has one. */
+void disasm_label_(struct render *r, struct debug_block *debug, u32 *labels,
+                   int i) {
   switch (labels[i]) {
     case -1: {
       const struct debug_symbol *sym = NULL;
       if (debug != NULL) sym = lookup_sym(debug, i*4, 0x0009, 0);
 
+      render_sgr(r, FMT_FUNC);
       if (sym != NULL) {
-        sprintf(label_buf, "%s%s%s", FMT_FUNC, sym->name, FMT_END);
+        render_str(r, sym->name);
       } else {
-        sprintf(label_buf, "%sFunc_%04x%s", FMT_FUNC, i * 4, FMT_END);
+        render_str(r, "Func_");
+        render_hex(r, i * 4, 4, '0');
       }
+      render_sgr(r, FMT_END);
     } break;
 
-    case 0: {
-      label_buf[0] = 0;
-    } break;
+    case 0: break;
 
     default: {
-      sprintf(label_buf, "%s.l%d%s", FMT_LABEL, labels[i], FMT_END);
+      render_sgr(r, FMT_LABEL);
+      render_str(r, ".l");
+      render_int(r, (i32) labels[i], 0);
+      render_sgr(r, FMT_END);
     }
   }
-  return label_buf;
 }
 
-void print_column(const char *str, int w) {
-  int n = 0;
-  for (const char *p = str; *p; p++) {
-    if (*p == '\x1B') {
-      while (*p != 'm' && *p) p++;
-      n--;
-    }
-    n++;
-  }
-
-//printf("[%d %d]", w, n);
-
-  #define max(a,b) ((a) > (b)? (a) : (b))
-  if (w > 0) printf("%*s%s", max(0, w - n), "", str);
-  else       printf("%s%*s", str, max(0, (-w) - n), "");
+/** Writes the label for a branch `target`, which may lie outside the `n`
+ *  words of code (in which case it has none). */
+void disasm_target_label_(struct render *r, struct debug_block *debug,
+                          u32 *labels, int n, i32 target) {
+  if (target >= 0 && target < n) disasm_label_(r, debug, labels, target);
 }
 
-void disasm_line_(u32 *ins, int i, int n, const char *str, u32 *labels,
-                  struct debug_block *debug, int lineno) {
-  char *label = disasm_lookup_label_(debug, labels, i);
-  if (n == 0) label[0] = 0; // This line doesn't really count
+/** Starts the line for the `n` words at `i`: any function header, then the
+ *  line number and label columns.  Returns the position of the text column,
+ *  for `disasm_line_end_`. */
+long disasm_line_begin_(struct render *r, u32 *labels, struct debug_block *debug,
+                        int i, int n, int lineno) {
+  int labelled = n != 0 && labels[i] != 0; // An `n` of 0 doesn't really count
 
   if (labels[i] == -1) {
-    printf("\n%s:\n", label);
-    label[0] = 0;
+    render_char(r, '\n');
+    if (labelled) disasm_label_(r, debug, labels, i);
+    render_str(r, ":\n");
+    labelled = 0;
   }
 
-  if (label[0]) strcat(label, ":");
-
   //  ..________..######################################;__####: xxxxxxxx xxxxxxxx
   // "  .l1:      Call Func_00a4                        ;  0004: 00000031 000000a0
-  if (lineno >= 0) {
-    printf("%-4d", lineno);
-  } else {
-    printf("    ");
+  long col = r->vis;
+  if (lineno >= 0) render_int(r, lineno, 0);
+  render_pad(r, col + 4);
+
+  col = r->vis;
+  if (labelled) {
+    disasm_label_(r, debug, labels, i);
+    render_char(r, ':');
   }
-  print_column(label, -8);
-  print_column(str, -37);
-  printf(" %s;", FMT_COMMENT);
+  render_pad(r, col + 8);
+
+  return r->vis;
+}
+
+/** Pads the text column started at `col`, and ends the line with the `n`
+ *  words at `i`. */
+void disasm_line_end_(struct render *r, u32 *ins, int i, int n, long col) {
+  render_pad(r, col + 37);
+  render_char(r, ' ');
+  render_sgr(r, FMT_COMMENT);
+  render_char(r, ';');
 
   if (n > 0) {
-    printf("%3x%03x:", (4*i) >> 12, (4*i) & 0xFFF);
+    render_hex(r, (4*i) >> 12,   3, ' ');
+    render_hex(r, (4*i) & 0xFFF, 3, '0');
+    render_char(r, ':');
     for (int j = 0; j < n; j++) {
-      int v = ins[i + j];
+      u32 v = ins[i + j];
       u16 hi = v >> 16,
           lo = v & 0xFFFF;
-      printf(" %s%04hx%s%04hx%s", format_of(hi), hi, format_of(lo), lo, FMT_END);
+      render_char(r, ' ');
+      render_sgr(r, format_of(hi));
+      render_hex(r, hi, 4, '0');
+      render_sgr(r, format_of(lo));
+      render_hex(r, lo, 4, '0');
+      render_sgr(r, FMT_END);
     }
   }
-  printf("%s\n", FMT_END);
+  render_sgr(r, FMT_END);
+  render_char(r, '\n');
+}
+
+/** Prints a whole line with the text `str`. */
+void disasm_line_(struct render *r, u32 *ins, int i, int n, const char *str,
+                  u32 *labels, struct debug_block *debug, int lineno) {
+  long col = disasm_line_begin_(r, labels, debug, i, n, lineno);
+  render_str(r, str);
+  disasm_line_end_(r, ins, i, n, col);
+}
+
+/** Prints the JumpMap `instr`, one line per choice. */
+void disasm_jumpmap_(struct render *r, struct code_block *code,
+                     struct code_ir *ir, struct ir_instr *instr, u32 *labels,
+                     struct debug_block *debug, int lineno) {
+  u32 *ins = code->instrs;
+  int n = code->ninstrs,
+      i = instr->pos;
+  i32 *targets = &ir->targets[instr->target];
+  int choices = ins[i + 1];
+
+  disasm_line_(r, ins, i, 2, "JumpMap {", labels, debug, lineno);
+
+  // Print the fallback choice
+  if (instr->ntargets > 0) {
+    long col = disasm_line_begin_(r, labels, debug, i + 2, 1, -1);
+    render_str(r, "    * => ");
+    disasm_target_label_(r, debug, labels, n, targets[0]);
+    disasm_line_end_(r, ins, i + 2, 1, col);
+  }
+
+  // Print each choice
+  for (int j = 0; j < choices; j++) {
+    int base = i + 3 + 2*j;
+    if (j + 1 >= instr->ntargets || targets[j + 1] - 1 >= n) break;
+    long col = disasm_line_begin_(r, labels, debug, base, 2, -1);
+    render_str(r, "  ");
+    render_int(r, (i32) ins[base], 3);
+    render_str(r, " => ");
+    disasm_target_label_(r, debug, labels, n, targets[j + 1]);
+    disasm_line_end_(r, ins, base, 2, col);
+  }
+
+  // A broken JumpMap is really just a single word, so nothing follows it
+  int end = instr->flags & IR_BROKEN? i : i + 3 + 2*choices;
+  disasm_line_(r, ins, end, 0, "}", labels, debug, -1);
 }
 
-void disasm_extra_block_(const char *str, u32 *extras, u32 start, u32 end) {
+void disasm_extra_block_(struct render *r, const char *str, u32 *extras,
+                         u32 start, u32 end) {
   u32 start_ = (start - 0x20) / 4,
       end_   = (end   - 0x20) / 4;
 
-  printf("%s:", str);
-  for (int i = 0; i < 8 - strlen(str); i++) putchar(' ');
+  render_str(r, str);
+  render_char(r, ':');
+  render_repeat(r, ' ', 8 - (int) strlen(str));
   for (u32 i = start_; i < end_; i += 2) {
-    int a = extras[i],
+    u32 a = extras[i],
         b = extras[i + 1];
-    if (i != start_) printf(" %*s  ", 6, "");
-    printf(" %s%08x%s %s%08x%s\n", format_of(a), a, FMT_END,
-                                   format_of(b), b, FMT_END);
+    if (i != start_) render_repeat(r, ' ', 9);
+    render_char(r, ' ');
+    render_sgr(r, format_of(a));
+    render_hex(r, a, 8, '0');
+    render_sgr(r, FMT_END);
+    render_char(r, ' ');
+    render_sgr(r, format_of(b));
+    render_hex(r, b, 8, '0');
+    render_sgr(r, FMT_END);
+    render_char(r, '\n');
+  }
+  if (start == end) render_char(r, '\n');
+}
+
+/** Returns nonzero if the "extra" words of `code` start with sane block
+ *  offsets: 7 of them in order, the last pointing at the final word. */
+int disasm_extra_ok_(struct code_block *code) {
+  if (code->nextra < 8) return 0;
+  u32 *offsets = code->extra;
+  if (offsets[0] < 0x20) return 0;
+  for (int k = 0; k < 6; k++) {
+    if (offsets[k] > offsets[k + 1]) return 0;
   }
-  if (start == end) printf("\n");
+  return offsets[6] == (code->nextra - 1) * 4 + 0x20;
 }
 
-/** Disassembles the given code section `code` and prints to stdout. */
-void disassemble(struct code_block *code, struct debug_block *debug) {
-  char buf[BUFSIZ];
-  buf[0] = 0;
+/** Disassembles the instructions of `code` at byte addresses [start, end)
+ *  and prints them to `r`, along with the header, extra words and movement
+ *  data if `whole`. */
+int disasm_block_(struct render *r, struct code_block *code,
+                  struct debug_block *debug, u32 start, u32 end, int whole) {
+  TIMING_BEGIN(span, PHASE_PRINT);
 
   //-- Grab debugging symbols
   struct debug_symbol *symbols;
@@ -327,12 +282,15 @@ void disassemble(struct code_block *code, struct debug_block *debug) {
       function_i = 0,
       local_i    = 0;
 
+  if (!disasm_extra_ok_(code)) {
+    TIMING_END(span, 0, 0);
+    return -1;
+  }
+
   if (debug != NULL) {
-    // Create a sorted copy of the symbol table
-    int sym_bytes = sizeof(struct debug_symbol) * debug->nsymbols;
-    symbols = malloc(sym_bytes);
-    memcpy(symbols, debug->symbols, sym_bytes);
-    qsort(symbols, debug->nsymbols, sizeof(struct debug_symbol), symbols_comparator);
+    // Use the sorted copy of the symbol table from the index
+    if (debug->index == NULL) build_debug_index(debug);
+    symbols = debug->index->sorted;
 
     // Extract the globals, functions and locals from the symbol table.
     int k = 0;
@@ -343,7 +301,11 @@ void disassemble(struct code_block *code, struct debug_block *debug) {
     while (k < debug->nsymbols && symbols[k].type == 0x0101) k++;
     nlocals = k - nfunctions - nglobals;
 
-    assert(nglobals + nfunctions + nlocals == debug->nsymbols);
+    // Anything else isn't understood
+    if (nglobals + nfunctions + nlocals != debug->nsymbols) {
+      TIMING_END(span, 0, 0);
+      return -1;
+    }
 
     nfiles = debug->nfiles;
     nlinenos = debug->nlinenos;
@@ -354,7 +316,7 @@ void disassemble(struct code_block *code, struct debug_block *debug) {
 
   } else {
     // No debugging symbols
-    symbols = malloc(0);
+    symbols = NULL;
 
     sym_globals   = symbols;
     sym_functions = symbols;
@@ -368,28 +330,31 @@ void disassemble(struct code_block *code, struct debug_block *debug) {
   }
 
 
+  u32 *offsets = code->extra;
+  if (!whole) goto instructions;
+
   // TODO: This is just temporary
   struct code_header *hd = code->header;
-  printf("[Code block] section_size=%x  magic=%08x\n",
-         hd->section_size, hd->magic);
-  printf("  unk1=%04x  unk2=%04x  header_size=%04x\n",
-         hd->unk1, hd->unk2, hd->header_size);
-  printf("  extracted_size=%08x  extracted_code_size=%08x  unk4=%08x  unk6=%08x\n",
-         hd->extracted_size, hd->extracted_code_size, hd->unk4, hd->unk6);
-  printf("\n");
-
-  u32 *offsets = code->extra;
-  assert(offsets[6] == (code->nextra - 1) * 4 + 0x20);
-
-  disasm_extra_block_("(unk0)",  code->extra, offsets[0], offsets[1]);
-  disasm_extra_block_("(unk1)",  code->extra, offsets[1], offsets[2]);
-  disasm_extra_block_("(unk2)",  code->extra, offsets[2], offsets[3]);
-  disasm_extra_block_("globals", code->extra, offsets[3], offsets[4]);
-  disasm_extra_block_("(unk4)",  code->extra, offsets[4], offsets[5]);
-  disasm_extra_block_("(unk5)",  code->extra, offsets[5], offsets[6]);
-  int v = code->extra[(offsets[6] - 0x20) / 4];
-  printf("(unk6):   %s%08x%s\n", format_of(v), v, FMT_END);
-  printf("\n");
+  render_fmt(r, "[Code block] section_size=%x  magic=%08x\n",
+                hd->section_size, hd->magic);
+  render_fmt(r, "  unk1=%04x  unk2=%04x  header_size=%04x\n",
+                hd->unk1, hd->unk2, hd->header_size);
+  render_fmt(r, "  extracted_size=%08x  extracted_code_size=%08x  unk4=%08x  unk6=%08x\n",
+                hd->extracted_size, hd->extracted_code_size, hd->unk4, hd->unk6);
+  render_char(r, '\n');
+
+  disasm_extra_block_(r, "(unk0)",  code->extra, offsets[0], offsets[1]);
+  disasm_extra_block_(r, "(unk1)",  code->extra, offsets[1], offsets[2]);
+  disasm_extra_block_(r, "(unk2)",  code->extra, offsets[2], offsets[3]);
+  disasm_extra_block_(r, "globals", code->extra, offsets[3], offsets[4]);
+  disasm_extra_block_(r, "(unk4)",  code->extra, offsets[4], offsets[5]);
+  disasm_extra_block_(r, "(unk5)",  code->extra, offsets[5], offsets[6]);
+  u32 v = code->extra[(offsets[6] - 0x20) / 4];
+  render_str(r, "(unk6):   ");
+  render_sgr(r, format_of(v));
+  render_hex(r, v, 8, '0');
+  render_sgr(r, FMT_END);
+  render_str(r, "\n\n");
 
 //for (int i = 0; i < code->nextra; i += 2) {
 //  u32 a = code->extra[i],
@@ -399,39 +364,64 @@ void disassemble(struct code_block *code, struct debug_block *debug) {
 //printf("\n");
 
   //-- Disassembler proper
+instructions:;
   u32 *ins = code->instrs;
   int n = code->ninstrs;
 
-  u32 *labels = calloc(n, sizeof(u32));
-  disasm_assign_labels_(labels, code);
+  // Operands (and thus lines) may spill over into the movement data
+  u32 *labels = calloc(n + code->nmovement + 1, sizeof(u32));
+  struct code_ir *ir = get_code_ir(code);
+  assign_labels(labels, code, ir);
 
   // Disassemble each instruction
-  struct instr instr;
-  for (int i = 0; i < n; i += instr.nargs + 1) {
-    decode(&instr, &ins[i]);
+  for (int k = 0; k < ir->ninstrs; k++) {
+    struct ir_instr *instr = &ir->instrs[k];
+    int i = instr->pos;
 
     int lineno = -1;
 
+    // Outside the range: just keep up with the debug info
+    if (4*i >= end) break;
+    if (4*i < start) {
+      while (global_i < nglobals && sym_globals[global_i].start <= 4*i) global_i++;
+      while (file_i < nfiles && debug->files[file_i].start <= 4*i) file_i++;
+      while (line_i < nlinenos && debug->linenos[line_i].start <= 4*i) line_i++;
+      continue;
+    }
+
     // Print any new globals
     while (global_i < nglobals && sym_globals[global_i].start <= 4*i) {
       struct debug_symbol *sym = &sym_globals[global_i];
-      printf(FMT_COMMENT "; Global: (%04hx) %s" FMT_END "\n",
-             (u16) sym->id, sym->name);
+      render_sgr(r, FMT_COMMENT);
+      render_str(r, "; Global: (");
+      render_hex(r, (u16) sym->id, 4, '0');
+      render_str(r, ") ");
+      render_str(r, sym->name);
+      render_sgr(r, FMT_END);
+      render_char(r, '\n');
       global_i++;
     }
 
     // Print file header if new file
     while (file_i < nfiles && debug->files[file_i].start <= 4*i) {
-      printf("\n%s", FMT_COMMENT);
-      for (int i = 0; i < 74; i++) putchar(';');
-      putchar('\n');
-      printf("%s;;;; %s%s%s ", FMT_COMMENT, FMT_END, debug->files[file_i].name, FMT_COMMENT);
-      int pad = 74 - (strlen(debug->files[file_i].name) + strlen(";;;;  "));
-      if (pad < 0) pad = 0;
-      for (int i = 0; i < pad; i++) putchar(';');
-      printf("\n%s", FMT_COMMENT);
-      for (int i = 0; i < 74; i++) putchar(';');
-      printf("\n%s", FMT_END);
+      const char *name = debug->files[file_i].name;
+      int pad = 74 - (strlen(name) + strlen(";;;;  "));
+      render_char(r, '\n');
+      render_sgr(r, FMT_COMMENT);
+      render_repeat(r, ';', 74);
+      render_char(r, '\n');
+      render_sgr(r, FMT_COMMENT);
+      render_str(r, ";;;; ");
+      render_sgr(r, FMT_END);
+      render_str(r, name);
+      render_sgr(r, FMT_COMMENT);
+      render_char(r, ' ');
+      render_repeat(r, ';', pad);
+      render_char(r, '\n');
+      render_sgr(r, FMT_COMMENT);
+      render_repeat(r, ';', 74);
+      render_char(r, '\n');
+      render_sgr(r, FMT_END);
       file_i++;
     }
 
@@ -459,95 +449,92 @@ void disassemble(struct code_block *code, struct debug_block *debug) {
  //   local_i++;
  // }
 
-    int nargs = instr.nargs;
-    u16 vh = instr.high_half;
+    // JumpMaps span several lines
+    if (instr->op == 0x0082) {
+      disasm_jumpmap_(r, code, ir, instr, labels, debug, lineno);
+      continue;
+    }
+
+    u16 vh = instr->high_half;
+    i32 target = instr->target;
 
-    #define RLABEL(offset, j) disasm_lookup_label_(debug, labels, (offset) + (int) ins[j]/4)
-    #define ID(id, type) disasm_lookup_identifier_(debug, (i16) (id), (type), i)
+    #define STR(s)     render_str(r, (s))
+    #define INT(x)     render_int(r, (x), 0)
+    #define HEX4(x)    render_hex(r, (x), 4, '0')
+    #define TLABEL(target) disasm_target_label_(r, debug, labels, n, (target))
+    #define ID(id, type) disasm_identifier_(r, debug, (i16) (id), (type), i)
     #define GLOBAL(id) ID(id, 0x0001)
     #define FUNC(id)   ID(id, 0x0009)
     #define LOCAL(id)  ID(id, 0x0101)
 
-    switch (instr.op) {
-      case 0x0027: sprintf(buf, "CPushConst $%x", ins[i + 1]);      break;
-      case 0x002E: sprintf(buf, "Begin");                           break;
-      case 0x0030: sprintf(buf, "Return");                          break;
-      case 0x0031: sprintf(buf, "Call %s",       RLABEL(i, i + 1)); break;
-      case 0x0033: sprintf(buf, "Jump %s",       RLABEL(i, i + 1)); break;
-      case 0x0034: sprintf(buf, "Jump?? %s",     RLABEL(i, i + 1)); break;
-      case 0x0035: sprintf(buf, "JumpNE %s",     RLABEL(i, i + 1)); break;
-      case 0x0036: sprintf(buf, "JumpEq %s",     RLABEL(i, i + 1)); break;
-      case 0x0037: sprintf(buf, "Jump?? %s",     RLABEL(i, i + 1)); break;
-      case 0x0038: sprintf(buf, "Jump?? %s",     RLABEL(i, i + 1)); break;
-      case 0x003D: sprintf(buf, "Jump?? %s",     RLABEL(i, i + 1)); break;
-      case 0x003E: sprintf(buf, "Jump?? %s",     RLABEL(i, i + 1)); break;
-      case 0x0040: sprintf(buf, "Jump?? %s",     RLABEL(i, i + 1)); break;
-      case 0x004E: sprintf(buf, "Add?");                            break;
-      case 0x0051: sprintf(buf, "Cmp?");                            break;
-      case 0x0059: sprintf(buf, "DPushFalse");                      break;
-      case 0x0081: sprintf(buf, "Trampoline %s", RLABEL(i, i + 1)); break;
-
-      case 0x0082: { // JumpMaps
-        disasm_line_(ins, i, 2, "JumpMap {", labels, debug, lineno);
-        int choices = ins[i + 1],
-            base;
-        // Print the fallback choice
-        sprintf(buf, "  %3c => %s", '*', RLABEL(i + 1, i + 2));
-        disasm_line_(ins, i + 2, 1, buf, labels, debug, -1);
-        // Print each choice
-        int j;
-        for (j = 0; j < choices; j++) {
-          base = i + 3 + 2*j;
-          if (base + (int) ins[base + 1]/4 - 1 >= n) break;
-          sprintf(buf, "  %3d => %s", ins[base], RLABEL(base, base + 1));
-          disasm_line_(ins, base, 2, buf, labels, debug, -1);
-        }
-        if (j != choices) { // Check for broken instruction
-          instr.nargs = 0;
-          break;
-        }
-        disasm_line_(ins, i + 3 + 2*choices, 0, "}", labels, debug, -1);
-        // Suppress standard printing
-        buf[0] = 0;
+    long col = disasm_line_begin_(r, labels, debug, i, instr->nargs + 1, lineno);
+
+    switch (instr->op) {
+      case 0x0027: STR("CPushConst $"); render_hex(r, ins[i + 1], 0, '0'); break;
+      case 0x002E: STR("Begin");                                 break;
+      case 0x0030: STR("Return");                                break;
+      case 0x0031: STR("Call ");          TLABEL(target);        break;
+      case 0x0033: STR("Jump ");          TLABEL(target);        break;
+      case 0x0034: STR("Jump?? ");        TLABEL(target);        break;
+      case 0x0035: STR("JumpNE ");        TLABEL(target);        break;
+      case 0x0036: STR("JumpEq ");        TLABEL(target);        break;
+      case 0x0037: STR("Jump?? ");        TLABEL(target);        break;
+      case 0x0038: STR("Jump?? ");        TLABEL(target);        break;
+      case 0x003D: STR("Jump?? ");        TLABEL(target);        break;
+      case 0x003E: STR("Jump?? ");        TLABEL(target);        break;
+      case 0x0040: STR("Jump?? ");        TLABEL(target);        break;
+      case 0x004E: STR("Add?");                                  break;
+      case 0x0051: STR("Cmp?");                                  break;
+      case 0x0059: STR("DPushFalse");                            break;
+      case 0x0081: STR("Trampoline ");    TLABEL(target);        break;
+
+      case 0x0087: {
+        STR("DoCommand? ");   INT((i32) ins[i + 1]);
+        STR(" (");            INT((i32) (ins[i + 2] / 4));
+        STR(" args)");
       } break;
-
-      case 0x0087: sprintf(buf, "DoCommand? %d (%d args)", ins[i + 1], ins[i + 2] / 4); break;
-      case 0x0089: sprintf(buf, "LineNo");                           break;
+      case 0x0089: STR("LineNo");                                break;
 
       case 0x008A: case 0x008E: case 0x0096: {
-        sprintf(buf, "$%02X", instr.op);
-        for (int i = 0; i < instr.nargs; i++) {
-          sprintf(buf + strlen(buf), " %f,", *((float *) &instr.args[i]));
+        render_fmt(r, "$%02X", instr->op);
+        for (int j = 0; j < instr->nargs; j++) {
+          render_fmt(r, j? ", %f" : " %f", *((float *) &ins[i + 1 + j]));
         }
-        buf[strlen(buf) - 1] = 0;
       } break;
 
    // case 0x009B: sprintf(buf, "$9B $%04hx, $%04hx", (u16) ins[i + 1], (u16) ins[i + 2]); break;
-      case 0x00A2: sprintf(buf, "TGetGlobal2 %s",   GLOBAL(vh));     break;
-      case 0x00A3: sprintf(buf, "DGetGlobal %s",    GLOBAL(vh));     break;
-      case 0x00A4: sprintf(buf, "DGetLocal %s",      LOCAL(vh));     break;
-      case 0x00AB: sprintf(buf, "DPushConst %d",           vh );     break;
-      case 0x00AC: sprintf(buf, "CmpConst2 $%04hx",        vh );     break;
-      case 0x00AF: sprintf(buf, "DSetGlobal %s",    GLOBAL(vh));     break;
-      case 0x00B1: sprintf(buf, "DSetLocal %s",      LOCAL(vh));     break;
-      case 0x00BC: sprintf(buf, "CPushConst %d",     (i16) vh );     break;
-      case 0x00BD: sprintf(buf, "CGetGlobal %s",    GLOBAL(vh));     break;
-      case 0x00BE: sprintf(buf, "CGetLocal %s",      LOCAL(vh));     break;
-      case 0x00BF: sprintf(buf, "CAdjustStack %+hd",       vh );     break;
-      case 0x00C8: sprintf(buf, "CmpLocal %s",       LOCAL(vh));     break;
-      case 0x00C9: sprintf(buf, "CmpConst $%04hx",         vh );     break;
-      case 0x00D2: sprintf(buf, "Script Begin");                     break;
+      case 0x00A2: STR("TGetGlobal2 ");   GLOBAL(vh);            break;
+      case 0x00A3: STR("DGetGlobal ");    GLOBAL(vh);            break;
+      case 0x00A4: STR("DGetLocal ");      LOCAL(vh);            break;
+      case 0x00AB: STR("DPushConst ");       INT(vh);            break;
+      case 0x00AC: STR("CmpConst2 $");      HEX4(vh);            break;
+      case 0x00AF: STR("DSetGlobal ");    GLOBAL(vh);            break;
+      case 0x00B1: STR("DSetLocal ");      LOCAL(vh);            break;
+      case 0x00BC: STR("CPushConst ");  INT((i16) vh);           break;
+      case 0x00BD: STR("CGetGlobal ");    GLOBAL(vh);            break;
+      case 0x00BE: STR("CGetLocal ");      LOCAL(vh);            break;
+      case 0x00BF: {
+        STR((i16) vh < 0? "CAdjustStack " : "CAdjustStack +");
+        INT((i16) vh);
+      } break;
+      case 0x00C8: STR("CmpLocal ");       LOCAL(vh);            break;
+      case 0x00C9: STR("CmpConst $");       HEX4(vh);            break;
+      case 0x00D2: STR("Script Begin");                          break;
 
       default:
-        sprintf(buf, "%s$%04hx%s", FMT_UNKNOWN, (u16) (ins[i] & 0xFFFF), FMT_END);
+        render_sgr(r, FMT_UNKNOWN);
+        STR("$");
+        HEX4(ins[i] & 0xFFFF);
+        render_sgr(r, FMT_END);
     }
 
-    // Print the line for this instruction
-    if (buf[0] != 0) {
-      disasm_line_(ins, i, instr.nargs + 1, buf, labels, debug, lineno);
-    }
+    // Finish the line for this instruction
+    disasm_line_end_(r, ins, i, instr->nargs + 1, col);
 
-    #undef LABEL
+    #undef STR
+    #undef INT
+    #undef HEX4
+    #undef TLABEL
     #undef ID
     #undef GLOBAL
     #undef FUNC
@@ -555,18 +542,47 @@ void disassemble(struct code_block *code, struct debug_block *debug) {
   }
 
   //-- Movement
-  printf("\n");
+  if (!whole) goto cleanup;
+  render_char(r, '\n');
   for (int i = 0; i < code->nmovement; i++) {
     u32 v = code->movement[i];
-    printf("  %s%08x%s", format_of(v), v, FMT_END);
+    render_str(r, "  ");
+    render_sgr(r, format_of(v));
+    render_hex(r, v, 8, '0');
+    render_sgr(r, FMT_END);
     if (i % 3 == 2) {
-      printf("                    %s;  %04x%s\n",
-             FMT_COMMENT, (code->ninstrs + i) * 4, FMT_END);
+      render_repeat(r, ' ', 20);
+      render_sgr(r, FMT_COMMENT);
+      render_str(r, ";  ");
+      render_hex(r, (code->ninstrs + i) * 4, 4, '0');
+      render_sgr(r, FMT_END);
+      render_char(r, '\n');
     }
   }
-  printf("\n");
+  render_char(r, '\n');
 
-  // Cleanup
-  free(symbols);
+cleanup:
   free(labels);
+  TIMING_END(span, 0, 0);
+  return 0;
+}
+
+/** Disassembles the given code section `code` and prints to `r`. */
+int render_disassembly(struct render *r, struct code_block *code,
+                        struct debug_block *debug) {
+  return disasm_block_(r, code, debug, 0, UINT32_MAX, 1);
+}
+
+int render_disassembly_range(struct render *r, struct code_block *code,
+                             struct debug_block *debug, u32 start, u32 end) {
+  return disasm_block_(r, code, debug, start, end, 0);
+}
+
+/** Disassembles the given code section `code` and prints to `out`. */
+int disassemble(FILE *out, struct code_block *code, struct debug_block *debug) {
+  struct render r;
+  render_init(&r, out);
+  int res = render_disassembly(&r, code, debug);
+  render_flush(&r);
+  return res;
 }
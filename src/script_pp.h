@@ -1,19 +1,36 @@
 #ifndef SCRIPT_PP_H
 #define SCRIPT_PP_H
 
+#include <stdio.h>
+
+#include "render.h"
 #include "formats/script.h"
 
-/** Prints the given code section `code` to stdout. */
-void print_code(struct code_block *code);
+/** Prints the given code section `code` to `out`. */
+void print_code(FILE *out, struct code_block *code);
 
-/** Prints the given debug section `debug` to stdout. */
-void print_debug(struct debug_block *debug);
+/** Prints the given debug section `debug` to `out`. */
+void print_debug(FILE *out, struct debug_block *debug);
 
-/** Prints the given code section `code` to stdout, using debug info from
+/** Prints the given code section `code` to `out`, using debug info from
  *  `debug` as aid for pretty-printing. */
-void print_debug_code(struct code_block *code, struct debug_block *debug);
+void print_debug_code(FILE *out, struct code_block *code, struct debug_block *debug);
+
+/** Disassembles the given code section `code` and prints to `out`.  Returns
+ *  0, or -1 (having printed nothing) if `code` or `debug` is malformed in a
+ *  way the disassembler can't deal with. */
+int disassemble(FILE *out, struct code_block *code, struct debug_block *debug);
+
+/** Like `print_debug`, but writes to the renderer `r`. */
+void render_debug(struct render *r, struct debug_block *debug);
+
+/** Like `disassemble`, but writes to the renderer `r`. */
+int render_disassembly(struct render *r, struct code_block *code,
+                        struct debug_block *debug);
 
-/** Disassembles the given code section `code` and prints to stdout. */
-void disassemble(struct code_block *code, struct debug_block *debug);
+/** Like `render_disassembly`, but only the instructions at byte addresses
+ *  [start, end), without the header, extra words or movement data. */
+int render_disassembly_range(struct render *r, struct code_block *code,
+                             struct debug_block *debug, u32 start, u32 end);
 
 #endif
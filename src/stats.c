@@ -0,0 +1,344 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "decode.h"
+#include "mapfile.h"
+#include "formats/zonedata.h"
+
+//-- Sketches -------------------------------------------------------
+/** A 64-bit mix (splitmix64's finalizer). */
+u64 stats_hash(u64 x) {
+  x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 27; x *= 0x94D049BB133111EBULL;
+  x ^= x >> 31;
+  return x;
+}
+
+u64 stats_key(u16 op, int slot, u32 value) {
+  return (u64) op << 40 | (u64) slot << 32 | value;
+}
+
+/** Returns the count-min counter of `key` in row `row`. */
+u64 *cm_counter(struct stats *s, int row, u64 key) {
+  u64 h = stats_hash(key + 0x9E3779B97F4A7C15ULL * (row + 1));
+  return &s->cm[row][h & (STATS_CM_WIDTH - 1)];
+}
+
+u64 stats_estimate(const struct stats *s, u16 op, int slot, u32 value) {
+  u64 key = stats_key(op, slot, value), min = UINT64_MAX;
+  for (int row = 0; row < STATS_CM_DEPTH; row++) {
+    u64 c = *cm_counter((struct stats *) s, row, key);
+    if (c < min) min = c;
+  }
+  return min;
+}
+
+void hll_add(u8 *hll, u64 h) {
+  u32 i = h >> (64 - STATS_HLL_BITS);
+  u64 rest = h << STATS_HLL_BITS;
+  u8 rank = rest == 0? 64 - STATS_HLL_BITS + 1 : __builtin_clzll(rest) + 1;
+  if (rank > hll[i]) hll[i] = rank;
+}
+
+double stats_distinct(const struct stats_slot *slot) {
+  const int m = 1 << STATS_HLL_BITS;
+  double sum = 0;
+  int zeros = 0;
+  for (int i = 0; i < m; i++) {
+    sum += ldexp(1, -slot->hll[i]);
+    if (slot->hll[i] == 0) zeros++;
+  }
+  double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  // Small ranges are better estimated by linear counting
+  if (e <= 2.5 * m && zeros > 0) e = m * log((double) m / zeros);
+  return e;
+}
+
+/** Puts `value`, now estimated at `count`, into its place in `top` (sorted
+ *  by count, descending). */
+void top_update(struct stats_top *top, u32 value, u64 count) {
+  int i;
+  for (i = 0; i < STATS_TOP - 1; i++) {
+    if (top[i].count == 0 || top[i].value == value) break;
+  }
+  // Not there, and nowhere free: it replaces the lightest if heavier
+  if (top[i].count != 0 && top[i].value != value && count <= top[i].count) return;
+
+  top[i].value = value;
+  top[i].count = count;
+  // Ties go by value, so the order doesn't depend on the order of updates
+  for (; i > 0 && (top[i].count > top[i - 1].count
+                   || (top[i].count == top[i - 1].count && top[i].value < top[i - 1].value)); i--) {
+    struct stats_top t = top[i];
+    top[i] = top[i - 1];
+    top[i - 1] = t;
+  }
+}
+
+/** Records one occurrence of `value` in operand slot `slot` of opcode `op`. */
+void stats_add_value(struct stats *s, u16 op, int slot, u32 value) {
+  u64 key = stats_key(op, slot, value), min = UINT64_MAX;
+  for (int row = 0; row < STATS_CM_DEPTH; row++) {
+    u64 *c = cm_counter(s, row, key);
+    if (++*c < min) min = *c;
+  }
+  if (op >= 0x100) return;
+
+  struct stats_slot *sl = &s->slots[op][slot];
+  sl->count++;
+  hll_add(sl->hll, stats_hash(value));
+  top_update(sl->top, value, min);
+}
+
+
+//-- Gathering ------------------------------------------------------
+struct stats *stats_new(void) {
+  struct stats *s = calloc(1, sizeof(struct stats));
+  s->magic = STATS_MAGIC;
+  s->version = STATS_VERSION;
+  return s;
+}
+
+/** Returns the bucket of a branch distance of `d` bytes: the number of bits
+ *  it takes. */
+int distance_bucket(u32 d) {
+  int b = d == 0? 0 : 32 - __builtin_clz(d);
+  return b < STATS_BUCKETS? b : STATS_BUCKETS - 1;
+}
+
+void stats_add_code(struct stats *s, struct code_block *code,
+                    enum stats_source source) {
+  u32 *ins = code->instrs;
+  struct code_ir *ir = get_code_ir(code);
+
+  for (int k = 0; k < ir->ninstrs; k++) {
+    struct ir_instr *instr = &ir->instrs[k];
+    u32 i = instr->pos;
+    u16 op = ins[i] & 0xFFFF;
+
+    s->instrs++;
+    s->ops[source][op]++;
+    if (instr->op == -1) s->unknown++;
+    if (instr->flags & (IR_BROKEN | IR_TRUNCATED)) s->broken++;
+
+    // Unknown opcodes get their high half recorded, to tell if it's used
+    if (instr->op == -1 || instr->uses_high_half) stats_add_value(s, op, 0, ins[i] >> 16);
+    if (instr->op == -1 || instr->flags & (IR_BROKEN | IR_TRUNCATED)) continue;
+
+    // JumpMap operands are a table, not operands proper
+    if (instr->op != 0x0082) {
+      for (u32 j = 0; j < instr->nargs && j < STATS_SLOTS - 1; j++) {
+        stats_add_value(s, op, j + 1, ins[i + 1 + j]);
+      }
+    }
+
+    if (instr->flags & IR_BRANCH) {
+      i64 d = 4 * ((i64) instr->target - (i64) i);
+      if (d >= 0) s->forward[distance_bucket(d)]++;
+      else s->backward[distance_bucket(-d)]++;
+    }
+  }
+}
+
+int stats_add_file(struct stats *s, const char *path) {
+  struct mapped_file file;
+  if (map_file(&file, path) < 0) {
+    fprintf(stderr, "Couldn't open '%s' for reading.\n", path);
+    return 2;
+  }
+
+  u32 magic = 0;
+  if (file.size >= sizeof(u32)) memcpy(&magic, file.data, sizeof(u32));
+
+  struct code_block *code = NULL;
+  if (magic == 0x00044F5A) {
+    struct zonedata *zone = parse_zonedata(file.data, file.size);
+    if (zone != NULL) {
+      code = zone->code1;
+      stats_add_code(s, zone->code1, STATS_ZONE);
+      stats_add_code(s, zone->code2, STATS_ZONE);
+      s->files[STATS_ZONE]++;
+    }
+  } else {
+    // The code section of a script
+    size_t start = 0;
+    while (file.size - start >= 2 * sizeof(u32)) {
+      u32 size, section_magic;
+      memcpy(&size,          file.data + start,               sizeof(u32));
+      memcpy(&section_magic, file.data + start + sizeof(u32), sizeof(u32));
+
+      if (section_magic == 0x0A0AF1E0) {
+        code = parse_code_block(file.data + start, file.size - start, NULL);
+        if (code != NULL) {
+          stats_add_code(s, code, STATS_SCRIPT);
+          s->files[STATS_SCRIPT]++;
+        }
+        break;
+      }
+      if (section_magic != 0x0A0AF1EF || size == 0 || size > file.size - start) break;
+      start += size;
+    }
+  }
+
+  if (code == NULL) {
+    fprintf(stderr, "%s: Not a script or zone.\n", path);
+    unmap_file(&file);
+    return 2;
+  }
+
+  // What was parsed goes with the batch worker's arena
+  unmap_file(&file);
+  return 0;
+}
+
+
+//-- Merging --------------------------------------------------------
+void stats_merge(struct stats *into, const struct stats *from) {
+  into->files[0] += from->files[0];
+  into->files[1] += from->files[1];
+  into->instrs   += from->instrs;
+  into->unknown  += from->unknown;
+  into->broken   += from->broken;
+  for (int src = 0; src < 2; src++) {
+    for (int op = 0; op < 0x10000; op++) into->ops[src][op] += from->ops[src][op];
+  }
+  for (int b = 0; b < STATS_BUCKETS; b++) {
+    into->forward[b]  += from->forward[b];
+    into->backward[b] += from->backward[b];
+  }
+  for (int row = 0; row < STATS_CM_DEPTH; row++) {
+    for (int i = 0; i < STATS_CM_WIDTH; i++) into->cm[row][i] += from->cm[row][i];
+  }
+
+  for (int op = 0; op < 0x100; op++) {
+    for (int slot = 0; slot < STATS_SLOTS; slot++) {
+      struct stats_slot *a = &into->slots[op][slot];
+      const struct stats_slot *b = &from->slots[op][slot];
+      if (b->count == 0) continue;
+
+      a->count += b->count;
+      for (int i = 0; i < (1 << STATS_HLL_BITS); i++) {
+        if (b->hll[i] > a->hll[i]) a->hll[i] = b->hll[i];
+      }
+
+      // The heaviest of either side's candidates, re-estimated from the
+      // merged counts
+      struct stats_top old[2 * STATS_TOP];
+      memcpy(old, a->top, sizeof(a->top));
+      memcpy(old + STATS_TOP, b->top, sizeof(b->top));
+      memset(a->top, 0, sizeof(a->top));
+      for (int i = 0; i < 2 * STATS_TOP; i++) {
+        if (old[i].count == 0) continue;
+        top_update(a->top, old[i].value, stats_estimate(into, op, slot, old[i].value));
+      }
+    }
+  }
+}
+
+int stats_save(const struct stats *s, const char *path) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) return -1;
+  int ok = fwrite(s, sizeof(struct stats), 1, f) == 1;
+  return fclose(f) == 0 && ok? 0 : -1;
+}
+
+int stats_load(struct stats *s, const char *path) {
+  struct mapped_file file;
+  if (map_file(&file, path) < 0) return -1;
+
+  const struct stats *saved = (const struct stats *) file.data;
+  int res = -1;
+  if (file.size == sizeof(struct stats) && saved->magic == STATS_MAGIC
+      && saved->version == STATS_VERSION) {
+    stats_merge(s, saved);
+    res = 0;
+  }
+  unmap_file(&file);
+  return res;
+}
+
+
+//-- Report ---------------------------------------------------------
+int op_comparator(const void *a, const void *b) {
+  u64 ca = ((const u64 *) a)[1], cb = ((const u64 *) b)[1];
+  return (ca < cb) - (ca > cb);
+}
+
+/** Writes the line of operand slot `slot` of opcode `op`. */
+void report_slot(FILE *out, const struct stats *s, int op, int slot) {
+  static const char *slot_names[] = { "high", "arg1", "arg2", "arg3" };
+  const struct stats_slot *sl = &s->slots[op][slot];
+
+  fprintf(out, "    %s: %llu, ~%.0f distinct:", slot_names[slot],
+          (unsigned long long) sl->count, stats_distinct(sl));
+  for (int i = 0; i < STATS_TOP && sl->top[i].count > 0; i++) {
+    fprintf(out, slot == 0? " $%04x" : " $%08x", sl->top[i].value);
+    fprintf(out, " (%.1f%%)", 100.0 * sl->top[i].count / sl->count);
+  }
+  fputc('\n', out);
+}
+
+void stats_report(FILE *out, const struct stats *s) {
+  fprintf(out, "files:         %llu scripts, %llu zones\n",
+          (unsigned long long) s->files[STATS_SCRIPT], (unsigned long long) s->files[STATS_ZONE]);
+  fprintf(out, "instructions:  %llu\n", (unsigned long long) s->instrs);
+  fprintf(out, "unknown:       %llu (%.2f%%)\n", (unsigned long long) s->unknown,
+          s->instrs? 100.0 * s->unknown / s->instrs : 0.0);
+  fprintf(out, "broken:        %llu\n", (unsigned long long) s->broken);
+
+  //-- Known opcodes, with their operands
+  fprintf(out, "\n;; Opcodes     scripts     zones\n");
+  for (int op = 0; op < 0x100; op++) {
+    struct instr instr;
+    u32 word[8] = { op };
+    if (!decode(&instr, word)) continue;
+
+    const char *name = ir_op_name(op);
+    u64 n1 = s->ops[STATS_SCRIPT][op], n2 = s->ops[STATS_ZONE][op];
+    fprintf(out, "$%04x %-12s %9llu %9llu%s\n", op, name != NULL? name : "",
+            (unsigned long long) n1, (unsigned long long) n2,
+            n1 + n2 == 0? "  (never used)" : n2 == 0? "  (never in zones)" : n1 == 0? "  (never in scripts)" : "");
+    for (int slot = 0; slot < STATS_SLOTS; slot++) {
+      if (s->slots[op][slot].count > 0) report_slot(out, s, op, slot);
+    }
+  }
+
+  //-- Unknown opcodes, most frequent first
+  u64 (*unknown)[2] = malloc(0x10000 * sizeof(*unknown));
+  int nunknown = 0;
+  for (int op = 0; op < 0x10000; op++) {
+    struct instr instr;
+    u32 word[8] = { op };
+    u64 n = s->ops[STATS_SCRIPT][op] + s->ops[STATS_ZONE][op];
+    if (n == 0 || decode(&instr, word)) continue;
+    unknown[nunknown][0] = op;
+    unknown[nunknown++][1] = n;
+  }
+  qsort(unknown, nunknown, sizeof(*unknown), op_comparator);
+
+  fprintf(out, "\n;; Unknown opcodes (%d)\n", nunknown);
+  for (int k = 0; k < nunknown && k < 32; k++) {
+    int op = unknown[k][0];
+    fprintf(out, "$%04x %-12s %9llu %9llu\n", op, "",
+            (unsigned long long) s->ops[STATS_SCRIPT][op], (unsigned long long) s->ops[STATS_ZONE][op]);
+    if (op < 0x100 && s->slots[op][0].count > 0) report_slot(out, s, op, 0);
+  }
+  if (nunknown > 32) fprintf(out, "... and %d more\n", nunknown - 32);
+  free(unknown);
+
+  //-- Branch distances
+  fprintf(out, "\n;; Branch distances (bytes)   forward  backward\n");
+  for (int b = 0; b < STATS_BUCKETS; b++) {
+    if (s->forward[b] == 0 && s->backward[b] == 0) continue;
+    u32 lo = b == 0? 0 : 1u << (b - 1), hi = b == 0? 0 : (1u << b) - 1;
+    char range[32];
+    if (b == STATS_BUCKETS - 1) sprintf(range, "%u+", lo);
+    else if (lo == hi) sprintf(range, "%u", lo);
+    else sprintf(range, "%u-%u", lo, hi);
+    fprintf(out, "%-28s %9llu %9llu\n", range,
+            (unsigned long long) s->forward[b], (unsigned long long) s->backward[b]);
+  }
+}
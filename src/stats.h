@@ -0,0 +1,93 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+#include "poketools.h"
+#include "formats/script.h"
+
+/** Corpus-wide statistics on opcodes and their operands, gathered in one
+ *  streaming pass in bounded memory: opcodes are counted exactly, while
+ *  operand values go into sketches (a count-min sketch for frequencies, with
+ *  the heaviest values of each operand tracked alongside, and HyperLogLog
+ *  registers for the number of distinct values).  Everything merges, so
+ *  shards can be gathered separately (or on other machines) and combined. */
+
+#define STATS_MAGIC   0x31534B50 // "PKS1"
+#define STATS_VERSION 1
+
+#define STATS_CM_DEPTH 4         // Count-min rows
+#define STATS_CM_WIDTH (1 << 14) // Count-min counters per row
+#define STATS_HLL_BITS 8         // log2 of the HyperLogLog registers
+#define STATS_TOP      8         // Heaviest values tracked per operand
+#define STATS_SLOTS    4         // Operands tracked: high half, 3 words
+#define STATS_BUCKETS  24        // Branch distance buckets (powers of 2)
+
+/** Where code comes from; opcode counts are kept per source. */
+enum stats_source {
+  STATS_SCRIPT,
+  STATS_ZONE,
+};
+
+/** A value and its (estimated) count. */
+struct stats_top {
+  u32 value;
+  u32 unused;
+  u64 count;
+};
+
+/** Statistics on one operand slot of one opcode. */
+struct stats_slot {
+  u64 count;                               // Exact number of values seen
+  u8 hll[1 << STATS_HLL_BITS];
+  struct stats_top top[STATS_TOP];         // Sorted by count, descending
+};
+
+/** Gathered statistics.  This is a fixed-size, pointer-free structure, so
+ *  it can be saved and loaded as it is. */
+struct stats {
+  u32 magic;
+  u32 version;
+  u64 files[2];                            // Per `stats_source`
+  u64 instrs;
+  u64 unknown;                             // `decode` returned -1
+  u64 broken;                              // Broken JumpMaps, truncated operands
+  u64 ops[2][0x10000];                     // Per source, by raw opcode
+  u64 forward[STATS_BUCKETS];              // Branch distances in bytes,
+  u64 backward[STATS_BUCKETS];             //   by power of 2
+  struct stats_slot slots[0x100][STATS_SLOTS]; // Opcodes $00-$ff: high half, then operand words
+  u64 cm[STATS_CM_DEPTH][STATS_CM_WIDTH];  // (opcode, slot, value) frequencies
+};
+
+/** Returns new, empty statistics. */
+struct stats *stats_new(void);
+
+/** Adds the instructions of `code` to `s` (without counting a file). */
+void stats_add_code(struct stats *s, struct code_block *code,
+                    enum stats_source source);
+
+/** Adds the script or zone at `path` to `s`.  Returns 0 on success, or
+ *  nonzero (after reporting why on stderr) if it couldn't be read. */
+int stats_add_file(struct stats *s, const char *path);
+
+/** Merges `from` into `into`. */
+void stats_merge(struct stats *into, const struct stats *from);
+
+/** Returns the estimated number of distinct values seen in `slot`. */
+double stats_distinct(const struct stats_slot *slot);
+
+/** Returns the estimated number of times `value` was seen in operand slot
+ *  `slot` of opcode `op`.  Never an underestimate. */
+u64 stats_estimate(const struct stats *s, u16 op, int slot, u32 value);
+
+/** Saves `s` to the file at `path`.  Returns 0 on success. */
+int stats_save(const struct stats *s, const char *path);
+
+/** Loads the statistics saved at `path`, merging them into `s`.  Returns 0
+ *  on success, or -1 if the file couldn't be read or isn't compatible. */
+int stats_load(struct stats *s, const char *path);
+
+/** Writes a report of `s` to `out`. */
+void stats_report(FILE *out, const struct stats *s);
+
+#endif
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "symmap.h"
+#include "indexfile.h"
+#include "formats/script.h"
+
+// Raw address tables, as streamed from `symmap_tables` to `symmap_build`
+// (see indexfile.h):
+//   'A' u32 nruns, nranges, nfiles, nfunctions, then the runs, the ranges,
+//       and the files and functions as u32 addr, u16 len, name
+#define RAW_ADDRS 'A'
+
+
+//-- Building -------------------------------------------------------
+int symmap_tables(FILE *out, const char *path) {
+  struct mapped_file file;
+  if (map_file(&file, path) < 0) {
+    fprintf(stderr, "Couldn't open '%s' for reading.\n", path);
+    return 2;
+  }
+
+  // Only the debug section is parsed; zones have none
+  u32 magic = 0;
+  if (file.size >= sizeof(u32)) memcpy(&magic, file.data, sizeof(u32));
+  struct debug_block *debug = NULL;
+  size_t start = 0;
+  while (magic != 0x00044F5A && file.size - start >= 2 * sizeof(u32)) {
+    u32 size, section_magic;
+    memcpy(&size,          file.data + start,               sizeof(u32));
+    memcpy(&section_magic, file.data + start + sizeof(u32), sizeof(u32));
+
+    size_t n = file.size - start;
+    if (section_magic == 0x0A0AF1EF) {
+      debug = parse_debug_block(file.data + start, n, NULL);
+      break;
+    }
+    if (section_magic != 0x0A0AF1E0 || size == 0 || size > n) break;
+    start += size;
+  }
+  if (debug == NULL) {
+    unmap_file(&file);
+    return 0;
+  }
+
+  struct debug_addrs *a = get_debug_addrs(debug);
+  u32 counts[4] = { a->nruns, a->nranges, debug->nfiles, a->nfunctions };
+  fputc(RAW_FILE, out);
+  raw_string(out, path);
+  fputc(RAW_ADDRS, out);
+  fwrite(counts, sizeof(u32), 4, out);
+  fwrite(a->runs, sizeof(struct addr_run), a->nruns, out);
+  fwrite(a->ranges, sizeof(struct addr_range), a->nranges, out);
+  for (int i = 0; i < debug->nfiles; i++) {
+    fwrite(&debug->files[i].start, sizeof(u32), 1, out);
+    raw_string(out, debug->files[i].name);
+  }
+  for (int i = 0; i < a->nfunctions; i++) {
+    fwrite(&a->functions[i]->id, sizeof(u32), 1, out);
+    raw_string(out, a->functions[i]->name);
+  }
+
+  unmap_file(&file);
+  return 0;
+}
+
+/** Reads `n` raw names (u32 addr, u16 len, name) from `in` into `names`,
+ *  with their strings in `strings`.  Returns 0, or -1 if they are cut
+ *  short. */
+int read_raw_names(FILE *in, u32 n, struct index_buf *names,
+                   struct index_buf *strings) {
+  for (u32 i = 0; i < n; i++) {
+    struct symmap_name name;
+    long off;
+    if (fread(&name.addr, sizeof(u32), 1, in) != 1 || (off = read_raw_string(in, strings)) < 0) return -1;
+    name.name = off;
+    buf_put(names, &name, sizeof(name));
+  }
+  return 0;
+}
+
+const char *symmap_sort_strings; // For `symmap_script_comparator`
+
+int symmap_script_comparator(const void *s1, const void *s2) {
+  return strcmp(symmap_sort_strings + ((const struct symmap_script *) s1)->path,
+                symmap_sort_strings + ((const struct symmap_script *) s2)->path);
+}
+
+int symmap_build(FILE *in, const char *path) {
+  struct index_buf strings = { 0 }, scripts = { 0 }, runs = { 0 }, ranges = { 0 },
+                    files = { 0 }, functions = { 0 };
+  buf_put(&strings, "", 1); // Offset 0 is never a real string
+
+  //-- Read each script's tables, after the others'
+  int type;
+  long path_off = -1;
+  while ((type = fgetc(in)) != EOF) {
+    if (type == RAW_FILE) {
+      if ((path_off = read_raw_string(in, &strings)) < 0) break;
+      continue;
+    }
+
+    u32 counts[4];
+    if (type != RAW_ADDRS || path_off < 0 || fread(counts, sizeof(u32), 4, in) != 4) break;
+    struct symmap_script s = {
+      .path           = path_off,
+      .first_run      = runs.len / sizeof(struct addr_run),           .nruns      = counts[0],
+      .first_range    = ranges.len / sizeof(struct addr_range),       .nranges    = counts[1],
+      .first_file     = files.len / sizeof(struct symmap_name),       .nfiles     = counts[2],
+      .first_function = functions.len / sizeof(struct symmap_name),   .nfunctions = counts[3],
+    };
+    if (read_raw_bytes(in, sizeof(struct addr_run) * (size_t) counts[0], &runs) < 0
+        || read_raw_bytes(in, sizeof(struct addr_range) * (size_t) counts[1], &ranges) < 0
+        || read_raw_names(in, counts[2], &files, &strings) < 0
+        || read_raw_names(in, counts[3], &functions, &strings) < 0) break;
+    buf_put(&scripts, &s, sizeof(s));
+    path_off = -1;
+  }
+
+  // By path, for lookups
+  u32 nscripts = scripts.len / sizeof(struct symmap_script);
+  symmap_sort_strings = (const char *) strings.p;
+  qsort(scripts.p, nscripts, sizeof(struct symmap_script), symmap_script_comparator);
+
+  //-- Write the file
+  struct index_writer w;
+  int res = -1;
+  if (index_begin(&w, path, sizeof(struct symmap_header)) == 0) {
+    struct symmap_header hd = {
+      .magic        = SYMMAP_MAGIC,
+      .version      = SYMMAP_VERSION,
+      .nscripts     = nscripts,
+      .nruns        = runs.len / sizeof(struct addr_run),
+      .nranges      = ranges.len / sizeof(struct addr_range),
+      .nfiles       = files.len / sizeof(struct symmap_name),
+      .nfunctions   = functions.len / sizeof(struct symmap_name),
+      .strings_size = strings.len,
+    };
+    hd.scripts_off   = index_section(&w, scripts.p, scripts.len);
+    hd.runs_off      = index_section(&w, runs.p, runs.len);
+    hd.ranges_off    = index_section(&w, ranges.p, ranges.len);
+    hd.files_off     = index_section(&w, files.p, files.len);
+    hd.functions_off = index_section(&w, functions.p, functions.len);
+    hd.strings_off   = index_section(&w, strings.p, strings.len);
+    res = index_end(&w, &hd, sizeof(hd));
+  }
+
+  // Cleanup
+  free(strings.p);
+  free(scripts.p);
+  free(runs.p);
+  free(ranges.p);
+  free(files.p);
+  free(functions.p);
+
+  return res;
+}
+
+
+//-- Querying -------------------------------------------------------
+int symmap_open(struct corpus_symmap *m, const char *path) {
+  if (map_file(&m->map, path) < 0) return -1;
+
+  const struct symmap_header *hd = (const struct symmap_header *) m->map.data;
+  size_t size = m->map.size;
+  if (size < sizeof(struct symmap_header) || hd->magic != SYMMAP_MAGIC
+      || hd->version != SYMMAP_VERSION
+      || hd->scripts_off + (u64) hd->nscripts * sizeof(struct symmap_script) > size
+      || hd->runs_off + (u64) hd->nruns * sizeof(struct addr_run) > size
+      || hd->ranges_off + (u64) hd->nranges * sizeof(struct addr_range) > size
+      || hd->files_off + (u64) hd->nfiles * sizeof(struct symmap_name) > size
+      || hd->functions_off + (u64) hd->nfunctions * sizeof(struct symmap_name) > size
+      || hd->strings_off + hd->strings_size > size
+      || hd->strings_size == 0 || m->map.data[hd->strings_off + hd->strings_size - 1] != 0) {
+    unmap_file(&m->map);
+    return -1;
+  }
+
+  // Every script's slices must lie within the tables
+  const struct symmap_script *scripts = (const struct symmap_script *) (m->map.data + hd->scripts_off);
+  int ok = 1;
+  for (u32 i = 0; ok && i < hd->nscripts; i++) {
+    const struct symmap_script *s = &scripts[i];
+    ok = s->path < hd->strings_size
+         && s->first_run + (u64) s->nruns <= hd->nruns
+         && s->first_range + (u64) s->nranges <= hd->nranges
+         && s->first_file + (u64) s->nfiles <= hd->nfiles
+         && s->first_function + (u64) s->nfunctions <= hd->nfunctions;
+  }
+  if (!ok) {
+    unmap_file(&m->map);
+    return -1;
+  }
+
+  m->header    = hd;
+  m->scripts   = scripts;
+  m->runs      = (const struct addr_run *) (m->map.data + hd->runs_off);
+  m->ranges    = (const struct addr_range *) (m->map.data + hd->ranges_off);
+  m->files     = (const struct symmap_name *) (m->map.data + hd->files_off);
+  m->functions = (const struct symmap_name *) (m->map.data + hd->functions_off);
+  m->strings   = (const char *) (m->map.data + hd->strings_off);
+  return 0;
+}
+
+void symmap_close(struct corpus_symmap *m) {
+  unmap_file(&m->map);
+}
+
+const struct symmap_script *symmap_script(const struct corpus_symmap *m,
+                                          const char *path) {
+  u32 lo = 0, hi = m->header->nscripts;
+  while (lo < hi) {
+    u32 mid = (lo + hi) / 2;
+    int c = strcmp(symmap_string(m, m->scripts[mid].path), path);
+    if (c == 0) return &m->scripts[mid];
+    if (c < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return NULL;
+}
+
+const struct addr_run *symmap_addr(const struct corpus_symmap *m,
+                                   const struct symmap_script *s, u32 addr) {
+  return addr_find_run(m->runs + s->first_run, s->nruns, addr);
+}
+
+const struct addr_range *symmap_line(const struct corpus_symmap *m,
+                                     const struct symmap_script *s,
+                                     i32 file, i32 line, int *count) {
+  return addr_find_ranges(m->ranges + s->first_range, s->nranges, file, line, count);
+}
+
+const struct symmap_name *symmap_file(const struct corpus_symmap *m,
+                                      const struct symmap_script *s, i32 i) {
+  return i >= 0 && (u32) i < s->nfiles? &m->files[s->first_file + i] : NULL;
+}
+
+const struct symmap_name *symmap_function(const struct corpus_symmap *m,
+                                          const struct symmap_script *s, i32 i) {
+  return i >= 0 && (u32) i < s->nfunctions? &m->functions[s->first_function + i] : NULL;
+}
+
+i32 symmap_find_file(const struct corpus_symmap *m,
+                     const struct symmap_script *s, const char *name) {
+  for (u32 i = 0; i < s->nfiles; i++) {
+    if (strcmp(symmap_string(m, m->files[s->first_file + i].name), name) == 0) return i;
+  }
+  return -1;
+}
+
+const char *symmap_string(const struct corpus_symmap *m, u32 n) {
+  return n < m->header->strings_size? m->strings + n : "";
+}
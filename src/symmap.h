@@ -0,0 +1,107 @@
+#ifndef SYMMAP_H
+#define SYMMAP_H
+
+#include <stdio.h>
+
+#include "poketools.h"
+#include "addrmap.h"
+#include "mapfile.h"
+
+/** The address tables (see addrmap.h) of every script of a corpus, in one
+ *  file that is mapped as it is: symbolizing an address takes a binary
+ *  search for the script and one for the address, with nothing to parse.
+ *
+ *    header | scripts | runs | ranges | files | functions | strings
+ *
+ *  Scripts are sorted by path.  Each has a slice of each table; the file
+ *  and function numbers in its runs and ranges are indices into its own
+ *  slices. */
+
+#define SYMMAP_MAGIC   0x314D5350 // "PSM1"
+#define SYMMAP_VERSION 1
+
+struct symmap_header {
+  u32 magic;
+  u32 version;
+  u32 nscripts;
+  u32 nruns;
+  u32 nranges;
+  u32 nfiles;
+  u32 nfunctions;
+  u32 strings_size;
+  u64 scripts_off, runs_off, ranges_off, files_off, functions_off, strings_off;
+};
+
+struct symmap_script {
+  u32 path;           // Offset of the path in the strings
+  u32 first_run, nruns;
+  u32 first_range, nranges;
+  u32 first_file, nfiles;
+  u32 first_function, nfunctions;
+};
+
+/** A file or function: where it starts, and its name. */
+struct symmap_name {
+  u32 addr;
+  u32 name;           // Offset in the strings
+};
+
+/** A mapped symbol map. */
+struct corpus_symmap {
+  struct mapped_file map;
+  const struct symmap_header *header;
+  const struct symmap_script *scripts;
+  const struct addr_run *runs;
+  const struct addr_range *ranges;
+  const struct symmap_name *files;
+  const struct symmap_name *functions;
+  const char *strings;
+};
+
+//-- Building -------------------------------------------------------
+/** Writes the raw address tables of the script at `path` to `out` (a
+ *  `batch_fn`); zones and scripts without debug info have none.  Returns 0
+ *  on success, or nonzero if the file couldn't be read. */
+int symmap_tables(FILE *out, const char *path);
+
+/** Builds the symbol map at `path` from the raw address tables of any
+ *  number of scripts, read from `in`.  Returns 0 on success, or -1 if it
+ *  couldn't be written. */
+int symmap_build(FILE *in, const char *path);
+
+//-- Querying -------------------------------------------------------
+/** Maps the symbol map at `path`.  Returns 0 on success, or -1 if it
+ *  couldn't be read or isn't one. */
+int symmap_open(struct corpus_symmap *m, const char *path);
+
+void symmap_close(struct corpus_symmap *m);
+
+/** Returns the script at `path` in `m`, or NULL. */
+const struct symmap_script *symmap_script(const struct corpus_symmap *m,
+                                          const char *path);
+
+/** Returns the run of script `s` that covers byte address `addr`, or NULL. */
+const struct addr_run *symmap_addr(const struct corpus_symmap *m,
+                                   const struct symmap_script *s, u32 addr);
+
+/** Returns the first of the ranges of line `line` of file `file` of script
+ *  `s`, storing how many there are in `*count`; NULL if there are none. */
+const struct addr_range *symmap_line(const struct corpus_symmap *m,
+                                     const struct symmap_script *s,
+                                     i32 file, i32 line, int *count);
+
+/** Returns file or function `i` of script `s` (an index as found in its
+ *  runs and ranges), or NULL if it is -1. */
+const struct symmap_name *symmap_file(const struct corpus_symmap *m,
+                                      const struct symmap_script *s, i32 i);
+const struct symmap_name *symmap_function(const struct corpus_symmap *m,
+                                          const struct symmap_script *s, i32 i);
+
+/** Returns the file of script `s` called `name`, or -1. */
+i32 symmap_find_file(const struct corpus_symmap *m,
+                     const struct symmap_script *s, const char *name);
+
+/** Returns the name `n` (or the path of a script). */
+const char *symmap_string(const struct corpus_symmap *m, u32 n);
+
+#endif
@@ -0,0 +1,221 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "timings.h"
+
+int timings_enabled = 0;
+__thread struct timings timings_thread;
+__thread enum timing_phase timings_phase = PHASE_OTHER;
+
+// When the current phase (and file) last started or resumed
+__thread u64 phase_wall, phase_cpu, file_wall, file_cpu;
+
+/** One file's counters, for the report. */
+struct timing_file {
+  char *path;
+  u64 wall_ns, cpu_ns;
+  struct timings t;
+};
+
+pthread_mutex_t timings_lock = PTHREAD_MUTEX_INITIALIZER;
+struct timing_file *timing_files = NULL;
+int ntiming_files = 0, cap_timing_files = 0;
+struct timings timings_total;
+
+const char *phase_names[NPHASES] = {
+  "io", "decompress", "debug", "sort", "decode", "labels", "print", "other",
+};
+
+u64 clock_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (u64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//-- Phases ---------------------------------------------------------
+/** Charges the time since the last switch to the current phase. */
+void timing_switch(enum timing_phase next) {
+  u64 wall = clock_ns(CLOCK_MONOTONIC),
+      cpu  = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+  if (timings_phase != PHASE_OTHER) {
+    timings_thread.phases[timings_phase].wall_ns += wall - phase_wall;
+    timings_thread.phases[timings_phase].cpu_ns  += cpu - phase_cpu;
+  }
+  timings_phase = next;
+  phase_wall = wall;
+  phase_cpu = cpu;
+}
+
+void timing_begin(struct timing_span *s, enum timing_phase phase) {
+  s->prev = timings_phase;
+  timing_switch(phase);
+}
+
+void timing_end(struct timing_span *s, u64 bytes_in, u64 bytes_out) {
+  struct timing_counters *c = &timings_thread.phases[timings_phase];
+  c->calls++;
+  c->bytes_in += bytes_in;
+  c->bytes_out += bytes_out;
+  timing_switch(s->prev);
+}
+
+
+//-- Files ----------------------------------------------------------
+void timings_add(struct timings *into, const struct timings *from) {
+  for (int p = 0; p < NPHASES; p++) {
+    struct timing_counters *a = &into->phases[p];
+    const struct timing_counters *b = &from->phases[p];
+    a->wall_ns     += b->wall_ns;
+    a->cpu_ns      += b->cpu_ns;
+    a->calls       += b->calls;
+    a->bytes_in    += b->bytes_in;
+    a->bytes_out   += b->bytes_out;
+    a->allocs      += b->allocs;
+    a->alloc_bytes += b->alloc_bytes;
+  }
+  into->instrs  += from->instrs;
+  into->lookups += from->lookups;
+}
+
+void timings_file_begin(void) {
+  if (!timings_enabled) return;
+  memset(&timings_thread, 0, sizeof(struct timings));
+  file_wall = clock_ns(CLOCK_MONOTONIC);
+  file_cpu  = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void timings_file_end(const char *path) {
+  if (!timings_enabled) return;
+  struct timing_file f = {
+    .path    = strdup(path),
+    .wall_ns = clock_ns(CLOCK_MONOTONIC) - file_wall,
+    .cpu_ns  = clock_ns(CLOCK_THREAD_CPUTIME_ID) - file_cpu,
+    .t       = timings_thread,
+  };
+
+  pthread_mutex_lock(&timings_lock);
+  if (ntiming_files == cap_timing_files) {
+    cap_timing_files = cap_timing_files? 2 * cap_timing_files : 64;
+    timing_files = realloc(timing_files, sizeof(struct timing_file) * cap_timing_files);
+  }
+  timing_files[ntiming_files++] = f;
+  timings_add(&timings_total, &timings_thread);
+  pthread_mutex_unlock(&timings_lock);
+
+  memset(&timings_thread, 0, sizeof(struct timings));
+}
+
+
+//-- Report ---------------------------------------------------------
+int wall_comparator(const void *a_, const void *b_) {
+  const struct timing_file *a = a_, *b = b_;
+  return (a->wall_ns < b->wall_ns) - (a->wall_ns > b->wall_ns);
+}
+
+void report_text(FILE *out, const struct timings *t) {
+  fprintf(out, "\n%-12s %10s %10s %9s %10s %10s %9s %10s\n", "phase", "wall ms",
+          "cpu ms", "calls", "MB in", "MB out", "allocs", "MB alloc");
+  struct timing_counters sum = { 0 };
+  for (int p = 0; p < NPHASES; p++) {
+    const struct timing_counters *c = &t->phases[p];
+    fprintf(out, "%-12s %10.2f %10.2f %9llu %10.2f %10.2f %9llu %10.2f\n", phase_names[p],
+            c->wall_ns / 1e6, c->cpu_ns / 1e6, (unsigned long long) c->calls,
+            c->bytes_in / 1e6, c->bytes_out / 1e6, (unsigned long long) c->allocs,
+            c->alloc_bytes / 1e6);
+    sum.wall_ns += c->wall_ns;
+    sum.cpu_ns += c->cpu_ns;
+    sum.allocs += c->allocs;
+    sum.alloc_bytes += c->alloc_bytes;
+  }
+  fprintf(out, "%-12s %10.2f %10.2f %9s %10s %10s %9llu %10.2f\n", "total",
+          sum.wall_ns / 1e6, sum.cpu_ns / 1e6, "", "", "", (unsigned long long) sum.allocs,
+          sum.alloc_bytes / 1e6);
+  fprintf(out, "\n%llu instructions decoded, %llu lookup_sym calls\n",
+          (unsigned long long) t->instrs, (unsigned long long) t->lookups);
+
+  // The slowest files
+  if (ntiming_files == 0) return;
+  struct timing_file *files = malloc(sizeof(struct timing_file) * ntiming_files);
+  memcpy(files, timing_files, sizeof(struct timing_file) * ntiming_files);
+  qsort(files, ntiming_files, sizeof(struct timing_file), wall_comparator);
+
+  int n = ntiming_files < 10? ntiming_files : 10;
+  fprintf(out, "\n%d files; the %d slowest:\n%10s %10s %10s  %s\n", ntiming_files, n,
+          "wall ms", "cpu ms", "instrs", "path");
+  for (int i = 0; i < n; i++) {
+    fprintf(out, "%10.2f %10.2f %10llu  %s\n", files[i].wall_ns / 1e6, files[i].cpu_ns / 1e6,
+            (unsigned long long) files[i].t.instrs, files[i].path);
+  }
+  free(files);
+}
+
+void json_counters(FILE *out, const struct timing_counters *c) {
+  fprintf(out, "{\"wall_ns\":%llu,\"cpu_ns\":%llu,\"calls\":%llu,\"bytes_in\":%llu,"
+               "\"bytes_out\":%llu,\"allocs\":%llu,\"alloc_bytes\":%llu}",
+          (unsigned long long) c->wall_ns, (unsigned long long) c->cpu_ns,
+          (unsigned long long) c->calls, (unsigned long long) c->bytes_in,
+          (unsigned long long) c->bytes_out, (unsigned long long) c->allocs,
+          (unsigned long long) c->alloc_bytes);
+}
+
+void json_timings(FILE *out, const struct timings *t) {
+  fprintf(out, "\"phases\":{");
+  for (int p = 0; p < NPHASES; p++) {
+    fprintf(out, "%s\"%s\":", p? "," : "", phase_names[p]);
+    json_counters(out, &t->phases[p]);
+  }
+  fprintf(out, "},\"instrs\":%llu,\"lookups\":%llu",
+          (unsigned long long) t->instrs, (unsigned long long) t->lookups);
+}
+
+void report_json(FILE *out, const struct timings *t) {
+  fputc('{', out);
+  json_timings(out, t);
+  fprintf(out, ",\"files\":[");
+  for (int i = 0; i < ntiming_files; i++) {
+    struct timing_file *f = &timing_files[i];
+    fprintf(out, "%s\n{\"path\":\"", i? "," : "");
+    for (const char *s = f->path; *s; s++) {
+      if (*s == '"' || *s == '\\') fprintf(out, "\\%c", *s);
+      else if ((unsigned char) *s < 0x20) fprintf(out, "\\u%04x", *s);
+      else fputc(*s, out);
+    }
+    fprintf(out, "\",\"wall_ns\":%llu,\"cpu_ns\":%llu,",
+            (unsigned long long) f->wall_ns, (unsigned long long) f->cpu_ns);
+    json_timings(out, &f->t);
+    fputc('}', out);
+  }
+  fprintf(out, "]}\n");
+}
+
+void timings_report(void) {
+  // Whatever the main thread did outside of files counts too
+  struct timings t = timings_total;
+  timings_add(&t, &timings_thread);
+
+  if (timings_enabled == TIMINGS_JSON) report_json(stderr, &t);
+  else report_text(stderr, &t);
+
+  for (int i = 0; i < ntiming_files; i++) free(timing_files[i].path);
+  free(timing_files);
+}
+
+int timings_parse_args(int argc, char *argv[]) {
+  int k = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--timings") == 0) timings_enabled = TIMINGS_TEXT;
+    else if (strcmp(argv[i], "--timings=json") == 0) timings_enabled = TIMINGS_JSON;
+    else argv[k++] = argv[i];
+  }
+  argv[k] = NULL;
+
+  static int registered = 0;
+  if (timings_enabled && !registered) {
+    atexit(timings_report);
+    registered = 1;
+  }
+  return k;
+}
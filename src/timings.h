@@ -0,0 +1,86 @@
+#ifndef TIMINGS_H
+#define TIMINGS_H
+
+#include "poketools.h"
+
+/** Opt-in instrumentation: with `--timings`, each phase of the work records
+ *  wall and CPU time, bytes in and out, and allocations, per file and in
+ *  total, and a report goes to stderr at exit.  Time is exclusive: a phase
+ *  entered while another is running (say, the IR being built while
+ *  printing) pauses the outer one.  Disabled, every hook is a single
+ *  predictable branch.
+ *
+ *  Files are mapped, not read, so most of the cost of actually reading them
+ *  shows up as page faults in whatever phase touches the data first. */
+
+enum timing_phase {
+  PHASE_IO,           // Mapping files
+  PHASE_DECOMPRESS,   // Decompressing code sections
+  PHASE_DEBUG,        // Parsing debug sections
+  PHASE_SORT,         // Sorting and indexing symbols
+  PHASE_DECODE,       // Decoding instructions into the IR
+  PHASE_LABELS,       // Assigning labels
+  PHASE_PRINT,        // Rendering output
+  PHASE_OTHER,        // Everything else (allocations only)
+  NPHASES,
+};
+
+struct timing_counters {
+  u64 wall_ns, cpu_ns;
+  u64 calls;
+  u64 bytes_in, bytes_out;
+  u64 allocs, alloc_bytes;
+};
+
+struct timings {
+  struct timing_counters phases[NPHASES];
+  u64 instrs;         // Instructions decoded
+  u64 lookups;        // `lookup_sym` calls
+};
+
+/** An entered phase, to be left with `timing_end`. */
+struct timing_span {
+  enum timing_phase prev;
+};
+
+#define TIMINGS_TEXT 1
+#define TIMINGS_JSON 2
+
+/** Whether (and how) to report; set by `--timings`. */
+extern int timings_enabled;
+
+/** The calling thread's counters for the file it is working on. */
+extern __thread struct timings timings_thread;
+extern __thread enum timing_phase timings_phase;
+
+/** Removes `--timings[=json]` from the command line, applying it.  Returns
+ *  the new `argc`. */
+int timings_parse_args(int argc, char *argv[]);
+
+void timing_begin(struct timing_span *s, enum timing_phase phase);
+void timing_end(struct timing_span *s, u64 bytes_in, u64 bytes_out);
+
+/** Brackets the work on one file on the calling thread, adding its counters
+ *  to the report under `path`. */
+void timings_file_begin(void);
+void timings_file_end(const char *path);
+
+#define TIMING_BEGIN(span, phase) \
+  struct timing_span span; \
+  if (__builtin_expect(timings_enabled, 0)) timing_begin(&span, phase)
+
+#define TIMING_END(span, in, out) \
+  if (__builtin_expect(timings_enabled, 0)) timing_end(&span, in, out)
+
+/** Adds `n` to the counter `field` of the calling thread. */
+#define TIMING_COUNT(field, n) \
+  if (__builtin_expect(timings_enabled, 0)) timings_thread.field += (n)
+
+/** Counts an allocation of `n` bytes against the current phase. */
+#define TIMING_ALLOC(n) \
+  if (__builtin_expect(timings_enabled, 0)) { \
+    timings_thread.phases[timings_phase].allocs++; \
+    timings_thread.phases[timings_phase].alloc_bytes += (n); \
+  }
+
+#endif
@@ -0,0 +1,370 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+#include "decode.h"
+
+/** What an operation does. */
+enum vm_kind {
+  OP_NOP,
+  OP_PUSH,             // a: value
+  OP_GET_GLOBAL,       // a: ID
+  OP_SET_GLOBAL,
+  OP_GET_LOCAL,        // a: slot
+  OP_SET_LOCAL,
+  OP_ADD,
+  OP_CMP,
+  OP_CMP_CONST,        // a: value
+  OP_JUMP,             // a: target
+  OP_JUMP_IF,
+  OP_JUMP_UNLESS,
+  OP_JUMPMAP,          // a: offset in `cases` (fallback target first), b: choices
+  OP_CALL,             // a: target
+  OP_RETURN,
+  OP_ADJUST,           // a: words to push (or drop, if negative)
+  OP_COMMAND,          // a: command, b: number of arguments
+  OP_TRAP,             // a: index in `vm_trap_messages`
+  NKINDS,
+};
+
+const char *vm_trap_messages[] = {
+  "unknown opcode",
+  "broken JumpMap",
+  "ran off the end of the code",
+  "jump to where no instruction starts",
+  "local out of range",
+};
+
+//-- Decoding -------------------------------------------------------
+/** Returns the operation index of the instruction at word `target`, or
+ *  adds a trap for the branch at word `pos` going nowhere. */
+i32 vm_target(struct vm *vm, i32 target, u32 pos) {
+  int n = vm->code->ninstrs;
+  if (target >= 0 && target < n && vm->op_at[target] >= 0) return vm->op_at[target];
+
+  int k = vm->nops + 1 + vm->ntraps++;
+  vm->ops[k] = (struct vm_op) { NULL, OP_TRAP, 3, 0, pos };
+  return k;
+}
+
+int vm_init(struct vm *vm, struct code_block *code) {
+  memset(vm, 0, sizeof(struct vm));
+  u32 *ins = code->instrs;
+  int n = code->ninstrs;
+  struct code_ir *ir = get_code_ir(code);
+
+  vm->code = code;
+  vm->nops = ir->ninstrs;
+  // Room for a trap per branch target, after the end-of-code one
+  vm->ops = malloc(sizeof(struct vm_op) * (2 * ir->ninstrs + ir->ntargets + 1));
+  vm->cases = malloc(sizeof(i32) * (2 * ir->ntargets + 1));
+  vm->op_at = malloc(sizeof(int) * (n + 1));
+  vm->globals = calloc(VM_GLOBALS, sizeof(i32));
+  vm->frames = malloc(sizeof(struct vm_frame) * VM_FRAMES);
+
+  for (int i = 0; i <= n; i++) vm->op_at[i] = -1;
+  for (int k = 0; k < ir->ninstrs; k++) vm->op_at[ir->instrs[k].pos] = k;
+
+  int ncases = 0;
+  for (int k = 0; k < ir->ninstrs; k++) {
+    struct ir_instr *instr = &ir->instrs[k];
+    u32 i = instr->pos;
+    u16 hh = instr->high_half;
+    struct vm_op *op = &vm->ops[k];
+    *op = (struct vm_op) { NULL, OP_NOP, 0, 0, i };
+
+    switch (instr->op) {
+      case -1:     op->kind = OP_TRAP;                               break;
+      case 0x0027: op->kind = OP_PUSH;       op->a = ins[i + 1];     break;
+      case 0x00BC: op->kind = OP_PUSH;       op->a = (i16) hh;       break;
+      case 0x00AB: op->kind = OP_PUSH;       op->a = hh;             break;
+      case 0x0059: op->kind = OP_PUSH;       op->a = 0;              break;
+      case 0x00A2: case 0x00A3: case 0x00BD:
+                   op->kind = OP_GET_GLOBAL; op->a = hh;             break;
+      case 0x00AF: op->kind = OP_SET_GLOBAL; op->a = hh;             break;
+      case 0x00A4: case 0x00BE:
+                   op->kind = OP_GET_LOCAL;  op->a = hh >> 2;        break;
+      case 0x00B1: op->kind = OP_SET_LOCAL;  op->a = hh >> 2;        break;
+      case 0x004E: op->kind = OP_ADD;                                break;
+      case 0x0051: op->kind = OP_CMP;                                break;
+      case 0x00AC: case 0x00C9:
+                   op->kind = OP_CMP_CONST;  op->a = hh;             break;
+      case 0x0030: op->kind = OP_RETURN;                             break;
+      case 0x00BF: op->kind = OP_ADJUST;     op->a = (i16) hh / 4;   break;
+      case 0x0087: op->kind = OP_COMMAND;    op->a = ins[i + 1];
+                                             op->b = ins[i + 2] / 4; break;
+
+      case 0x0031: op->kind = OP_CALL;        op->a = vm_target(vm, instr->target, i); break;
+      case 0x0033: case 0x0081:
+                   op->kind = OP_JUMP;        op->a = vm_target(vm, instr->target, i); break;
+      case 0x0035: op->kind = OP_JUMP_UNLESS; op->a = vm_target(vm, instr->target, i); break;
+      case 0x0036: case 0x0037: case 0x0038: case 0x003D: case 0x003E:
+      case 0x0040:
+                   op->kind = OP_JUMP_IF;     op->a = vm_target(vm, instr->target, i); break;
+
+      case 0x0082: {
+        if (instr->flags & IR_BROKEN || instr->ntargets == 0) {
+          op->kind = OP_TRAP;
+          op->a = 1;
+          break;
+        }
+        op->kind = OP_JUMPMAP;
+        op->a = ncases;
+        op->b = instr->ntargets - 1;
+        vm->cases[ncases++] = vm_target(vm, ir->targets[instr->target], i);
+        for (int j = 0; j < op->b; j++) {
+          vm->cases[ncases++] = ins[i + 3 + 2*j];
+          vm->cases[ncases++] = vm_target(vm, ir->targets[instr->target + 1 + j], i);
+        }
+      } break;
+    }
+
+    // Frames only have so many locals
+    if ((op->kind == OP_GET_LOCAL || op->kind == OP_SET_LOCAL) && op->a >= VM_LOCALS) {
+      op->kind = OP_TRAP;
+      op->a = 4;
+    }
+  }
+
+  // Running off the end
+  vm->ops[vm->nops] = (struct vm_op) { NULL, OP_TRAP, 2, 0, n };
+  return 0;
+}
+
+void vm_free(struct vm *vm) {
+  free(vm->ops);
+  free(vm->cases);
+  free(vm->op_at);
+  free(vm->globals);
+  free(vm->frames);
+}
+
+void vm_register(struct vm *vm, i32 cmd, vm_native *fn) {
+  if (cmd < 0) vm->fallback = fn;
+  else if (cmd < VM_NATIVES) vm->natives[cmd] = fn;
+}
+
+int vm_call(struct vm *vm, u32 addr) {
+  u32 word = addr / 4;
+  if (addr % 4 != 0 || word >= (u32) vm->code->ninstrs || vm->op_at[word] < 0) return -1;
+
+  vm->sp = 0;
+  vm->nframes = 1;
+  memset(&vm->frames[0], 0, sizeof(struct vm_frame));
+  vm->frames[0].ret = vm->nops;
+  vm->flag = 0;
+  vm->pc = vm->op_at[word];
+  vm->error = NULL;
+  return 0;
+}
+
+int vm_push(struct vm *vm, i32 v) {
+  if (vm->sp == VM_STACK) return -1;
+  vm->stack[vm->sp++] = v;
+  return 0;
+}
+
+int vm_pop(struct vm *vm, i32 *v) {
+  if (vm->sp == 0) {
+    *v = 0;
+    return -1;
+  }
+  *v = vm->stack[--vm->sp];
+  return 0;
+}
+
+
+//-- Running --------------------------------------------------------
+enum vm_status vm_run(struct vm *vm, u64 max_steps) {
+  static const void *const handlers[NKINDS] = {
+    [OP_NOP]         = &&op_nop,
+    [OP_PUSH]        = &&op_push,
+    [OP_GET_GLOBAL]  = &&op_get_global,
+    [OP_SET_GLOBAL]  = &&op_set_global,
+    [OP_GET_LOCAL]   = &&op_get_local,
+    [OP_SET_LOCAL]   = &&op_set_local,
+    [OP_ADD]         = &&op_add,
+    [OP_CMP]         = &&op_cmp,
+    [OP_CMP_CONST]   = &&op_cmp_const,
+    [OP_JUMP]        = &&op_jump,
+    [OP_JUMP_IF]     = &&op_jump_if,
+    [OP_JUMP_UNLESS] = &&op_jump_unless,
+    [OP_JUMPMAP]     = &&op_jumpmap,
+    [OP_CALL]        = &&op_call,
+    [OP_RETURN]      = &&op_return,
+    [OP_ADJUST]      = &&op_adjust,
+    [OP_COMMAND]     = &&op_command,
+    [OP_TRAP]        = &&op_trap,
+  };
+
+  // Thread the code on first use
+  if (!vm->threaded) {
+    for (int k = 0; k < vm->nops + 1 + vm->ntraps; k++) vm->ops[k].handler = handlers[vm->ops[k].kind];
+    vm->threaded = 1;
+  }
+  if (vm->nframes == 0) {
+    vm->error = "no function called";
+    return VM_ERROR;
+  }
+
+  struct vm_op *ops = vm->ops, *op = &ops[vm->pc];
+  struct vm_frame *frame = &vm->frames[vm->nframes - 1];
+  i32 *stack = vm->stack, *globals = vm->globals;
+  int sp = vm->sp;
+  u64 budget = max_steps? max_steps : UINT64_MAX, left = budget;
+  enum vm_status status = VM_DONE;
+  i32 a, b;
+
+  #define DISPATCH() do { if (__builtin_expect(left-- == 0, 0)) goto stepped; goto *op->handler; } while (0)
+  #define NEXT()     do { op++; DISPATCH(); } while (0)
+  #define PUSH(v)    do { if (__builtin_expect(sp == VM_STACK, 0)) goto overflow; stack[sp++] = (v); } while (0)
+  #define POP(v)     do { if (__builtin_expect(sp == 0, 0)) goto underflow; (v) = stack[--sp]; } while (0)
+
+  DISPATCH();
+
+op_nop:
+  NEXT();
+
+op_push:
+  PUSH(op->a);
+  NEXT();
+
+op_get_global:
+  PUSH(globals[op->a]);
+  NEXT();
+
+op_set_global:
+  POP(globals[op->a]);
+  NEXT();
+
+op_get_local:
+  PUSH(frame->locals[op->a]);
+  NEXT();
+
+op_set_local:
+  POP(frame->locals[op->a]);
+  NEXT();
+
+op_add:
+  POP(b);
+  POP(a);
+  PUSH((i32) ((u32) a + (u32) b));
+  NEXT();
+
+op_cmp:
+  POP(b);
+  POP(a);
+  vm->flag = a == b;
+  NEXT();
+
+op_cmp_const:
+  POP(a);
+  vm->flag = a == op->a;
+  NEXT();
+
+op_jump:
+  op = &ops[op->a];
+  DISPATCH();
+
+op_jump_if:
+  op = vm->flag? &ops[op->a] : op + 1;
+  DISPATCH();
+
+op_jump_unless:
+  op = !vm->flag? &ops[op->a] : op + 1;
+  DISPATCH();
+
+op_jumpmap: {
+  const i32 *cases = &vm->cases[op->a];
+  POP(a);
+  i32 target = cases[0];
+  for (int j = 0; j < op->b; j++) {
+    if (cases[1 + 2*j] == a) {
+      target = cases[2 + 2*j];
+      break;
+    }
+  }
+  op = &ops[target];
+  DISPATCH();
+}
+
+op_call:
+  if (vm->nframes == VM_FRAMES) {
+    vm->error = "call stack overflow";
+    goto error;
+  }
+  frame = &vm->frames[vm->nframes++];
+  memset(frame->locals, 0, sizeof(frame->locals));
+  frame->ret = op - ops + 1;
+  op = &ops[op->a];
+  DISPATCH();
+
+op_return:
+  if (--vm->nframes == 0) goto out;
+  op = &ops[frame->ret];
+  frame--;
+  DISPATCH();
+
+op_adjust:
+  if (op->a >= 0) {
+    if (op->a > VM_STACK - sp) goto overflow;
+    memset(&stack[sp], 0, sizeof(i32) * op->a);
+    sp += op->a;
+  } else {
+    sp = -op->a > sp? 0 : sp + op->a;
+  }
+  NEXT();
+
+op_command: {
+  static __thread i32 args[VM_STACK];
+  int nargs = op->b;
+  if (nargs < 0 || nargs > sp) goto underflow;
+  sp -= nargs;
+  memcpy(args, &stack[sp], sizeof(i32) * nargs);
+
+  u32 cmd = op->a;
+  vm_native *fn = cmd < VM_NATIVES && vm->natives[cmd] != NULL? vm->natives[cmd] : vm->fallback;
+  if (fn != NULL) {
+    vm->sp = sp;
+    vm->pc = op - ops;
+    if (fn(vm, cmd, nargs, args) != 0) {
+      vm->error = "native handler failed";
+      goto error;
+    }
+    sp = vm->sp;
+  }
+  NEXT();
+}
+
+op_trap:
+  vm->error = vm_trap_messages[op->a];
+  goto error;
+
+overflow:
+  vm->error = "stack overflow";
+  goto error;
+
+underflow:
+  vm->error = "stack underflow";
+  goto error;
+
+stepped:
+  status = VM_STEPPED;
+  left = 0;
+  goto out;
+
+error:
+  status = VM_ERROR;
+  vm->error_pos = op->pos * 4;
+
+out:
+  #undef DISPATCH
+  #undef NEXT
+  #undef PUSH
+  #undef POP
+
+  vm->sp = sp;
+  vm->pc = op - ops;
+  vm->steps += budget - left;
+  return status;
+}
@@ -0,0 +1,113 @@
+#ifndef VM_H
+#define VM_H
+
+#include "poketools.h"
+#include "formats/script.h"
+
+/** An interpreter for script code.  A code block is decoded once into an
+ *  array of operations, each holding the address of its handler, so that
+ *  dispatch is a single indirect jump (direct threading) with the operands
+ *  already unpacked and branch targets resolved to operation indices.
+ *
+ *  What most opcodes do is educated guesswork, so the model is simple:
+ *
+ *    - Values are i32s on one stack.  Constants, globals and locals are
+ *      pushed; DSetGlobal and DSetLocal pop into them.  Globals are keyed by
+ *      their 16-bit ID, locals by ID within the current frame; using a
+ *      local past the first VM_LOCALS stops the run with an error.
+ *    - Cmp? (two popped values) and CmpConst/CmpConst2 (one popped value and
+ *      the high half) set a flag.  JumpEq is taken if it is set, JumpNE if
+ *      not; the unnamed conditional jumps behave like JumpEq.
+ *    - JumpMap pops a value and jumps to the matching choice, or to its
+ *      fallback.  Jump and Trampoline always jump.
+ *    - Call pushes a frame and Return pops it; returning from the outermost
+ *      frame ends the run.  CAdjustStack pushes (or drops) words.
+ *    - DoCommand? pops its arguments and calls the native handler registered
+ *      for its command, if any.
+ *    - Everything else `decode` knows is skipped, operands and all, and
+ *      anything it doesn't stops the run with an error. */
+
+#define VM_STACK    1024      // Words
+#define VM_FRAMES   256
+#define VM_LOCALS   64        // Per frame
+#define VM_GLOBALS  0x10000
+#define VM_NATIVES  0x400     // Commands with their own handler slots
+
+/** A pre-decoded operation. */
+struct vm_op {
+  const void *handler; // Filled in on the first run
+  u32 kind;
+  i32 a, b;            // Operands; branch targets as operation indices
+  u32 pos;             // Word index of the instruction
+};
+
+struct vm_frame {
+  u32 ret;             // Operation to return to
+  i32 locals[VM_LOCALS];
+};
+
+enum vm_status {
+  VM_DONE,             // Returned from the outermost frame
+  VM_STEPPED,          // Ran out of steps
+  VM_ERROR,            // See `vm->error` and `vm->error_pos`
+};
+
+struct vm;
+
+/** A native handler for DoCommand?: called with its `nargs` arguments (in the
+ *  order they were pushed).  May push results onto the stack.  Returns 0, or
+ *  nonzero to stop the run with an error. */
+typedef int vm_native(struct vm *vm, u32 cmd, int nargs, const i32 *args);
+
+struct vm {
+  struct code_block *code;
+  int nops;
+  struct vm_op *ops;   // Followed by traps for running off the end and for
+                       // each branch going nowhere
+  int ntraps;
+  i32 *cases;          // JumpMap choices: (value, operation) pairs
+  int *op_at;          // Operation index of each word, or -1
+  int threaded;        // Have the handlers been filled in?
+
+  vm_native *natives[VM_NATIVES];
+  vm_native *fallback; // For commands without a handler of their own
+  void *user;          // For the handlers
+
+  i32 *globals;
+  i32 stack[VM_STACK];
+  int sp;
+  struct vm_frame *frames;
+  int nframes;
+  int flag;            // Result of the last comparison
+  u32 pc;              // Next operation
+
+  u64 steps;           // Operations executed, in total
+  const char *error;
+  u32 error_pos;       // Byte offset of the failing instruction
+};
+
+/** Prepares `vm` to run `code`: decodes it into operations.  Returns 0 on
+ *  success. */
+int vm_init(struct vm *vm, struct code_block *code);
+
+/** Frees what `vm_init` allocated. */
+void vm_free(struct vm *vm);
+
+/** Registers `fn` as the handler of DoCommand? `cmd` (or as the fallback for
+ *  all commands, if `cmd` is -1). */
+void vm_register(struct vm *vm, i32 cmd, vm_native *fn);
+
+/** Sets up a call of the function at byte offset `addr`, with an empty
+ *  stack.  Returns 0, or -1 if no instruction starts there. */
+int vm_call(struct vm *vm, u32 addr);
+
+/** Runs until the outermost function returns, something goes wrong, or
+ *  `max_steps` operations have been executed (if nonzero). */
+enum vm_status vm_run(struct vm *vm, u64 max_steps);
+
+/** Stack access, for native handlers.  Return 0, or -1 on overflow (for
+ *  `vm_push`) or underflow (for `vm_pop`, which then yields 0). */
+int vm_push(struct vm *vm, i32 v);
+int vm_pop(struct vm *vm, i32 *v);
+
+#endif
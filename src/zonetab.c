@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zonetab.h"
+#include "indexfile.h"
+#include "formats/zonedata.h"
+
+// Raw entries, as streamed from `tables_entries` to `tables_build` (see
+// indexfile.h):
+//   'E' u8 table, u16 index, the entry's bytes  -- one entry
+#define RAW_ENTRY 'E'
+
+
+//-- Building -------------------------------------------------------
+int tables_entries(FILE *out, const char *path) {
+  struct mapped_file file;
+  if (map_file(&file, path) < 0) {
+    fprintf(stderr, "Couldn't open '%s' for reading.\n", path);
+    return 2;
+  }
+
+  // Only the unk1 section is parsed, not the code
+  u32 magic = 0;
+  if (file.size >= sizeof(u32)) memcpy(&magic, file.data, sizeof(u32));
+  if (magic != 0x00044F5A) {
+    unmap_file(&file);
+    return 0;
+  }
+  struct zone_handle zone;
+  struct zone_unk1 *unk1 = open_zonedata(&zone, file.data, file.size) == 0? zone_get_unk1(&zone) : NULL;
+  if (unk1 == NULL) {
+    fprintf(stderr, "%s: Malformed unk1 section.\n", path);
+    unmap_file(&file);
+    return 2;
+  }
+
+  fputc(RAW_FILE, out);
+  raw_string(out, path);
+  for (int k = 1; k <= ZONE_UNK1_NTABLES; k++) {
+    int n;
+    const u8 *p = zone_unk1_entries(unk1, k, &n);
+    size_t size = zone_unk1_tables[k].entry_size;
+    for (int i = 0; i < n; i++) {
+      u8 head[2] = { RAW_ENTRY, k };
+      u16 index = i;
+      fwrite(head, 1, 2, out);
+      fwrite(&index, sizeof(u16), 1, out);
+      fwrite(p + i * size, 1, size, out);
+    }
+  }
+
+  unmap_file(&file);
+  return 0;
+}
+
+/** Appends the entry at `entry` of table `k` to its columns `cols`: the
+ *  table's own decoder splits it into its fields. */
+void tables_add_entry(struct index_buf *cols, int k, const u8 *entry) {
+  #define APPEND(type, name) buf_put(&cols[j++], &row.name, sizeof(type));
+  #define DECODE(k, count, type, FIELDS) \
+    case k: { \
+      struct zone_unk1_row_##k row; \
+      zone_unk1_decode_##k(entry, &row); \
+      int j = 2; \
+      FIELDS(APPEND) \
+    } break;
+
+  switch (k) {
+    ZONE_UNK1_TABLES(DECODE)
+  }
+
+  #undef APPEND
+  #undef DECODE
+}
+
+int tables_build(FILE *in, const char *path) {
+  struct index_buf strings = { 0 }, zones = { 0 };
+  struct index_buf *cols[ZONE_UNK1_NTABLES + 1];
+  u32 nrows[ZONE_UNK1_NTABLES + 1] = { 0 }, nzones = 0;
+  for (int k = 1; k <= ZONE_UNK1_NTABLES; k++) {
+    cols[k] = calloc(zone_unk1_tables[k].nfields + 2, sizeof(struct index_buf));
+  }
+
+  buf_put(&strings, "", 1); // Offset 0 is never a real string
+
+  //-- Read the raw entries into columns
+  int type;
+  while ((type = fgetc(in)) != EOF) {
+    if (type == RAW_FILE) {
+      long off = read_raw_string(in, &strings);
+      if (off < 0) break;
+      u32 path_off = off;
+      buf_put(&zones, &path_off, sizeof(u32));
+      nzones++;
+      continue;
+    }
+
+    u8 k;
+    u16 index;
+    u8 entry[256];
+    if (type != RAW_ENTRY || nzones == 0
+        || fread(&k, 1, 1, in) != 1 || k < 1 || k > ZONE_UNK1_NTABLES
+        || fread(&index, sizeof(u16), 1, in) != 1
+        || fread(entry, 1, zone_unk1_tables[k].entry_size, in) != zone_unk1_tables[k].entry_size) break;
+
+    u32 zone = nzones - 1, i = index;
+    buf_put(&cols[k][0], &zone, sizeof(u32));
+    buf_put(&cols[k][1], &i, sizeof(u32));
+    tables_add_entry(cols[k], k, entry);
+    nrows[k]++;
+  }
+
+  //-- Describe the tables and columns
+  struct tables_table tables[ZONE_UNK1_NTABLES];
+  struct index_buf columns = { 0 };
+  u32 ncolumns = 0;
+  for (int k = 1; k <= ZONE_UNK1_NTABLES; k++) {
+    const struct zone_unk1_table *schema = &zone_unk1_tables[k];
+    tables[k - 1] = (struct tables_table) { k, nrows[k], ncolumns, schema->nfields + 2 };
+    for (int j = 0; j < schema->nfields + 2; j++) {
+      const char *name = j == 0? "zone" : j == 1? "index" : schema->field_names[j - 2];
+      struct tables_column c = {
+        .name  = buf_put(&strings, name, strlen(name) + 1),
+        .width = j < 2? sizeof(u32) : schema->field_sizes[j - 2],
+      };
+      buf_put(&columns, &c, sizeof(c));
+      ncolumns++;
+    }
+  }
+
+  //-- Write the file
+  struct index_writer w;
+  int res = -1;
+  if (index_begin(&w, path, sizeof(struct tables_header)) == 0) {
+    struct tables_header hd = {
+      .magic        = TABLES_MAGIC,
+      .version      = TABLES_VERSION,
+      .nzones       = nzones,
+      .ntables      = ZONE_UNK1_NTABLES,
+      .ncolumns     = ncolumns,
+      .strings_size = strings.len,
+    };
+    hd.tables_off  = index_section(&w, tables, sizeof(struct tables_table) * ZONE_UNK1_NTABLES);
+    hd.columns_off = index_section(&w, columns.p, columns.len); // Offsets are filled in below
+    hd.zones_off   = index_section(&w, zones.p, zones.len);
+
+    struct tables_column *c = (struct tables_column *) columns.p;
+    for (int k = 1; k <= ZONE_UNK1_NTABLES; k++) {
+      for (int j = 0; j < zone_unk1_tables[k].nfields + 2; j++, c++) {
+        c->off = index_section(&w, cols[k][j].p, cols[k][j].len);
+      }
+    }
+    hd.strings_off = index_section(&w, strings.p, strings.len);
+
+    // Now that the offsets are known
+    index_rewrite(&w, hd.columns_off, columns.p, columns.len);
+    res = index_end(&w, &hd, sizeof(hd));
+  }
+
+  // Cleanup
+  for (int k = 1; k <= ZONE_UNK1_NTABLES; k++) {
+    for (int j = 0; j < zone_unk1_tables[k].nfields + 2; j++) free(cols[k][j].p);
+    free(cols[k]);
+  }
+  free(columns.p);
+  free(zones.p);
+  free(strings.p);
+
+  return res;
+}
+
+
+//-- Querying -------------------------------------------------------
+int tables_open(struct corpus_tables *t, const char *path) {
+  if (map_file(&t->map, path) < 0) return -1;
+
+  const struct tables_header *hd = (const struct tables_header *) t->map.data;
+  size_t size = t->map.size;
+  if (size < sizeof(struct tables_header) || hd->magic != TABLES_MAGIC
+      || hd->version != TABLES_VERSION
+      || hd->tables_off + (u64) hd->ntables * sizeof(struct tables_table) > size
+      || hd->columns_off + (u64) hd->ncolumns * sizeof(struct tables_column) > size
+      || hd->zones_off + (u64) hd->nzones * sizeof(u32) > size
+      || hd->strings_off + hd->strings_size > size
+      || hd->strings_size == 0 || t->map.data[hd->strings_off + hd->strings_size - 1] != 0) {
+    unmap_file(&t->map);
+    return -1;
+  }
+
+  // Every zone's path must lie within the strings, every column within the
+  // file, and every table's within the columns
+  const struct tables_table *tables = (const struct tables_table *) (t->map.data + hd->tables_off);
+  const struct tables_column *columns = (const struct tables_column *) (t->map.data + hd->columns_off);
+  const u32 *zones = (const u32 *) (t->map.data + hd->zones_off);
+  int ok = 1;
+  for (u32 i = 0; ok && i < hd->nzones; i++) ok = zones[i] < hd->strings_size;
+  for (u32 i = 0; ok && i < hd->ntables; i++) {
+    ok = tables[i].first_column + (u64) tables[i].ncolumns <= hd->ncolumns;
+    for (u32 j = 0; ok && j < tables[i].ncolumns; j++) {
+      const struct tables_column *c = &columns[tables[i].first_column + j];
+      ok = (c->width == 1 || c->width == 2 || c->width == 4)
+           && c->off + (u64) c->width * tables[i].nrows <= size
+           && c->name < hd->strings_size;
+    }
+  }
+  if (!ok) {
+    unmap_file(&t->map);
+    return -1;
+  }
+
+  t->header  = hd;
+  t->tables  = tables;
+  t->columns = columns;
+  t->zones   = zones;
+  t->strings = (const char *) (t->map.data + hd->strings_off);
+  return 0;
+}
+
+void tables_close(struct corpus_tables *t) {
+  unmap_file(&t->map);
+}
+
+const struct tables_table *tables_table(const struct corpus_tables *t, u32 id) {
+  for (u32 i = 0; i < t->header->ntables; i++) {
+    if (t->tables[i].id == id) return &t->tables[i];
+  }
+  return NULL;
+}
+
+const struct tables_column *tables_column(const struct corpus_tables *t,
+                                          const struct tables_table *table,
+                                          const char *name) {
+  for (u32 j = 0; j < table->ncolumns; j++) {
+    const struct tables_column *c = &t->columns[table->first_column + j];
+    if (strcmp(t->strings + c->name, name) == 0) return c;
+  }
+  return NULL;
+}
+
+const char *tables_column_name(const struct corpus_tables *t,
+                               const struct tables_column *c) {
+  return t->strings + c->name;
+}
+
+u32 tables_value(const struct corpus_tables *t, const struct tables_column *c, u32 i) {
+  const u8 *p = t->map.data + c->off + (u64) c->width * i;
+  u32 v = 0;
+  memcpy(&v, p, c->width);
+  return v;
+}
+
+const char *tables_zone(const struct corpus_tables *t, u32 i) {
+  // Rows aren't checked when the tables are opened: there are too many
+  return i < t->header->nzones? t->strings + t->zones[i] : "";
+}
@@ -0,0 +1,93 @@
+#ifndef ZONETAB_H
+#define ZONETAB_H
+
+#include <stdio.h>
+
+#include "poketools.h"
+#include "mapfile.h"
+
+/** The unk1 entries of every zone of a corpus, as columns: one file, mapped
+ *  as it is, in which going over every entry of a table (every warp, say)
+ *  reads its columns front to back, once, whatever the number of zones.
+ *
+ *    header | tables | columns | zones (u32 path offsets) | data | strings
+ *
+ *  Each table has a row per entry, and a column per field of its entries
+ *  (see `ZONE_UNK1_TABLES`), after two of its own: "zone" (which zone the
+ *  row is from) and "index" (where in that zone's table).  A column holds
+ *  its rows' values back to back, each as wide as the field, from an 8-byte
+ *  boundary. */
+
+#define TABLES_MAGIC   0x31545A50 // "PZT1"
+#define TABLES_VERSION 1
+
+struct tables_header {
+  u32 magic;
+  u32 version;
+  u32 nzones;
+  u32 ntables;
+  u32 ncolumns;
+  u32 strings_size;
+  u64 tables_off, columns_off, zones_off, strings_off;
+};
+
+struct tables_table {
+  u32 id;             // Table number, from 1
+  u32 nrows;
+  u32 first_column;
+  u32 ncolumns;
+};
+
+struct tables_column {
+  u32 name;           // Offset of the name in the strings
+  u32 width;          // Bytes per value: 1, 2 or 4
+  u64 off;
+};
+
+/** A mapped table file. */
+struct corpus_tables {
+  struct mapped_file map;
+  const struct tables_header *header;
+  const struct tables_table *tables;
+  const struct tables_column *columns;
+  const u32 *zones;
+  const char *strings;
+};
+
+//-- Building -------------------------------------------------------
+/** Writes the raw unk1 entries of the zone at `path` to `out` (a
+ *  `batch_fn`); anything else has none.  Returns 0 on success, or nonzero if
+ *  the file couldn't be read. */
+int tables_entries(FILE *out, const char *path);
+
+/** Builds the table file at `path` from the raw entries of any number of
+ *  zones, read from `in`.  Returns 0 on success, or -1 if it couldn't be
+ *  written. */
+int tables_build(FILE *in, const char *path);
+
+//-- Querying -------------------------------------------------------
+/** Maps the table file at `path`.  Returns 0 on success, or -1 if it
+ *  couldn't be read or isn't one. */
+int tables_open(struct corpus_tables *t, const char *path);
+
+void tables_close(struct corpus_tables *t);
+
+/** Returns table `id` of `t`, or NULL. */
+const struct tables_table *tables_table(const struct corpus_tables *t, u32 id);
+
+/** Returns the column of `table` called `name`, or NULL. */
+const struct tables_column *tables_column(const struct corpus_tables *t,
+                                          const struct tables_table *table,
+                                          const char *name);
+
+/** Returns the name of column `c`. */
+const char *tables_column_name(const struct corpus_tables *t,
+                               const struct tables_column *c);
+
+/** Returns the value in row `i` of column `c`. */
+u32 tables_value(const struct corpus_tables *t, const struct tables_column *c, u32 i);
+
+/** Returns the path of zone `i`, or "" if there is no such zone. */
+const char *tables_zone(const struct corpus_tables *t, u32 i);
+
+#endif